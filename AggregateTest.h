@@ -0,0 +1,221 @@
+#pragma once
+
+#include "StreamSupport.h"
+#include "Benchmark.h"
+#include "ZoneMapTest.h"
+
+class CAggregateTest
+{
+public:
+
+    //------------------------------------------------------------------------------
+    // Verifies the aggregate's count, sum, minimum and maximum.
+    //------------------------------------------------------------------------------
+
+    static HRESULT VerifyAggregate( const CVariantAggregate& aggregate, ULONGLONG count, double sum, double minimum, double maximum )
+    {
+        if ( aggregate.count != count || aggregate.sum != sum )
+            HR( E_UNEXPECTED );
+        if ( count && ( aggregate.minimum != minimum || aggregate.maximum != maximum ) )
+            HR( E_UNEXPECTED );
+
+        return S_OK;
+
+    } // VerifyAggregate
+
+
+    //------------------------------------------------------------------------------
+    // Creates an array of count longs, alternately positive and negative,
+    // counting away from zero.
+    //------------------------------------------------------------------------------
+
+    static HRESULT GetLongs( ULONG count, VARIANT& variant )
+    {
+        variant.parray = SafeArrayCreateVector( VT_I4, 0, count );
+        if ( !variant.parray )
+            HR( E_OUTOFMEMORY );
+        variant.vt = VT_I4 | VT_ARRAY;
+
+        for( ULONG i = 0; i < count; ++i )
+            ( (long*)variant.parray->pvData )[i] = i % 2 ? -(long)i : (long)i;
+
+        return S_OK;
+
+    } // GetLongs
+
+
+    //------------------------------------------------------------------------------
+    // Test aggregating streamed arrays without reading them.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Test()
+    {
+        CComPtr<IStream>    pStream;
+        CComVariant         doubles;
+        CComVariant         longs;
+        CComVariant         mixed;
+        CComVariant         none;
+        CComVariant         number = 2.5;
+        CVariantAggregate   aggregate;
+        BLOB                blob;
+        HRESULT             hr = S_OK;
+
+        // 100001 doubles from -50000, enough to take several runs and leave
+        // some over after the last group of four.
+        HR( CZoneMapTest::GetNumbers( -50000, 100001, 0, doubles ) );
+        HR( CreateMemoryStream( &pStream ) );
+        WriteVariantToStream( &doubles, pStream );
+
+        HR( RewindStream( pStream ) );
+        AggregateVariantInStream( pStream, aggregate );
+        HR( VerifyAggregate( aggregate, 100001, 0, -50000, 50000 ) );
+        if ( aggregate.GetMean() != 0 )
+            HR( E_UNEXPECTED );
+
+        HR( RewindStream( pStream ) );
+        AggregateVariantInStream( pStream, 10, 13.5, aggregate );
+        HR( VerifyAggregate( aggregate, 4, 46, 10, 13 ) );
+
+        // Nothing in range.
+        HR( RewindStream( pStream ) );
+        AggregateVariantInStream( pStream, 60000, 70000, aggregate );
+        HR( VerifyAggregate( aggregate, 0, 0, 0, 0 ) );
+        if ( aggregate.GetMean() != 0 )
+            HR( E_UNEXPECTED );
+
+        // Longs, straight from a blob.
+        HR( GetLongs( 1003, longs ) );
+        WriteVariantToBlob( longs, blob );
+        {
+            CMemoryReadStream   stream( blob.pBlobData, blob.cbSize );
+
+            AggregateVariantInStream( &stream, aggregate );
+            if ( FAILED( VerifyAggregate( aggregate, 1003, 501, -1001, 1002 ) ) )
+                hr = E_UNEXPECTED;
+        }
+        {
+            CMemoryReadStream   stream( blob.pBlobData, blob.cbSize );
+
+            AggregateVariantInStream( &stream, -3, 1, aggregate );
+            if ( FAILED( VerifyAggregate( aggregate, 3, -4, -3, 0 ) ) )
+                hr = E_UNEXPECTED;
+        }
+        ::CoTaskMemFree( blob.pBlobData );
+        HR( hr );
+
+        // Variants: the numbers in the nested array count too, and strings
+        // and nulls don't.
+        HR( CZoneMapTest::GetMixedArray( mixed ) );
+        HR( RewindStream( pStream ) );
+        WriteVariantToStream( &mixed, pStream );
+        HR( RewindStream( pStream ) );
+        AggregateVariantInStream( pStream, aggregate );
+        HR( VerifyAggregate( aggregate, 3, 72, -3, 70 ) );
+
+        HR( RewindStream( pStream ) );
+        AggregateVariantInStream( pStream, 0, 10, aggregate );
+        HR( VerifyAggregate( aggregate, 1, 5, 5, 5 ) );
+
+        // A plain value, and an empty array.
+        HR( RewindStream( pStream ) );
+        WriteVariantToStream( &number, pStream );
+        HR( RewindStream( pStream ) );
+        AggregateVariantInStream( pStream, aggregate );
+        HR( VerifyAggregate( aggregate, 1, 2.5, 2.5, 2.5 ) );
+
+        none.parray = SafeArrayCreateVector( VT_R8, 0, 0 );
+        if ( !none.parray )
+            HR( E_OUTOFMEMORY );
+        none.vt = VT_R8 | VT_ARRAY;
+        HR( RewindStream( pStream ) );
+        WriteVariantToStream( &none, pStream );
+        HR( RewindStream( pStream ) );
+        AggregateVariantInStream( pStream, aggregate );
+        HR( VerifyAggregate( aggregate, 0, 0, 0, 0 ) );
+
+        return S_OK;
+
+    } // Test
+
+
+    //------------------------------------------------------------------------------
+    // Time summing a million doubles and a million longs in a blob by reading
+    // them into an array, against aggregating them where they are.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Benchmark()
+    {
+        CComVariant         doubles;
+        CComVariant         longs;
+
+        HR( CZoneMapTest::GetNumbers( 0, 1000000, 0, doubles ) );
+        HR( GetLongs( 1000000, longs ) );
+
+        HR( BenchmarkVariant( "1000000 doubles", doubles ) );
+        HR( BenchmarkVariant( "1000000 longs", longs ) );
+
+        return S_OK;
+
+    } // Benchmark
+
+
+    //------------------------------------------------------------------------------
+    // Times reading the variant and summing the array, against aggregating
+    // it, with and without a range.
+    //------------------------------------------------------------------------------
+
+    static HRESULT BenchmarkVariant( LPCSTR name, VARIANT& variant )
+    {
+        ULONG const         iterations = 20;
+        CBenchmarkTimer     timer;
+        CVariantAggregate   aggregate;
+        ULONG               readTime = 0;
+        ULONG               aggregateTime = 0;
+        ULONG               rangeTime = 0;
+        double              sum = 0;
+        BLOB                blob;
+        char                label[128];
+
+        WriteVariantToBlob( variant, blob );
+
+        for( ULONG i = 0; i < iterations; ++i )
+        {
+            CComVariant         copy;
+            CMemoryReadStream   stream1( blob.pBlobData, blob.cbSize );
+            CMemoryReadStream   stream2( blob.pBlobData, blob.cbSize );
+
+            timer.Start();
+            ReadVariantFromBlob( blob, copy );
+            for( ULONG j = 0; j < copy.parray->rgsabound[0].cElements; ++j )
+            {
+                if ( ( VT_R8 | VT_ARRAY ) == copy.vt )
+                    sum += ( (double*)copy.parray->pvData )[j];
+                else
+                    sum += ( (long*)copy.parray->pvData )[j];
+            }
+            readTime += timer.ElapsedMicroseconds();
+
+            timer.Start();
+            AggregateVariantInStream( &stream1, aggregate );
+            aggregateTime += timer.ElapsedMicroseconds();
+
+            timer.Start();
+            AggregateVariantInStream( &stream2, 1000, 100000, aggregate );
+            rangeTime += timer.ElapsedMicroseconds();
+        }
+
+        ::CoTaskMemFree( blob.pBlobData );
+
+        ::wsprintfA( label, "read and sum %s", name );
+        ReportBenchmark( label, iterations, readTime );
+        ::wsprintfA( label, "aggregate %s", name );
+        ReportBenchmark( label, iterations, aggregateTime );
+        ::wsprintfA( label, "aggregate %s in range", name );
+        ReportBenchmark( label, iterations, rangeTime );
+
+        return sum == 0 && aggregate.count == 0 ? E_UNEXPECTED : S_OK;
+
+    } // BenchmarkVariant
+
+
+}; // class CAggregateTest
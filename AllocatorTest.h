@@ -0,0 +1,256 @@
+#pragma once
+
+#include "StreamSupport.h"
+#include "Benchmark.h"
+#include "ParallelReadTest.h"
+#include "BatchTest.h"
+
+
+//==============================================================================
+// CCountingAllocator
+// Passes requests on to the task allocator, counting them and what is still
+// allocated.
+//==============================================================================
+
+class CCountingAllocator : public CVariantAllocator
+{
+public:
+    CCountingAllocator()
+        :   m_allocations( 0 ),
+            m_live( 0 )
+    {
+    }
+
+    virtual void* Allocate( SIZE_T size )
+    {
+        void*   data = ::CoTaskMemAlloc( size );
+
+        if ( data )
+        {
+            m_allocations++;
+            m_live++;
+        }
+
+        return data;
+    }
+
+    virtual void Free( void* data )
+    {
+        if ( data )
+            m_live--;
+
+        ::CoTaskMemFree( data );
+    }
+
+    ULONG               m_allocations;
+    LONG                m_live;
+
+}; // class CCountingAllocator
+
+
+class CAllocatorTest
+{
+public:
+
+    //------------------------------------------------------------------------------
+    // Compares a decoded variant with the one it was encoded from.
+    //------------------------------------------------------------------------------
+
+    static HRESULT VerifyDecoded( VARIANT& expected, CDecodedVariant& decoded )
+    {
+        VARIANT     view = decoded.GetVariant();
+
+        return VerifySame( expected, view );
+
+    } // VerifyDecoded
+
+
+    //------------------------------------------------------------------------------
+    // Test the slab pool, and encoding and decoding with allocators.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Test()
+    {
+        SAFEARRAYBOUND      bounds[2] = { { 30, 0 }, { 40, 1 } };
+        CComVariant         mixed;
+        CComVariant         row;
+        CComVariant         grid;
+        CComVariant         copy;
+        CVariantSlabPool    pool;
+        CCountingAllocator  counting;
+        CVariantEncoder     encoder;
+        CVariantDecoder     decoder;
+        CDecodedVariant     decoded;
+        void*               small;
+        void*               again;
+        void*               large;
+        ULONG               slabs;
+        BLOB                blob;
+        HRESULT             hr = S_OK;
+
+        // Freed blocks are handed out again; large ones are the task
+        // allocator's.
+        small = pool.Allocate( 20 );
+        ::FillMemory( small, 20, 0xAB );
+        pool.Free( small );
+        again = pool.Allocate( 30 );
+        if ( again != small || pool.GetSystemAllocationCount() != 1 )
+            hr = E_UNEXPECTED;
+        large = pool.Allocate( 100000 );
+        ::FillMemory( large, 100000, 0xCD );
+        if ( pool.GetSystemAllocationCount() != 2 )
+            hr = E_UNEXPECTED;
+        pool.Free( again );
+        pool.Free( large );
+        pool.Free( NULL );
+
+        HR( CParallelReadTest::GetMixedArray( mixed ) );
+        HR( CBatchTest::GetRow( 3, row ) );
+        grid.vt = VT_R8 | VT_ARRAY;
+        grid.parray = SafeArrayCreate( VT_R8, 2, bounds );
+        if ( !grid.parray )
+            HR( E_OUTOFMEMORY );
+        for ( ULONG i = 0; i < 30 * 40; i++ )
+            ( (double*)grid.parray->pvData )[i] = i / 2.0;
+
+        // Blobs from the pool.
+        encoder.SetAllocator( &pool );
+        encoder.Encode( mixed, blob );
+        ReadVariantFromBlob( blob, copy );
+        pool.Free( blob.pBlobData );
+        if ( FAILED( VerifySame( mixed, copy ) ) )
+            hr = E_UNEXPECTED;
+        copy.Clear();
+
+        // Arrays from the allocator, nested ones too, all freed again.
+        encoder.SetAllocator( &counting );
+        encoder.Encode( row, blob );
+        decoder.SetAllocator( &counting );
+        decoder.Decode( blob, decoded );
+        if ( FAILED( VerifyDecoded( row, decoded ) ) )
+            hr = E_UNEXPECTED;
+        decoded.CopyTo( copy );
+        decoded.Clear();
+        counting.Free( blob.pBlobData );
+        if ( FAILED( VerifySame( row, copy ) ) || counting.m_live )
+            hr = E_UNEXPECTED;
+        copy.Clear();
+
+        // Once the pool holds them, decoding again takes nothing more from
+        // the task allocator.
+        decoder.SetAllocator( &pool );
+        encoder.SetAllocator( NULL );
+        encoder.Encode( mixed, blob );
+        decoder.Decode( blob, decoded );
+        if ( FAILED( VerifyDecoded( mixed, decoded ) ) )
+            hr = E_UNEXPECTED;
+        slabs = pool.GetSystemAllocationCount();
+        decoder.Decode( blob, decoded );
+        if ( FAILED( VerifyDecoded( mixed, decoded ) ) || pool.GetSystemAllocationCount() != slabs )
+            hr = E_UNEXPECTED;
+        ::CoTaskMemFree( blob.pBlobData );
+
+        encoder.Encode( grid, blob );
+        decoder.Decode( blob, decoded );
+        if ( FAILED( VerifyDecoded( grid, decoded ) ) )
+            hr = E_UNEXPECTED;
+        ::CoTaskMemFree( blob.pBlobData );
+
+        // Without an allocator, arrays are made as usual.
+        decoder.SetAllocator( NULL );
+        encoder.Encode( row, blob );
+        decoder.Decode( blob, decoded );
+        if ( FAILED( VerifyDecoded( row, decoded ) ) )
+            hr = E_UNEXPECTED;
+        ::CoTaskMemFree( blob.pBlobData );
+        decoded.Clear();
+
+        return hr;
+
+    } // Test
+
+
+    //------------------------------------------------------------------------------
+    // Time encoding 100000 rows to blobs and freeing them, and decoding them,
+    // with the task allocator and with a slab pool, and count the
+    // allocations each makes.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Benchmark()
+    {
+        ULONG const                     count = 100000;
+        CComVector<VARIANT>             a( count );
+        CComVectorData<VARIANT>         rg( a );
+        VariantStreaming::CTaskMemory   memory( count * sizeof( BLOB ) );
+        BLOB*                           blobs = (BLOB*)(BYTE*)memory;
+        CVariantSlabPool                pool;
+        CCountingAllocator              counting;
+        CVariantEncoder                 encoder;
+        CVariantDecoder                 decoder;
+        CDecodedVariant                 decoded;
+        CBenchmarkTimer                 timer;
+        ULONG                           time;
+        ULONG                           before;
+        if ( !rg )
+            HR( E_UNEXPECTED );
+
+        for( ULONG i = 0; i < count; ++i )
+            HR( CBatchTest::GetRow( i, rg[i] ) );
+
+        // Blobs made and freed in turn.
+        encoder.SetAllocator( &counting );
+        timer.Start();
+        for( ULONG j = 0; j < count; ++j )
+        {
+            encoder.Encode( rg[j], blobs[0] );
+            counting.Free( blobs[0].pBlobData );
+        }
+        time = timer.ElapsedMicroseconds();
+        ReportBenchmark( "encode and free 100000 blobs, task allocator", count, time );
+        ReportAllocations( "encode and free 100000 blobs, task allocator", count, counting.m_allocations );
+
+        encoder.SetAllocator( &pool );
+        timer.Start();
+        for( ULONG k = 0; k < count; ++k )
+        {
+            encoder.Encode( rg[k], blobs[0] );
+            pool.Free( blobs[0].pBlobData );
+        }
+        time = timer.ElapsedMicroseconds();
+        ReportBenchmark( "encode and free 100000 blobs, slab pool", count, time );
+        ReportAllocations( "encode and free 100000 blobs, slab pool", count, pool.GetSystemAllocationCount() );
+
+        // Decoding rows of strings and nested arrays.
+        encoder.SetAllocator( NULL );
+        for( ULONG m = 0; m < count; ++m )
+            encoder.Encode( rg[m], blobs[m] );
+
+        counting.m_allocations = 0;
+        decoder.SetAllocator( &counting );
+        timer.Start();
+        for( ULONG n = 0; n < count; ++n )
+            decoder.Decode( blobs[n], decoded );
+        decoded.Clear();
+        time = timer.ElapsedMicroseconds();
+        ReportBenchmark( "decode 100000 rows, task allocator", count, time );
+        ReportAllocations( "decode 100000 rows, task allocator", count, counting.m_allocations );
+
+        decoder.SetAllocator( &pool );
+        before = pool.GetSystemAllocationCount();
+        timer.Start();
+        for( ULONG p = 0; p < count; ++p )
+            decoder.Decode( blobs[p], decoded );
+        decoded.Clear();
+        time = timer.ElapsedMicroseconds();
+        ReportBenchmark( "decode 100000 rows, slab pool", count, time );
+        ReportAllocations( "decode 100000 rows, slab pool", count, pool.GetSystemAllocationCount() - before );
+
+        for( ULONG q = 0; q < count; ++q )
+            ::CoTaskMemFree( blobs[q].pBlobData );
+
+        return S_OK;
+
+    } // Benchmark
+
+
+}; // class CAllocatorTest
@@ -0,0 +1,208 @@
+#pragma once
+
+#include "StreamSupport.h"
+
+class CArrayWriterTest
+{
+public:
+
+    //------------------------------------------------------------------------------
+    // Verifies that the two memory streams hold the same bytes.
+    //------------------------------------------------------------------------------
+
+    static HRESULT VerifySameBytes( IStream* pStream1, IStream* pStream2 )
+    {
+        BLOB        blob1;
+        BLOB        blob2;
+        HRESULT     hr = S_OK;
+
+        StreamToTaskMemory( pStream1, blob1 );
+        StreamToTaskMemory( pStream2, blob2 );
+
+        if ( blob1.cbSize != blob2.cbSize || 0 != memcmp( blob1.pBlobData, blob2.pBlobData, blob1.cbSize ) )
+            hr = E_UNEXPECTED;
+
+        ::CoTaskMemFree( blob1.pBlobData );
+        ::CoTaskMemFree( blob2.pBlobData );
+
+        return hr;
+
+    } // VerifySameBytes
+
+
+    //------------------------------------------------------------------------------
+    // Writes a 3 x 4 array of longs with the writer, partly an element at a
+    // time and partly in a chunk, and checks that it streams the same as the
+    // SAFEARRAY.
+    //------------------------------------------------------------------------------
+
+    static HRESULT TestNumbers()
+    {
+        SAFEARRAYBOUND      bounds[2] = { { 3, 1 }, { 4, -2 } };
+        CComVariant         v1;
+        CComVariant         v2;
+        CComPtr<IStream>    pStream1;
+        CComPtr<IStream>    pStream2;
+        long*               data;
+        long*               index = NULL;
+        long                chunk[12];
+        int                 count = 0;
+        bool                more = true;
+
+        v1.parray = SafeArrayCreate( VT_I4, 2, bounds );
+        if ( !v1.parray )
+            HR( E_OUTOFMEMORY );
+        v1.vt = VT_I4 | VT_ARRAY;
+
+        HR( SafeArrayAccessData( v1.parray, (void**)&data ) );
+        for( int i = 0; i < 12; ++i )
+            data[i] = i * 10;
+        HR( SafeArrayUnaccessData( v1.parray ) );
+
+        HR( CreateMemoryStream( &pStream1 ) );
+        HR( CreateMemoryStream( &pStream2 ) );
+
+        WriteVariantToStream( &v1, pStream1 );
+
+        CVariantArrayWriter                         writer( pStream2 );
+        VariantStreaming::CWalkSafeArrayElements    walk( v1.parray );
+
+        writer.Begin( VT_I4, 2, bounds );
+
+        // Write the first four elements as shorts, which the writer changes
+        // to longs, and the rest as one chunk.
+        while( more )
+        {
+            long    value;
+
+            walk.GetIndex( index );
+            HR( SafeArrayGetElement( v1.parray, index, &value ) );
+
+            if ( writer.GetRemaining() > 8 )
+                writer.Write( CComVariant( (short)value ) );
+            else
+                chunk[count++] = value;
+
+            walk.Next( more );
+        }
+
+        writer.WriteData( chunk, count );
+        writer.End();
+
+        HR( VerifySameBytes( pStream1, pStream2 ) );
+
+        // Read it back.
+        HR( RewindStream( pStream2 ) );
+        ReadVariantFromStream( pStream2, v2 );
+
+        if ( v2.vt != ( VT_I4 | VT_ARRAY ) || 0 != memcmp( v1.parray->pvData, v2.parray->pvData, 12 * sizeof( long ) ) )
+            HR( E_UNEXPECTED );
+
+        return S_OK;
+
+    } // TestNumbers
+
+
+    //------------------------------------------------------------------------------
+    // Writes an array of variants holding a string, a number and an array with
+    // the writer, and checks that it streams the same as the SAFEARRAY.
+    //------------------------------------------------------------------------------
+
+    static HRESULT TestVariants()
+    {
+        SAFEARRAYBOUND      bounds = { 3, 5 };
+        CComVariant         v1;
+        CComPtr<IStream>    pStream1;
+        CComPtr<IStream>    pStream2;
+        CComVariant         elements[3];
+        CComVector<long>    numbers( 4 );
+
+        elements[0] = L"first";
+        elements[1] = 2.5;
+        elements[2].vt = VT_I4 | VT_ARRAY;
+        elements[2].parray = numbers.Detach();
+
+        v1.parray = SafeArrayCreate( VT_VARIANT, 1, &bounds );
+        if ( !v1.parray )
+            HR( E_OUTOFMEMORY );
+        v1.vt = VT_VARIANT | VT_ARRAY;
+
+        for( long i = 0; i < 3; ++i )
+        {
+            long    index = i + 5;
+
+            HR( SafeArrayPutElement( v1.parray, &index, &elements[i] ) );
+        }
+
+        HR( CreateMemoryStream( &pStream1 ) );
+        HR( CreateMemoryStream( &pStream2 ) );
+
+        WriteVariantToStream( &v1, pStream1 );
+
+        CVariantArrayWriter     writer( pStream2 );
+
+        writer.Begin( VT_VARIANT, 1, &bounds );
+        for( int j = 0; j < 3; ++j )
+            writer.Write( elements[j] );
+        writer.End();
+
+        HR( VerifySameBytes( pStream1, pStream2 ) );
+
+        return S_OK;
+
+    } // TestVariants
+
+
+    //------------------------------------------------------------------------------
+    // Writes one more element than the array holds.
+    //------------------------------------------------------------------------------
+
+    static void WriteOverrun( IStream* pStream )
+    {
+        SAFEARRAYBOUND          bounds = { 2, 0 };
+        long                    data[3] = { 1, 2, 3 };
+        CVariantArrayWriter     writer( pStream );
+
+        writer.Begin( VT_I4, 1, &bounds );
+        writer.WriteData( data, 3 );
+
+    } // WriteOverrun
+
+
+    //------------------------------------------------------------------------------
+    // Calls WriteOverrun, reporting failure rather than raising it.
+    //------------------------------------------------------------------------------
+
+    static HRESULT TryOverrun( IStream* pStream )
+    {
+        HRESULT     hr = S_OK;
+
+        TryStreamCall( WriteOverrun( pStream ), hr );
+
+        return hr;
+
+    } // TryOverrun
+
+
+    //------------------------------------------------------------------------------
+    // Test writing arrays incrementally.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Test()
+    {
+        CComPtr<IStream>    pStream;
+
+        HR( TestNumbers() );
+        HR( TestVariants() );
+
+        // Writing more elements than the bounds allow should fail.
+        HR( CreateMemoryStream( &pStream ) );
+        if ( DISP_E_BADINDEX != TryOverrun( pStream ) )
+            HR( E_UNEXPECTED );
+
+        return S_OK;
+
+    } // Test
+
+
+}; // class CArrayWriterTest
@@ -0,0 +1,256 @@
+#pragma once
+
+#include "StreamSupport.h"
+#include "ParallelReadTest.h"
+
+
+//==============================================================================
+// CAsyncQueue
+// Executor that runs the operations posted to it in turn, on the thread that
+// calls Run, standing in for an event loop.
+//==============================================================================
+
+class CAsyncQueue : public CAsyncExecutor
+{
+public:
+    CAsyncQueue()
+        :   m_first( 0 ),
+            m_count( 0 ),
+            m_resumed( 0 )
+    {
+    }
+
+    virtual void Post( CAsyncOperation* operation )
+    {
+        if ( m_count == maxOperations )
+            ThrowError( E_OUTOFMEMORY );
+
+        m_operations[( m_first + m_count++ ) % maxOperations] = operation;
+    }
+
+    // Resumes operations until none are left waiting to be.
+    void Run()
+    {
+        while ( m_count )
+        {
+            CAsyncOperation*    operation = m_operations[m_first];
+
+            m_first = ( m_first + 1 ) % maxOperations;
+            m_count--;
+            m_resumed++;
+
+            operation->Resume();
+        }
+    }
+
+    inline ULONG GetResumed()
+    {
+        return m_resumed;
+    }
+
+private:
+    enum { maxOperations = 16 };
+
+    CAsyncOperation*    m_operations[maxOperations];
+    ULONG               m_first;
+    ULONG               m_count;
+    ULONG               m_resumed;
+
+}; // class CAsyncQueue
+
+
+//==============================================================================
+// CWriteSequence
+// Writes a run of variants one after another, each from the completion of
+// the one before, then closes the pipe.
+//==============================================================================
+
+class CWriteSequence : public CAsyncCompletion
+{
+public:
+    CWriteSequence( VARIANT* variants, ULONG count, CAsyncPipe& pipe, CAsyncExecutor& executor )
+        :   m_variants( variants ),
+            m_count( count ),
+            m_done( 0 ),
+            m_pipe( pipe ),
+            m_executor( executor ),
+            m_result( S_OK )
+    {
+    }
+
+    void Start()
+    {
+        m_writer.BeginWrite( m_variants[0], &m_pipe, &m_executor, this );
+    }
+
+    virtual void OnComplete( HRESULT hr )
+    {
+        m_result = hr;
+
+        if ( SUCCEEDED( hr ) && ++m_done < m_count )
+            m_writer.BeginWrite( m_variants[m_done], &m_pipe, &m_executor, this );
+        else
+            m_pipe.Close();
+    }
+
+    CAsyncVariantWriter m_writer;
+    VARIANT*            m_variants;
+    ULONG               m_count;
+    ULONG               m_done;
+    CAsyncPipe&         m_pipe;
+    CAsyncExecutor&     m_executor;
+    HRESULT             m_result;
+
+}; // class CWriteSequence
+
+
+//==============================================================================
+// CReadSequence
+// Reads variants one after another, each from the completion of the one
+// before, checking each against what was written, until a read fails.
+//==============================================================================
+
+class CReadSequence : public CAsyncCompletion
+{
+public:
+    CReadSequence( VARIANT* expected, ULONG count, CAsyncPipe& pipe, CAsyncExecutor& executor )
+        :   m_expected( expected ),
+            m_count( count ),
+            m_done( 0 ),
+            m_pipe( pipe ),
+            m_executor( executor ),
+            m_result( S_OK )
+    {
+    }
+
+    void Start()
+    {
+        m_reader.BeginRead( &m_pipe, &m_executor, this );
+    }
+
+    virtual void OnComplete( HRESULT hr )
+    {
+        CComVariant     variant;
+
+        m_result = hr;
+        if ( FAILED( hr ) )
+            return;
+
+        m_reader.Detach( variant );
+        if ( m_done == m_count || FAILED( VerifySame( m_expected[m_done++], variant ) ) )
+        {
+            m_result = E_UNEXPECTED;
+            return;
+        }
+
+        m_reader.BeginRead( &m_pipe, &m_executor, this );
+    }
+
+    CAsyncVariantReader m_reader;
+    VARIANT*            m_expected;
+    ULONG               m_count;
+    ULONG               m_done;
+    CAsyncPipe&         m_pipe;
+    CAsyncExecutor&     m_executor;
+    HRESULT             m_result;
+
+}; // class CReadSequence
+
+
+class CAsyncVariantTest
+{
+public:
+
+    //------------------------------------------------------------------------------
+    // Writes the variants through a pipe of the given size while reading them
+    // back, both on one queue, and checks what was read.
+    //------------------------------------------------------------------------------
+
+    static HRESULT VerifyPipe( VARIANT* variants, ULONG count, ULONG pipeSize )
+    {
+        CAsyncQueue     queue;
+        CAsyncPipe      pipe;
+        CWriteSequence  writes( variants, count, pipe, queue );
+        CReadSequence   reads( variants, count, pipe, queue );
+
+        pipe.Open( pipeSize );
+        writes.Start();
+        reads.Start();
+        queue.Run();
+
+        // Every variant went through, and the reader then found the end.
+        if ( FAILED( writes.m_result ) || writes.m_done != count )
+            HR( E_UNEXPECTED );
+        if ( reads.m_done != count || SUCCEEDED( reads.m_result ) || E_UNEXPECTED == reads.m_result )
+            HR( E_UNEXPECTED );
+
+        // A small pipe keeps both sides waiting on each other.
+        if ( pipeSize < 100 && queue.GetResumed() < 20 )
+            HR( E_UNEXPECTED );
+
+        return S_OK;
+
+    } // VerifyPipe
+
+
+    //------------------------------------------------------------------------------
+    // Test writing and reading variants without blocking.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Test()
+    {
+        CComVariant         variants[4];
+        CAsyncQueue         queue;
+        CAsyncPipe          pipe;
+        CAsyncPipe          objectPipe;
+        CReadSequence       reads( variants, 1, pipe, queue );
+        CReadSequence       objectReads( variants, 1, objectPipe, queue );
+        BYTE                object[sizeof( long ) + sizeof( VARTYPE )];
+        long                version = 1;
+        VARTYPE             vt = VT_DISPATCH;
+        BLOB                blob;
+        ULONG               written;
+
+        HR( CParallelReadTest::GetMixedArray( variants[0] ) );
+        variants[1] = L"a string";
+        variants[2] = 42L;
+        variants[3] = 2.5;
+
+        HR( VerifyPipe( variants, 4, 16 ) );
+        HR( VerifyPipe( variants, 4, 0x10000 ) );
+
+        // A stream that ends part way through a variant fails the read.
+        WriteVariantToBlob( variants[1], blob );
+
+        pipe.Open( 64 );
+        pipe.WriteSome( blob.pBlobData, blob.cbSize - 1, written, NULL, NULL );
+        pipe.Close();
+
+        reads.Start();
+        queue.Run();
+
+        ::CoTaskMemFree( blob.pBlobData );
+
+        if ( reads.m_done || SUCCEEDED( reads.m_result ) )
+            HR( E_UNEXPECTED );
+
+        // An object can't be pushed, and the read fails saying why.
+        ::CopyMemory( object, &version, sizeof( version ) );
+        ::CopyMemory( object + sizeof( version ), &vt, sizeof( vt ) );
+
+        objectPipe.Open( 64 );
+        objectPipe.WriteSome( object, sizeof( object ), written, NULL, NULL );
+        objectPipe.Close();
+
+        objectReads.Start();
+        queue.Run();
+
+        if ( objectReads.m_done || DISP_E_TYPEMISMATCH != objectReads.m_result )
+            HR( E_UNEXPECTED );
+
+        return S_OK;
+
+    } // Test
+
+
+}; // class CAsyncVariantTest
@@ -0,0 +1,228 @@
+#pragma once
+
+#include "StreamSupport.h"
+#include "Benchmark.h"
+#include "ParallelReadTest.h"
+
+
+//==============================================================================
+// CSlowStream
+// Stream on a block of memory that takes a millisecond for every 64 KB
+// written to it, standing in for a slow file or pipe.
+//==============================================================================
+
+class CSlowStream : public CMemoryWriteStream
+{
+public:
+    CSlowStream( void* data, ULONGLONG size )
+        :   CMemoryWriteStream( data, size )
+    {
+    }
+
+    STDMETHOD(Write)( const void* pv, ULONG cb, ULONG* pcbWritten )
+    {
+        ULONGLONG   before = m_position;
+        HRESULT     hr = CMemoryWriteStream::Write( pv, cb, pcbWritten );
+
+        for ( ULONGLONG block = before >> 16; block < m_position >> 16; block++ )
+            ::Sleep( 1 );
+
+        return hr;
+    }
+
+}; // class CSlowStream
+
+
+class CAsyncWriteTest
+{
+public:
+
+    //------------------------------------------------------------------------------
+    // Writes the variant through an asynchronous stream, with a buffer small
+    // enough to be handed over many times, and checks that the same bytes
+    // arrive as when written directly.
+    //------------------------------------------------------------------------------
+
+    static HRESULT VerifyAsyncWrite( VARIANT& variant )
+    {
+        CComPtr<IStream>    pStream1;
+        CComPtr<IStream>    pStream2;
+        CAsyncWriteStream   stream;
+        LARGE_INTEGER       zero = { 0 };
+        ULARGE_INTEGER      position;
+        BLOB                blob1;
+        BLOB                blob2;
+        HRESULT             hr = S_OK;
+
+        HR( CreateMemoryStream( &pStream1 ) );
+        HR( CreateMemoryStream( &pStream2 ) );
+
+        WriteVariantToStream( &variant, pStream1 );
+
+        stream.Open( pStream2, 64 );
+        WriteVariantToStream( &variant, &stream );
+        HR( stream.Flush() );
+
+        StreamToTaskMemory( pStream1, blob1 );
+        StreamToTaskMemory( pStream2, blob2 );
+
+        if ( blob1.cbSize != blob2.cbSize || 0 != memcmp( blob1.pBlobData, blob2.pBlobData, blob1.cbSize ) )
+            hr = E_UNEXPECTED;
+
+        // Seeking only tells how much has been written.
+        if ( FAILED( stream.Seek( zero, STREAM_SEEK_CUR, &position ) ) || position.QuadPart != blob1.cbSize )
+            hr = E_UNEXPECTED;
+
+        ::CoTaskMemFree( blob1.pBlobData );
+        ::CoTaskMemFree( blob2.pBlobData );
+
+        return hr;
+
+    } // VerifyAsyncWrite
+
+
+    //------------------------------------------------------------------------------
+    // Writes the variant to the stream, reporting failure rather than raising
+    // it.
+    //------------------------------------------------------------------------------
+
+    static HRESULT TryWrite( VARIANT& variant, IStream* pStream )
+    {
+        HRESULT     hr = S_OK;
+
+        TryStreamCall( WriteVariantToStream( &variant, pStream ), hr );
+
+        return hr;
+
+    } // TryWrite
+
+
+    //------------------------------------------------------------------------------
+    // Test writing through a stream that writes on a background thread.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Test()
+    {
+        CComVariant         mixed;
+        CComVariant         text = L"some text";
+        CComPtr<IStream>    pStream;
+        BYTE                small[100];
+        CMemoryWriteStream  target( small, sizeof( small ) );
+        CAsyncWriteStream   stream;
+        CAsyncWriteStream   full;
+        HRESULT             hr;
+
+        HR( CParallelReadTest::GetMixedArray( mixed ) );
+
+        HR( VerifyAsyncWrite( mixed ) );
+        HR( VerifyAsyncWrite( text ) );
+
+        // The flush event is signaled once the value has been written out.
+        HR( CreateMemoryStream( &pStream ) );
+        stream.Open( pStream );
+        WriteVariantToStream( &text, &stream );
+        if ( WAIT_OBJECT_0 != ::WaitForSingleObject( stream.BeginFlush(), INFINITE ) )
+            HR( E_UNEXPECTED );
+        if ( FAILED( stream.Flush() ) )
+            HR( E_UNEXPECTED );
+
+        // A stream that fills up fails the flush, whether or not the writes
+        // got to see the failure.
+        full.Open( &target, 64 );
+        hr = TryWrite( mixed, &full );
+        if ( FAILED( hr ) && STG_E_MEDIUMFULL != hr )
+            HR( E_UNEXPECTED );
+        if ( STG_E_MEDIUMFULL != full.Flush() )
+            HR( E_UNEXPECTED );
+
+        return S_OK;
+
+    } // Test
+
+
+    //------------------------------------------------------------------------------
+    // Times writing arrays of strings to a slow stream, directly and through
+    // an asynchronous stream, reporting the total time and how long each
+    // write held up the caller.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Benchmark()
+    {
+        ULONG const             count = 2000;
+        ULONG const             iterations = 200;
+        ULONG const             sinkSize = 0x2000000;
+        CComVariant             strings;
+        CComVector<BSTR>        a( count );
+        CComVectorData<BSTR>    rg( a );
+        ULONG                   latency[iterations];
+        BYTE*                   sink;
+        if ( !rg )
+            HR( E_UNEXPECTED );
+
+        for( ULONG i = 0; i < count; ++i )
+            rg[i] = ::SysAllocString( L"a string of some length" );
+
+        strings.vt = VT_BSTR | VT_ARRAY;
+        strings.parray = a.Detach();
+
+        sink = (BYTE*)::CoTaskMemAlloc( sinkSize );
+        if ( !sink )
+            HR( E_OUTOFMEMORY );
+
+        HR( BenchmarkWrites( strings, sink, sinkSize, false, latency, iterations ) );
+        HR( BenchmarkWrites( strings, sink, sinkSize, true, latency, iterations ) );
+
+        ::CoTaskMemFree( sink );
+
+        return S_OK;
+
+    } // Benchmark
+
+
+    //------------------------------------------------------------------------------
+    // Writes the variant iterations times to a slow stream on the sink,
+    // through an asynchronous stream or not.
+    //------------------------------------------------------------------------------
+
+    static HRESULT BenchmarkWrites( VARIANT&    variant,
+                                    BYTE*       sink,
+                                    ULONG       sinkSize,
+                                    bool        isAsync,
+                                    ULONG*      latency,
+                                    ULONG       iterations )
+    {
+        CSlowStream         slow( sink, sinkSize );
+        CAsyncWriteStream   async;
+        IStream*            pStream = &slow;
+        CBenchmarkTimer     total;
+        CBenchmarkTimer     timer;
+        ULONG               time;
+        LPCSTR              name = isAsync ? "asynchronous write to slow stream" : "write to slow stream";
+
+        if ( isAsync )
+        {
+            async.Open( &slow );
+            pStream = &async;
+        }
+
+        total.Start();
+        for( ULONG i = 0; i < iterations; ++i )
+        {
+            timer.Start();
+            WriteVariantToStream( &variant, pStream );
+            latency[i] = timer.ElapsedMicroseconds();
+        }
+
+        if ( isAsync )
+            HR( async.Flush() );
+        time = total.ElapsedMicroseconds();
+
+        ReportBenchmark( name, iterations, time );
+        ReportLatency( name, latency, iterations );
+
+        return S_OK;
+
+    } // BenchmarkWrites
+
+
+}; // class CAsyncWriteTest
@@ -0,0 +1,297 @@
+#pragma once
+
+#include "StreamSupport.h"
+#include "Benchmark.h"
+
+class CBatchTest
+{
+public:
+
+    //------------------------------------------------------------------------------
+    // Creates a row, from 1, of a long, a double, a string and a variant that
+    // is a double, or for every third row an array of longs.
+    //------------------------------------------------------------------------------
+
+    static HRESULT GetRow( ULONG row, VARIANT& variant )
+    {
+        CComVector<VARIANT>     a( 4, 1 );
+        CComVectorData<VARIANT> rg( a );
+        WCHAR                   text[32];
+        if ( !rg )
+            HR( E_UNEXPECTED );
+
+        rg[0].vt = VT_I4;
+        rg[0].lVal = row;
+        rg[1].vt = VT_R8;
+        rg[1].dblVal = row / 2.0;
+
+        ::wsprintfW( text, L"row %lu", row );
+        rg[2].vt = VT_BSTR;
+        rg[2].bstrVal = ::SysAllocString( text );
+
+        if ( row % 3 )
+        {
+            rg[3].vt = VT_R8;
+            rg[3].dblVal = row;
+        }
+        else
+        {
+            rg[3].vt = VT_I4 | VT_ARRAY;
+            rg[3].parray = SafeArrayCreateVector( VT_I4, 0, row % 4 );
+            if ( !rg[3].parray )
+                HR( E_OUTOFMEMORY );
+        }
+
+        variant.vt = VT_VARIANT | VT_ARRAY;
+        variant.parray = a.Detach();
+
+        return S_OK;
+
+    } // GetRow
+
+
+    //------------------------------------------------------------------------------
+    // Writes the rows as a batch.
+    //------------------------------------------------------------------------------
+
+    static void WriteBatch( const VARIANT* rows, ULONG count, IStream* pStream )
+    {
+        CVariantBatchWriter     writer( pStream );
+
+        writer.Write( rows, count );
+
+    } // WriteBatch
+
+
+    //------------------------------------------------------------------------------
+    // Calls WriteBatch, or reads a row of a batch, reporting failure rather
+    // than raising it.
+    //------------------------------------------------------------------------------
+
+    static HRESULT TryWrite( const VARIANT* rows, ULONG count, IStream* pStream )
+    {
+        HRESULT     hr = S_OK;
+
+        TryStreamCall( WriteBatch( rows, count, pStream ), hr );
+
+        return hr;
+
+    } // TryWrite
+
+
+    static HRESULT TryReadRow( CVariantBatchReader& reader, ULONG row, VARIANT& variant )
+    {
+        HRESULT     hr = S_OK;
+
+        TryStreamCall( reader.ReadRow( row, variant ), hr );
+
+        return hr;
+
+    } // TryReadRow
+
+
+    //------------------------------------------------------------------------------
+    // Test writing rows as columns and reading back columns, single rows and
+    // every row.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Test()
+    {
+        ULONG const             count = 100;
+        CComVariant             rows[count];
+        CComVariant             copies[count];
+        CComVariant             column;
+        CComVariant             row;
+        CComVariant             mismatched;
+        CComVariant             number = 1L;
+        CComVariant             byref;
+        CComPtr<IStream>        pStream;
+        CComPtr<IStream>        pRejected;
+        HRESULT                 hr = S_OK;
+
+        for( ULONG i = 0; i < count; ++i )
+            HR( GetRow( i, rows[i] ) );
+
+        // A batch passed by reference, then an empty batch.
+        byref.vt = VT_VARIANT | VT_ARRAY | VT_BYREF;
+        byref.pparray = &rows[count - 1].parray;
+
+        HR( CreateMemoryStream( &pStream ) );
+        {
+            CVariantBatchWriter     writer( pStream );
+
+            writer.Write( rows, count );
+            writer.Write( &byref, 1 );
+            writer.Write( NULL, 0 );
+        }
+
+        // The rows are locked only while they are written.
+        if ( rows[0].parray->cLocks || rows[count - 1].parray->cLocks )
+            hr = E_UNEXPECTED;
+
+        HR( RewindStream( pStream ) );
+        {
+            CVariantBatchReader     reader( pStream );
+
+            reader.Open();
+            if ( reader.GetRowCount() != count || reader.GetColumnCount() != 4 )
+                hr = E_UNEXPECTED;
+
+            // Columns of one type come back as arrays of it, the others as
+            // arrays of variants.
+            reader.ReadColumn( 0, column );
+            if ( column.vt != ( VT_I4 | VT_ARRAY ) || column.parray->rgsabound[0].cElements != count )
+                hr = E_UNEXPECTED;
+            else if ( ( (long*)column.parray->pvData )[count - 1] != (long)count - 1 )
+                hr = E_UNEXPECTED;
+
+            column.Clear();
+            reader.ReadColumn( 2, column );
+            if ( column.vt != ( VT_BSTR | VT_ARRAY ) || 0 != lstrcmpW( ( (BSTR*)column.parray->pvData )[42], L"row 42" ) )
+                hr = E_UNEXPECTED;
+
+            column.Clear();
+            reader.ReadColumn( 3, column );
+            if ( column.vt != ( VT_VARIANT | VT_ARRAY ) || ( (VARIANT*)column.parray->pvData )[3].vt != ( VT_I4 | VT_ARRAY ) )
+                hr = E_UNEXPECTED;
+
+            // Single rows, out of order.
+            reader.ReadRow( 57, row );
+            if ( FAILED( VerifySame( rows[57], row ) ) )
+                hr = E_UNEXPECTED;
+            row.Clear();
+            reader.ReadRow( 3, row );
+            if ( FAILED( VerifySame( rows[3], row ) ) )
+                hr = E_UNEXPECTED;
+            row.Clear();
+            if ( DISP_E_BADINDEX != TryReadRow( reader, count, row ) )
+                hr = E_UNEXPECTED;
+
+            // Every row, which leaves the stream at the next batch.
+            reader.ReadRows( copies );
+            for( ULONG j = 0; j < count; ++j )
+            {
+                if ( FAILED( VerifySame( rows[j], copies[j] ) ) )
+                    hr = E_UNEXPECTED;
+            }
+
+            row.Clear();
+            reader.Open();
+            reader.ReadRow( 0, row );
+            if ( reader.GetRowCount() != 1 || FAILED( VerifySame( rows[count - 1], row ) ) )
+                hr = E_UNEXPECTED;
+            reader.End();
+
+            reader.Open();
+            if ( reader.GetRowCount() || reader.GetColumnCount() )
+                hr = E_UNEXPECTED;
+        }
+        HR( hr );
+
+        // Rows must be one dimensional arrays of variants with the same
+        // bounds.
+        HR( CreateMemoryStream( &pRejected ) );
+        if ( E_INVALIDARG != TryWrite( &number, 1, pRejected ) )
+            hr = E_UNEXPECTED;
+
+        mismatched.vt = VT_VARIANT | VT_ARRAY;
+        mismatched.parray = SafeArrayCreateVector( VT_VARIANT, 0, 4 );
+        if ( !mismatched.parray )
+            HR( E_OUTOFMEMORY );
+        rows[count - 1] = mismatched;
+        if ( E_INVALIDARG != TryWrite( rows, count, pRejected ) )
+            hr = E_UNEXPECTED;
+
+        return hr;
+
+    } // Test
+
+
+    //------------------------------------------------------------------------------
+    // Time writing 100000 rows each on their own and as a batch, and adding
+    // up a column of the batch against reading every row to do so.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Benchmark()
+    {
+        ULONG const             count = 100000;
+        CComVector<VARIANT>     a( count );
+        CComVectorData<VARIANT> rg( a );
+        CComVector<VARIANT>     copies( count );
+        CComVectorData<VARIANT> rgCopies( copies );
+        CComPtr<IStream>        pPlain;
+        CComPtr<IStream>        pStream;
+        CComVariant             column;
+        CBenchmarkTimer         timer;
+        ULONG                   time;
+        LARGE_INTEGER           zero = { 0 };
+        ULARGE_INTEGER          size;
+        double                  sum = 0;
+        HRESULT                 hr = S_OK;
+        if ( !rg || !rgCopies )
+            HR( E_UNEXPECTED );
+
+        for( ULONG i = 0; i < count; ++i )
+            HR( GetRow( i, rg[i] ) );
+
+        HR( CreateMemoryStream( &pPlain ) );
+        HR( CreateMemoryStream( &pStream ) );
+
+        timer.Start();
+        for( ULONG j = 0; j < count; ++j )
+            WriteVariantToStream( &rg[j], pPlain );
+        time = timer.ElapsedMicroseconds();
+        ReportBenchmark( "write 100000 rows", count, time );
+        HR( pPlain->Seek( zero, STREAM_SEEK_CUR, &size ) );
+        ReportSize( "rows", count, size.QuadPart );
+
+        {
+            CVariantBatchWriter     writer( pStream );
+
+            timer.Start();
+            writer.Write( &rg[0], count );
+            time = timer.ElapsedMicroseconds();
+            ReportBenchmark( "write 100000 rows as a batch", count, time );
+            HR( pStream->Seek( zero, STREAM_SEEK_CUR, &size ) );
+            ReportSize( "rows as a batch", count, size.QuadPart );
+        }
+
+        HR( RewindStream( pPlain ) );
+        timer.Start();
+        for( ULONG k = 0; k < count; ++k )
+        {
+            CComVariant     row;
+
+            ReadVariantFromStream( pPlain, row );
+            sum -= ( (VARIANT*)row.parray->pvData )[1].dblVal;
+        }
+        time = timer.ElapsedMicroseconds();
+        ReportBenchmark( "sum a column of 100000 rows", count, time );
+
+        HR( RewindStream( pStream ) );
+        {
+            CVariantBatchReader     reader( pStream );
+
+            timer.Start();
+            reader.Open();
+            reader.ReadColumn( 1, column );
+            for( ULONG m = 0; m < count; ++m )
+                sum += ( (double*)column.parray->pvData )[m];
+            time = timer.ElapsedMicroseconds();
+            ReportBenchmark( "sum a column of a batch of 100000", count, time );
+
+            timer.Start();
+            reader.ReadRows( &rgCopies[0] );
+            time = timer.ElapsedMicroseconds();
+            ReportBenchmark( "read 100000 rows from a batch", count, time );
+        }
+
+        if ( sum != 0 )
+            hr = E_UNEXPECTED;
+
+        return hr;
+
+    } // Benchmark
+
+
+}; // class CBatchTest
@@ -0,0 +1,179 @@
+#pragma once
+
+
+//------------------------------------------------------------------------------
+// CBenchmarkTimer
+// Measures elapsed time using the performance counter.
+//------------------------------------------------------------------------------
+
+class CBenchmarkTimer
+{
+public:
+    CBenchmarkTimer()
+    {
+        ::QueryPerformanceFrequency( &m_frequency );
+        Start();
+    }
+
+    inline void Start()
+    {
+        ::QueryPerformanceCounter( &m_start );
+    }
+
+    inline ULONG ElapsedMicroseconds()
+    {
+        LARGE_INTEGER   now;
+
+        ::QueryPerformanceCounter( &now );
+
+        return (ULONG)( ( now.QuadPart - m_start.QuadPart ) * 1000000 / m_frequency.QuadPart );
+    }
+
+private:
+    LARGE_INTEGER   m_frequency;
+    LARGE_INTEGER   m_start;
+
+}; // class CBenchmarkTimer
+
+
+//------------------------------------------------------------------------------
+// ReportBenchmark
+// Sends the benchmark's name, iteration count and timings to the debugger
+// output.
+//------------------------------------------------------------------------------
+
+inline void ReportBenchmark( LPCSTR name, ULONG iterations, ULONG microseconds )
+{
+    char    line[256];
+
+    ::wsprintfA( line,
+                 "%s: %lu iterations, %lu us total, %lu ns each\n",
+                 name,
+                 iterations,
+                 microseconds,
+                 (ULONG)( (LONGLONG)microseconds * 1000 / ( iterations ? iterations : 1 ) ) );
+
+    ::OutputDebugStringA( line );
+
+} // ReportBenchmark
+
+
+//------------------------------------------------------------------------------
+// ReportLatency
+// Sends the median, 99th percentile and longest of the given timings to the
+// debugger output.  Sorts the timings in place.
+//------------------------------------------------------------------------------
+
+inline void ReportLatency( LPCSTR name, ULONG* microseconds, ULONG count )
+{
+    char    line[256];
+
+    if ( !count )
+        return;
+
+    // Insertion sort; there are only as many timings as iterations.
+    for ( ULONG i = 1; i < count; i++ )
+    {
+        ULONG   value = microseconds[i];
+        ULONG   j = i;
+
+        for ( ; j > 0 && microseconds[j - 1] > value; j-- )
+            microseconds[j] = microseconds[j - 1];
+
+        microseconds[j] = value;
+    }
+
+    ::wsprintfA( line,
+                 "%s: %lu calls, median %lu us, 99th percentile %lu us, longest %lu us\n",
+                 name,
+                 count,
+                 microseconds[count / 2],
+                 microseconds[(ULONG)( (ULONGLONG)count * 99 / 100 )],
+                 microseconds[count - 1] );
+
+    ::OutputDebugStringA( line );
+
+} // ReportLatency
+
+
+//------------------------------------------------------------------------------
+// ReportSize
+// Sends the total and average size of count streamed items to the debugger
+// output.
+//------------------------------------------------------------------------------
+
+inline void ReportSize( LPCSTR name, ULONG count, ULONGLONG bytes )
+{
+    char    line[256];
+
+    ::wsprintfA( line,
+                 "%s: %lu items, %lu bytes, %lu bytes each\n",
+                 name,
+                 count,
+                 (ULONG)bytes,
+                 (ULONG)( bytes / ( count ? count : 1 ) ) );
+
+    ::OutputDebugStringA( line );
+
+} // ReportSize
+
+
+//------------------------------------------------------------------------------
+// ReportAllocations
+// Sends how many allocations count items took to the debugger output.
+//------------------------------------------------------------------------------
+
+inline void ReportAllocations( LPCSTR name, ULONG count, ULONG allocations )
+{
+    char    line[256];
+
+    ::wsprintfA( line,
+                 "%s: %lu items, %lu allocations\n",
+                 name,
+                 count,
+                 allocations );
+
+    ::OutputDebugStringA( line );
+
+} // ReportAllocations
+
+
+//------------------------------------------------------------------------------
+// GetProcessorCount
+// Returns the number of processors, for benchmarks that scale with them.
+//------------------------------------------------------------------------------
+
+inline ULONG GetProcessorCount()
+{
+    SYSTEM_INFO     info;
+
+    ::GetSystemInfo( &info );
+
+    return info.dwNumberOfProcessors;
+
+} // GetProcessorCount
+
+
+//------------------------------------------------------------------------------
+// ReportScaling
+// Sends how many times as fast the work ran on the given number of threads
+// as on one to the debugger output, along with the number of processors it
+// had.  With fewer processors than threads this shows overhead, not scaling.
+//------------------------------------------------------------------------------
+
+inline void ReportScaling( LPCSTR name, ULONG threads, ULONG oneThread, ULONG microseconds )
+{
+    char    line[256];
+    ULONG   speedup = (ULONG)( (ULONGLONG)oneThread * 100 / ( microseconds ? microseconds : 1 ) );
+
+    ::wsprintfA( line,
+                 "%s: %lu threads on %lu processors, %lu.%02lu times as fast as one thread\n",
+                 name,
+                 threads,
+                 GetProcessorCount(),
+                 speedup / 100,
+                 speedup % 100 );
+
+    ::OutputDebugStringA( line );
+
+} // ReportScaling
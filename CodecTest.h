@@ -0,0 +1,218 @@
+#pragma once
+
+#include "StreamSupport.h"
+#include "Benchmark.h"
+#include "ParallelReadTest.h"
+#include "VariantsBlobTest.h"
+
+class CCodecTest
+{
+public:
+
+    //------------------------------------------------------------------------------
+    // Test encoding and decoding with kept memory, against the global
+    // functions.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Test()
+    {
+        SAFEARRAYBOUND      bounds[2] = { { 300, 0 }, { 400, 1 } };
+        CComVariant         mixed;
+        CComVariant         grid;
+        CComVariant         text = L"some text";
+        CComVariant         copy;
+        CComPtr<IStream>    pStream;
+        CVariantEncoder     encoder;
+        CVariantDecoder     decoder;
+        const BYTE*         data;
+        const BYTE*         again;
+        ULONG               size;
+        ULONG               againSize;
+        BLOB                blob;
+        HRESULT             hr = S_OK;
+
+        HR( CParallelReadTest::GetMixedArray( mixed ) );
+
+        // A two dimensional array larger than the bulk buffer, so that it is
+        // gathered and scattered.
+        grid.vt = VT_I4 | VT_ARRAY;
+        grid.parray = SafeArrayCreate( VT_I4, 2, bounds );
+        if ( !grid.parray )
+            HR( E_OUTOFMEMORY );
+        for ( ULONG i = 0; i < 300 * 400; i++ )
+            ( (long*)grid.parray->pvData )[i] = i;
+
+        // The encoder's data is what WriteVariantToBlob writes.
+        WriteVariantToBlob( mixed, blob );
+        data = encoder.Encode( mixed, size );
+        if ( size != blob.cbSize || 0 != ::memcmp( data, blob.pBlobData, size ) )
+            hr = E_UNEXPECTED;
+        ::CoTaskMemFree( blob.pBlobData );
+
+        decoder.Decode( data, size, copy );
+        if ( FAILED( VerifySame( mixed, copy ) ) )
+            hr = E_UNEXPECTED;
+        copy.Clear();
+
+        // The same variant encodes into the same memory again.
+        again = encoder.Encode( mixed, againSize );
+        if ( again != data || againSize != size )
+            hr = E_UNEXPECTED;
+
+        encoder.Encode( grid, blob );
+        decoder.Decode( blob, copy );
+        if ( FAILED( VerifySame( grid, copy ) ) )
+            hr = E_UNEXPECTED;
+        ::CoTaskMemFree( blob.pBlobData );
+        copy.Clear();
+
+        // Through a stream, read back by the global function.
+        HR( CreateMemoryStream( &pStream ) );
+        encoder.Encode( text, pStream );
+        encoder.Encode( grid, pStream );
+        HR( RewindStream( pStream ) );
+        decoder.Decode( pStream, copy );
+        if ( FAILED( VerifySame( text, copy ) ) )
+            hr = E_UNEXPECTED;
+        copy.Clear();
+        ReadVariantFromStream( pStream, copy );
+        if ( FAILED( VerifySame( grid, copy ) ) )
+            hr = E_UNEXPECTED;
+        copy.Clear();
+
+        // A trimmed encoder starts again.
+        encoder.Trim();
+        data = encoder.Encode( text, size );
+        decoder.Decode( data, size, copy );
+        if ( FAILED( VerifySame( text, copy ) ) )
+            hr = E_UNEXPECTED;
+        copy.Clear();
+
+        // The global functions keep nothing, and read what they write.
+        WriteVariantToBlob( grid, blob );
+        ReadVariantFromBlob( blob, copy );
+        if ( FAILED( VerifySame( grid, copy ) ) )
+            hr = E_UNEXPECTED;
+        ::CoTaskMemFree( blob.pBlobData );
+
+        return hr;
+
+    } // Test
+
+
+    //------------------------------------------------------------------------------
+    // Time encoding and decoding 100000 small variants through a new HGLOBAL
+    // stream each, the global functions and an encoder and decoder.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Benchmark()
+    {
+        ULONG const                     count = 100000;
+        CComVector<VARIANT>             a( count );
+        CComVectorData<VARIANT>         rg( a );
+        CComVector<VARIANT>             copies( count );
+        CComVectorData<VARIANT>         rgCopies( copies );
+        VariantStreaming::CTaskMemory   memory( count * sizeof( BLOB ) );
+        BLOB*                           blobs = (BLOB*)(BYTE*)memory;
+        CVariantEncoder                 encoder;
+        CVariantDecoder                 decoder;
+        CBenchmarkTimer                 timer;
+        ULONG                           time;
+        ULONG                           total = 0;
+        ULONG                           size;
+        if ( !rg || !rgCopies )
+            HR( E_UNEXPECTED );
+
+        for( ULONG i = 0; i < count; ++i )
+            HR( CVariantsBlobTest::GetValue( i, rg[i] ) );
+
+        // What WriteVariantToBlob and ReadVariantFromBlob used to do.
+        timer.Start();
+        for( ULONG j = 0; j < count; ++j )
+        {
+            CComPtr<IStream>    pStream;
+
+            HR( ::CreateStreamOnHGlobal( NULL, TRUE, &pStream ) );
+            WriteVariantToStream( &rg[j], pStream );
+            StreamToTaskMemory( pStream, blobs[j] );
+        }
+        time = timer.ElapsedMicroseconds();
+        ReportBenchmark( "write 100000 variants through HGLOBAL streams", count, time );
+
+        timer.Start();
+        for( ULONG k = 0; k < count; ++k )
+        {
+            CComPtr<IStream>    pStream;
+
+            BlobToStream( blobs[k], &pStream );
+            ReadVariantFromStream( pStream, rgCopies[k] );
+        }
+        time = timer.ElapsedMicroseconds();
+        ReportBenchmark( "read 100000 variants through HGLOBAL streams", count, time );
+
+        HR( Clear( blobs, &rgCopies[0], count ) );
+
+        timer.Start();
+        for( ULONG m = 0; m < count; ++m )
+            WriteVariantToBlob( rg[m], blobs[m] );
+        time = timer.ElapsedMicroseconds();
+        ReportBenchmark( "write 100000 variants to blobs", count, time );
+
+        timer.Start();
+        for( ULONG n = 0; n < count; ++n )
+            ReadVariantFromBlob( blobs[n], rgCopies[n] );
+        time = timer.ElapsedMicroseconds();
+        ReportBenchmark( "read 100000 variants from blobs", count, time );
+
+        HR( Clear( blobs, &rgCopies[0], count ) );
+
+        timer.Start();
+        for( ULONG p = 0; p < count; ++p )
+            encoder.Encode( rg[p], blobs[p] );
+        time = timer.ElapsedMicroseconds();
+        ReportBenchmark( "encode 100000 variants to blobs", count, time );
+
+        timer.Start();
+        for( ULONG q = 0; q < count; ++q )
+            decoder.Decode( blobs[q], rgCopies[q] );
+        time = timer.ElapsedMicroseconds();
+        ReportBenchmark( "decode 100000 variants from blobs", count, time );
+
+        // Encoding in place, into the encoder's own buffer, reused from one
+        // call to the next.
+        timer.Start();
+        for( ULONG r = 0; r < count; ++r )
+        {
+            encoder.Encode( rg[r], size );
+            total += size;
+        }
+        time = timer.ElapsedMicroseconds();
+        ReportBenchmark( "encode 100000 variants in place", count, time );
+
+        HR( Clear( blobs, &rgCopies[0], count ) );
+        if ( !total )
+            HR( E_UNEXPECTED );
+
+        return S_OK;
+
+    } // Benchmark
+
+
+    //------------------------------------------------------------------------------
+    // Frees the blobs and clears the variants read from them.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Clear( BLOB* blobs, VARIANT* variants, ULONG count )
+    {
+        for( ULONG i = 0; i < count; ++i )
+        {
+            ::CoTaskMemFree( blobs[i].pBlobData );
+            HR( ::VariantClear( &variants[i] ) );
+        }
+
+        return S_OK;
+
+    } // Clear
+
+
+}; // class CCodecTest
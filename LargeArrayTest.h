@@ -0,0 +1,111 @@
+#pragma once
+
+#include "StreamSupport.h"
+
+class CLargeArrayTest
+{
+public:
+
+    //------------------------------------------------------------------------------
+    // Number of doubles in the test array, just over 4 GB worth, and the
+    // number written at a time.  The count is not a multiple of the chunk,
+    // so the last, shorter chunk lies wholly past the first 4 GB.
+    //------------------------------------------------------------------------------
+
+    enum { count = 0x20000100, chunk = 0x10000 };
+
+
+    //------------------------------------------------------------------------------
+    // Fills the chunk with the numbers 0 to 255 over and over, each plus
+    // offset.  Returns their sum.
+    //------------------------------------------------------------------------------
+
+    static double FillChunk( double* data, ULONG size, double offset )
+    {
+        double      sum = 0;
+
+        for( ULONG i = 0; i < size; i++ )
+        {
+            data[i] = offset + ( i & 0xFF );
+            sum += data[i];
+        }
+
+        return sum;
+
+    } // FillChunk
+
+
+    //------------------------------------------------------------------------------
+    // Writes an array of more than 4 GB to a file stream a chunk at a time,
+    // and aggregates it back from the stream, so that neither side ever holds
+    // more than a chunk in memory.  Checks the size of the stream, where
+    // reading it ended, and the count, sum, minimum and maximum of the
+    // numbers, the largest of which is in the last chunk.  The sums are of
+    // whole numbers well under 2^53, so they are exact.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Test()
+    {
+        SAFEARRAYBOUND      bounds = { count, 0 };
+        CComPtr<IStream>    pStream;
+        CVariantAggregate   aggregate;
+        ULARGE_INTEGER      position;
+        STATSTG             stat;
+        double*             data;
+        double              sum = 0;
+        double              chunkSum;
+        ULONG               written;
+        HRESULT             hr = S_OK;
+
+        data = (double*)::CoTaskMemAlloc( chunk * sizeof( double ) );
+        if ( !data )
+            HR( E_OUTOFMEMORY );
+
+        // Create a file stream.
+        hr = CreateTempFileStream( &pStream );
+        if ( FAILED( hr ) )
+        {
+            ::CoTaskMemFree( data );
+            return hr;
+        }
+
+        // Write all but the last chunk from the same buffer, then the last.
+        {
+            CVariantArrayWriter     writer( pStream );
+
+            writer.Begin( VT_R8, 1, &bounds );
+            chunkSum = FillChunk( data, chunk, 0 );
+            for( written = 0; written + chunk <= count; written += chunk )
+            {
+                writer.WriteData( data, chunk );
+                sum += chunkSum;
+            }
+            sum += FillChunk( data, count - written, 1000 );
+            writer.WriteData( data, count - written );
+            writer.End();
+        }
+        ::CoTaskMemFree( data );
+
+        // Make sure none of it was lost.
+        HR( pStream->Stat( &stat, STATFLAG_NONAME ) );
+        if ( stat.cbSize.QuadPart <= (ULONGLONG)count * sizeof( double ) )
+            HR( E_UNEXPECTED );
+
+        // Rewind the stream and aggregate it, which has to read to the end.
+        HR( RewindStream( pStream ) );
+        AggregateVariantInStream( pStream, aggregate );
+        HR( pStream->Seek( largeZero, STREAM_SEEK_CUR, &position ) );
+
+        if ( position.QuadPart != stat.cbSize.QuadPart )
+            hr = E_UNEXPECTED;
+        if ( count != aggregate.count || sum != aggregate.sum )
+            hr = E_UNEXPECTED;
+        if ( 0 != aggregate.minimum || 1255 != aggregate.maximum )
+            hr = E_UNEXPECTED;
+
+        return hr;
+
+    } // Test
+
+
+}; // class CLargeArrayTest
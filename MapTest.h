@@ -0,0 +1,303 @@
+#pragma once
+
+#include "StreamSupport.h"
+#include "Benchmark.h"
+#include "PushReaderTest.h"
+
+class CMapTest
+{
+public:
+
+    //------------------------------------------------------------------------------
+    // Creates a map of count names, "name 0" on, to values that are in turn
+    // the entry's number, a string, an array of doubles and a small map of
+    // two names, "inner" and "other", without a directory.
+    //------------------------------------------------------------------------------
+
+    static HRESULT GetMap( ULONG count, VARIANT& map )
+    {
+        SAFEARRAYBOUND      bounds[2] = { { 2, 0 }, { count, 1 } };
+        SAFEARRAYBOUND      innerBounds[2] = { { 2, 0 }, { 2, 0 } };
+        VARIANT*            rg;
+        VARIANT*            inner;
+
+        map.parray = SafeArrayCreate( VT_VARIANT, 2, bounds );
+        if ( !map.parray )
+            HR( E_OUTOFMEMORY );
+        map.vt = VT_VARIANT | VT_ARRAY;
+
+        HR( SafeArrayAccessData( map.parray, (void**)&rg ) );
+
+        // Each name is followed by its value in memory.
+        for( ULONG i = 0; i < count; ++i )
+        {
+            WCHAR       text[32];
+            VARIANT&    name = rg[2 * i];
+            VARIANT&    value = rg[2 * i + 1];
+
+            ::wsprintfW( text, L"name %lu", i );
+            name.vt = VT_BSTR;
+            name.bstrVal = ::SysAllocString( text );
+
+            switch ( i % 4 )
+            {
+            case 0:
+                value.vt = VT_I4;
+                value.lVal = i;
+                break;
+
+            case 1:
+                ::wsprintfW( text, L"value %lu", i );
+                value.vt = VT_BSTR;
+                value.bstrVal = ::SysAllocString( text );
+                break;
+
+            case 2:
+                value.vt = VT_R8 | VT_ARRAY;
+                value.parray = SafeArrayCreateVector( VT_R8, 0, i % 7 );
+                break;
+
+            default:
+                value.vt = VT_VARIANT | VT_ARRAY;
+                value.parray = SafeArrayCreate( VT_VARIANT, 2, innerBounds );
+                if ( !value.parray )
+                    break;
+
+                inner = (VARIANT*)value.parray->pvData;
+                inner[0].vt = VT_BSTR;
+                inner[0].bstrVal = ::SysAllocString( L"inner" );
+                inner[1].vt = VT_I4;
+                inner[1].lVal = i;
+                inner[2].vt = VT_BSTR;
+                inner[2].bstrVal = ::SysAllocString( L"other" );
+                break;
+            }
+        }
+
+        HR( SafeArrayUnaccessData( map.parray ) );
+
+        return S_OK;
+
+    } // GetMap
+
+
+    //------------------------------------------------------------------------------
+    // Finds the name in the view and checks that its value is the given
+    // long.
+    //------------------------------------------------------------------------------
+
+    static HRESULT VerifyLong( CVariantView& view, LPCWSTR name, long expected )
+    {
+        CVariantView    element;
+        VARIANT         value;
+
+        if ( !view.Find( name, element ) )
+            HR( E_UNEXPECTED );
+
+        element.GetValue( value );
+        if ( value.vt != VT_I4 || value.lVal != expected )
+            HR( E_UNEXPECTED );
+
+        return S_OK;
+
+    } // VerifyLong
+
+
+    //------------------------------------------------------------------------------
+    // Writes the variant as a map, or opens a view on the first size bytes of
+    // the blob, reporting failure rather than raising it.
+    //------------------------------------------------------------------------------
+
+    static HRESULT TryWrite( VARIANT& map, IStream* pStream )
+    {
+        HRESULT     hr = S_OK;
+
+        TryStreamCall( WriteVariantMapToStream( &map, pStream ), hr );
+
+        return hr;
+
+    } // TryWrite
+
+
+    static HRESULT TryOpen( CVariantView& view, const BLOB& blob, ULONG size )
+    {
+        HRESULT     hr = S_OK;
+
+        TryStreamCall( view.Open( blob.pBlobData, size ), hr );
+
+        return hr;
+
+    } // TryOpen
+
+
+    //------------------------------------------------------------------------------
+    // Test streaming maps with a directory and finding values by name.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Test()
+    {
+        CComVariant         map;
+        CComVariant         copy;
+        CComVariant         empty;
+        CComVariant         duplicates;
+        CComVariant         decoded;
+        CComVariant         numbers;
+        CComPtr<IStream>    pStream;
+        CVariantView        view;
+        CVariantView        element;
+        CVariantView        inner;
+        VARIANT*            names;
+        BLOB                blob;
+        BLOB                plain;
+        HRESULT             hr = S_OK;
+
+        HR( GetMap( 100, map ) );
+        WriteVariantMapToBlob( map, blob );
+        WriteVariantToBlob( map, plain );
+
+        // The directory holds 256 slots and 100 entries.
+        if ( blob.cbSize != plain.cbSize + 2 * sizeof( ULONG ) + 256 * sizeof( ULONG ) + 100 * ( sizeof( ULONG ) + 2 * sizeof( ULONGLONG ) ) )
+            hr = E_UNEXPECTED;
+
+        // Every reader sees the same array as was written.
+        ReadVariantFromBlob( blob, copy );
+        if ( FAILED( VerifySame( map, copy ) ) )
+            hr = E_UNEXPECTED;
+        if ( FAILED( CPushReaderTest::VerifyFragmented( blob, &map, 1, 64, 7 ) ) )
+            hr = E_UNEXPECTED;
+
+        view.Open( blob );
+        if ( FAILED( VerifyLong( view, L"name 96", 96 ) ) || FAILED( VerifyLong( view, L"name 0", 0 ) ) )
+            hr = E_UNEXPECTED;
+        if ( view.Find( L"name 100", element ) || view.Find( L"", element ) || view.Find( L"name", element ) )
+            hr = E_UNEXPECTED;
+
+        // Decode one value in full.
+        if ( !view.Find( L"name 41", element ) )
+            HR( E_UNEXPECTED );
+        element.Copy( decoded );
+        if ( decoded.vt != VT_BSTR || 0 != lstrcmpW( decoded.bstrVal, L"value 41" ) )
+            hr = E_UNEXPECTED;
+
+        if ( !view.Find( L"name 58", element ) || element.GetType() != ( VT_R8 | VT_ARRAY ) || element.GetElementCount() != 2 )
+            hr = E_UNEXPECTED;
+
+        // A map nested in a map is looked through name by name, and so is
+        // one streamed without a directory.
+        if ( !view.Find( L"name 23", element ) || FAILED( VerifyLong( element, L"inner", 23 ) ) )
+            hr = E_UNEXPECTED;
+        if ( !element.Find( L"other", inner ) || inner.GetType() != VT_EMPTY )
+            hr = E_UNEXPECTED;
+
+        view.Open( plain );
+        if ( FAILED( VerifyLong( view, L"name 96", 96 ) ) || view.Find( L"name 100", element ) )
+            hr = E_UNEXPECTED;
+
+        // A truncated directory fails to open.
+        if ( E_FAIL != TryOpen( view, blob, 3 * sizeof( ULONG ) + 10 ) )
+            hr = E_UNEXPECTED;
+
+        ::CoTaskMemFree( blob.pBlobData );
+        ::CoTaskMemFree( plain.pBlobData );
+        HR( hr );
+
+        // An empty map, and one with the same name twice, whose first value
+        // is found.
+        HR( GetMap( 0, empty ) );
+        WriteVariantMapToBlob( empty, blob );
+        view.Open( blob );
+        if ( view.Find( L"name 0", element ) )
+            hr = E_UNEXPECTED;
+        ::CoTaskMemFree( blob.pBlobData );
+
+        HR( GetMap( 5, duplicates ) );
+        names = (VARIANT*)duplicates.parray->pvData;
+        ::SysFreeString( names[8].bstrVal );
+        names[8].bstrVal = ::SysAllocString( L"name 0" );
+        WriteVariantMapToBlob( duplicates, blob );
+        view.Open( blob );
+        if ( FAILED( VerifyLong( view, L"name 0", 0 ) ) || view.Find( L"name 4", element ) )
+            hr = E_UNEXPECTED;
+        ::CoTaskMemFree( blob.pBlobData );
+
+        // Only 2 x N arrays of variants with strings for names are maps.
+        HR( CreateMemoryStream( &pStream ) );
+        numbers.vt = VT_VARIANT | VT_ARRAY;
+        numbers.parray = SafeArrayCreateVector( VT_VARIANT, 0, 4 );
+        if ( !numbers.parray )
+            HR( E_OUTOFMEMORY );
+        if ( DISP_E_TYPEMISMATCH != TryWrite( numbers, pStream ) )
+            hr = E_UNEXPECTED;
+
+        HR( ::VariantClear( &names[2] ) );
+        names[2].vt = VT_R8;
+        if ( DISP_E_TYPEMISMATCH != TryWrite( duplicates, pStream ) )
+            hr = E_UNEXPECTED;
+
+        return hr;
+
+    } // Test
+
+
+    //------------------------------------------------------------------------------
+    // Time finding a value in a map of 10000 names with a directory, against
+    // looking through the names and against reading the whole map.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Benchmark()
+    {
+        ULONG const         iterations = 1000;
+        CComVariant         map;
+        CVariantView        view;
+        CVariantView        plainView;
+        CVariantView        element;
+        CBenchmarkTimer     timer;
+        ULONG               time;
+        BLOB                blob;
+        BLOB                plain;
+        HRESULT             hr = S_OK;
+
+        HR( GetMap( 10000, map ) );
+        WriteVariantMapToBlob( map, blob );
+        WriteVariantToBlob( map, plain );
+
+        view.Open( blob );
+        plainView.Open( plain );
+
+        timer.Start();
+        for( ULONG i = 0; i < iterations; ++i )
+        {
+            if ( !view.Find( L"name 9000", element ) )
+                hr = E_UNEXPECTED;
+        }
+        time = timer.ElapsedMicroseconds();
+        ReportBenchmark( "find in map of 10000", iterations, time );
+
+        timer.Start();
+        for( ULONG j = 0; j < iterations; ++j )
+        {
+            if ( !plainView.Find( L"name 9000", element ) )
+                hr = E_UNEXPECTED;
+        }
+        time = timer.ElapsedMicroseconds();
+        ReportBenchmark( "find in map of 10000 without a directory", iterations, time );
+
+        timer.Start();
+        for( ULONG k = 0; k < iterations / 100; ++k )
+        {
+            CComVariant     copy;
+
+            ReadVariantFromBlob( plain, copy );
+        }
+        time = timer.ElapsedMicroseconds();
+        ReportBenchmark( "read map of 10000", iterations / 100, time );
+
+        ::CoTaskMemFree( blob.pBlobData );
+        ::CoTaskMemFree( plain.pBlobData );
+
+        return hr;
+
+    } // Benchmark
+
+
+}; // class CMapTest
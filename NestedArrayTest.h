@@ -0,0 +1,241 @@
+#pragma once
+
+#include "StreamSupport.h"
+#include "Benchmark.h"
+
+class CNestedArrayTest
+{
+public:
+
+    //------------------------------------------------------------------------------
+    // Creates a chain of arrays of variants, depth arrays deep.  Each array
+    // holds its depth followed by the next array in, and the innermost holds
+    // its depth followed by an empty variant.
+    //------------------------------------------------------------------------------
+
+    static HRESULT GetNestedArrays( ULONG depth, VARIANT& variant )
+    {
+        CComVariant     inner;
+
+        for( ULONG level = depth; level > 0; --level )
+        {
+            CComVector<VARIANT>     a( 2 );
+            CComVectorData<VARIANT> rg( a );
+            if ( !rg )
+                HR( E_UNEXPECTED );
+
+            rg[0].vt = VT_I4;
+            rg[0].lVal = level;
+            HR( inner.Detach( &rg[1] ) );
+
+            inner.vt = VT_VARIANT | VT_ARRAY;
+            inner.parray = a.Detach();
+        }
+
+        return inner.Detach( &variant );
+
+    } // GetNestedArrays
+
+
+    //------------------------------------------------------------------------------
+    // Verifies a chain of arrays created by GetNestedArrays.
+    //------------------------------------------------------------------------------
+
+    static HRESULT VerifyNestedArrays( ULONG depth, const VARIANT& variant )
+    {
+        const VARIANT*  current = &variant;
+
+        for( ULONG level = 1; level <= depth; ++level )
+        {
+            VARIANT*    elements;
+
+            if ( current->vt != ( VT_VARIANT | VT_ARRAY ) || current->parray->rgsabound[0].cElements != 2 )
+                HR( E_UNEXPECTED );
+
+            elements = (VARIANT*)current->parray->pvData;
+            if ( elements[0].vt != VT_I4 || elements[0].lVal != (long)level )
+                HR( E_UNEXPECTED );
+
+            current = &elements[1];
+        }
+
+        if ( current->vt != VT_EMPTY )
+            HR( E_UNEXPECTED );
+
+        return S_OK;
+
+    } // VerifyNestedArrays
+
+
+    //------------------------------------------------------------------------------
+    // Creates an array of count arrays of variants, each holding a string, a
+    // double and an array of longs.
+    //------------------------------------------------------------------------------
+
+    static HRESULT GetJaggedArrays( ULONG count, VARIANT& variant )
+    {
+        CComVector<VARIANT>     outer( count );
+        CComVectorData<VARIANT> rgOuter( outer );
+        if ( !rgOuter )
+            HR( E_UNEXPECTED );
+
+        for( ULONG i = 0; i < count; ++i )
+        {
+            CComVector<VARIANT>     row( 3 );
+            CComVectorData<VARIANT> rgRow( row );
+            CComVector<long>        numbers( 8 );
+            if ( !rgRow )
+                HR( E_UNEXPECTED );
+
+            rgRow[0].vt = VT_BSTR;
+            rgRow[0].bstrVal = ::SysAllocString( L"jagged" );
+            rgRow[1].vt = VT_R8;
+            rgRow[1].dblVal = i;
+            rgRow[2].vt = VT_I4 | VT_ARRAY;
+            rgRow[2].parray = numbers.Detach();
+
+            rgOuter[i].vt = VT_VARIANT | VT_ARRAY;
+            rgOuter[i].parray = row.Detach();
+        }
+
+        variant.vt = VT_VARIANT | VT_ARRAY;
+        variant.parray = outer.Detach();
+
+        return S_OK;
+
+    } // GetJaggedArrays
+
+
+    //------------------------------------------------------------------------------
+    // Writes the variant out using the given depth limit, returning the
+    // failure rather than raising it.
+    //------------------------------------------------------------------------------
+
+    static HRESULT TryWrite( VARIANT* variant, IStream* pStream, ULONG maxDepth )
+    {
+        HRESULT     hr = S_OK;
+
+        TryStreamCall( WriteVariantToStream( variant, pStream, maxDepth ), hr );
+
+        return hr;
+
+    } // TryWrite
+
+
+    //------------------------------------------------------------------------------
+    // Reads a variant using the given depth limit, returning the failure
+    // rather than raising it.
+    //------------------------------------------------------------------------------
+
+    static HRESULT TryRead( IStream* pStream, VARIANT& variant, ULONG maxDepth )
+    {
+        HRESULT     hr = S_OK;
+
+        TryStreamCall( ReadVariantFromStream( pStream, variant, maxDepth ), hr );
+
+        return hr;
+
+    } // TryRead
+
+
+    //------------------------------------------------------------------------------
+    // Test arrays nested far deeper than recursion would allow, and the depth
+    // limit.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Test()
+    {
+        ULONG const         depth = 10000;
+        CComVariant         v1;
+        CComVariant         v2;
+        CComVariant         refused;
+        CComPtr<IStream>    pStream;
+
+        HR( GetNestedArrays( depth, v1 ) );
+
+        // Create a memory stream.
+        HR( CreateMemoryStream( &pStream ) );
+
+        // The default depth limit should refuse the chain, saying why.
+        if ( HRESULT_FROM_WIN32( ERROR_STACK_OVERFLOW ) != TryWrite( &v1, pStream, VariantStreaming::defaultMaxDepth ) )
+            HR( E_UNEXPECTED );
+
+        // Write out the variant to the stream, rewind the stream and read it back into another variant.
+        HR( RewindStream( pStream ) );
+        WriteVariantToStream( &v1, pStream, depth );
+        HR( RewindStream( pStream ) );
+        ReadVariantFromStream( pStream, v2, depth );
+
+        // Reading it back with the default limit should be refused too.
+        HR( RewindStream( pStream ) );
+        if ( HRESULT_FROM_WIN32( ERROR_STACK_OVERFLOW ) != TryRead( pStream, refused, VariantStreaming::defaultMaxDepth ) )
+            HR( E_UNEXPECTED );
+
+        HR( VerifyNestedArrays( depth, v2 ) );
+
+        return S_OK;
+
+    } // Test
+
+
+    //------------------------------------------------------------------------------
+    // Time writing and reading deeply nested and jagged arrays.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Benchmark()
+    {
+        ULONG const         iterations = 100;
+        CComVariant         nested;
+        CComVariant         jagged;
+
+        HR( GetNestedArrays( 1000, nested ) );
+        HR( GetJaggedArrays( 10000, jagged ) );
+
+        HR( BenchmarkVariant( "nested 1000 deep", nested, 1000, iterations ) );
+        HR( BenchmarkVariant( "jagged 10000 x 3", jagged, VariantStreaming::defaultMaxDepth, iterations ) );
+
+        return S_OK;
+
+    } // Benchmark
+
+
+    //------------------------------------------------------------------------------
+    // Times writing and reading the variant the given number of times.
+    //------------------------------------------------------------------------------
+
+    static HRESULT BenchmarkVariant( LPCSTR name, VARIANT& variant, ULONG maxDepth, ULONG iterations )
+    {
+        CComPtr<IStream>    pStream;
+        CBenchmarkTimer     timer;
+        ULONG               writeTime = 0;
+        ULONG               readTime = 0;
+        char                label[128];
+
+        HR( CreateMemoryStream( &pStream ) );
+
+        for( ULONG i = 0; i < iterations; ++i )
+        {
+            CComVariant     copy;
+
+            HR( RewindStream( pStream ) );
+            timer.Start();
+            WriteVariantToStream( &variant, pStream, maxDepth );
+            writeTime += timer.ElapsedMicroseconds();
+
+            HR( RewindStream( pStream ) );
+            timer.Start();
+            ReadVariantFromStream( pStream, copy, maxDepth );
+            readTime += timer.ElapsedMicroseconds();
+        }
+
+        ::wsprintfA( label, "write %s", name );
+        ReportBenchmark( label, iterations, writeTime );
+        ::wsprintfA( label, "read %s", name );
+        ReportBenchmark( label, iterations, readTime );
+
+        return S_OK;
+
+    } // BenchmarkVariant
+
+
+}; // class CNestedArrayTest
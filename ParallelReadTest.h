@@ -0,0 +1,230 @@
+#pragma once
+
+#include "StreamSupport.h"
+#include "Benchmark.h"
+
+class CParallelReadTest
+{
+public:
+
+    //------------------------------------------------------------------------------
+    // Creates a 60 x 7 array of variants holding longs, strings of varying
+    // length and small arrays of longs and of strings.
+    //------------------------------------------------------------------------------
+
+    static HRESULT GetMixedArray( VARIANT& variant )
+    {
+        SAFEARRAYBOUND      bounds[2] = { { 60, 1 }, { 7, -3 } };
+        VARIANT*            rg;
+
+        variant.parray = SafeArrayCreate( VT_VARIANT, 2, bounds );
+        if ( !variant.parray )
+            HR( E_OUTOFMEMORY );
+        variant.vt = VT_VARIANT | VT_ARRAY;
+
+        HR( SafeArrayAccessData( variant.parray, (void**)&rg ) );
+
+        for( ULONG i = 0; i < 420; ++i )
+        {
+            WCHAR   text[32];
+
+            switch ( i % 4 )
+            {
+            case 0:
+                rg[i].vt = VT_I4;
+                rg[i].lVal = i;
+                break;
+
+            case 1:
+                ::wsprintfW( text, L"element %lu", i * i );
+                rg[i].vt = VT_BSTR;
+                rg[i].bstrVal = ::SysAllocString( text );
+                break;
+
+            case 2:
+                rg[i].vt = VT_I4 | VT_ARRAY;
+                rg[i].parray = SafeArrayCreateVector( VT_I4, 0, i % 5 );
+                break;
+
+            default:
+                rg[i].vt = VT_BSTR | VT_ARRAY;
+                rg[i].parray = SafeArrayCreateVector( VT_BSTR, 0, 2 );
+                if ( rg[i].parray )
+                    ( (BSTR*)rg[i].parray->pvData )[1] = ::SysAllocString( L"inner" );
+                break;
+            }
+        }
+
+        HR( SafeArrayUnaccessData( variant.parray ) );
+
+        return S_OK;
+
+    } // GetMixedArray
+
+
+    //------------------------------------------------------------------------------
+    // Reads the variant from memory in parallel, reporting failure rather than
+    // raising it.
+    //------------------------------------------------------------------------------
+
+    static HRESULT TryRead( const BLOB& blob, VARIANT& variant )
+    {
+        HRESULT     hr = S_OK;
+
+        TryStreamCall( ReadVariantFromMemoryInParallel( blob.pBlobData, blob.cbSize, variant, 4 ), hr );
+
+        return hr;
+
+    } // TryRead
+
+
+    //------------------------------------------------------------------------------
+    // Test reading chunked arrays on several threads.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Test()
+    {
+        CComVariant         mixed;
+        CComVariant         doubles;
+        CComVariant         v1;
+        CComVariant         v2;
+        CComVariant         v3;
+        CComVariant         rejected;
+        CVariantView        view;
+        CVariantView        element;
+        VARIANT             value;
+        BLOB                blob;
+        BLOB                plain;
+        HRESULT             hr = S_OK;
+
+        HR( GetMixedArray( mixed ) );
+
+        // 420 elements in chunks of 16, the last one short, read on three
+        // threads, and read back by the readers that skip the chunk table.
+        WriteChunkedVariantToBlob( mixed, blob, 16 );
+        WriteVariantToBlob( mixed, plain );
+
+        if ( blob.cbSize != plain.cbSize + 2 * sizeof( ULONG ) + 27 * sizeof( ULONGLONG ) )
+            hr = E_UNEXPECTED;
+
+        ReadVariantFromMemoryInParallel( blob.pBlobData, blob.cbSize, v1, 3 );
+        ReadVariantFromBlob( blob, v2 );
+
+        if ( FAILED( VerifySame( mixed, v1 ) ) || FAILED( VerifySame( mixed, v2 ) ) )
+            hr = E_UNEXPECTED;
+
+        // Element 28 in streamed order is element 4 in memory.
+        view.Open( blob );
+        view.GetElement( 28, element );
+        element.GetValue( value );
+        if ( value.vt != VT_I4 || value.lVal != 4 )
+            hr = E_UNEXPECTED;
+
+        // Damage the second chunk's offset, so it no longer ends where the
+        // third starts.
+        ( (ULONGLONG UNALIGNED*)( blob.pBlobData + sizeof( long ) + 2 * sizeof( ULONG ) ) )[1] += 2;
+        if ( E_FAIL != TryRead( blob, rejected ) )
+            hr = E_UNEXPECTED;
+
+        ::CoTaskMemFree( blob.pBlobData );
+        ::CoTaskMemFree( plain.pBlobData );
+
+        // Arrays of fixed size types aren't chunked, and are read on the
+        // calling thread.
+        doubles.vt = VT_R8 | VT_ARRAY;
+        doubles.parray = SafeArrayCreateVector( VT_R8, 0, 1000 );
+        if ( !doubles.parray )
+            HR( E_OUTOFMEMORY );
+
+        WriteChunkedVariantToBlob( doubles, blob, 16 );
+        WriteVariantToBlob( doubles, plain );
+
+        if ( blob.cbSize != plain.cbSize )
+            hr = E_UNEXPECTED;
+
+        ReadVariantFromMemoryInParallel( blob.pBlobData, blob.cbSize, v3 );
+        if ( FAILED( VerifySame( doubles, v3 ) ) )
+            hr = E_UNEXPECTED;
+
+        ::CoTaskMemFree( blob.pBlobData );
+        ::CoTaskMemFree( plain.pBlobData );
+
+        return hr;
+
+    } // Test
+
+
+    //------------------------------------------------------------------------------
+    // Time reading a million strings on one thread and in parallel, on 1, 2,
+    // 4 and so on threads up to at least one per processor, and report how
+    // each scales against one thread.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Benchmark()
+    {
+        ULONG const             count = 1000000;
+        ULONG const             iterations = 5;
+        CComVariant             strings;
+        CComVector<BSTR>        a( count );
+        CComVectorData<BSTR>    rg( a );
+        CBenchmarkTimer         timer;
+        ULONG                   time;
+        ULONG                   oneThread = 0;
+        ULONG                   maxThreads = GetProcessorCount();
+        BLOB                    blob;
+        char                    label[128];
+        if ( !rg )
+            HR( E_UNEXPECTED );
+
+        for( ULONG i = 0; i < count; ++i )
+            rg[i] = ::SysAllocString( L"a string of some length" );
+
+        strings.vt = VT_BSTR | VT_ARRAY;
+        strings.parray = a.Detach();
+
+        WriteChunkedVariantToBlob( strings, blob, 16384 );
+
+        time = 0;
+        for( ULONG j = 0; j < iterations; ++j )
+        {
+            CComVariant     copy;
+
+            timer.Start();
+            ReadVariantFromBlob( blob, copy );
+            time += timer.ElapsedMicroseconds();
+        }
+        ReportBenchmark( "read 1000000 strings", iterations, time );
+
+        if ( maxThreads < 8 )
+            maxThreads = 8;
+        for( ULONG threads = 1; threads < maxThreads * 2; threads *= 2 )
+        {
+            if ( threads > maxThreads )
+                threads = maxThreads;
+
+            time = 0;
+            for( ULONG k = 0; k < iterations; ++k )
+            {
+                CComVariant     copy;
+
+                timer.Start();
+                ReadVariantFromMemoryInParallel( blob.pBlobData, blob.cbSize, copy, threads );
+                time += timer.ElapsedMicroseconds();
+            }
+
+            ::wsprintfA( label, "read 1000000 strings on %lu threads", threads );
+            ReportBenchmark( label, iterations, time );
+
+            if ( 1 == threads )
+                oneThread = time;
+            ReportScaling( "read 1000000 strings", threads, oneThread, time );
+        }
+
+        ::CoTaskMemFree( blob.pBlobData );
+
+        return S_OK;
+
+    } // Benchmark
+
+
+}; // class CParallelReadTest
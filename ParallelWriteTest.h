@@ -0,0 +1,177 @@
+#pragma once
+
+#include "StreamSupport.h"
+#include "Benchmark.h"
+#include "ParallelReadTest.h"
+
+class CParallelWriteTest
+{
+public:
+
+    //------------------------------------------------------------------------------
+    // Writes the variant in chunks both on one thread and on several, and
+    // verifies that both wrote the same bytes and that they read back.
+    //------------------------------------------------------------------------------
+
+    static HRESULT VerifyParallelWrite( VARIANT& variant, ULONG chunkElements )
+    {
+        CComPtr<IStream>    pStream1;
+        CComPtr<IStream>    pStream2;
+        CComVariant         copy;
+        BLOB                blob1;
+        BLOB                blob2;
+        HRESULT             hr = S_OK;
+
+        HR( CreateMemoryStream( &pStream1 ) );
+        HR( CreateMemoryStream( &pStream2 ) );
+
+        WriteChunkedVariantToStream( &variant, pStream1, chunkElements );
+        WriteVariantToStreamInParallel( &variant, pStream2, chunkElements, 3 );
+
+        StreamToTaskMemory( pStream1, blob1 );
+        StreamToTaskMemory( pStream2, blob2 );
+
+        if ( blob1.cbSize != blob2.cbSize || 0 != memcmp( blob1.pBlobData, blob2.pBlobData, blob1.cbSize ) )
+            hr = E_UNEXPECTED;
+
+        ::CoTaskMemFree( blob1.pBlobData );
+        ::CoTaskMemFree( blob2.pBlobData );
+        HR( hr );
+
+        HR( RewindStream( pStream2 ) );
+        ReadVariantFromStream( pStream2, copy );
+
+        return VerifySame( variant, copy );
+
+    } // VerifyParallelWrite
+
+
+    //------------------------------------------------------------------------------
+    // Test writing arrays in chunks on several threads.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Test()
+    {
+        CComVariant         mixed;
+        CComVariant         doubles;
+        CComVariant         number = 7L;
+
+        HR( CParallelReadTest::GetMixedArray( mixed ) );
+
+        doubles.vt = VT_R8 | VT_ARRAY;
+        doubles.parray = SafeArrayCreateVector( VT_R8, 0, 100 );
+        if ( !doubles.parray )
+            HR( E_OUTOFMEMORY );
+
+        // Chunks of 16 and of 1, and what isn't chunked at all: one chunk,
+        // an array of doubles and a plain value.
+        HR( VerifyParallelWrite( mixed, 16 ) );
+        HR( VerifyParallelWrite( mixed, 1 ) );
+        HR( VerifyParallelWrite( mixed, 1000 ) );
+        HR( VerifyParallelWrite( doubles, 16 ) );
+        HR( VerifyParallelWrite( number, 16 ) );
+
+        return S_OK;
+
+    } // Test
+
+
+    //------------------------------------------------------------------------------
+    // Time writing a million variants, alternately strings and doubles, on
+    // one thread and in parallel, on 1, 2, 4 and so on threads up to at least
+    // one per processor, and report how each scales against one thread.
+    // The sizing pass the parallel writer makes first is timed on its own,
+    // being the part that doesn't get faster with more threads.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Benchmark()
+    {
+        ULONG const                 count = 1000000;
+        ULONG const                 iterations = 5;
+        CComVariant                 variants;
+        CComVector<VARIANT>         a( count );
+        CComVectorData<VARIANT>     rg( a );
+        CBenchmarkTimer             timer;
+        ULONG                       time;
+        ULONG                       oneThread = 0;
+        ULONG                       maxThreads = GetProcessorCount();
+        char                        label[128];
+        if ( !rg )
+            HR( E_UNEXPECTED );
+
+        for( ULONG i = 0; i < count; ++i )
+        {
+            if ( i % 2 )
+            {
+                rg[i].vt = VT_R8;
+                rg[i].dblVal = i;
+            }
+            else
+            {
+                rg[i].vt = VT_BSTR;
+                rg[i].bstrVal = ::SysAllocString( L"a string of some length" );
+            }
+        }
+
+        variants.vt = VT_VARIANT | VT_ARRAY;
+        variants.parray = a.Detach();
+
+        time = 0;
+        for( ULONG j = 0; j < iterations; ++j )
+        {
+            CComPtr<IStream>    pStream;
+
+            HR( CreateMemoryStream( &pStream ) );
+            timer.Start();
+            WriteVariantToStream( &variants, pStream );
+            time += timer.ElapsedMicroseconds();
+        }
+        ReportBenchmark( "write 1000000 variants", iterations, time );
+
+        time = 0;
+        for( ULONG m = 0; m < iterations; ++m )
+        {
+            VariantStreaming::CTaskMemory   offsets( ( count / 16384 + 2 ) * sizeof( ULONGLONG ) );
+
+            timer.Start();
+            VariantStreaming::GetChunkOffsets( variants.parray,
+                                               VT_VARIANT,
+                                               16384,
+                                               (ULONGLONG*)(BYTE*)offsets,
+                                               VariantStreaming::defaultMaxDepth );
+            time += timer.ElapsedMicroseconds();
+        }
+        ReportBenchmark( "size 1000000 variants in 16384 element chunks", iterations, time );
+
+        if ( maxThreads < 8 )
+            maxThreads = 8;
+        for( ULONG threads = 1; threads < maxThreads * 2; threads *= 2 )
+        {
+            if ( threads > maxThreads )
+                threads = maxThreads;
+
+            time = 0;
+            for( ULONG k = 0; k < iterations; ++k )
+            {
+                CComPtr<IStream>    pStream;
+
+                HR( CreateMemoryStream( &pStream ) );
+                timer.Start();
+                WriteVariantToStreamInParallel( &variants, pStream, 16384, threads );
+                time += timer.ElapsedMicroseconds();
+            }
+
+            ::wsprintfA( label, "write 1000000 variants on %lu threads", threads );
+            ReportBenchmark( label, iterations, time );
+
+            if ( 1 == threads )
+                oneThread = time;
+            ReportScaling( "write 1000000 variants", threads, oneThread, time );
+        }
+
+        return S_OK;
+
+    } // Benchmark
+
+
+}; // class CParallelWriteTest
@@ -0,0 +1,195 @@
+#pragma once
+
+#include "StreamSupport.h"
+#include "ParallelReadTest.h"
+
+
+//==============================================================================
+// CFragmentingSource
+// Stands in for a non-blocking socket.  Hands out the bytes of a blob a
+// random number of them at a time, none at all now and then, as if they were
+// arriving in packets.
+//==============================================================================
+
+class CFragmentingSource
+{
+public:
+    CFragmentingSource( const BLOB& blob, ULONG seed )
+        :   m_data( blob.pBlobData ),
+            m_size( blob.cbSize ),
+            m_position( 0 ),
+            m_seed( seed )
+    {
+    }
+
+    // Copies up to size bytes into the buffer and returns how many.
+    ULONG Receive( BYTE* buffer, ULONG size )
+    {
+        ULONG   count;
+
+        m_seed = m_seed * 1103515245 + 12345;
+        count = ( m_seed >> 16 ) % ( size + 1 );
+
+        if ( count > m_size - m_position )
+            count = m_size - m_position;
+
+        ::CopyMemory( buffer, m_data + m_position, count );
+        m_position += count;
+
+        return count;
+    }
+
+    inline bool IsEnd()
+    {
+        return m_position == m_size;
+    }
+
+private:
+    const BYTE*         m_data;
+    ULONG               m_size;
+    ULONG               m_position;
+    ULONG               m_seed;
+
+}; // class CFragmentingSource
+
+
+class CPushReaderTest
+{
+public:
+
+    //------------------------------------------------------------------------------
+    // Pushes the bytes to the reader, reporting failure rather than raising
+    // it.
+    //------------------------------------------------------------------------------
+
+    static HRESULT TryPush( CVariantPushReader& reader, const BYTE* data, ULONG size )
+    {
+        HRESULT     hr = S_OK;
+
+        TryStreamCall( reader.Push( data, size ), hr );
+
+        return hr;
+
+    } // TryPush
+
+
+    //------------------------------------------------------------------------------
+    // Receives the variants, written one after another, from a source that
+    // breaks them up at random, and checks each against what was written.
+    //------------------------------------------------------------------------------
+
+    static HRESULT VerifyFragmented( const BLOB& blob, VARIANT* expected, ULONG count, ULONG bufferSize, ULONG seed )
+    {
+        CFragmentingSource  source( blob, seed );
+        CVariantPushReader  reader;
+        CComVariant         variant;
+        BYTE                buffer[64];
+        ULONG               done = 0;
+
+        while ( !source.IsEnd() )
+        {
+            ULONG   received = source.Receive( buffer, bufferSize );
+
+            for ( ULONG used = 0; used < received; )
+            {
+                used += reader.Push( buffer + used, received - used );
+
+                if ( reader.IsComplete() )
+                {
+                    reader.Detach( variant );
+                    if ( done == count )
+                        HR( E_UNEXPECTED );
+                    HR( VerifySame( expected[done++], variant ) );
+                }
+            }
+        }
+
+        if ( done != count )
+            HR( E_UNEXPECTED );
+
+        return S_OK;
+
+    } // VerifyFragmented
+
+
+    //------------------------------------------------------------------------------
+    // Test reading variants from bytes that arrive in pieces.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Test()
+    {
+        SAFEARRAYBOUND      bounds[2] = { { 3, 1 }, { 5, -2 } };
+        CComVariant         values[7];
+        CComPtr<IStream>    pStream;
+        CComVariant         variant;
+        CVariantPushReader  reader;
+        BLOB                blob;
+        BLOB                chunked;
+        HRESULT             hr = S_OK;
+
+        // An array of variants holding strings and nested arrays, the same
+        // array in chunks, a two dimensional array of doubles whose elements
+        // aren't streamed in memory order, and plain values.
+        HR( CParallelReadTest::GetMixedArray( values[0] ) );
+        HR( CParallelReadTest::GetMixedArray( values[1] ) );
+
+        values[2].parray = SafeArrayCreate( VT_R8, 2, bounds );
+        if ( !values[2].parray )
+            HR( E_OUTOFMEMORY );
+        values[2].vt = VT_R8 | VT_ARRAY;
+        for( ULONG i = 0; i < 15; ++i )
+            ( (double*)values[2].parray->pvData )[i] = i * 0.5;
+
+        values[3] = L"a string";
+        values[4] = L"";
+        values[5] = 42L;
+
+        HR( CreateMemoryStream( &pStream ) );
+        for( ULONG j = 0; j < 7; ++j )
+        {
+            if ( 1 == j )
+                WriteChunkedVariantToStream( &values[j], pStream, 50 );
+            else
+                WriteVariantToStream( &values[j], pStream );
+        }
+        StreamToTaskMemory( pStream, blob );
+
+        // From a byte at a time to a buffer full, with and without empty
+        // reads in between.
+        if ( FAILED( VerifyFragmented( blob, values, 7, 1, 1 ) ) ||
+             FAILED( VerifyFragmented( blob, values, 7, 7, 2 ) ) ||
+             FAILED( VerifyFragmented( blob, values, 7, 64, 3 ) ) )
+            hr = E_UNEXPECTED;
+
+        ::CoTaskMemFree( blob.pBlobData );
+        HR( hr );
+
+        // A variant cut short is never complete, and the reader can be reset
+        // to start over.
+        WriteChunkedVariantToBlob( values[0], chunked, 50 );
+
+        if ( reader.Push( chunked.pBlobData, chunked.cbSize - 1 ) != chunked.cbSize - 1 || reader.IsComplete() )
+            hr = E_UNEXPECTED;
+
+        reader.Reset();
+        if ( reader.Push( chunked.pBlobData, chunked.cbSize ) != chunked.cbSize || !reader.IsComplete() )
+            hr = E_UNEXPECTED;
+
+        reader.Detach( variant );
+        if ( FAILED( VerifySame( values[0], variant ) ) )
+            hr = E_UNEXPECTED;
+
+        // An unknown type, in place of the array type after the nine chunk
+        // offsets, fails.
+        ( (VARTYPE UNALIGNED*)( chunked.pBlobData + sizeof( long ) + 2 * sizeof( ULONG ) + 9 * sizeof( ULONGLONG ) ) )[0] = 0x7F;
+        if ( DISP_E_TYPEMISMATCH != TryPush( reader, chunked.pBlobData, chunked.cbSize ) )
+            hr = E_UNEXPECTED;
+
+        ::CoTaskMemFree( chunked.pBlobData );
+
+        return hr;
+
+    } // Test
+
+
+}; // class CPushReaderTest
@@ -0,0 +1,156 @@
+#pragma once
+
+#include "StreamSupport.h"
+#include "Benchmark.h"
+#include "ParallelReadTest.h"
+#include "StringArenaTest.h"
+
+class CReadIntoTest
+{
+public:
+
+    //------------------------------------------------------------------------------
+    // Creates a rows x columns array of doubles, both dimensions from 1,
+    // each value its index plus start.
+    //------------------------------------------------------------------------------
+
+    static HRESULT GetGrid( ULONG rows, ULONG columns, double start, VARIANT& variant )
+    {
+        SAFEARRAYBOUND      bounds[2] = { { rows, 1 }, { columns, 1 } };
+
+        variant.vt = VT_R8 | VT_ARRAY;
+        variant.parray = SafeArrayCreate( VT_R8, 2, bounds );
+        if ( !variant.parray )
+            HR( E_OUTOFMEMORY );
+
+        for ( ULONG i = 0; i < rows * columns; i++ )
+            ( (double*)variant.parray->pvData )[i] = start + i;
+
+        return S_OK;
+
+    } // GetGrid
+
+
+    //------------------------------------------------------------------------------
+    // Test reading arrays into arrays of the same shape, and into variants
+    // that aren't.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Test()
+    {
+        CComVariant         grid;
+        CComVariant         other;
+        CComVariant         wider;
+        CComVariant         strings;
+        CComVariant         fewer;
+        CComVariant         mixed;
+        CComVariant         number = 42L;
+        CComVariant         target;
+        CComPtr<IStream>    pStream;
+        SAFEARRAY*          kept;
+        BLOB                blob;
+        HRESULT             hr = S_OK;
+
+        HR( GetGrid( 30, 20, 0, grid ) );
+        HR( GetGrid( 30, 20, 1000, other ) );
+        HR( GetGrid( 20, 30, 0, wider ) );
+        HR( CStringArenaTest::GetStrings( 100, strings ) );
+        HR( CStringArenaTest::GetStrings( 50, fewer ) );
+        HR( CParallelReadTest::GetMixedArray( mixed ) );
+
+        // Into an empty variant, then into the same array again.
+        WriteVariantToBlob( grid, blob );
+        ReadVariantInto( blob, target );
+        ::CoTaskMemFree( blob.pBlobData );
+        if ( FAILED( VerifySame( grid, target ) ) )
+            hr = E_UNEXPECTED;
+        kept = target.parray;
+
+        WriteVariantToBlob( other, blob );
+        ReadVariantInto( blob, target );
+        ::CoTaskMemFree( blob.pBlobData );
+        if ( target.parray != kept || FAILED( VerifySame( other, target ) ) )
+            hr = E_UNEXPECTED;
+
+        // The same number of elements in another shape is a new array.
+        WriteVariantToBlob( wider, blob );
+        ReadVariantInto( blob, target );
+        ::CoTaskMemFree( blob.pBlobData );
+        if ( FAILED( VerifySame( wider, target ) ) )
+            hr = E_UNEXPECTED;
+
+        // Strings and variants overwrite what the elements held.
+        HR( CreateMemoryStream( &pStream ) );
+        WriteVariantToStream( &strings, pStream );
+        WriteVariantToStream( &strings, pStream );
+        WriteVariantToStream( &fewer, pStream );
+        WriteVariantToStream( &mixed, pStream );
+        WriteVariantToStream( &mixed, pStream );
+        WriteVariantToStream( &number, pStream );
+        HR( RewindStream( pStream ) );
+
+        ReadVariantInto( pStream, target );
+        kept = target.parray;
+        ReadVariantInto( pStream, target );
+        if ( target.parray != kept || FAILED( VerifySame( strings, target ) ) )
+            hr = E_UNEXPECTED;
+        ReadVariantInto( pStream, target );
+        if ( FAILED( VerifySame( fewer, target ) ) )
+            hr = E_UNEXPECTED;
+
+        ReadVariantInto( pStream, target );
+        kept = target.parray;
+        ReadVariantInto( pStream, target );
+        if ( target.parray != kept || FAILED( VerifySame( mixed, target ) ) )
+            hr = E_UNEXPECTED;
+
+        ReadVariantInto( pStream, target );
+        if ( FAILED( VerifySame( number, target ) ) )
+            hr = E_UNEXPECTED;
+
+        return hr;
+
+    } // Test
+
+
+    //------------------------------------------------------------------------------
+    // Time reading a 1000 element array of doubles 100000 times into a new
+    // variant each time, and into the same one.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Benchmark()
+    {
+        ULONG const         iterations = 100000;
+        CComVariant         grid;
+        CComVariant         target;
+        CBenchmarkTimer     timer;
+        ULONG               time;
+        BLOB                blob;
+
+        HR( GetGrid( 10, 100, 0, grid ) );
+        WriteVariantToBlob( grid, blob );
+
+        timer.Start();
+        for( ULONG i = 0; i < iterations; ++i )
+        {
+            CComVariant     copy;
+
+            ReadVariantFromBlob( blob, copy );
+        }
+        time = timer.ElapsedMicroseconds();
+        ReportBenchmark( "read a 10 x 100 array into a new variant", iterations, time );
+
+        timer.Start();
+        for( ULONG j = 0; j < iterations; ++j )
+            ReadVariantInto( blob, target );
+        time = timer.ElapsedMicroseconds();
+        ReportBenchmark( "read a 10 x 100 array into the same array", iterations, time );
+
+        ::CoTaskMemFree( blob.pBlobData );
+
+        return S_OK;
+
+    } // Benchmark
+
+
+}; // class CReadIntoTest
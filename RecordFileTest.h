@@ -0,0 +1,346 @@
+#pragma once
+
+#include "StreamSupport.h"
+#include "Benchmark.h"
+
+class CRecordFileTest
+{
+public:
+
+    //------------------------------------------------------------------------------
+    // Makes the given record: a number, a string or a small array of longs,
+    // by turns.
+    //------------------------------------------------------------------------------
+
+    static HRESULT GetRecord( ULONG record, VARIANT& variant )
+    {
+        WCHAR   text[32];
+
+        switch ( record % 3 )
+        {
+        case 0:
+            variant.vt = VT_I4;
+            variant.lVal = record;
+            break;
+
+        case 1:
+            ::wsprintfW( text, L"record %lu", record );
+            variant.bstrVal = ::SysAllocString( text );
+            if ( !variant.bstrVal )
+                HR( E_OUTOFMEMORY );
+            variant.vt = VT_BSTR;
+            break;
+
+        default:
+            variant.parray = SafeArrayCreateVector( VT_I4, 0, record % 5 );
+            if ( !variant.parray )
+                HR( E_OUTOFMEMORY );
+            variant.vt = VT_I4 | VT_ARRAY;
+            break;
+        }
+
+        return S_OK;
+
+    } // GetRecord
+
+
+    //------------------------------------------------------------------------------
+    // Writes count records to the stream, keyed or not.
+    //------------------------------------------------------------------------------
+
+    static HRESULT WriteRecords( IStream* pStream, ULONG count, bool isKeyed )
+    {
+        CVariantRecordWriter    writer( pStream );
+
+        writer.Begin();
+
+        for( ULONG record = 0; record < count; ++record )
+        {
+            CComVariant     variant;
+            WCHAR           key[32];
+
+            HR( GetRecord( record, variant ) );
+            ::wsprintfW( key, L"key %lu", record );
+            writer.Write( variant, isKeyed ? key : NULL );
+        }
+
+        writer.End();
+
+        return S_OK;
+
+    } // WriteRecords
+
+
+    //------------------------------------------------------------------------------
+    // Verifies that the reader reads back the given record.
+    //------------------------------------------------------------------------------
+
+    static HRESULT VerifyRecord( CVariantRecordReader& reader, ULONG record )
+    {
+        CComVariant     expected;
+        CComVariant     variant;
+
+        HR( GetRecord( record, expected ) );
+        reader.Read( record, variant );
+
+        return VerifySame( expected, variant );
+
+    } // VerifyRecord
+
+
+    //------------------------------------------------------------------------------
+    // Opens the reader, reporting failure rather than raising it.
+    //------------------------------------------------------------------------------
+
+    static HRESULT TryOpen( CVariantRecordReader& reader )
+    {
+        HRESULT     hr = S_OK;
+
+        TryStreamCall( reader.Open(), hr );
+
+        return hr;
+
+    } // TryOpen
+
+
+    //------------------------------------------------------------------------------
+    // Reads a record, reporting failure rather than raising it.
+    //------------------------------------------------------------------------------
+
+    static HRESULT TryRead( CVariantRecordReader& reader, ULONG record, VARIANT& variant )
+    {
+        HRESULT     hr = S_OK;
+
+        TryStreamCall( reader.Read( record, variant ), hr );
+
+        return hr;
+
+    } // TryRead
+
+
+    //------------------------------------------------------------------------------
+    // Writes a record, reporting failure rather than raising it.
+    //------------------------------------------------------------------------------
+
+    static HRESULT TryWrite( CVariantRecordWriter& writer, const VARIANT& variant, LPCWSTR key )
+    {
+        HRESULT     hr = S_OK;
+
+        TryStreamCall( writer.Write( variant, key ), hr );
+
+        return hr;
+
+    } // TryWrite
+
+
+    //------------------------------------------------------------------------------
+    // Makes an array of variants holding an array of variants holding an array
+    // of longs, three arrays deep.
+    //------------------------------------------------------------------------------
+
+    static HRESULT GetNested( VARIANT& variant )
+    {
+        CComVariant     inner;
+        CComVariant     middle;
+        long            index = 0;
+
+        inner.parray = SafeArrayCreateVector( VT_I4, 0, 4 );
+        middle.parray = SafeArrayCreateVector( VT_VARIANT, 0, 1 );
+        variant.parray = SafeArrayCreateVector( VT_VARIANT, 0, 1 );
+        if ( !inner.parray || !middle.parray || !variant.parray )
+            HR( E_OUTOFMEMORY );
+        inner.vt = VT_I4 | VT_ARRAY;
+        middle.vt = VT_VARIANT | VT_ARRAY;
+        variant.vt = VT_VARIANT | VT_ARRAY;
+
+        HR( SafeArrayPutElement( middle.parray, &index, &inner ) );
+        HR( SafeArrayPutElement( variant.parray, &index, &middle ) );
+
+        return S_OK;
+
+    } // GetNested
+
+
+    //------------------------------------------------------------------------------
+    // Test keeping records in one stream and reading them in any order.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Test()
+    {
+        CComPtr<IStream>    pStream;
+        CComPtr<IStream>    pPrefixed;
+        CComPtr<IStream>    pTruncated;
+        CComVariant         variant;
+        CComVariant         nested;
+        CComVariant         first;
+        CComVariant         second;
+        ULONG               record;
+        long                prefix = 12345;
+        BLOB                blob;
+        HRESULT             hr = S_OK;
+
+        HR( CreateMemoryStream( &pStream ) );
+        HR( WriteRecords( pStream, 1000, true ) );
+        HR( RewindStream( pStream ) );
+
+        {
+            CVariantRecordReader    reader( pStream );
+
+            reader.Open();
+            if ( reader.GetCount() != 1000 )
+                HR( E_UNEXPECTED );
+
+            // Out of order, so that each read seeks.
+            HR( VerifyRecord( reader, 999 ) );
+            HR( VerifyRecord( reader, 0 ) );
+            HR( VerifyRecord( reader, 500 ) );
+            HR( VerifyRecord( reader, 1 ) );
+
+            if ( !reader.Find( L"key 777", record ) || 777 != record || reader.Find( L"key 1000", record ) )
+                HR( E_UNEXPECTED );
+
+            if ( DISP_E_BADINDEX != TryRead( reader, 1000, variant ) )
+                HR( E_UNEXPECTED );
+        }
+
+        // A container without keys, starting part way into the stream.
+        HR( CreateMemoryStream( &pPrefixed ) );
+        HR( pPrefixed->Write( &prefix, sizeof( prefix ), NULL ) );
+        HR( WriteRecords( pPrefixed, 10, false ) );
+
+        {
+            CVariantRecordReader    reader( pPrefixed );
+            LARGE_INTEGER           offset;
+
+            offset.QuadPart = sizeof( prefix );
+            HR( pPrefixed->Seek( offset, STREAM_SEEK_SET, NULL ) );
+
+            reader.Open();
+            if ( reader.GetCount() != 10 || reader.Find( L"key 1", record ) )
+                HR( E_UNEXPECTED );
+
+            HR( VerifyRecord( reader, 9 ) );
+            HR( VerifyRecord( reader, 2 ) );
+        }
+
+        // A container cut short can't be opened.
+        StreamToTaskMemory( pStream, blob );
+        blob.cbSize--;
+        BlobToStream( blob, &pTruncated );
+
+        {
+            CVariantRecordReader    reader( pTruncated );
+
+            if ( E_FAIL != TryOpen( reader ) )
+                hr = E_UNEXPECTED;
+        }
+
+        ::CoTaskMemFree( blob.pBlobData );
+
+        // A record that fails to write, or to have its statistics worked
+        // out, is left out of the index, and its key freed.
+        HR( GetNested( nested ) );
+        HR( GetRecord( 1, first ) );
+        HR( GetRecord( 2, second ) );
+
+        for ( int statistics = 0; statistics < 2; statistics++ )
+        {
+            CComPtr<IStream>    pFailed;
+
+            HR( CreateMemoryStream( &pFailed ) );
+
+            {
+                CVariantRecordWriter    writer( pFailed, 2 );
+
+                if ( statistics )
+                    writer.EnableStatistics( 2 );
+                writer.Begin();
+                writer.Write( first, L"first" );
+                if ( HRESULT_FROM_WIN32( ERROR_STACK_OVERFLOW ) != TryWrite( writer, nested, L"nested" ) || writer.GetCount() != 1 )
+                    hr = E_UNEXPECTED;
+                writer.Write( second, L"second" );
+                writer.End();
+            }
+
+            HR( RewindStream( pFailed ) );
+
+            {
+                CVariantRecordReader    reader( pFailed );
+
+                reader.Open();
+                if ( reader.GetCount() != 2 || !reader.Find( L"second", record ) || 1 != record || reader.Find( L"nested", record ) )
+                    hr = E_UNEXPECTED;
+
+                variant.Clear();
+                reader.Read( 1, variant );
+                if ( FAILED( VerifySame( second, variant ) ) )
+                    hr = E_UNEXPECTED;
+            }
+        }
+
+        return hr;
+
+    } // Test
+
+
+    //------------------------------------------------------------------------------
+    // Time reading the last of 100000 records through the index, against
+    // reading through the records before it.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Benchmark()
+    {
+        ULONG const             count = 100000;
+        ULONG const             iterations = 1000;
+        CComPtr<IStream>        pStream;
+        CBenchmarkTimer         timer;
+        ULONG                   time;
+
+        HR( CreateMemoryStream( &pStream ) );
+        HR( WriteRecords( pStream, count, true ) );
+        HR( RewindStream( pStream ) );
+
+        timer.Start();
+        {
+            LARGE_INTEGER   offset;
+
+            offset.QuadPart = sizeof( ULONG ) + sizeof( long );
+            HR( pStream->Seek( offset, STREAM_SEEK_SET, NULL ) );
+
+            for( ULONG record = 0; record < count; ++record )
+            {
+                CComVariant     variant;
+
+                ReadVariantFromStream( pStream, variant );
+            }
+        }
+        time = timer.ElapsedMicroseconds();
+        ReportBenchmark( "read through 100000 records", 1, time );
+
+        HR( RewindStream( pStream ) );
+
+        {
+            CVariantRecordReader    reader( pStream );
+
+            timer.Start();
+            reader.Open();
+            time = timer.ElapsedMicroseconds();
+            ReportBenchmark( "open index of 100000 records", 1, time );
+
+            timer.Start();
+            for( ULONG i = 0; i < iterations; ++i )
+            {
+                CComVariant     variant;
+
+                reader.Read( ( i * 7919 ) % count, variant );
+            }
+            time = timer.ElapsedMicroseconds();
+            ReportBenchmark( "read one of 100000 records", iterations, time );
+        }
+
+        return S_OK;
+
+    } // Benchmark
+
+
+}; // class CRecordFileTest
@@ -0,0 +1,256 @@
+#pragma once
+
+#include "StreamSupport.h"
+#include "Benchmark.h"
+#include "ParallelReadTest.h"
+
+class CRingBufferTest
+{
+public:
+
+    //------------------------------------------------------------------------------
+    // What the producer thread writes, and how it went.
+    //------------------------------------------------------------------------------
+
+    struct Producer
+    {
+        CRingBufferStream*  pStream;
+        VARIANT*            pVariant;
+        ULONG               count;
+        HRESULT             result;
+    };
+
+
+    //------------------------------------------------------------------------------
+    // Writes the variant to the stream, reporting failure rather than raising
+    // it.
+    //------------------------------------------------------------------------------
+
+    static HRESULT TryWrite( VARIANT& variant, IStream* pStream )
+    {
+        HRESULT     hr = S_OK;
+
+        TryStreamCall( WriteVariantToStream( &variant, pStream ), hr );
+
+        return hr;
+
+    } // TryWrite
+
+
+    //------------------------------------------------------------------------------
+    // Reads a variant from the stream, reporting failure rather than raising
+    // it.
+    //------------------------------------------------------------------------------
+
+    static HRESULT TryRead( IStream* pStream, VARIANT& variant )
+    {
+        HRESULT     hr = S_OK;
+
+        TryStreamCall( ReadVariantFromStream( pStream, variant ), hr );
+
+        return hr;
+
+    } // TryRead
+
+
+    //------------------------------------------------------------------------------
+    // Writes the producer's variant count times and closes the stream, or
+    // aborts it if a write fails.
+    //------------------------------------------------------------------------------
+
+    static DWORD WINAPI ProducerProc( void* parameter )
+    {
+        Producer*   producer = (Producer*)parameter;
+
+        producer->result = S_OK;
+        for ( ULONG i = 0; i < producer->count && SUCCEEDED( producer->result ); i++ )
+            producer->result = TryWrite( *producer->pVariant, producer->pStream );
+
+        if ( SUCCEEDED( producer->result ) )
+            producer->pStream->Close();
+        else
+            producer->pStream->Abort();
+
+        return 0;
+
+    } // ProducerProc
+
+
+    //------------------------------------------------------------------------------
+    // Starts a thread writing the variant count times to the stream.
+    //------------------------------------------------------------------------------
+
+    static HRESULT StartProducer( Producer& producer, HANDLE& thread )
+    {
+        thread = ::CreateThread( NULL, 0, ProducerProc, &producer, 0, NULL );
+        if ( !thread )
+            HR( HRESULT_FROM_WIN32( ::GetLastError() ) );
+
+        return S_OK;
+
+    } // StartProducer
+
+
+    //------------------------------------------------------------------------------
+    // Waits for the producer thread to finish.
+    //------------------------------------------------------------------------------
+
+    static void JoinProducer( HANDLE thread )
+    {
+        ::WaitForSingleObject( thread, INFINITE );
+        ::CloseHandle( thread );
+
+    } // JoinProducer
+
+
+    //------------------------------------------------------------------------------
+    // Verifies that the variant streams the given bytes.
+    //------------------------------------------------------------------------------
+
+    static HRESULT VerifyBlob( VARIANT& variant, const BLOB& expected )
+    {
+        BLOB        blob;
+        HRESULT     hr = S_OK;
+
+        WriteVariantToBlob( variant, blob );
+
+        if ( blob.cbSize != expected.cbSize || 0 != memcmp( blob.pBlobData, expected.pBlobData, blob.cbSize ) )
+            hr = E_UNEXPECTED;
+
+        ::CoTaskMemFree( blob.pBlobData );
+
+        return hr;
+
+    } // VerifyBlob
+
+
+    //------------------------------------------------------------------------------
+    // Test passing variants from one thread to another through a ring.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Test()
+    {
+        ULONG const         count = 20;
+        CComVariant         mixed;
+        CComVariant         last;
+        CRingBufferStream   ring;
+        CRingBufferStream   aborted;
+        Producer            producer = { &ring, &mixed, count, S_OK };
+        Producer            stopped = { &aborted, &mixed, count, S_OK };
+        HANDLE              thread;
+        BLOB                expected;
+        HRESULT             hr = S_OK;
+
+        HR( CParallelReadTest::GetMixedArray( mixed ) );
+
+        // What to expect is written beforehand, as the producer will be
+        // using the array.
+        WriteVariantToBlob( mixed, expected );
+
+        // A ring much smaller than each value, so that the writer keeps
+        // waiting for the reader to make room.
+        ring.Open( 200 );
+        HR( StartProducer( producer, thread ) );
+
+        for ( ULONG i = 0; i < count && SUCCEEDED( hr ); i++ )
+        {
+            CComVariant     copy;
+
+            hr = TryRead( &ring, copy );
+            if ( SUCCEEDED( hr ) )
+                hr = VerifyBlob( copy, expected );
+        }
+
+        // Once the writer has closed the stream there is nothing more to read.
+        if ( SUCCEEDED( hr ) && E_FAIL != TryRead( &ring, last ) )
+            hr = E_UNEXPECTED;
+
+        JoinProducer( thread );
+        ::CoTaskMemFree( expected.pBlobData );
+        HR( hr );
+        HR( producer.result );
+
+        // A reader that gives up fails the writer rather than leaving it
+        // waiting for room.
+        aborted.Open( 64 );
+        HR( StartProducer( stopped, thread ) );
+
+        hr = TryRead( &aborted, last );
+        aborted.Abort();
+
+        JoinProducer( thread );
+        HR( hr );
+        if ( E_ABORT != stopped.result )
+            HR( E_UNEXPECTED );
+
+        return S_OK;
+
+    } // Test
+
+
+    //------------------------------------------------------------------------------
+    // Times passing arrays of strings from one thread to another through a
+    // ring, against writing each one to memory and then reading it back.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Benchmark()
+    {
+        ULONG const             count = 2000;
+        ULONG const             iterations = 500;
+        CComVariant             strings;
+        CComVector<BSTR>        a( count );
+        CComVectorData<BSTR>    rg( a );
+        CRingBufferStream       ring;
+        Producer                producer = { &ring, &strings, iterations, S_OK };
+        HANDLE                  thread;
+        CBenchmarkTimer         timer;
+        ULONG                   time;
+        HRESULT                 hr = S_OK;
+        if ( !rg )
+            HR( E_UNEXPECTED );
+
+        for( ULONG i = 0; i < count; ++i )
+            rg[i] = ::SysAllocString( L"a string of some length" );
+
+        strings.vt = VT_BSTR | VT_ARRAY;
+        strings.parray = a.Detach();
+
+        timer.Start();
+        for( ULONG j = 0; j < iterations; ++j )
+        {
+            CComVariant     copy;
+            BLOB            blob;
+
+            WriteVariantToBlob( strings, blob );
+            ReadVariantFromBlob( blob, copy );
+            ::CoTaskMemFree( blob.pBlobData );
+        }
+        time = timer.ElapsedMicroseconds();
+        ReportBenchmark( "write to memory and read 2000 strings", iterations, time );
+
+        ring.Open( 0x10000 );
+        timer.Start();
+        HR( StartProducer( producer, thread ) );
+
+        for( ULONG k = 0; k < iterations && SUCCEEDED( hr ); ++k )
+        {
+            CComVariant     copy;
+
+            hr = TryRead( &ring, copy );
+        }
+
+        if ( FAILED( hr ) )
+            ring.Abort();
+        JoinProducer( thread );
+        time = timer.ElapsedMicroseconds();
+        HR( hr );
+        HR( producer.result );
+
+        ReportBenchmark( "pass 2000 strings through a ring", iterations, time );
+
+        return S_OK;
+
+    } // Benchmark
+
+
+}; // class CRingBufferTest
@@ -0,0 +1,352 @@
+#pragma once
+
+#include "StreamSupport.h"
+#include "Benchmark.h"
+#include "ParallelReadTest.h"
+
+class CSchemaTest
+{
+public:
+
+    //------------------------------------------------------------------------------
+    // Creates a row of four variants: a long, a string, a double and, for odd
+    // rows, a date in place of the double.  Every fifth row holds an array of
+    // longs in place of the string.
+    //------------------------------------------------------------------------------
+
+    static HRESULT GetRow( ULONG row, VARIANT& variant )
+    {
+        CComVector<VARIANT>     a( 4 );
+        CComVectorData<VARIANT> rg( a );
+        WCHAR                   text[32];
+        if ( !rg )
+            HR( E_UNEXPECTED );
+
+        rg[0].vt = VT_I4;
+        rg[0].lVal = row;
+
+        if ( row % 5 )
+        {
+            ::wsprintfW( text, L"row %lu", row );
+            rg[1].vt = VT_BSTR;
+            rg[1].bstrVal = ::SysAllocString( text );
+        }
+        else
+        {
+            rg[1].vt = VT_I4 | VT_ARRAY;
+            rg[1].parray = SafeArrayCreateVector( VT_I4, 0, row % 3 );
+            if ( !rg[1].parray )
+                HR( E_OUTOFMEMORY );
+        }
+
+        rg[2].vt = row % 2 ? VT_DATE : VT_R8;
+        rg[2].dblVal = row / 4.0;
+        rg[3].vt = VT_BOOL;
+        rg[3].boolVal = row % 3 ? VARIANT_TRUE : VARIANT_FALSE;
+
+        variant.vt = VT_VARIANT | VT_ARRAY;
+        variant.parray = a.Detach();
+
+        return S_OK;
+
+    } // GetRow
+
+
+    //------------------------------------------------------------------------------
+    // Returns how far the stream has been written.
+    //------------------------------------------------------------------------------
+
+    static ULONGLONG GetPosition( IStream* pStream )
+    {
+        LARGE_INTEGER       zero = { 0 };
+        ULARGE_INTEGER      position = { 0 };
+
+        pStream->Seek( zero, STREAM_SEEK_CUR, &position );
+
+        return position.QuadPart;
+
+    } // GetPosition
+
+
+    //------------------------------------------------------------------------------
+    // Starts reading a session and reads a record.
+    //------------------------------------------------------------------------------
+
+    static void ReadFirst( IStream* pStream, VARIANT& variant )
+    {
+        CVariantSchemaReader    reader( pStream );
+
+        reader.Begin();
+        reader.Read( variant );
+
+    } // ReadFirst
+
+
+    //------------------------------------------------------------------------------
+    // Calls ReadFirst, reporting failure rather than raising it.
+    //------------------------------------------------------------------------------
+
+    static HRESULT TryRead( IStream* pStream, VARIANT& variant )
+    {
+        HRESULT     hr = S_OK;
+
+        TryStreamCall( ReadFirst( pStream, variant ), hr );
+
+        return hr;
+
+    } // TryRead
+
+
+    //------------------------------------------------------------------------------
+    // Test streaming records whose shapes are written once.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Test()
+    {
+        ULONG const             count = 300;
+        CComVariant             records[count];
+        CComVariant             mixed;
+        CComVariant             strings;
+        CComVariant             number = 2.5;
+        CComVariant             byref;
+        CComVariant             rejected;
+        CComPtr<IStream>        pStream;
+        CComPtr<IStream>        pPlain;
+        ULONG                   shapes;
+        HRESULT                 hr = S_OK;
+
+        for( ULONG i = 0; i < count; ++i )
+            HR( GetRow( i, records[i] ) );
+
+        HR( CParallelReadTest::GetMixedArray( mixed ) );
+
+        strings.vt = VT_BSTR | VT_ARRAY;
+        strings.parray = SafeArrayCreateVector( VT_BSTR, 3, 2 );
+        if ( !strings.parray )
+            HR( E_OUTOFMEMORY );
+        ( (BSTR*)strings.parray->pvData )[0] = ::SysAllocString( L"first" );
+
+        byref.vt = VT_VARIANT | VT_ARRAY | VT_BYREF;
+        byref.pparray = &records[7].parray;
+
+        HR( CreateMemoryStream( &pStream ) );
+        HR( CreateMemoryStream( &pPlain ) );
+
+        {
+            CVariantSchemaWriter    session( pStream );
+
+            session.Begin();
+            for( ULONG j = 0; j < count; ++j )
+            {
+                session.Write( records[j] );
+                WriteVariantToStream( &records[j], pPlain );
+            }
+
+            // Rows have a string or an array, and a double or a date.  The
+            // arrays' bounds are not part of the rows' shapes.
+            shapes = session.GetShapeCount();
+            if ( 4 != shapes )
+                hr = E_UNEXPECTED;
+
+            // Far fewer bytes than writing each row on its own.
+            if ( GetPosition( pStream ) * 3 > GetPosition( pPlain ) * 2 )
+                hr = E_UNEXPECTED;
+
+            // Other records, and a byref row that is shaped as the others.
+            session.Write( mixed );
+            session.Write( strings );
+            session.Write( number );
+            session.Write( byref );
+            if ( session.GetShapeCount() != shapes + 3 )
+                hr = E_UNEXPECTED;
+        }
+
+        HR( RewindStream( pStream ) );
+        {
+            CVariantSchemaReader    reader( pStream );
+            CComVariant             variant;
+
+            reader.Begin();
+            for( ULONG k = 0; k < count; ++k )
+            {
+                variant.Clear();
+                if ( !reader.Read( variant ) || FAILED( VerifySame( records[k], variant ) ) )
+                    hr = E_UNEXPECTED;
+            }
+
+            variant.Clear();
+            if ( !reader.Read( variant ) || FAILED( VerifySame( mixed, variant ) ) )
+                hr = E_UNEXPECTED;
+            variant.Clear();
+            if ( !reader.Read( variant ) || FAILED( VerifySame( strings, variant ) ) )
+                hr = E_UNEXPECTED;
+            variant.Clear();
+            if ( !reader.Read( variant ) || variant.vt != VT_R8 || variant.dblVal != 2.5 )
+                hr = E_UNEXPECTED;
+            variant.Clear();
+            if ( !reader.Read( variant ) || FAILED( VerifySame( records[7], variant ) ) )
+                hr = E_UNEXPECTED;
+
+            // Then the end of the stream.
+            variant.Clear();
+            if ( reader.Read( variant ) )
+                hr = E_UNEXPECTED;
+        }
+        HR( hr );
+
+        // A shape that has not been sent is refused, and so is a stream that
+        // isn't a session.
+        HR( RewindStream( pStream ) );
+        {
+            CStream     stream( pStream );
+
+            stream.Write( VariantStreaming::schemaMagic );
+            stream.Write( VariantStreaming::schemaVersion );
+            stream.Write( (ULONG)1 );
+        }
+        HR( RewindStream( pStream ) );
+        if ( E_FAIL != TryRead( pStream, rejected ) )
+            hr = E_UNEXPECTED;
+
+        HR( RewindStream( pPlain ) );
+        if ( E_FAIL != TryRead( pPlain, rejected ) )
+            hr = E_UNEXPECTED;
+        HR( hr );
+
+        return TestReset();
+
+    } // Test
+
+
+    //------------------------------------------------------------------------------
+    // Test starting the shapes over when there are too many of them, with
+    // arrays of longs of every length up to more than the limit.
+    //------------------------------------------------------------------------------
+
+    static HRESULT TestReset()
+    {
+        ULONG const             count = VariantStreaming::schemaShapeLimit + 10;
+        CComPtr<IStream>        pStream;
+        HRESULT                 hr = S_OK;
+
+        HR( CreateMemoryStream( &pStream ) );
+
+        {
+            CVariantSchemaWriter    session( pStream );
+
+            session.Begin();
+            for( ULONG i = 0; i < count; ++i )
+            {
+                CComVariant     longs;
+
+                longs.vt = VT_I4 | VT_ARRAY;
+                longs.parray = SafeArrayCreateVector( VT_I4, 0, i );
+                if ( !longs.parray )
+                    HR( E_OUTOFMEMORY );
+                if ( i )
+                    ( (long*)longs.parray->pvData )[i - 1] = i;
+
+                session.Write( longs );
+            }
+
+            if ( session.GetShapeCount() != 10 )
+                hr = E_UNEXPECTED;
+        }
+
+        HR( RewindStream( pStream ) );
+        {
+            CVariantSchemaReader    reader( pStream );
+
+            reader.Begin();
+            for( ULONG j = 0; j < count; ++j )
+            {
+                CComVariant     longs;
+
+                if ( !reader.Read( longs ) || longs.vt != ( VT_I4 | VT_ARRAY ) || longs.parray->rgsabound[0].cElements != j )
+                    hr = E_UNEXPECTED;
+                else if ( j && ( (long*)longs.parray->pvData )[j - 1] != (long)j )
+                    hr = E_UNEXPECTED;
+            }
+        }
+
+        return hr;
+
+    } // TestReset
+
+
+    //------------------------------------------------------------------------------
+    // Time writing and reading 100000 rows each on their own and in a
+    // session, and compare their sizes.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Benchmark()
+    {
+        ULONG const             count = 100000;
+        CComVector<VARIANT>     a( count );
+        CComVectorData<VARIANT> rg( a );
+        CComPtr<IStream>        pPlain;
+        CComPtr<IStream>        pStream;
+        CBenchmarkTimer         timer;
+        ULONG                   time;
+        if ( !rg )
+            HR( E_UNEXPECTED );
+
+        for( ULONG i = 0; i < count; ++i )
+            HR( GetRow( i, rg[i] ) );
+
+        HR( CreateMemoryStream( &pPlain ) );
+        HR( CreateMemoryStream( &pStream ) );
+
+        timer.Start();
+        for( ULONG j = 0; j < count; ++j )
+            WriteVariantToStream( &rg[j], pPlain );
+        time = timer.ElapsedMicroseconds();
+        ReportBenchmark( "write 100000 rows", count, time );
+        ReportSize( "rows", count, GetPosition( pPlain ) );
+
+        {
+            CVariantSchemaWriter    writer( pStream );
+
+            timer.Start();
+            writer.Begin();
+            for( ULONG k = 0; k < count; ++k )
+                writer.Write( rg[k] );
+            time = timer.ElapsedMicroseconds();
+            ReportBenchmark( "write 100000 rows with shapes", count, time );
+            ReportSize( "rows with shapes", count, GetPosition( pStream ) );
+        }
+
+        HR( RewindStream( pPlain ) );
+        HR( RewindStream( pStream ) );
+
+        timer.Start();
+        for( ULONG m = 0; m < count; ++m )
+        {
+            CComVariant     row;
+
+            ReadVariantFromStream( pPlain, row );
+        }
+        time = timer.ElapsedMicroseconds();
+        ReportBenchmark( "read 100000 rows", count, time );
+
+        {
+            CVariantSchemaReader    reader( pStream );
+
+            timer.Start();
+            reader.Begin();
+            for( ULONG n = 0; n < count; ++n )
+            {
+                CComVariant     row;
+
+                reader.Read( row );
+            }
+            time = timer.ElapsedMicroseconds();
+            ReportBenchmark( "read 100000 rows with shapes", count, time );
+        }
+
+        return S_OK;
+
+    } // Benchmark
+
+
+}; // class CSchemaTest
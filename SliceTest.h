@@ -0,0 +1,356 @@
+#pragma once
+
+#include "StreamSupport.h"
+#include "Benchmark.h"
+
+class CSliceTest
+{
+public:
+
+    //------------------------------------------------------------------------------
+    // Verifies that every element of the slice is the same as the element of
+    // the source array with the same indexes.  Elements of arrays of variants
+    // may hold longs or strings.
+    //------------------------------------------------------------------------------
+
+    static HRESULT VerifySlice( SAFEARRAY* source, SAFEARRAY* slice )
+    {
+        VariantStreaming::CWalkSafeArrayElements    walk( slice );
+        long*                                       index = NULL;
+        bool                                        more = true;
+        VARTYPE                                     vt;
+
+        HR( SafeArrayGetVartype( source, &vt ) );
+
+        while( more )
+        {
+            BYTE*   element1;
+            BYTE*   element2;
+
+            walk.GetIndex( index );
+            HR( SafeArrayPtrOfIndex( source, index, (void**)&element1 ) );
+            HR( SafeArrayPtrOfIndex( slice, index, (void**)&element2 ) );
+
+            if ( VT_VARIANT == vt )
+            {
+                VARIANT*    variant1 = (VARIANT*)element1;
+                VARIANT*    variant2 = (VARIANT*)element2;
+
+                if ( variant1->vt != variant2->vt )
+                    HR( E_UNEXPECTED );
+                if ( VT_BSTR == variant1->vt ? 0 != lstrcmpW( variant1->bstrVal, variant2->bstrVal ) : variant1->lVal != variant2->lVal )
+                    HR( E_UNEXPECTED );
+            }
+            else if ( VT_BSTR == vt )
+            {
+                if ( 0 != lstrcmpW( *(BSTR*)element1, *(BSTR*)element2 ) )
+                    HR( E_UNEXPECTED );
+            }
+            else if ( 0 != memcmp( element1, element2, source->cbElements ) )
+            {
+                HR( E_UNEXPECTED );
+            }
+
+            walk.Next( more );
+        }
+
+        return S_OK;
+
+    } // VerifySlice
+
+
+    //------------------------------------------------------------------------------
+    // Decodes the slice of the variant both from a view on a blob and from a
+    // stream, and verifies both against the variant's array.  Also writes the
+    // slice straight from the array, which should stream the same bytes as
+    // the decoded slice does.
+    //------------------------------------------------------------------------------
+
+    static HRESULT VerifySlices( VARIANT& variant, const SAFEARRAYBOUND* slice )
+    {
+        CComVariant         v1;
+        CComVariant         v2;
+        CComVariant         v3;
+        CComPtr<IStream>    pStream;
+        CComPtr<IStream>    pSliceStream;
+        CVariantView        view;
+        BLOB                blob;
+        BLOB                written;
+        bool                isSame;
+        HRESULT             hr;
+
+        WriteVariantToBlob( variant, blob );
+        view.Open( blob );
+        view.BuildIndex( 16 );
+        view.CopySlice( slice, v1 );
+        ::CoTaskMemFree( blob.pBlobData );
+
+        HR( CreateMemoryStream( &pStream ) );
+        WriteVariantToStream( &variant, pStream );
+        HR( RewindStream( pStream ) );
+        ReadVariantSliceFromStream( pStream, slice, v2 );
+
+        HR( CreateMemoryStream( &pSliceStream ) );
+        WriteVariantSliceToStream( &variant, slice, pSliceStream );
+        StreamToTaskMemory( pSliceStream, written );
+        ReadVariantFromBlob( written, v3 );
+        WriteVariantToBlob( v2, blob );
+        isSame = blob.cbSize == written.cbSize && 0 == memcmp( blob.pBlobData, written.pBlobData, blob.cbSize );
+        ::CoTaskMemFree( blob.pBlobData );
+        ::CoTaskMemFree( written.pBlobData );
+
+        if ( v1.vt != variant.vt || v2.vt != variant.vt || v3.vt != variant.vt || !isSame )
+            HR( E_UNEXPECTED );
+
+        hr = VerifySlice( variant.parray, v3.parray );
+        HR( hr );
+
+        hr = VerifySlice( variant.parray, v1.parray );
+        HR( hr );
+
+        return VerifySlice( variant.parray, v2.parray );
+
+    } // VerifySlices
+
+
+    //------------------------------------------------------------------------------
+    // Creates an array of strings, "0", "1", "2", etc.
+    //------------------------------------------------------------------------------
+
+    static HRESULT GetStrings( ULONG count, VARIANT& variant )
+    {
+        CComVector<BSTR>        a( count );
+        CComVectorData<BSTR>    rg( a );
+        if ( !rg )
+            HR( E_UNEXPECTED );
+
+        for( ULONG i = 0; i < count; ++i )
+        {
+            WCHAR   text[16];
+
+            ::wsprintfW( text, L"%lu", i );
+            rg[i] = ::SysAllocString( text );
+        }
+
+        variant.vt = VT_BSTR | VT_ARRAY;
+        variant.parray = a.Detach();
+
+        return S_OK;
+
+    } // GetStrings
+
+
+    //------------------------------------------------------------------------------
+    // Reads a slice from the stream, reporting failure rather than raising it.
+    //------------------------------------------------------------------------------
+
+    static HRESULT TrySlice( IStream* pStream, const SAFEARRAYBOUND* slice, VARIANT& variant )
+    {
+        HRESULT     hr = S_OK;
+
+        TryStreamCall( ReadVariantSliceFromStream( pStream, slice, variant ), hr );
+
+        return hr;
+
+    } // TrySlice
+
+
+    //------------------------------------------------------------------------------
+    // Writes a slice to the stream, reporting failure rather than raising it.
+    //------------------------------------------------------------------------------
+
+    static HRESULT TryWriteSlice( const VARIANT& variant, const SAFEARRAYBOUND* slice, IStream* pStream )
+    {
+        HRESULT     hr = S_OK;
+
+        TryStreamCall( WriteVariantSliceToStream( &variant, slice, pStream ), hr );
+
+        return hr;
+
+    } // TryWriteSlice
+
+
+    //------------------------------------------------------------------------------
+    // Test decoding single elements and slices of streamed arrays, and
+    // writing slices of arrays.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Test()
+    {
+        SAFEARRAYBOUND      bounds[2] = { { 50, 0 }, { 6, 1 } };
+        SAFEARRAYBOUND      rows[2] = { { 10, 10 }, { 3, 2 } };
+        SAFEARRAYBOUND      vectorBounds = { 1000, 0 };
+        SAFEARRAYBOUND      range = { 100, 300 };
+        SAFEARRAYBOUND      outside[2] = { { 10, 45 }, { 1, 1 } };
+        SAFEARRAYBOUND      whole[2] = { { 50, 0 }, { 6, 1 } };
+        SAFEARRAYBOUND      column[2] = { { 50, 0 }, { 1, 3 } };
+        CComVariant         doubles;
+        CComVariant         byref;
+        CComVariant         number = 5L;
+        CComVariant         copy;
+        CComVariant         vector;
+        CComVariant         strings;
+        CComVariant         variants;
+        CComVariant         element;
+        CComVariant         rejected;
+        CComPtr<IStream>    pStream;
+        CComPtr<IStream>    pSliceStream;
+        double*             data;
+        VARIANT*            rg;
+
+        // A 50 x 6 array of doubles numbered in memory order, and rows 10 to
+        // 19 of its columns 2 to 4.
+        doubles.parray = SafeArrayCreate( VT_R8, 2, bounds );
+        vector.parray = SafeArrayCreate( VT_R8, 1, &vectorBounds );
+        variants.parray = SafeArrayCreate( VT_VARIANT, 2, bounds );
+        if ( !doubles.parray || !vector.parray || !variants.parray )
+            HR( E_OUTOFMEMORY );
+        doubles.vt = VT_R8 | VT_ARRAY;
+        vector.vt = VT_R8 | VT_ARRAY;
+        variants.vt = VT_VARIANT | VT_ARRAY;
+
+        HR( SafeArrayAccessData( doubles.parray, (void**)&data ) );
+        for( int i = 0; i < 300; ++i )
+            data[i] = i;
+        HR( SafeArrayUnaccessData( doubles.parray ) );
+
+        HR( SafeArrayAccessData( vector.parray, (void**)&data ) );
+        for( int j = 0; j < 1000; ++j )
+            data[j] = j;
+        HR( SafeArrayUnaccessData( vector.parray ) );
+
+        // The same shape of variants, alternately longs and strings.
+        HR( SafeArrayAccessData( variants.parray, (void**)&rg ) );
+        for( int k = 0; k < 300; ++k )
+        {
+            if ( k % 2 )
+            {
+                rg[k].vt = VT_I4;
+                rg[k].lVal = k;
+            }
+            else
+            {
+                rg[k].vt = VT_BSTR;
+                rg[k].bstrVal = ::SysAllocString( L"even" );
+            }
+        }
+        HR( SafeArrayUnaccessData( variants.parray ) );
+
+        HR( GetStrings( 1000, strings ) );
+
+        HR( VerifySlices( doubles, rows ) );
+        HR( VerifySlices( vector, &range ) );
+        HR( VerifySlices( strings, &range ) );
+        HR( VerifySlices( variants, rows ) );
+        HR( VerifySlices( doubles, column ) );
+        HR( VerifySlices( doubles, whole ) );
+
+        // A slice of the whole array is the array, and a reference to an
+        // array writes as the array does.
+        HR( CreateMemoryStream( &pSliceStream ) );
+        byref.vt = VT_R8 | VT_ARRAY | VT_BYREF;
+        byref.pparray = &doubles.parray;
+        WriteVariantSliceToStream( &byref, whole, pSliceStream );
+        byref.vt = VT_EMPTY;
+        HR( RewindStream( pSliceStream ) );
+        ReadVariantFromStream( pSliceStream, copy );
+        if ( copy.vt != doubles.vt || FAILED( VerifySlice( doubles.parray, copy.parray ) ) )
+            HR( E_UNEXPECTED );
+
+        // Single elements from a stream.
+        HR( CreateMemoryStream( &pStream ) );
+        WriteVariantToStream( &strings, pStream );
+        HR( RewindStream( pStream ) );
+        ReadVariantElementFromStream( pStream, 777, element );
+        if ( element.vt != VT_BSTR || 0 != lstrcmpW( element.bstrVal, L"777" ) )
+            HR( E_UNEXPECTED );
+
+        HR( element.Clear() );
+        HR( RewindStream( pStream ) );
+        WriteVariantToStream( &variants, pStream );
+        HR( RewindStream( pStream ) );
+        ReadVariantElementFromStream( pStream, 7, element );
+        if ( element.vt != VT_I4 || element.lVal != 51 )
+            HR( E_UNEXPECTED );
+
+        // Slices outside the array's bounds should fail.
+        HR( RewindStream( pStream ) );
+        if ( DISP_E_BADINDEX != TrySlice( pStream, outside, rejected ) )
+            HR( E_UNEXPECTED );
+        if ( DISP_E_BADINDEX != TryWriteSlice( doubles, outside, pSliceStream ) )
+            HR( E_UNEXPECTED );
+        if ( DISP_E_TYPEMISMATCH != TryWriteSlice( number, &range, pSliceStream ) )
+            HR( E_UNEXPECTED );
+
+        return S_OK;
+
+    } // Test
+
+
+    //------------------------------------------------------------------------------
+    // Time streaming rows 1000 to 1999 of a 10000 x 8 array of doubles, by
+    // copying them into an array of their own first and by writing them
+    // straight from the array.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Benchmark()
+    {
+        ULONG const         iterations = 10000;
+        SAFEARRAYBOUND      bounds[2] = { { 10000, 0 }, { 8, 0 } };
+        SAFEARRAYBOUND      rows[2] = { { 1000, 1000 }, { 8, 0 } };
+        CComVariant         doubles;
+        CComPtr<IStream>    pStream;
+        CBenchmarkTimer     timer;
+        ULONG               time;
+        double*             data;
+
+        doubles.parray = SafeArrayCreate( VT_R8, 2, bounds );
+        if ( !doubles.parray )
+            HR( E_OUTOFMEMORY );
+        doubles.vt = VT_R8 | VT_ARRAY;
+
+        HR( SafeArrayAccessData( doubles.parray, (void**)&data ) );
+        for( ULONG i = 0; i < 80000; ++i )
+            data[i] = i;
+        HR( SafeArrayUnaccessData( doubles.parray ) );
+
+        HR( CreateMemoryStream( &pStream ) );
+
+        // Each column's rows are next to each other in memory.
+        timer.Start();
+        for( ULONG j = 0; j < iterations; ++j )
+        {
+            CComVariant     slice;
+            double*         sliceData;
+
+            slice.parray = SafeArrayCreate( VT_R8, 2, rows );
+            if ( !slice.parray )
+                HR( E_OUTOFMEMORY );
+            slice.vt = VT_R8 | VT_ARRAY;
+
+            HR( SafeArrayAccessData( slice.parray, (void**)&sliceData ) );
+            for( ULONG column = 0; column < 8; ++column )
+                ::CopyMemory( sliceData + column * 1000, data + column * 10000 + 1000, 1000 * sizeof( double ) );
+            HR( SafeArrayUnaccessData( slice.parray ) );
+
+            HR( RewindStream( pStream ) );
+            WriteVariantToStream( &slice, pStream );
+        }
+        time = timer.ElapsedMicroseconds();
+        ReportBenchmark( "write 1000 x 8 rows copied into a new array", iterations, time );
+
+        timer.Start();
+        for( ULONG k = 0; k < iterations; ++k )
+        {
+            HR( RewindStream( pStream ) );
+            WriteVariantSliceToStream( &doubles, rows, pStream );
+        }
+        time = timer.ElapsedMicroseconds();
+        ReportBenchmark( "write 1000 x 8 rows straight from the array", iterations, time );
+
+        return S_OK;
+
+    } // Benchmark
+
+
+}; // class CSliceTest
@@ -1,234 +1,1569 @@
-#pragma once
-
-//==============================================================================
-// Included code:
-//  CStream - A wrapper for IStream.
-//  StreamToTaskMemory -- Converts a stream to a blob
-//  BlobToStream -- Converts a blob to a stream.
-//==============================================================================
-
-#ifndef HR
-#define HR(_ex) { HRESULT _hr = _ex; if( FAILED(_hr) ) return _hr; }
-#endif
-#define ThrowError(_ex) RaiseException( 0xE0000001, 0, 0, 0);
-#define CheckResult(_ex) do { HRESULT _hr = _ex; if( FAILED(_hr) ) ThrowError(_hr) } while (0,0)
-#define VerifyAllocation(_ex) do { if ( NULL == (_ex) ) ThrowError( E_OUTOFMEMORY ); } while(0, 0)
-#define ValidatePointer(_ex) do { if ( NULL == (_ex) ) ThrowError( E_POINTER ); } while( 0, 0 )
-
-
-//==============================================================================
-// Wrapper for IStream.  Supplies template Read and Write method so that 
-// data sizes are automatically calculated.  Standard overload assumes
-// an intrinsic type and uses the & operator on the parameter to to get to the data
-// to be read or written and the sizeof operator on the parameter to determine
-// the size of the data to be read or written.
-// A BSTR operator is supplied for reading and writing strings.
-// Example:
-//        IStream*    pStream = ...;
-//        ...
-//        CStream     stream( pStream );
-//    
-//        stream.Write( longVal );
-//        stream.Write( shortVal );
-//        stream.Write( floatVal );
-//        stream.Write( bstrVal );
-//        stream.Write( (BSTR)CComBSTR( lpszStringVal ) );
-//    
-// ToDo:
-//   Could add support for LPCSTR, LPWSTR, string and wstring.
-//==============================================================================
-
-class CStream
-{
-public:
-    //------------------------------------------------------------------------------
-    // Construct using an IStream pointer
-    //------------------------------------------------------------------------------
-    
-    inline CStream( IStream* stream )
-        :   stream( stream )
-    {
-    }
-    
-    //------------------------------------------------------------------------------
-    // Alows code to get the IStream pointer.
-    //------------------------------------------------------------------------------
-    
-    inline operator IStream*()
-    {
-        return stream;
-    }
-    
-    
-    //------------------------------------------------------------------------------
-    // Template method that will write any data type that supports & to return
-    // the address of the data and sizeof that will return the size of the data.
-    //------------------------------------------------------------------------------
-    
-    template <class Q>
-    inline void Write( Q value )
-    {
-        ULONG   written;
-        CheckResult( stream->Write( &value, sizeof( value ), &written ) );
-        if ( written != sizeof( value ) )
-            ThrowError( E_FAIL );
-    }
-    
-    
-    //------------------------------------------------------------------------------
-    // Special code for writing BSTRs
-    //------------------------------------------------------------------------------
-    
-    inline void Write( BSTR value )
-    {
-        ULONG   written;
-        UINT    bufferSize = ::SysStringLen( value ) * sizeof( WCHAR );
-        
-        Write( bufferSize );
-        CheckResult( stream->Write( value, bufferSize, &written ) );
-        if ( written != bufferSize )
-            ThrowError( E_FAIL );
-    }
-    
-    
-    //------------------------------------------------------------------------------
-    // Template method that will read any data type that supports & to return
-    // the address of the data and sizeof that will return the size of the data.
-    //------------------------------------------------------------------------------
-    
-    template <class Q>
-    inline void Read( Q& value )
-    {
-        ULONG   read;
-        CheckResult( stream->Read( &value, sizeof( value ), &read ) );
-        if ( read != sizeof( value ) )
-            ThrowError( E_FAIL );
-    }
-    
-    
-    //------------------------------------------------------------------------------
-    // Special code for reading BSTRs
-    //------------------------------------------------------------------------------
-    
-    inline void Read( BSTR* value )
-    {
-        ULONG   read;
-        UINT    bufferSize;
-        
-        Read( bufferSize );
-        LPWSTR buf = (LPWSTR)_alloca( bufferSize + sizeof( WCHAR ) );
-        CheckResult( stream->Read( buf, bufferSize, &read ) );
-        if ( read != bufferSize )
-            ThrowError( E_FAIL );
-
-        UINT len = bufferSize / sizeof( WCHAR );
-        buf[len] = L'\0';
-        *value = ::SysAllocStringLen( buf, len );
-        if ( !*value )
-            ThrowError( E_OUTOFMEMORY );
-    }
-
-
-    //------------------------------------------------------------------------------
-    // Special code for reading BSTRs
-    //------------------------------------------------------------------------------
-
-    DWORD GetSize()
-    {
-        ULARGE_INTEGER                  largeSize = { 0 };
-        ULARGE_INTEGER                  uLargeCurrentLocation;
-        LARGE_INTEGER                   largeZero;
-        largeZero.QuadPart = 0i64;
-
-        // Get the Size of the stream.
-        CheckResult( stream->Seek( largeZero, STREAM_SEEK_CUR, &uLargeCurrentLocation ) );
-        CheckResult( stream->Seek( largeZero, STREAM_SEEK_END, &largeSize ) );
-
-        LARGE_INTEGER largeCurrentLocation;
-        largeCurrentLocation.QuadPart = uLargeCurrentLocation.QuadPart;
-        CheckResult( stream->Seek( largeCurrentLocation, STREAM_SEEK_SET, NULL ) );
-
-        return largeSize.LowPart;
-    }
-
-
-    //------------------------------------------------------------------------------
-    // GetStreamHGlobal
-    //------------------------------------------------------------------------------
-
-    HGLOBAL GetStreamHGlobal()
-    {
-        HGLOBAL             handle;
-
-        // Get the memory handle associated with the stream.
-        CheckResult( ::GetHGlobalFromStream( stream, &handle ) );
-
-        return handle;
-    }
-
-
-private:
-    // If these get accessed, change your code to explicitly cast the parameter to
-    // a BSTR for writes and BSTR* for reads.
-    void Write( CComBSTR value );
-    void Read( CComBSTR* value );
-    
-private:
-    CComPtr<IStream>    stream;
-    
-}; // class CStream
-
-
-//------------------------------------------------------------------------------
-// StreamToTaskMemory
-// Given a memory stream, converts it to a task memory pointer, which the caller
-// is responsible for deleting with CoTaskMemFree.
-//------------------------------------------------------------------------------
-
-inline void StreamToTaskMemory( IStream* pStream, BLOB& blob )
-{
-    CStream         stream( pStream );
-
-    // Get the memory handle associated with the stream.
-    HGLOBAL handle = stream.GetStreamHGlobal();
-
-    // Allocate new memory that will be returned to the caller as a BLOB.
-    blob.cbSize = stream.GetSize();
-    blob.pBlobData = (BYTE*) ::CoTaskMemAlloc( blob.cbSize );
-
-    // Copy the memory from the stream to the new memory.
-    ::CopyMemory( blob.pBlobData, ::GlobalLock( handle ), blob.cbSize );
-    ::GlobalUnlock( handle );
-
-} // StreamToTaskMemory
-
-
-//------------------------------------------------------------------------------
-// BlobToStream
-// Given a BLOB object, converts to a memory stream.
-// The BLOB may have null data, in which case an empty memory stream is created.
-//------------------------------------------------------------------------------
-
-inline void BlobToStream( const BLOB& blob, IStream** ppStream )
-{
-    HGLOBAL             handle = NULL;
-
-    // Create a handle from the output BLOB
-    if ( blob.cbSize )
-    {
-        handle = ::GlobalAlloc( GMEM_MOVEABLE, blob.cbSize );
-        if ( !handle )
-            CheckResult( HRESULT_FROM_WIN32( ::GetLastError() ) );
-
-        // Copy the blob to the new memory.
-        if ( blob.pBlobData )
-        {
-            ::memcpy( ::GlobalLock( handle ), blob.pBlobData, blob.cbSize );
-            ::GlobalUnlock( handle );
-        }
-    }
-
-    // Create an IStream object that stores data in memory.
-    CheckResult( ::CreateStreamOnHGlobal( handle, TRUE, ppStream ) );
-
-} // BlobToStream
+#pragma once
+
+//==============================================================================
+// Included code:
+//  CStream - A wrapper for IStream.
+//  StreamToTaskMemory -- Converts a stream to a blob
+//  BlobToStream -- Converts a blob to a stream.
+//  CMemoryReadStream -- A read-only stream on memory, without a copy.
+//  CMemoryWriteStream -- A stream on a fixed block of memory.
+//  CTaskMemoryWriteStream -- A growing stream that becomes a blob.
+//  CAsyncWriteStream -- Writes to another stream on a background thread.
+//  CRingBufferStream -- Passes bytes from one thread to another.
+//  CAsyncByteStream -- A byte stream that doesn't block, for async callers.
+//  CAsyncPipe -- A CAsyncByteStream from a writer to a reader in memory.
+//==============================================================================
+
+#ifndef HR
+#define HR(_ex) { HRESULT _hr = _ex; if( FAILED(_hr) ) return _hr; }
+#endif
+
+// Code of the exceptions ThrowError raises.  The failing HRESULT is the
+// exception's one argument; use FilterStreamError to get it back.
+#define STREAM_ERROR_EXCEPTION 0xE0000001
+
+#define ThrowError(_ex) RaiseStreamError( _ex );
+#define CheckResult(_ex) do { HRESULT _hr = _ex; if( FAILED(_hr) ) ThrowError(_hr) } while (0,0)
+#define VerifyAllocation(_ex) do { if ( NULL == (_ex) ) ThrowError( E_OUTOFMEMORY ); } while(0, 0)
+#define ValidatePointer(_ex) do { if ( NULL == (_ex) ) ThrowError( E_POINTER ); } while( 0, 0 )
+
+
+//------------------------------------------------------------------------------
+// RaiseStreamError
+// Raises the exception ThrowError stands for, carrying the HRESULT.
+//------------------------------------------------------------------------------
+
+inline void RaiseStreamError( HRESULT hr )
+{
+    ULONG_PTR   argument = (ULONG_PTR)(ULONG)hr;
+
+    ::RaiseException( STREAM_ERROR_EXCEPTION, 0, 1, &argument );
+
+} // RaiseStreamError
+
+
+//------------------------------------------------------------------------------
+// FilterStreamError
+// Exception filter that handles only the exceptions ThrowError raises,
+// setting hr to the HRESULT they carry.  Anything else, such as an access
+// violation, is left to the handlers further out.
+// Example:
+//      __try
+//      {
+//          ReadVariantFromStream( pStream, variant );
+//      }
+//      __except( FilterStreamError( GetExceptionInformation(), hr ) )
+//      {
+//          return hr;
+//      }
+//------------------------------------------------------------------------------
+
+inline int FilterStreamError( EXCEPTION_POINTERS* pointers, HRESULT& hr )
+{
+    EXCEPTION_RECORD*   record = pointers->ExceptionRecord;
+
+    if ( STREAM_ERROR_EXCEPTION != record->ExceptionCode )
+        return EXCEPTION_CONTINUE_SEARCH;
+
+    hr = record->NumberParameters ? (HRESULT)record->ExceptionInformation[0] : E_FAIL;
+
+    return EXCEPTION_EXECUTE_HANDLER;
+
+} // FilterStreamError
+
+
+//==============================================================================
+// Wrapper for IStream.  Supplies template Read and Write method so that 
+// data sizes are automatically calculated.  Standard overload assumes
+// an intrinsic type and uses the & operator on the parameter to to get to the data
+// to be read or written and the sizeof operator on the parameter to determine
+// the size of the data to be read or written.
+// A BSTR operator is supplied for reading and writing strings.
+// Example:
+//        IStream*    pStream = ...;
+//        ...
+//        CStream     stream( pStream );
+//    
+//        stream.Write( longVal );
+//        stream.Write( shortVal );
+//        stream.Write( floatVal );
+//        stream.Write( bstrVal );
+//        stream.Write( (BSTR)CComBSTR( lpszStringVal ) );
+//    
+// ToDo:
+//   Could add support for LPCSTR, LPWSTR, string and wstring.
+//==============================================================================
+
+class CStream
+{
+public:
+    //------------------------------------------------------------------------------
+    // Construct using an IStream pointer
+    //------------------------------------------------------------------------------
+    
+    inline CStream( IStream* stream )
+        :   stream( stream )
+    {
+    }
+    
+    //------------------------------------------------------------------------------
+    // Alows code to get the IStream pointer.
+    //------------------------------------------------------------------------------
+    
+    inline operator IStream*()
+    {
+        return stream;
+    }
+    
+    
+    //------------------------------------------------------------------------------
+    // Template method that will write any data type that supports & to return
+    // the address of the data and sizeof that will return the size of the data.
+    //------------------------------------------------------------------------------
+    
+    template <class Q>
+    inline void Write( Q value )
+    {
+        ULONG   written;
+        CheckResult( stream->Write( &value, sizeof( value ), &written ) );
+        if ( written != sizeof( value ) )
+            ThrowError( E_FAIL );
+    }
+    
+    
+    //------------------------------------------------------------------------------
+    // Special code for writing BSTRs
+    //------------------------------------------------------------------------------
+    
+    inline void Write( BSTR value )
+    {
+        ULONG   written;
+        UINT    bufferSize = ::SysStringLen( value ) * sizeof( WCHAR );
+        
+        Write( bufferSize );
+        CheckResult( stream->Write( value, bufferSize, &written ) );
+        if ( written != bufferSize )
+            ThrowError( E_FAIL );
+    }
+    
+    
+    //------------------------------------------------------------------------------
+    // Writes a block of memory as is.  Blocks larger than maxTransfer are
+    // written in pieces, since IStream::Write takes a 32-bit count.
+    //------------------------------------------------------------------------------
+
+    inline void Write( const void* buffer, ULONGLONG size )
+    {
+        const BYTE*     data = (const BYTE*)buffer;
+        ULONG           written;
+        ULONG           piece;
+
+        while ( size )
+        {
+            piece = size < maxTransfer ? (ULONG)size : maxTransfer;
+
+            CheckResult( stream->Write( data, piece, &written ) );
+            if ( written != piece )
+                ThrowError( E_FAIL );
+
+            data += piece;
+            size -= piece;
+        }
+    }
+
+
+    //------------------------------------------------------------------------------
+    // Template method that will read any data type that supports & to return
+    // the address of the data and sizeof that will return the size of the data.
+    //------------------------------------------------------------------------------
+    
+    template <class Q>
+    inline void Read( Q& value )
+    {
+        ULONG   read;
+        CheckResult( stream->Read( &value, sizeof( value ), &read ) );
+        if ( read != sizeof( value ) )
+            ThrowError( E_FAIL );
+    }
+    
+    
+    //------------------------------------------------------------------------------
+    // Reads a block of memory as is.  Blocks larger than maxTransfer are read
+    // in pieces.
+    //------------------------------------------------------------------------------
+
+    inline void Read( void* buffer, ULONGLONG size )
+    {
+        BYTE*           data = (BYTE*)buffer;
+        ULONG           read;
+        ULONG           piece;
+
+        while ( size )
+        {
+            piece = size < maxTransfer ? (ULONG)size : maxTransfer;
+
+            CheckResult( stream->Read( data, piece, &read ) );
+            if ( read != piece )
+                ThrowError( E_FAIL );
+
+            data += piece;
+            size -= piece;
+        }
+    }
+
+
+    //------------------------------------------------------------------------------
+    // Special code for reading BSTRs
+    // The characters are read straight into the new BSTR, which has room for
+    // an odd last byte in its terminator.
+    //------------------------------------------------------------------------------
+    
+    inline void Read( BSTR* value )
+    {
+        ULONG   read;
+        UINT    bufferSize;
+        HRESULT hr;
+        
+        Read( bufferSize );
+
+        UINT len = bufferSize / sizeof( WCHAR );
+        BSTR buf = ::SysAllocStringLen( NULL, len );
+        VerifyAllocation( buf );
+
+        // Free the string before raising the stream's own failure, if any.
+        hr = stream->Read( buf, bufferSize, &read );
+        if ( FAILED( hr ) || read != bufferSize )
+        {
+            ::SysFreeString( buf );
+            ThrowError( FAILED( hr ) ? hr : E_FAIL );
+        }
+
+        buf[len] = L'\0';
+        *value = buf;
+    }
+
+
+    //------------------------------------------------------------------------------
+    // GetSize
+    // Returns the full size of the stream, which may be over 4 GB.
+    //------------------------------------------------------------------------------
+
+    ULONGLONG GetSize()
+    {
+        ULARGE_INTEGER                  largeSize = { 0 };
+        ULARGE_INTEGER                  uLargeCurrentLocation;
+        LARGE_INTEGER                   largeZero;
+        largeZero.QuadPart = 0i64;
+
+        // Get the Size of the stream.
+        CheckResult( stream->Seek( largeZero, STREAM_SEEK_CUR, &uLargeCurrentLocation ) );
+        CheckResult( stream->Seek( largeZero, STREAM_SEEK_END, &largeSize ) );
+
+        LARGE_INTEGER largeCurrentLocation;
+        largeCurrentLocation.QuadPart = uLargeCurrentLocation.QuadPart;
+        CheckResult( stream->Seek( largeCurrentLocation, STREAM_SEEK_SET, NULL ) );
+
+        return largeSize.QuadPart;
+    }
+
+
+    //------------------------------------------------------------------------------
+    // GetStreamHGlobal
+    //------------------------------------------------------------------------------
+
+    HGLOBAL GetStreamHGlobal()
+    {
+        HGLOBAL             handle;
+
+        // Get the memory handle associated with the stream.
+        CheckResult( ::GetHGlobalFromStream( stream, &handle ) );
+
+        return handle;
+    }
+
+
+    // Largest block handed to IStream::Read or IStream::Write in one call.
+    enum { maxTransfer = 0x40000000 };
+
+private:
+    // If these get accessed, change your code to explicitly cast the parameter to
+    // a BSTR for writes and BSTR* for reads.
+    void Write( CComBSTR value );
+    void Read( CComBSTR* value );
+    
+private:
+    CComPtr<IStream>    stream;
+    
+}; // class CStream
+
+
+//------------------------------------------------------------------------------
+// StreamToTaskMemory
+// Given a memory stream, converts it to a task memory pointer, which the caller
+// is responsible for deleting with CoTaskMemFree.
+// A BLOB's size is 32 bits, so streams of 4 GB or more fail rather than
+// being truncated.  Use a stream, such as one on a file, for those.
+//------------------------------------------------------------------------------
+
+inline void StreamToTaskMemory( IStream* pStream, BLOB& blob )
+{
+    CStream         stream( pStream );
+    ULONGLONG       size = stream.GetSize();
+
+    if ( size > 0xFFFFFFFF )
+        ThrowError( HRESULT_FROM_WIN32( ERROR_ARITHMETIC_OVERFLOW ) );
+
+    // Get the memory handle associated with the stream.
+    HGLOBAL handle = stream.GetStreamHGlobal();
+
+    // Allocate new memory that will be returned to the caller as a BLOB.
+    blob.cbSize = (ULONG)size;
+    blob.pBlobData = (BYTE*) ::CoTaskMemAlloc( blob.cbSize );
+    VerifyAllocation( blob.pBlobData );
+
+    // Copy the memory from the stream to the new memory.
+    ::CopyMemory( blob.pBlobData, ::GlobalLock( handle ), blob.cbSize );
+    ::GlobalUnlock( handle );
+
+} // StreamToTaskMemory
+
+
+//------------------------------------------------------------------------------
+// BlobToStream
+// Given a BLOB object, converts to a memory stream.
+// The BLOB may have null data, in which case an empty memory stream is created.
+//------------------------------------------------------------------------------
+
+inline void BlobToStream( const BLOB& blob, IStream** ppStream )
+{
+    HGLOBAL             handle = NULL;
+
+    // Create a handle from the output BLOB
+    if ( blob.cbSize )
+    {
+        handle = ::GlobalAlloc( GMEM_MOVEABLE, blob.cbSize );
+        if ( !handle )
+            CheckResult( HRESULT_FROM_WIN32( ::GetLastError() ) );
+
+        // Copy the blob to the new memory.
+        if ( blob.pBlobData )
+        {
+            ::memcpy( ::GlobalLock( handle ), blob.pBlobData, blob.cbSize );
+            ::GlobalUnlock( handle );
+        }
+    }
+
+    // Create an IStream object that stores data in memory.
+    CheckResult( ::CreateStreamOnHGlobal( handle, TRUE, ppStream ) );
+
+} // BlobToStream
+
+
+//==============================================================================
+// CMemoryReadStream
+// Read-only IStream on memory owned by the caller, so that streamed data can
+// be read in place rather than copied into an HGLOBAL first.  It is declared
+// where it is used, not created on the heap, and is not deleted by its last
+// Release, so it must outlive every reference handed out.
+// Example:
+//      CMemoryReadStream   stream( data, size );
+//
+//      ReadVariantFromStream( &stream, variant );
+//==============================================================================
+
+class CMemoryReadStream : public IStream
+{
+public:
+    CMemoryReadStream( const void* data, ULONGLONG size )
+        :   m_data( (const BYTE*)data ),
+            m_size( size ),
+            m_position( 0 ),
+            m_references( 0 )
+    {
+    }
+
+    inline ULONGLONG GetPosition()
+    {
+        return m_position;
+    }
+
+    // IUnknown
+    STDMETHOD(QueryInterface)( REFIID iid, void** ppv )
+    {
+        if ( !ppv )
+            return E_POINTER;
+
+        if ( iid == IID_IUnknown || iid == IID_ISequentialStream || iid == IID_IStream )
+        {
+            *ppv = (IStream*)this;
+            AddRef();
+            return S_OK;
+        }
+
+        *ppv = NULL;
+        return E_NOINTERFACE;
+    }
+
+    STDMETHOD_(ULONG, AddRef)()
+    {
+        return ::InterlockedIncrement( &m_references );
+    }
+
+    STDMETHOD_(ULONG, Release)()
+    {
+        return ::InterlockedDecrement( &m_references );
+    }
+
+    // ISequentialStream
+    STDMETHOD(Read)( void* pv, ULONG cb, ULONG* pcbRead )
+    {
+        ULONGLONG   left = m_position < m_size ? m_size - m_position : 0;
+        ULONG       read = cb < left ? cb : (ULONG)left;
+
+        ::CopyMemory( pv, m_data + m_position, read );
+        m_position += read;
+
+        if ( pcbRead )
+            *pcbRead = read;
+
+        return read == cb ? S_OK : S_FALSE;
+    }
+
+    STDMETHOD(Write)( const void*, ULONG, ULONG* )
+    {
+        return STG_E_ACCESSDENIED;
+    }
+
+    // IStream
+    STDMETHOD(Seek)( LARGE_INTEGER move, DWORD origin, ULARGE_INTEGER* newPosition )
+    {
+        LONGLONG    base;
+
+        switch ( origin )
+        {
+        case STREAM_SEEK_SET:
+            base = 0;
+            break;
+
+        case STREAM_SEEK_CUR:
+            base = (LONGLONG)m_position;
+            break;
+
+        case STREAM_SEEK_END:
+            base = (LONGLONG)m_size;
+            break;
+
+        default:
+            return STG_E_INVALIDFUNCTION;
+        }
+
+        if ( base + move.QuadPart < 0 )
+            return STG_E_INVALIDFUNCTION;
+
+        m_position = (ULONGLONG)( base + move.QuadPart );
+
+        if ( newPosition )
+            newPosition->QuadPart = m_position;
+
+        return S_OK;
+    }
+
+    STDMETHOD(SetSize)( ULARGE_INTEGER )
+    {
+        return STG_E_ACCESSDENIED;
+    }
+
+    STDMETHOD(CopyTo)( IStream*, ULARGE_INTEGER, ULARGE_INTEGER*, ULARGE_INTEGER* )
+    {
+        return E_NOTIMPL;
+    }
+
+    STDMETHOD(Commit)( DWORD )
+    {
+        return S_OK;
+    }
+
+    STDMETHOD(Revert)()
+    {
+        return S_OK;
+    }
+
+    STDMETHOD(LockRegion)( ULARGE_INTEGER, ULARGE_INTEGER, DWORD )
+    {
+        return STG_E_INVALIDFUNCTION;
+    }
+
+    STDMETHOD(UnlockRegion)( ULARGE_INTEGER, ULARGE_INTEGER, DWORD )
+    {
+        return STG_E_INVALIDFUNCTION;
+    }
+
+    STDMETHOD(Stat)( STATSTG* pstatstg, DWORD )
+    {
+        if ( !pstatstg )
+            return E_POINTER;
+
+        ::ZeroMemory( pstatstg, sizeof( STATSTG ) );
+        pstatstg->type = STGTY_STREAM;
+        pstatstg->cbSize.QuadPart = m_size;
+
+        return S_OK;
+    }
+
+    STDMETHOD(Clone)( IStream** )
+    {
+        return E_NOTIMPL;
+    }
+
+protected:
+    const BYTE*         m_data;
+    ULONGLONG           m_size;
+    ULONGLONG           m_position;
+    LONG                m_references;
+
+}; // class CMemoryReadStream
+
+
+//==============================================================================
+// CMemoryWriteStream
+// CMemoryReadStream that may also be written to, within the block of memory
+// it is given.  Writes that would run past the end of the block fail.
+//==============================================================================
+
+class CMemoryWriteStream : public CMemoryReadStream
+{
+public:
+    CMemoryWriteStream( void* data, ULONGLONG size )
+        :   CMemoryReadStream( data, size )
+    {
+    }
+
+    STDMETHOD(Write)( const void* pv, ULONG cb, ULONG* pcbWritten )
+    {
+        if ( pcbWritten )
+            *pcbWritten = 0;
+
+        if ( m_position > m_size || cb > m_size - m_position )
+            return STG_E_MEDIUMFULL;
+
+        ::CopyMemory( (BYTE*)m_data + m_position, pv, cb );
+        m_position += cb;
+
+        if ( pcbWritten )
+            *pcbWritten = cb;
+
+        return S_OK;
+    }
+
+}; // class CMemoryWriteStream
+
+
+//==============================================================================
+// CTaskMemoryWriteStream
+// CMemoryReadStream that may be written to without limit, growing a block of
+// task memory as it goes, and that hands the block over as a BLOB when done.
+// A blob is so written without an HGLOBAL stream and without copying it at
+// the end.  Memory that hasn't been handed over is freed on destruction.
+// Example:
+//      CTaskMemoryWriteStream  stream;
+//
+//      WriteVariantToStream( &variant, &stream );
+//      stream.Detach( blob );
+//==============================================================================
+
+class CTaskMemoryWriteStream : public CMemoryReadStream
+{
+public:
+    CTaskMemoryWriteStream()
+        :   CMemoryReadStream( NULL, 0 ),
+            m_capacity( 0 ),
+            m_keep( NULL )
+    {
+    }
+
+    // Writes into the memory kept in the blob, whose cbSize is how much there
+    // is of it rather than how much has been written, growing it as needed.
+    // The memory is left in the blob, not freed, for the next stream to
+    // start with.
+    CTaskMemoryWriteStream( BLOB& keep )
+        :   CMemoryReadStream( keep.pBlobData, 0 ),
+            m_capacity( keep.cbSize ),
+            m_keep( &keep )
+    {
+    }
+
+    inline ~CTaskMemoryWriteStream()
+    {
+        if ( !m_keep )
+            ::CoTaskMemFree( (void*)m_data );
+    }
+
+    inline const BYTE* GetData()
+    {
+        return m_data;
+    }
+
+    inline ULONGLONG GetSize()
+    {
+        return m_size;
+    }
+
+    // Makes room for size bytes in all.  A BLOB holds no more than 4 GB.
+    HRESULT Reserve( ULONGLONG size )
+    {
+        BYTE*   data;
+
+        if ( size <= m_capacity )
+            return S_OK;
+        if ( size > 0xFFFFFFFF )
+            return STG_E_MEDIUMFULL;
+
+        data = (BYTE*)::CoTaskMemRealloc( (void*)m_data, (ULONG)size );
+        if ( !data )
+            return E_OUTOFMEMORY;
+
+        m_data = data;
+        m_capacity = size;
+        if ( m_keep )
+        {
+            m_keep->pBlobData = data;
+            m_keep->cbSize = (ULONG)size;
+        }
+
+        return S_OK;
+    }
+
+    // Hands what has been written over to the blob, to be freed with
+    // CoTaskMemFree, and starts again with no memory.  Not for a stream that
+    // keeps its memory.
+    void Detach( BLOB& blob )
+    {
+        blob.cbSize = (ULONG)m_size;
+        blob.pBlobData = m_size ? (BYTE*)m_data : NULL;
+        if ( !m_size )
+            ::CoTaskMemFree( (void*)m_data );
+
+        m_data = NULL;
+        m_size = 0;
+        m_position = 0;
+        m_capacity = 0;
+    }
+
+    STDMETHOD(Write)( const void* pv, ULONG cb, ULONG* pcbWritten )
+    {
+        ULONGLONG   end = m_position + cb;
+        ULONGLONG   capacity;
+        HRESULT     hr;
+
+        if ( pcbWritten )
+            *pcbWritten = 0;
+
+        // Grow by doubling, up to the most a BLOB holds.
+        if ( end > m_capacity )
+        {
+            capacity = m_capacity < 0x100 ? 0x100 : 2 * m_capacity;
+            if ( capacity > 0xFFFFFFFF )
+                capacity = 0xFFFFFFFF;
+            if ( capacity < end )
+                capacity = end;
+
+            hr = Reserve( capacity );
+            if ( FAILED( hr ) )
+                return hr;
+        }
+
+        // Writing past the end after a seek leaves zeros in between.
+        if ( m_position > m_size )
+            ::ZeroMemory( (BYTE*)m_data + m_size, (SIZE_T)( m_position - m_size ) );
+
+        ::CopyMemory( (BYTE*)m_data + m_position, pv, cb );
+        m_position = end;
+        if ( end > m_size )
+            m_size = end;
+
+        if ( pcbWritten )
+            *pcbWritten = cb;
+
+        return S_OK;
+    }
+
+private:
+    ULONGLONG           m_capacity;
+    BLOB*               m_keep;
+
+}; // class CTaskMemoryWriteStream
+
+
+//==============================================================================
+// CAsyncWriteStream
+// Write-only IStream that buffers what is written to it and passes it on to
+// another stream from a background thread, so that the writing thread only
+// waits on the other stream when it gets a whole buffer ahead.  There are two
+// buffers: one being filled while the other is written out, so no more than
+// twice bufferSize is ever held.
+// A failure writing to the other stream is returned by the next call that
+// hands over a buffer, and by Flush, and nothing more is written.  The stream
+// can't seek, except to find how much has been written, so objects that seek
+// while they save can't be written to it.  Like CMemoryReadStream, it is not
+// deleted by its last Release.
+// Example:
+//      CAsyncWriteStream   stream;
+//
+//      stream.Open( pFileStream );
+//      WriteVariantToStream( &variant, &stream );
+//      ... the calling thread is free ...
+//      CheckResult( stream.Flush() );
+//==============================================================================
+
+class CAsyncWriteStream : public IStream
+{
+public:
+    enum { defaultBufferSize = 0x40000 };
+
+    CAsyncWriteStream()
+        :   m_bufferSize( 0 ),
+            m_current( 0 ),
+            m_pending( 0 ),
+            m_written( 0 ),
+            m_thread( NULL ),
+            m_ready( NULL ),
+            m_drained( NULL ),
+            m_stop( false ),
+            m_result( S_OK ),
+            m_failure( S_OK ),
+            m_references( 0 )
+    {
+        m_buffers[0] = NULL;
+        m_buffers[1] = NULL;
+        m_used[0] = 0;
+        m_used[1] = 0;
+    }
+
+    // Writes out what is left and stops the background thread.  Call Flush
+    // first to find out whether everything was written.
+    ~CAsyncWriteStream()
+    {
+        if ( m_thread )
+        {
+            Flush();
+
+            m_stop = true;
+            ::SetEvent( m_ready );
+            ::WaitForSingleObject( m_thread, INFINITE );
+            ::CloseHandle( m_thread );
+        }
+
+        if ( m_ready )
+            ::CloseHandle( m_ready );
+        if ( m_drained )
+            ::CloseHandle( m_drained );
+
+        ::CoTaskMemFree( m_buffers[0] );
+        ::CoTaskMemFree( m_buffers[1] );
+    }
+
+    //------------------------------------------------------------------------------
+    // Open
+    // Starts passing what is written on to the given stream.
+    //------------------------------------------------------------------------------
+
+    void Open( IStream* pStream, ULONG bufferSize = defaultBufferSize )
+    {
+        ValidatePointer( pStream );
+        if ( m_thread || !bufferSize )
+            ThrowError( E_UNEXPECTED );
+
+        m_target = pStream;
+        m_bufferSize = bufferSize;
+
+        m_buffers[0] = (BYTE*)::CoTaskMemAlloc( bufferSize );
+        m_buffers[1] = (BYTE*)::CoTaskMemAlloc( bufferSize );
+        VerifyAllocation( m_buffers[0] );
+        VerifyAllocation( m_buffers[1] );
+
+        // Nothing is being written out yet, so the stream starts drained.
+        m_ready = ::CreateEvent( NULL, FALSE, FALSE, NULL );
+        m_drained = ::CreateEvent( NULL, TRUE, TRUE, NULL );
+        if ( !m_ready || !m_drained )
+            ThrowError( HRESULT_FROM_WIN32( ::GetLastError() ) );
+
+        m_thread = ::CreateThread( NULL, 0, ThreadProc, this, 0, NULL );
+        if ( !m_thread )
+            ThrowError( HRESULT_FROM_WIN32( ::GetLastError() ) );
+    }
+
+    //------------------------------------------------------------------------------
+    // BeginFlush
+    // Starts writing out what has been buffered so far without waiting for
+    // it.  Returns an event that is signaled once it has all been written, or
+    // has failed.  The event belongs to the stream, and is reset by the next
+    // buffer that is written out.
+    //------------------------------------------------------------------------------
+
+    HANDLE BeginFlush()
+    {
+        if ( m_used[m_current] && SUCCEEDED( m_failure ) )
+            Submit();
+
+        return m_drained;
+    }
+
+    //------------------------------------------------------------------------------
+    // Flush
+    // Writes out what has been buffered so far and waits for it.  Returns
+    // the first failure writing to the other stream, if any.
+    //------------------------------------------------------------------------------
+
+    HRESULT Flush()
+    {
+        if ( !m_thread )
+            return E_UNEXPECTED;
+
+        ::WaitForSingleObject( BeginFlush(), INFINITE );
+
+        return m_result;
+    }
+
+    // IUnknown
+    STDMETHOD(QueryInterface)( REFIID iid, void** ppv )
+    {
+        if ( !ppv )
+            return E_POINTER;
+
+        if ( iid == IID_IUnknown || iid == IID_ISequentialStream || iid == IID_IStream )
+        {
+            *ppv = (IStream*)this;
+            AddRef();
+            return S_OK;
+        }
+
+        *ppv = NULL;
+        return E_NOINTERFACE;
+    }
+
+    STDMETHOD_(ULONG, AddRef)()
+    {
+        return ::InterlockedIncrement( &m_references );
+    }
+
+    STDMETHOD_(ULONG, Release)()
+    {
+        return ::InterlockedDecrement( &m_references );
+    }
+
+    // ISequentialStream
+    STDMETHOD(Read)( void*, ULONG, ULONG* )
+    {
+        return STG_E_ACCESSDENIED;
+    }
+
+    STDMETHOD(Write)( const void* pv, ULONG cb, ULONG* pcbWritten )
+    {
+        const BYTE*     data = (const BYTE*)pv;
+        ULONG           left = cb;
+
+        if ( pcbWritten )
+            *pcbWritten = 0;
+
+        if ( !m_thread )
+            return E_UNEXPECTED;
+
+        if ( FAILED( m_failure ) )
+            return m_failure;
+
+        while ( left )
+        {
+            ULONG   piece = m_bufferSize - m_used[m_current];
+
+            if ( piece > left )
+                piece = left;
+
+            ::CopyMemory( m_buffers[m_current] + m_used[m_current], data, piece );
+            m_used[m_current] += piece;
+            data += piece;
+            left -= piece;
+
+            if ( m_used[m_current] == m_bufferSize && FAILED( Submit() ) )
+                return m_failure;
+        }
+
+        m_written += cb;
+
+        if ( pcbWritten )
+            *pcbWritten = cb;
+
+        return S_OK;
+    }
+
+    // IStream
+    STDMETHOD(Seek)( LARGE_INTEGER move, DWORD origin, ULARGE_INTEGER* newPosition )
+    {
+        if ( move.QuadPart || STREAM_SEEK_CUR != origin )
+            return STG_E_INVALIDFUNCTION;
+
+        if ( newPosition )
+            newPosition->QuadPart = m_written;
+
+        return S_OK;
+    }
+
+    STDMETHOD(SetSize)( ULARGE_INTEGER )
+    {
+        return STG_E_INVALIDFUNCTION;
+    }
+
+    STDMETHOD(CopyTo)( IStream*, ULARGE_INTEGER, ULARGE_INTEGER*, ULARGE_INTEGER* )
+    {
+        return E_NOTIMPL;
+    }
+
+    STDMETHOD(Commit)( DWORD flags )
+    {
+        HRESULT     hr = Flush();
+
+        return FAILED( hr ) ? hr : m_target->Commit( flags );
+    }
+
+    STDMETHOD(Revert)()
+    {
+        return S_OK;
+    }
+
+    STDMETHOD(LockRegion)( ULARGE_INTEGER, ULARGE_INTEGER, DWORD )
+    {
+        return STG_E_INVALIDFUNCTION;
+    }
+
+    STDMETHOD(UnlockRegion)( ULARGE_INTEGER, ULARGE_INTEGER, DWORD )
+    {
+        return STG_E_INVALIDFUNCTION;
+    }
+
+    STDMETHOD(Stat)( STATSTG* pstatstg, DWORD )
+    {
+        if ( !pstatstg )
+            return E_POINTER;
+
+        ::ZeroMemory( pstatstg, sizeof( STATSTG ) );
+        pstatstg->type = STGTY_STREAM;
+        pstatstg->cbSize.QuadPart = m_written;
+
+        return S_OK;
+    }
+
+    STDMETHOD(Clone)( IStream** )
+    {
+        return E_NOTIMPL;
+    }
+
+private:
+    // Hands the buffer being filled to the background thread, once it has
+    // finished with the other one, and starts filling the other one.  Fails,
+    // handing nothing over, if writing the other one failed.  The background
+    // thread only sets m_result before signaling m_drained, so it is safe to
+    // look at once m_drained is signaled.
+    HRESULT Submit()
+    {
+        ::WaitForSingleObject( m_drained, INFINITE );
+
+        m_failure = m_result;
+        if ( FAILED( m_failure ) )
+            return m_failure;
+
+        ::ResetEvent( m_drained );
+
+        m_pending = m_current;
+        ::SetEvent( m_ready );
+
+        m_current = 1 - m_current;
+        m_used[m_current] = 0;
+
+        return S_OK;
+    }
+
+    static DWORD WINAPI ThreadProc( void* parameter )
+    {
+        ( (CAsyncWriteStream*)parameter )->Drain();
+        return 0;
+    }
+
+    // Writes out each buffer handed over until told to stop.
+    void Drain()
+    {
+        for ( ;; )
+        {
+            ::WaitForSingleObject( m_ready, INFINITE );
+            if ( m_stop )
+                break;
+
+            ULONG   written = 0;
+            HRESULT hr = m_target->Write( m_buffers[m_pending], m_used[m_pending], &written );
+
+            if ( SUCCEEDED( hr ) && written != m_used[m_pending] )
+                hr = STG_E_MEDIUMFULL;
+            if ( FAILED( hr ) )
+                m_result = hr;
+
+            ::SetEvent( m_drained );
+        }
+    }
+
+private:
+    CComPtr<IStream>    m_target;
+    BYTE*               m_buffers[2];
+    ULONG               m_used[2];
+    ULONG               m_bufferSize;
+    ULONG               m_current;
+    ULONG               m_pending;
+    ULONGLONG           m_written;
+    HANDLE              m_thread;
+    HANDLE              m_ready;
+    HANDLE              m_drained;
+    bool volatile       m_stop;
+    HRESULT             m_result;
+    HRESULT             m_failure;
+    LONG                m_references;
+
+}; // class CAsyncWriteStream
+
+
+//==============================================================================
+// CRingBufferStream
+// IStream through which one thread writes and another reads, such as
+// WriteVariantToStream on a producer thread and ReadVariantFromStream on a
+// consumer, so that encoding and decoding overlap with no buffer in between.
+// Bytes go through a ring buffer of fixed size without locks: each side owns
+// the count of bytes it has moved and only reads the other's.  A writer that
+// fills the ring waits for the reader to make room, and a reader that empties
+// it waits for the writer, so memory stays bounded however far apart they
+// get.
+// The writer calls Close when done, after which reads past what was written
+// come up short, as at the end of any stream.  Either side may call Abort to
+// make the other's reads and writes fail rather than wait forever.  Only one
+// thread may write and one read.  Like CMemoryReadStream, it is not deleted
+// by its last Release.
+// Example:
+//      CRingBufferStream   ring;
+//
+//      ring.Open( 0x10000 );
+//
+//      // Producer thread.
+//      WriteVariantToStream( &variant, &ring );
+//      ring.Close();
+//
+//      // Consumer thread.
+//      ReadVariantFromStream( &ring, variant );
+//==============================================================================
+
+class CRingBufferStream : public IStream
+{
+public:
+    CRingBufferStream()
+        :   m_buffer( NULL ),
+            m_mask( 0 ),
+            m_written( 0 ),
+            m_read( 0 ),
+            m_closed( 0 ),
+            m_aborted( 0 ),
+            m_writerWaiting( 0 ),
+            m_readerWaiting( 0 ),
+            m_spaceReady( NULL ),
+            m_dataReady( NULL ),
+            m_references( 0 )
+    {
+    }
+
+    ~CRingBufferStream()
+    {
+        if ( m_spaceReady )
+            ::CloseHandle( m_spaceReady );
+        if ( m_dataReady )
+            ::CloseHandle( m_dataReady );
+
+        ::CoTaskMemFree( m_buffer );
+    }
+
+    //------------------------------------------------------------------------------
+    // Open
+    // Creates the ring, rounding its size up to a power of two.
+    //------------------------------------------------------------------------------
+
+    void Open( ULONG size )
+    {
+        ULONG   capacity = 16;
+
+        if ( m_buffer || !size || size > 0x40000000 )
+            ThrowError( E_INVALIDARG );
+
+        while ( capacity < size )
+            capacity *= 2;
+
+        m_buffer = (BYTE*)::CoTaskMemAlloc( capacity );
+        VerifyAllocation( m_buffer );
+        m_mask = capacity - 1;
+
+        m_spaceReady = ::CreateEvent( NULL, FALSE, FALSE, NULL );
+        m_dataReady = ::CreateEvent( NULL, FALSE, FALSE, NULL );
+        if ( !m_spaceReady || !m_dataReady )
+            ThrowError( HRESULT_FROM_WIN32( ::GetLastError() ) );
+    }
+
+    // Called by the writer once everything has been written.
+    void Close()
+    {
+        ::InterlockedExchange( &m_closed, 1 );
+        ::SetEvent( m_dataReady );
+    }
+
+    // Called by either side to give up.
+    void Abort()
+    {
+        ::InterlockedExchange( &m_aborted, 1 );
+        ::SetEvent( m_spaceReady );
+        ::SetEvent( m_dataReady );
+    }
+
+    // IUnknown
+    STDMETHOD(QueryInterface)( REFIID iid, void** ppv )
+    {
+        if ( !ppv )
+            return E_POINTER;
+
+        if ( iid == IID_IUnknown || iid == IID_ISequentialStream || iid == IID_IStream )
+        {
+            *ppv = (IStream*)this;
+            AddRef();
+            return S_OK;
+        }
+
+        *ppv = NULL;
+        return E_NOINTERFACE;
+    }
+
+    STDMETHOD_(ULONG, AddRef)()
+    {
+        return ::InterlockedIncrement( &m_references );
+    }
+
+    STDMETHOD_(ULONG, Release)()
+    {
+        return ::InterlockedDecrement( &m_references );
+    }
+
+    // ISequentialStream
+    // Reads cb bytes, waiting for the writer as needed.  Comes up short only
+    // once the writer has closed the stream.
+    STDMETHOD(Read)( void* pv, ULONG cb, ULONG* pcbRead )
+    {
+        BYTE*       data = (BYTE*)pv;
+        ULONG       done = 0;
+
+        if ( pcbRead )
+            *pcbRead = 0;
+
+        if ( !m_buffer )
+            return E_UNEXPECTED;
+
+        while ( done < cb )
+        {
+            ULONG   read = Load( m_read );
+            ULONG   used = Load( m_written ) - read;
+            ULONG   offset = read & m_mask;
+            ULONG   piece = cb - done;
+
+            if ( Load( m_aborted ) )
+                return E_ABORT;
+
+            if ( !used )
+            {
+                // Check for data once more after saying that we are waiting,
+                // so that the writer can't slip some in unseen in between.
+                ::InterlockedExchange( &m_readerWaiting, 1 );
+                if ( Load( m_written ) == read && !Load( m_aborted ) )
+                {
+                    if ( Load( m_closed ) )
+                    {
+                        ::InterlockedExchange( &m_readerWaiting, 0 );
+                        break;
+                    }
+
+                    ::WaitForSingleObject( m_dataReady, INFINITE );
+                }
+                ::InterlockedExchange( &m_readerWaiting, 0 );
+                continue;
+            }
+
+            // As much as can be copied in one piece, up to the end of the
+            // buffer.
+            if ( piece > used )
+                piece = used;
+            if ( piece > m_mask + 1 - offset )
+                piece = m_mask + 1 - offset;
+
+            ::CopyMemory( data + done, m_buffer + offset, piece );
+            done += piece;
+            Store( m_read, read + piece );
+
+            if ( ::InterlockedExchange( &m_writerWaiting, 0 ) )
+                ::SetEvent( m_spaceReady );
+        }
+
+        if ( pcbRead )
+            *pcbRead = done;
+
+        return done == cb ? S_OK : S_FALSE;
+    }
+
+    // Writes cb bytes, waiting for the reader to make room as needed.
+    STDMETHOD(Write)( const void* pv, ULONG cb, ULONG* pcbWritten )
+    {
+        const BYTE*     data = (const BYTE*)pv;
+        ULONG           done = 0;
+
+        if ( pcbWritten )
+            *pcbWritten = 0;
+
+        if ( !m_buffer )
+            return E_UNEXPECTED;
+        if ( Load( m_closed ) )
+            return STG_E_ACCESSDENIED;
+
+        while ( done < cb )
+        {
+            ULONG   written = Load( m_written );
+            ULONG   free = m_mask + 1 - ( written - Load( m_read ) );
+            ULONG   offset = written & m_mask;
+            ULONG   piece = cb - done;
+
+            if ( Load( m_aborted ) )
+                return E_ABORT;
+
+            if ( !free )
+            {
+                ::InterlockedExchange( &m_writerWaiting, 1 );
+                if ( Load( m_read ) + m_mask + 1 == written && !Load( m_aborted ) )
+                    ::WaitForSingleObject( m_spaceReady, INFINITE );
+                ::InterlockedExchange( &m_writerWaiting, 0 );
+                continue;
+            }
+
+            if ( piece > free )
+                piece = free;
+            if ( piece > m_mask + 1 - offset )
+                piece = m_mask + 1 - offset;
+
+            ::CopyMemory( m_buffer + offset, data + done, piece );
+            done += piece;
+            Store( m_written, written + piece );
+
+            if ( pcbWritten )
+                *pcbWritten = done;
+
+            if ( ::InterlockedExchange( &m_readerWaiting, 0 ) )
+                ::SetEvent( m_dataReady );
+        }
+
+        return S_OK;
+    }
+
+    // IStream
+    STDMETHOD(Seek)( LARGE_INTEGER, DWORD, ULARGE_INTEGER* )
+    {
+        return STG_E_INVALIDFUNCTION;
+    }
+
+    STDMETHOD(SetSize)( ULARGE_INTEGER )
+    {
+        return STG_E_INVALIDFUNCTION;
+    }
+
+    STDMETHOD(CopyTo)( IStream*, ULARGE_INTEGER, ULARGE_INTEGER*, ULARGE_INTEGER* )
+    {
+        return E_NOTIMPL;
+    }
+
+    STDMETHOD(Commit)( DWORD )
+    {
+        return S_OK;
+    }
+
+    STDMETHOD(Revert)()
+    {
+        return S_OK;
+    }
+
+    STDMETHOD(LockRegion)( ULARGE_INTEGER, ULARGE_INTEGER, DWORD )
+    {
+        return STG_E_INVALIDFUNCTION;
+    }
+
+    STDMETHOD(UnlockRegion)( ULARGE_INTEGER, ULARGE_INTEGER, DWORD )
+    {
+        return STG_E_INVALIDFUNCTION;
+    }
+
+    STDMETHOD(Stat)( STATSTG* pstatstg, DWORD )
+    {
+        if ( !pstatstg )
+            return E_POINTER;
+
+        ::ZeroMemory( pstatstg, sizeof( STATSTG ) );
+        pstatstg->type = STGTY_STREAM;
+
+        return S_OK;
+    }
+
+    STDMETHOD(Clone)( IStream** )
+    {
+        return E_NOTIMPL;
+    }
+
+private:
+    // Counts shared between the threads are read and written with interlocked
+    // calls, which order them with the copies into and out of the ring.
+    static inline ULONG Load( LONG volatile& value )
+    {
+        return (ULONG)::InterlockedExchangeAdd( &value, 0 );
+    }
+
+    static inline void Store( LONG volatile& value, ULONG newValue )
+    {
+        ::InterlockedExchange( &value, (LONG)newValue );
+    }
+
+private:
+    BYTE*               m_buffer;
+    ULONG               m_mask;
+    LONG volatile       m_written;
+    LONG volatile       m_read;
+    LONG volatile       m_closed;
+    LONG volatile       m_aborted;
+    LONG volatile       m_writerWaiting;
+    LONG volatile       m_readerWaiting;
+    HANDLE              m_spaceReady;
+    HANDLE              m_dataReady;
+    LONG                m_references;
+
+}; // class CRingBufferStream
+
+
+//==============================================================================
+// CAsyncOperation, CAsyncExecutor, CAsyncCompletion
+// An asynchronous operation goes as far as it can without waiting, then
+// leaves itself with whatever it is waiting on, which posts it to the
+// executor it was given once it may be able to go on.  The executor calls
+// Resume from wherever it runs things, such as a thread pool or an event
+// loop.  An operation reports that it is done through a CAsyncCompletion.
+//==============================================================================
+
+class CAsyncOperation
+{
+public:
+    virtual void Resume() = 0;
+
+}; // class CAsyncOperation
+
+
+class CAsyncExecutor
+{
+public:
+    // Arranges for the operation to be resumed later, never before returning.
+    virtual void Post( CAsyncOperation* operation ) = 0;
+
+}; // class CAsyncExecutor
+
+
+class CAsyncCompletion
+{
+public:
+    virtual void OnComplete( HRESULT hr ) = 0;
+
+}; // class CAsyncCompletion
+
+
+//==============================================================================
+// CAsyncByteStream
+// Source and sink of bytes that never blocks.  ReadSome and WriteSome move
+// whatever can be moved right away, and if that is nothing return E_PENDING,
+// having taken note of the operation to post to the executor once something
+// can.  ReadSome returns S_FALSE, reading nothing, at the end of the data.
+//==============================================================================
+
+class CAsyncByteStream
+{
+public:
+    virtual HRESULT ReadSome(   void*               pv,
+                                ULONG               cb,
+                                ULONG&              read,
+                                CAsyncOperation*    waiter,
+                                CAsyncExecutor*     executor ) = 0;
+
+    virtual HRESULT WriteSome(  const void*         pv,
+                                ULONG               cb,
+                                ULONG&              written,
+                                CAsyncOperation*    waiter,
+                                CAsyncExecutor*     executor ) = 0;
+
+}; // class CAsyncByteStream
+
+
+//==============================================================================
+// CAsyncPipe
+// CAsyncByteStream whose writes are read back from a buffer of fixed size, so
+// that a writer that gets ahead waits for the reader.  Close once everything
+// is written, so the reader sees the end.  One operation at a time may wait
+// to read and one to write, and all calls must come from the thread, or the
+// executors, that the operations run on.
+// Example:
+//      CAsyncPipe  pipe;
+//
+//      pipe.Open( 0x1000 );
+//      writer.BeginWrite( variant, &pipe, &executor, &writeDone );
+//      reader.BeginRead( &pipe, &executor, &readDone );
+//==============================================================================
+
+class CAsyncPipe : public CAsyncByteStream
+{
+public:
+    CAsyncPipe()
+        :   m_buffer( NULL ),
+            m_capacity( 0 ),
+            m_start( 0 ),
+            m_used( 0 ),
+            m_isClosed( false ),
+            m_reader( NULL ),
+            m_readerExecutor( NULL ),
+            m_writer( NULL ),
+            m_writerExecutor( NULL )
+    {
+    }
+
+    inline ~CAsyncPipe()
+    {
+        ::CoTaskMemFree( m_buffer );
+    }
+
+    void Open( ULONG capacity )
+    {
+        if ( m_buffer || !capacity )
+            ThrowError( E_INVALIDARG );
+
+        m_buffer = (BYTE*)::CoTaskMemAlloc( capacity );
+        VerifyAllocation( m_buffer );
+        m_capacity = capacity;
+    }
+
+    // Called by the writer once everything has been written.
+    void Close()
+    {
+        m_isClosed = true;
+        Wake( m_reader, m_readerExecutor );
+    }
+
+    virtual HRESULT ReadSome(   void*               pv,
+                                ULONG               cb,
+                                ULONG&              read,
+                                CAsyncOperation*    waiter,
+                                CAsyncExecutor*     executor )
+    {
+        read = 0;
+
+        if ( !m_buffer )
+            return E_UNEXPECTED;
+
+        if ( !m_used )
+        {
+            if ( m_isClosed )
+                return S_FALSE;
+
+            m_reader = waiter;
+            m_readerExecutor = executor;
+            return E_PENDING;
+        }
+
+        // Up to two pieces, either side of the end of the buffer.
+        while ( read < cb && m_used )
+        {
+            ULONG   piece = cb - read;
+
+            if ( piece > m_used )
+                piece = m_used;
+            if ( piece > m_capacity - m_start )
+                piece = m_capacity - m_start;
+
+            ::CopyMemory( (BYTE*)pv + read, m_buffer + m_start, piece );
+            read += piece;
+            m_used -= piece;
+            m_start = ( m_start + piece ) % m_capacity;
+        }
+
+        Wake( m_writer, m_writerExecutor );
+
+        return S_OK;
+    }
+
+    virtual HRESULT WriteSome(  const void*         pv,
+                                ULONG               cb,
+                                ULONG&              written,
+                                CAsyncOperation*    waiter,
+                                CAsyncExecutor*     executor )
+    {
+        written = 0;
+
+        if ( !m_buffer )
+            return E_UNEXPECTED;
+        if ( m_isClosed )
+            return STG_E_ACCESSDENIED;
+
+        if ( m_used == m_capacity )
+        {
+            m_writer = waiter;
+            m_writerExecutor = executor;
+            return E_PENDING;
+        }
+
+        while ( written < cb && m_used < m_capacity )
+        {
+            ULONG   end = ( m_start + m_used ) % m_capacity;
+            ULONG   piece = cb - written;
+
+            if ( piece > m_capacity - m_used )
+                piece = m_capacity - m_used;
+            if ( piece > m_capacity - end )
+                piece = m_capacity - end;
+
+            ::CopyMemory( m_buffer + end, (const BYTE*)pv + written, piece );
+            written += piece;
+            m_used += piece;
+        }
+
+        Wake( m_reader, m_readerExecutor );
+
+        return S_OK;
+    }
+
+private:
+    // Posts the operation waiting on the other end, if there is one.
+    static void Wake( CAsyncOperation*& waiter, CAsyncExecutor*& executor )
+    {
+        CAsyncOperation*    operation = waiter;
+
+        if ( !operation )
+            return;
+
+        waiter = NULL;
+        executor->Post( operation );
+    }
+
+private:
+    BYTE*               m_buffer;
+    ULONG               m_capacity;
+    ULONG               m_start;
+    ULONG               m_used;
+    bool                m_isClosed;
+    CAsyncOperation*    m_reader;
+    CAsyncExecutor*     m_readerExecutor;
+    CAsyncOperation*    m_writer;
+    CAsyncExecutor*     m_writerExecutor;
+
+}; // class CAsyncPipe
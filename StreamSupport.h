@@ -1,32 +1,97 @@
-#pragma once
-
-
-//------------------------------------------------------------------------------
-// Constants
-//------------------------------------------------------------------------------
-
-const LARGE_INTEGER   largeZero = { 0 };
-
-
-//------------------------------------------------------------------------------
-// Creates an IStream object that owns the data in memory.
-//------------------------------------------------------------------------------
-
-inline HRESULT CreateMemoryStream( IStream** ppStream )
-{
-    return CreateStreamOnHGlobal( NULL, TRUE, ppStream );
-
-} // CreateMemoryStream
-
-
-//------------------------------------------------------------------------------
-// Rewinds the given IStream
-//------------------------------------------------------------------------------
-
-inline HRESULT RewindStream( IStream* pStream )
-{
-   return pStream->Seek( largeZero, STREAM_SEEK_SET, NULL );
-
-} // RewindStream
-
-
+#pragma once
+
+#include <shlwapi.h>
+
+
+//------------------------------------------------------------------------------
+// Constants
+//------------------------------------------------------------------------------
+
+const LARGE_INTEGER   largeZero = { 0 };
+
+
+//------------------------------------------------------------------------------
+// Makes the call, setting hr to the HRESULT of the error if it raises one
+// through ThrowError, rather than letting it be raised.  Anything else, such
+// as an access violation or a real stack overflow, is still raised, so a test
+// expecting a failure can't pass on a crash.  hr is left alone if the call
+// succeeds.  The call can't construct objects with destructors here; put
+// them in a function of their own and call that.
+// Example:
+//      HRESULT     hr = S_OK;
+//
+//      TryStreamCall( ReadVariantFromStream( pStream, variant ), hr );
+//
+//      return hr;
+//------------------------------------------------------------------------------
+
+#define TryStreamCall(_call, _hr) __try { _call; } __except( FilterStreamError( GetExceptionInformation(), _hr ) ) {}
+
+
+//------------------------------------------------------------------------------
+// Creates an IStream object that owns the data in memory.
+//------------------------------------------------------------------------------
+
+inline HRESULT CreateMemoryStream( IStream** ppStream )
+{
+    return CreateStreamOnHGlobal( NULL, TRUE, ppStream );
+
+} // CreateMemoryStream
+
+
+//------------------------------------------------------------------------------
+// Rewinds the given IStream
+//------------------------------------------------------------------------------
+
+inline HRESULT RewindStream( IStream* pStream )
+{
+   return pStream->Seek( largeZero, STREAM_SEEK_SET, NULL );
+
+} // RewindStream
+
+
+//------------------------------------------------------------------------------
+// Creates an IStream object on a temporary file, which is deleted when the
+// stream is released.  Used for streams too large to keep in memory.
+//------------------------------------------------------------------------------
+
+inline HRESULT CreateTempFileStream( IStream** ppStream )
+{
+    WCHAR   path[MAX_PATH];
+    WCHAR   file[MAX_PATH];
+
+    if ( !::GetTempPathW( MAX_PATH, path ) || !::GetTempFileNameW( path, L"vst", 0, file ) )
+        return HRESULT_FROM_WIN32( ::GetLastError() );
+
+    return ::SHCreateStreamOnFileEx( file,
+                                     STGM_CREATE | STGM_READWRITE | STGM_SHARE_EXCLUSIVE,
+                                     FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE,
+                                     TRUE,
+                                     NULL,
+                                     ppStream );
+
+} // CreateTempFileStream
+
+
+//------------------------------------------------------------------------------
+// Verifies that the two variants stream the same bytes.
+//------------------------------------------------------------------------------
+
+inline HRESULT VerifySame( VARIANT& variant1, VARIANT& variant2 )
+{
+    BLOB        blob1;
+    BLOB        blob2;
+    HRESULT     hr = S_OK;
+
+    WriteVariantToBlob( variant1, blob1 );
+    WriteVariantToBlob( variant2, blob2 );
+
+    if ( blob1.cbSize != blob2.cbSize || 0 != memcmp( blob1.pBlobData, blob2.pBlobData, blob1.cbSize ) )
+        hr = E_UNEXPECTED;
+
+    ::CoTaskMemFree( blob1.pBlobData );
+    ::CoTaskMemFree( blob2.pBlobData );
+
+    return hr;
+
+} // VerifySame
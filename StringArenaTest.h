@@ -0,0 +1,285 @@
+#pragma once
+
+#include "StreamSupport.h"
+#include "Benchmark.h"
+#include "ParallelReadTest.h"
+
+
+//==============================================================================
+// CFailingReadStream
+// Stream on a block of memory whose reads of more than 8 bytes at a time
+// fail with the given HRESULT, as a file or pipe might part way through a
+// string.  The reads of a variant's header are all smaller.
+//==============================================================================
+
+class CFailingReadStream : public CMemoryReadStream
+{
+public:
+    CFailingReadStream( const void* data, ULONGLONG size, HRESULT failure )
+        :   CMemoryReadStream( data, size ),
+            m_failure( failure )
+    {
+    }
+
+    STDMETHOD(Read)( void* pv, ULONG cb, ULONG* pcbRead )
+    {
+        if ( cb <= 8 )
+            return CMemoryReadStream::Read( pv, cb, pcbRead );
+
+        if ( pcbRead )
+            *pcbRead = 0;
+
+        return m_failure;
+    }
+
+private:
+    HRESULT     m_failure;
+
+}; // class CFailingReadStream
+
+
+class CStringArenaTest
+{
+public:
+
+    //------------------------------------------------------------------------------
+    // Creates an array of count strings of 1 to 40 characters.
+    //------------------------------------------------------------------------------
+
+    static HRESULT GetStrings( ULONG count, VARIANT& variant )
+    {
+        CComVector<BSTR>        a( count );
+        CComVectorData<BSTR>    rg( a );
+        WCHAR                   text[48];
+        if ( !rg )
+            HR( E_UNEXPECTED );
+
+        for( ULONG i = 0; i < count; ++i )
+        {
+            ULONG   length = 1 + i % 40;
+
+            for( ULONG j = 0; j < length; ++j )
+                text[j] = (WCHAR)( L'a' + ( i + j ) % 26 );
+            text[length] = L'\0';
+
+            rg[i] = ::SysAllocString( text );
+            if ( !rg[i] )
+                HR( E_OUTOFMEMORY );
+        }
+
+        variant.vt = VT_BSTR | VT_ARRAY;
+        variant.parray = a.Detach();
+
+        return S_OK;
+
+    } // GetStrings
+
+
+    //------------------------------------------------------------------------------
+    // Compares a decoded variant with the one it was encoded from.
+    //------------------------------------------------------------------------------
+
+    static HRESULT VerifyDecoded( VARIANT& expected, CDecodedVariant& decoded )
+    {
+        VARIANT     view = decoded.GetVariant();
+
+        return VerifySame( expected, view );
+
+    } // VerifyDecoded
+
+
+    //------------------------------------------------------------------------------
+    // Decodes into the decoded variant, reporting failure rather than raising
+    // it.
+    //------------------------------------------------------------------------------
+
+    static HRESULT TryDecode( CVariantDecoder& decoder, const void* data, ULONG size, CDecodedVariant& decoded )
+    {
+        HRESULT     hr = S_OK;
+
+        TryStreamCall( decoder.Decode( data, size, decoded ), hr );
+
+        return hr;
+
+    } // TryDecode
+
+
+    //------------------------------------------------------------------------------
+    // Reads a variant from the stream, returning the failure rather than
+    // raising it.
+    //------------------------------------------------------------------------------
+
+    static HRESULT TryRead( IStream* pStream, VARIANT& variant )
+    {
+        HRESULT     hr = S_OK;
+
+        TryStreamCall( ReadVariantFromStream( pStream, variant ), hr );
+
+        return hr;
+
+    } // TryRead
+
+
+    //------------------------------------------------------------------------------
+    // Test decoding strings into an arena, alone, in arrays and nested in
+    // arrays of variants, and copying them out.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Test()
+    {
+        CComVariant         mixed;
+        CComVariant         strings;
+        CComVariant         text = L"some text";
+        CComVariant         empty = L"";
+        CComVariant         copy;
+        CComBSTR            large( 100000 );
+        CVariantEncoder     encoder;
+        CVariantDecoder     decoder;
+        CDecodedVariant     decoded;
+        BSTR                first;
+        const BYTE*         data;
+        ULONG               size;
+        HRESULT             hr = S_OK;
+
+        HR( CParallelReadTest::GetMixedArray( mixed ) );
+        HR( GetStrings( 5000, strings ) );
+
+        data = encoder.Encode( mixed, size );
+        decoder.Decode( data, size, decoded );
+        if ( FAILED( VerifyDecoded( mixed, decoded ) ) )
+            hr = E_UNEXPECTED;
+
+        // A copy has strings of its own, which may be freed.
+        decoded.CopyTo( copy );
+        decoded.Clear();
+        if ( FAILED( VerifySame( mixed, copy ) ) )
+            hr = E_UNEXPECTED;
+        copy.Clear();
+
+        // Decoding again reuses the arena's memory.
+        data = encoder.Encode( strings, size );
+        decoder.Decode( data, size, decoded );
+        first = ( (BSTR*)decoded.GetVariant().parray->pvData )[0];
+        if ( FAILED( VerifyDecoded( strings, decoded ) ) )
+            hr = E_UNEXPECTED;
+        if ( ::SysStringLen( ( (BSTR*)decoded.GetVariant().parray->pvData )[39] ) != 40 )
+            hr = E_UNEXPECTED;
+
+        decoder.Decode( data, size, decoded );
+        if ( ( (BSTR*)decoded.GetVariant().parray->pvData )[0] != first )
+            hr = E_UNEXPECTED;
+
+        // Single strings, one larger than an arena block.
+        for( ULONG i = 0; i < 100000; ++i )
+            large.m_str[i] = L'x';
+        copy = large.m_str;
+
+        data = encoder.Encode( text, size );
+        decoder.Decode( data, size, decoded );
+        if ( FAILED( VerifyDecoded( text, decoded ) ) )
+            hr = E_UNEXPECTED;
+
+        data = encoder.Encode( empty, size );
+        decoder.Decode( data, size, decoded );
+        if ( FAILED( VerifyDecoded( empty, decoded ) ) )
+            hr = E_UNEXPECTED;
+
+        data = encoder.Encode( copy, size );
+        decoder.Decode( data, size, decoded );
+        if ( FAILED( VerifyDecoded( copy, decoded ) ) )
+            hr = E_UNEXPECTED;
+        copy.Clear();
+
+        // A decode that fails part way leaves what it read to be cleared.
+        data = encoder.Encode( mixed, size );
+        if ( E_FAIL != TryDecode( decoder, data, size - 3, decoded ) )
+            hr = E_UNEXPECTED;
+        decoded.Clear();
+
+        // A stream that fails part way through a string fails the read with
+        // its own HRESULT.
+        data = encoder.Encode( text, size );
+        {
+            CFailingReadStream  failing( data, size, E_ABORT );
+
+            if ( E_ABORT != TryRead( &failing, copy ) )
+                hr = E_UNEXPECTED;
+        }
+
+        // Plain decoding still makes BSTRs.
+        data = encoder.Encode( strings, size );
+        decoder.Decode( data, size, copy );
+        if ( FAILED( VerifySame( strings, copy ) ) )
+            hr = E_UNEXPECTED;
+
+        return hr;
+
+    } // Test
+
+
+    //------------------------------------------------------------------------------
+    // Time decoding 100000 strings, in an array and as small variants, into
+    // BSTRs and into an arena.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Benchmark()
+    {
+        ULONG const         count = 100000;
+        ULONG const         iterations = 20;
+        CComVariant         strings;
+        CComVariant         small = L"a short string";
+        CVariantEncoder     encoder;
+        CVariantDecoder     decoder;
+        CDecodedVariant     decoded;
+        BLOB                array;
+        BLOB                single;
+        CBenchmarkTimer     timer;
+        ULONG               time;
+
+        HR( GetStrings( count, strings ) );
+        encoder.Encode( strings, array );
+        encoder.Encode( small, single );
+
+        timer.Start();
+        for( ULONG i = 0; i < iterations; ++i )
+        {
+            CComVariant     copy;
+
+            decoder.Decode( array, copy );
+        }
+        time = timer.ElapsedMicroseconds();
+        ReportBenchmark( "decode 100000 strings into BSTRs", iterations, time );
+
+        timer.Start();
+        for( ULONG j = 0; j < iterations; ++j )
+            decoder.Decode( array, decoded );
+        decoded.Clear();
+        time = timer.ElapsedMicroseconds();
+        ReportBenchmark( "decode 100000 strings into an arena", iterations, time );
+
+        timer.Start();
+        for( ULONG k = 0; k < count; ++k )
+        {
+            CComVariant     copy;
+
+            decoder.Decode( single, copy );
+        }
+        time = timer.ElapsedMicroseconds();
+        ReportBenchmark( "decode 100000 strings a blob each into BSTRs", count, time );
+
+        timer.Start();
+        for( ULONG m = 0; m < count; ++m )
+            decoder.Decode( single, decoded );
+        decoded.Clear();
+        time = timer.ElapsedMicroseconds();
+        ReportBenchmark( "decode 100000 strings a blob each into an arena", count, time );
+
+        ::CoTaskMemFree( array.pBlobData );
+        ::CoTaskMemFree( single.pBlobData );
+
+        return S_OK;
+
+    } // Benchmark
+
+
+}; // class CStringArenaTest
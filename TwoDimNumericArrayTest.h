@@ -0,0 +1,130 @@
+#pragma once
+
+#include "StreamSupport.h"
+
+template< class T, VARTYPE VAR_T>
+class CTwoDimNumericArrayTest
+{
+public:
+
+    //------------------------------------------------------------------------------
+    // Creates a 3 x 4 array, with non-zero lower bounds, whose elements are
+    // numbered in memory order.
+    //------------------------------------------------------------------------------
+
+    static HRESULT GetArrayOfTwelveNumbers( SAFEARRAY*& safearray )
+    {
+        SAFEARRAYBOUND  bounds[2] = { { 3, 1 }, { 4, -2 } };
+        T*              data;
+
+        safearray = SafeArrayCreate( VAR_T, 2, bounds );
+        if ( !safearray )
+            HR( E_OUTOFMEMORY );
+
+        HR( SafeArrayAccessData( safearray, (void**)&data ) );
+        for( int i = 0; i < 12; ++i )
+            data[i] = (T)i;
+        HR( SafeArrayUnaccessData( safearray ) );
+
+        return S_OK;
+
+    } // GetArrayOfTwelveNumbers
+
+
+    //------------------------------------------------------------------------------
+    // Verifies that the given two arrays of T have the same shape and content
+    //------------------------------------------------------------------------------
+
+    static HRESULT VerifyArrayOfTwelveNumbers( SAFEARRAY* array1, SAFEARRAY* array2 )
+    {
+        if ( array1->cDims != array2->cDims )
+            HR( E_UNEXPECTED );
+
+        for( int dimension = 0; dimension < array1->cDims; ++dimension )
+        {
+            if ( array1->rgsabound[dimension].lLbound != array2->rgsabound[dimension].lLbound )
+                HR( E_UNEXPECTED );
+            if ( array1->rgsabound[dimension].cElements != array2->rgsabound[dimension].cElements )
+                HR( E_UNEXPECTED );
+        }
+
+        if ( 0 != memcmp( array1->pvData, array2->pvData, 12 * sizeof( T ) ) )
+            HR( E_UNEXPECTED );
+
+        return S_OK;
+
+    } // VerifyArrayOfTwelveNumbers
+
+
+    //------------------------------------------------------------------------------
+    // Verifies that the elements at the end of the stream are in the order the
+    // array's indexes are walked, the same as when they are streamed one at a
+    // time.
+    //------------------------------------------------------------------------------
+
+    static HRESULT VerifyElementOrder( SAFEARRAY* safearray, IStream* pStream )
+    {
+        LARGE_INTEGER   offset;
+        bool            more = true;
+        long*           index = NULL;
+
+        offset.QuadPart = -(LONGLONG)( 12 * sizeof( T ) );
+        HR( pStream->Seek( offset, STREAM_SEEK_END, NULL ) );
+
+        VariantStreaming::CWalkSafeArrayElements  walk( safearray );
+
+        while( more )
+        {
+            T       expected;
+            T       streamed;
+            ULONG   read;
+
+            walk.GetIndex( index );
+            HR( SafeArrayGetElement( safearray, index, &expected ) );
+            HR( pStream->Read( &streamed, sizeof( streamed ), &read ) );
+
+            if ( read != sizeof( streamed ) || expected != streamed )
+                HR( E_UNEXPECTED );
+
+            walk.Next( more );
+        }
+
+        return S_OK;
+
+    } // VerifyElementOrder
+
+
+    //------------------------------------------------------------------------------
+    // Test a two dimensional array of numbers
+    //------------------------------------------------------------------------------
+
+    static HRESULT Test()
+    {
+        CComVariant         v1 = 0;
+        CComVariant         v2 = 0;
+        CComPtr<IStream>    pStream;
+
+        // Get a 3 x 4 array of the numbers 0, 1, 2, etc.
+        v1.vt = VAR_T | VT_ARRAY;
+        HR( GetArrayOfTwelveNumbers( v1.parray ) );
+
+        // Create a memory stream.
+        HR( CreateMemoryStream( &pStream ) );
+
+        // Write out the variant to the stream, rewind the stream and read it back into another variant.
+        WriteVariantToStream( &v1, pStream );
+        HR( RewindStream( pStream ) );
+        ReadVariantFromStream( pStream, v2 );
+
+        // Verify that the new array is the same as the old.
+        HR( VerifyArrayOfTwelveNumbers( v1.parray, v2.parray ) );
+
+        // Verify the streamed order of the elements.
+        HR( VerifyElementOrder( v1.parray, pStream ) );
+
+        return S_OK;
+
+    } // Test
+
+
+}; // class CTwoDimNumericArrayTest
@@ -1,162 +1,365 @@
-#include <atlbase.h>
-#include "VariantStream.h"
-#include "comvector.h"
-#include "OneDimStringArrayTest.h"
-#include "OneDimNumericArrayTest.h"
-#include "OneDimVariantArrayTest.h"
-#include "NumericTest.h"
-#include "NonValuetest.h"
-
-#pragma warning( disable: 4711 )
-
-#import "msado15.tlb"               \
-    rename("EOF", "EndOfFile"),     \
-    named_guids,                    \
-    no_implementation,              \
-    raw_interfaces_only,            \
-    raw_method_prefix(""),          \
-    raw_native_types,               \
-    no_namespace
-
-#include "ObjectTest.h"
-
-
-//------------------------------------------------------------------------------
-// TestArrays
-//------------------------------------------------------------------------------
-
-static HRESULT TestArrays()
-{
-    HRESULT hr;
-
-    // Test a one dimensional array of strings
-    HR( COneDimStringArrayTest::Test() );
-
-    // Test a one dimensional array of various types.
-    hr = COneDimNumericArrayTest<SCODE, VT_ERROR>::Test();
-    HR( hr );
-
-    hr = COneDimNumericArrayTest<long, VT_I4>::Test();
-    HR( hr );
-
-    hr = COneDimNumericArrayTest<BYTE, VT_UI1>::Test();
-    HR( hr );
-
-    hr = COneDimNumericArrayTest<short, VT_I2>::Test();
-    HR( hr );
-
-    hr = COneDimNumericArrayTest<double, VT_R8>::Test();
-    HR( hr );
-
-    hr = COneDimNumericArrayTest<DATE, VT_DATE>::Test();
-    HR( hr );
-
-    hr = COneDimNumericArrayTest<float, VT_R4>::Test();
-    HR( hr );
-
-    hr = COneDimVariantArrayTest::Test();
-    HR( hr );
-
-    return S_OK;
-
-} // TestArrays
-
-
-//------------------------------------------------------------------------------
-// TestNonArrays
-//------------------------------------------------------------------------------
-
-static HRESULT TestNonArrays()
-{
-    // Test various types.
-    HR( CNumericTest<CComBSTR>::Test() );
-    HR( CNumericTest<SCODE>::Test() );
-    HR( CNumericTest<long>::Test() );
-    HR( CNumericTest<BYTE>::Test() );
-    HR( CNumericTest<short>::Test() );
-    HR( CNumericTest<double>::Test() );
-    HR( CNumericTest<DATE>::Test() );
-    HR( CNumericTest<float>::Test() );
-
-    return S_OK;
-
-} // TestNonArrays
-
-
-//------------------------------------------------------------------------------
-// TestNonValueTypes
-//------------------------------------------------------------------------------
-
-static HRESULT TestNonValueTypes()
-{
-    // Test various types.
-    HR( CNonValueTest::Test( VT_EMPTY ) );
-    HR( CNonValueTest::Test( VT_NULL ) );
-
-    return S_OK;
-
-} // TestNonValueTypes
-
-
-//------------------------------------------------------------------------------
-// TestNonArrays
-//------------------------------------------------------------------------------
-
-static HRESULT TestObject()
-{
-    return CObjectTest::Test();
-
-} // TestObject
-
-
-//------------------------------------------------------------------------------
-// Start
-//------------------------------------------------------------------------------
-
-HRESULT Start()
-{
-    // Test non-array access.
-    HR( TestNonArrays() );
-
-    HR( TestNonValueTypes() );
-
-    // Test arrays
-    HR( TestArrays() );
-
-    // Test object access
-    return TestObject();
-
-} // Start
-
-
-//------------------------------------------------------------------------------
-// main
-//------------------------------------------------------------------------------
-
-int WINAPI WinMain( HINSTANCE, HINSTANCE, LPSTR, int )
-{
-    LPCTSTR     msg;
-    HRESULT     hr;
-
-    ::CoInitialize( NULL );
-
-    hr = Start();
-    if ( SUCCEEDED( hr ) )
-    {
-        if ( S_FALSE == hr )
-            msg = _T( "All tests successful except for object streaming -- Coult not create test ADO Recordset." );
-        else
-            msg = _T( "All tests successful" );
-    }
-    else
-    {
-        msg = _T( "Failed" );
-    }
-
-    ::MessageBox( 0, msg, _T( "" ), 0 );
-
-    ::CoUninitialize();
-
-    return 0;
-
-} // main
+#include <atlbase.h>
+#include "VariantStream.h"
+#include "comvector.h"
+#include "OneDimStringArrayTest.h"
+#include "OneDimNumericArrayTest.h"
+#include "OneDimVariantArrayTest.h"
+#include "TwoDimNumericArrayTest.h"
+#include "LargeArrayTest.h"
+#include "NestedArrayTest.h"
+#include "ArrayWriterTest.h"
+#include "VisitorTest.h"
+#include "ViewTest.h"
+#include "SliceTest.h"
+#include "ParallelReadTest.h"
+#include "ParallelWriteTest.h"
+#include "AsyncWriteTest.h"
+#include "RingBufferTest.h"
+#include "PushReaderTest.h"
+#include "AsyncVariantTest.h"
+#include "RecordFileTest.h"
+#include "ZoneMapTest.h"
+#include "AggregateTest.h"
+#include "MapTest.h"
+#include "SchemaTest.h"
+#include "BatchTest.h"
+#include "VariantsBlobTest.h"
+#include "CodecTest.h"
+#include "StringArenaTest.h"
+#include "AllocatorTest.h"
+#include "ReadIntoTest.h"
+#include "NumericTest.h"
+#include "NonValuetest.h"
+
+#pragma warning( disable: 4711 )
+
+#import "msado15.tlb"               \
+    rename("EOF", "EndOfFile"),     \
+    named_guids,                    \
+    no_implementation,              \
+    raw_interfaces_only,            \
+    raw_method_prefix(""),          \
+    raw_native_types,               \
+    no_namespace
+
+#include "ObjectTest.h"
+
+
+//------------------------------------------------------------------------------
+// TestArrays
+//------------------------------------------------------------------------------
+
+static HRESULT TestArrays()
+{
+    HRESULT hr;
+
+    // Test a one dimensional array of strings
+    HR( COneDimStringArrayTest::Test() );
+
+    // Test a one dimensional array of various types.
+    hr = COneDimNumericArrayTest<SCODE, VT_ERROR>::Test();
+    HR( hr );
+
+    hr = COneDimNumericArrayTest<long, VT_I4>::Test();
+    HR( hr );
+
+    hr = COneDimNumericArrayTest<BYTE, VT_UI1>::Test();
+    HR( hr );
+
+    hr = COneDimNumericArrayTest<short, VT_I2>::Test();
+    HR( hr );
+
+    hr = COneDimNumericArrayTest<double, VT_R8>::Test();
+    HR( hr );
+
+    hr = COneDimNumericArrayTest<DATE, VT_DATE>::Test();
+    HR( hr );
+
+    hr = COneDimNumericArrayTest<float, VT_R4>::Test();
+    HR( hr );
+
+    hr = COneDimNumericArrayTest<CHAR, VT_I1>::Test();
+    HR( hr );
+
+    hr = COneDimNumericArrayTest<USHORT, VT_UI2>::Test();
+    HR( hr );
+
+    hr = COneDimNumericArrayTest<ULONG, VT_UI4>::Test();
+    HR( hr );
+
+    hr = COneDimNumericArrayTest<LONGLONG, VT_I8>::Test();
+    HR( hr );
+
+    hr = COneDimNumericArrayTest<ULONGLONG, VT_UI8>::Test();
+    HR( hr );
+
+    hr = COneDimNumericArrayTest<INT, VT_INT>::Test();
+    HR( hr );
+
+    hr = COneDimNumericArrayTest<UINT, VT_UINT>::Test();
+    HR( hr );
+
+    // Test multi-dimensional arrays of various types.
+    hr = CTwoDimNumericArrayTest<long, VT_I4>::Test();
+    HR( hr );
+
+    hr = CTwoDimNumericArrayTest<double, VT_R8>::Test();
+    HR( hr );
+
+    hr = CTwoDimNumericArrayTest<LONGLONG, VT_I8>::Test();
+    HR( hr );
+
+    hr = COneDimVariantArrayTest::Test();
+    HR( hr );
+
+    // Test arrays of arrays nested too deep to recurse through.
+    hr = CNestedArrayTest::Test();
+    HR( hr );
+
+    // Test writing arrays an element or a chunk at a time.
+    hr = CArrayWriterTest::Test();
+    HR( hr );
+
+    // Test visiting arrays without building them.
+    hr = CVisitorTest::Test();
+    HR( hr );
+
+    // Test viewing streamed arrays without decoding them.
+    hr = CViewTest::Test();
+    HR( hr );
+
+    // Test decoding single elements and slices of streamed arrays.
+    hr = CSliceTest::Test();
+    HR( hr );
+
+    // Test reading chunked arrays on several threads.
+    hr = CParallelReadTest::Test();
+    HR( hr );
+
+    // Test writing chunked arrays on several threads.
+    hr = CParallelWriteTest::Test();
+    HR( hr );
+
+    // Test writing through a background thread.
+    hr = CAsyncWriteTest::Test();
+    HR( hr );
+
+    // Test passing variants between threads through a ring buffer.
+    hr = CRingBufferTest::Test();
+    HR( hr );
+
+    // Test reading variants from bytes pushed as they arrive.
+    hr = CPushReaderTest::Test();
+    HR( hr );
+
+    // Test writing and reading variants without blocking.
+    hr = CAsyncVariantTest::Test();
+    HR( hr );
+
+    // Test containers of records with an index.
+    hr = CRecordFileTest::Test();
+    HR( hr );
+
+    // Test statistics for skipping records and blocks.
+    hr = CZoneMapTest::Test();
+    HR( hr );
+
+    // Test aggregating numbers without reading them into arrays.
+    hr = CAggregateTest::Test();
+    HR( hr );
+
+    // Test maps of names to values, found by name.
+    hr = CMapTest::Test();
+    HR( hr );
+
+    // Test records whose shapes are written once per session.
+    hr = CSchemaTest::Test();
+    HR( hr );
+
+    // Test batches of rows stored as columns.
+    hr = CBatchTest::Test();
+    HR( hr );
+
+    // Test many variants in one blob.
+    hr = CVariantsBlobTest::Test();
+    HR( hr );
+
+    // Test encoders and decoders that keep their memory.
+    hr = CCodecTest::Test();
+    HR( hr );
+
+    // Test decoding strings into an arena.
+    hr = CStringArenaTest::Test();
+    HR( hr );
+
+    // Test allocator hooks and the slab pool.
+    hr = CAllocatorTest::Test();
+    HR( hr );
+
+    // Test reading arrays into arrays of the same shape.
+    hr = CReadIntoTest::Test();
+    HR( hr );
+
+    return S_OK;
+
+} // TestArrays
+
+
+//------------------------------------------------------------------------------
+// TestLargeArrays
+//------------------------------------------------------------------------------
+
+static HRESULT TestLargeArrays()
+{
+    // Test an array of more than 4 GB.
+    return CLargeArrayTest::Test();
+
+} // TestLargeArrays
+
+
+//------------------------------------------------------------------------------
+// TestNonArrays
+//------------------------------------------------------------------------------
+
+static HRESULT TestNonArrays()
+{
+    // Test various types.
+    HR( CNumericTest<CComBSTR>::Test() );
+    HR( CNumericTest<SCODE>::Test() );
+    HR( CNumericTest<long>::Test() );
+    HR( CNumericTest<BYTE>::Test() );
+    HR( CNumericTest<short>::Test() );
+    HR( CNumericTest<double>::Test() );
+    HR( CNumericTest<DATE>::Test() );
+    HR( CNumericTest<float>::Test() );
+    HR( CNumericTest<CHAR>::Test() );
+    HR( CNumericTest<USHORT>::Test() );
+    HR( CNumericTest<ULONG>::Test() );
+    HR( CNumericTest<LONGLONG>::Test() );
+    HR( CNumericTest<ULONGLONG>::Test() );
+
+    return S_OK;
+
+} // TestNonArrays
+
+
+//------------------------------------------------------------------------------
+// TestNonValueTypes
+//------------------------------------------------------------------------------
+
+static HRESULT TestNonValueTypes()
+{
+    // Test various types.
+    HR( CNonValueTest::Test( VT_EMPTY ) );
+    HR( CNonValueTest::Test( VT_NULL ) );
+
+    return S_OK;
+
+} // TestNonValueTypes
+
+
+//------------------------------------------------------------------------------
+// TestNonArrays
+//------------------------------------------------------------------------------
+
+static HRESULT TestObject()
+{
+    return CObjectTest::Test();
+
+} // TestObject
+
+
+//------------------------------------------------------------------------------
+// Start
+//------------------------------------------------------------------------------
+
+HRESULT Start()
+{
+    // Test non-array access.
+    HR( TestNonArrays() );
+
+    HR( TestNonValueTypes() );
+
+    // Test arrays
+    HR( TestArrays() );
+
+    HR( TestLargeArrays() );
+
+    // Test object access
+    return TestObject();
+
+} // Start
+
+
+//------------------------------------------------------------------------------
+// Benchmark
+// Timings are sent to the debugger output.
+//------------------------------------------------------------------------------
+
+HRESULT Benchmark()
+{
+    HR( CNestedArrayTest::Benchmark() );
+    HR( CVisitorTest::Benchmark() );
+    HR( CParallelReadTest::Benchmark() );
+    HR( CParallelWriteTest::Benchmark() );
+    HR( CAsyncWriteTest::Benchmark() );
+    HR( CRingBufferTest::Benchmark() );
+    HR( CRecordFileTest::Benchmark() );
+    HR( CZoneMapTest::Benchmark() );
+    HR( CAggregateTest::Benchmark() );
+    HR( CMapTest::Benchmark() );
+    HR( CSchemaTest::Benchmark() );
+    HR( CBatchTest::Benchmark() );
+    HR( CVariantsBlobTest::Benchmark() );
+    HR( CCodecTest::Benchmark() );
+    HR( CStringArenaTest::Benchmark() );
+    HR( CAllocatorTest::Benchmark() );
+    HR( CReadIntoTest::Benchmark() );
+    HR( CSliceTest::Benchmark() );
+
+    return S_OK;
+
+} // Benchmark
+
+
+//------------------------------------------------------------------------------
+// main
+// Runs the tests, or with /benchmark on the command line, the benchmarks.
+//------------------------------------------------------------------------------
+
+int WINAPI WinMain( HINSTANCE, HINSTANCE, LPSTR lpCmdLine, int )
+{
+    LPCTSTR     msg;
+    HRESULT     hr;
+
+    ::CoInitialize( NULL );
+
+    if ( 0 == ::lstrcmpiA( lpCmdLine, "/benchmark" ) )
+    {
+        hr = Benchmark();
+        msg = SUCCEEDED( hr ) ? _T( "Benchmarks complete" ) : _T( "Failed" );
+        ::MessageBox( 0, msg, _T( "" ), 0 );
+        ::CoUninitialize();
+        return 0;
+    }
+
+    hr = Start();
+    if ( SUCCEEDED( hr ) )
+    {
+        if ( S_FALSE == hr )
+            msg = _T( "All tests successful except for object streaming -- Coult not create test ADO Recordset." );
+        else
+            msg = _T( "All tests successful" );
+    }
+    else
+    {
+        msg = _T( "Failed" );
+    }
+
+    ::MessageBox( 0, msg, _T( "" ), 0 );
+
+    ::CoUninitialize();
+
+    return 0;
+
+} // main
@@ -1,955 +1,8689 @@
-//==============================================================================
-// Public domain variant streaming code.
-//
-// Use global functions WriteVariantToStream and ReadVariantFromStream to
-// read and write a variant to a stream.
-// Use global functions ReadVariantFromBlob and WriteVariantToBlob to
-// read and write a variant to a blob.
-//
-//==============================================================================
-
-#pragma once
-
-#include <atlbase.h>
-#include "stream.h"
-
-
-//==============================================================================
-// namespace VariantStreaming
-// Internal namespace used to keep support calls in this header file private.
-//==============================================================================
-
-namespace VariantStreaming
-{
-
-
-//==============================================================================
-// Prototype
-//==============================================================================
-
-inline void  WriteDataToStream( const VARIANT* variant, IStream* pStream );
-inline void  ReadDataFromStream( VARTYPE vt, IStream* pStream, VARIANT& variant );
-
-
-
-//==============================================================================
-// Types
-//==============================================================================
-
-const long variantVersion = 1;
-
-
-//==============================================================================
-// CWalkSafeArrayElements
-// Walks the elements of a multi-dimensional safe array.  Array must have at
-// least one element.
-// Example:
-//      bool more = true;
-//
-//      CWalkSafeArrayElements  walk( safeArray );
-//
-//      // Walk the list.
-//      while( more )
-//          {
-//          ... walk.GetIndex( index ) ...
-//
-//          more = walk.Next();
-//          }
-//==============================================================================
-
-class CWalkSafeArrayElements
-{
-public:
-    CWalkSafeArrayElements( SAFEARRAY* safeArray )
-        :   m_SafeArray( safeArray ),
-            m_index( NULL ),
-            m_isInitialized( false )
-    {
-    }
-    
-    inline ~CWalkSafeArrayElements()
-    {
-        ::CoTaskMemFree( m_index );
-    }
-    
-    inline void GetIndex( long*& index )
-    {
-        if ( !m_isInitialized )
-            Initialize();
-
-        index = m_index;
-    }
-    
-    void Next( bool& more )
-    {
-        if ( !m_isInitialized )
-            Initialize();
-
-        more = false;
-        
-        // Increment the index and determine if we've hit the end.
-        for ( int dimension = 0; dimension < m_SafeArray->cDims; dimension++ )
-        {
-            m_index[m_SafeArray->cDims - dimension - 1]++;
-            
-            if (    m_index[m_SafeArray->cDims - dimension - 1] >=
-                m_SafeArray->rgsabound[dimension].lLbound + (long)m_SafeArray->rgsabound[dimension].cElements )
-            {
-                m_index[m_SafeArray->cDims - dimension - 1] = m_SafeArray->rgsabound[dimension].lLbound;
-            }
-            else
-            {
-                more = true;
-                break;
-            }
-        }
-    }
-
-private:
-    void Initialize()
-    {
-        // Allocate an index
-        m_index = (long*)::CoTaskMemAlloc( m_SafeArray->cDims * sizeof( long ) );
-        VerifyAllocation( m_index );
-        
-        // Initialize the index.
-        for ( int dimension = 0; dimension < m_SafeArray->cDims; dimension++ )
-            m_index[m_SafeArray->cDims - dimension - 1] = m_SafeArray->rgsabound[dimension].lLbound;
-
-        m_isInitialized = true;
-    }
-    
-private:
-    bool                m_isInitialized;
-    SAFEARRAY*          m_SafeArray;
-    long*               m_index;
-    
-}; // class CWalkSafeArrayElements
-
-
-//------------------------------------------------------------------------------
-// SafeArrayGetElementAsVariant
-// Like SafeArrayGetElement, but returns the element value as a VARIANT.
-//------------------------------------------------------------------------------
-
-inline void SafeArrayGetElementAsVariant(    SAFEARRAY*      safeArray,
-                                             long*           index,
-                                             VARTYPE         vt,
-                                             CComVariant&    variant )
-{
-    void*           entry;
-    void*           element;
-
-    // Allocate enough room to hold a single element of the array.
-    element = _alloca( safeArray->cbElements );
-
-    // Get the elemnt from the array.
-    CheckResult( SafeArrayGetElement( safeArray, index, element ) );
-
-    // If it's a string, assign the string to the variant.
-    if ( ( safeArray->fFeatures & FADF_BSTR ) == FADF_BSTR )
-    {
-        if ( VT_BSTR != vt )
-            ThrowError( DISP_E_TYPEMISMATCH );
-    
-        if ( sizeof( BSTR ) != safeArray->cbElements )
-            ThrowError( E_INVALIDARG );
-    
-        CComBSTR  bstrEntry;
-        entry = *(void**)(void*)element;
-        bstrEntry.Attach( (BSTR) (void*)entry );
-        variant = bstrEntry;
-    }
-    // If it's a generic COM object, assign the IUnknown to the variant.
-    else if ( ( safeArray->fFeatures & FADF_UNKNOWN ) == FADF_UNKNOWN )
-    {
-        if ( VT_UNKNOWN != vt )
-            ThrowError( DISP_E_TYPEMISMATCH );
-    
-        if ( sizeof( IUnknown* ) != safeArray->cbElements )
-            ThrowError( DISP_E_TYPEMISMATCH );
-    
-        CComPtr<IUnknown>   unknownEntry;
-        entry = *(void**)(void*)element;
-        unknownEntry.Attach( (IUnknown*)entry );
-        variant = unknownEntry;
-    }
-    // If it's an Automation object, assign the IDispatch to the variant.
-    else if ( ( safeArray->fFeatures & FADF_DISPATCH ) == FADF_DISPATCH )
-    {
-        if ( VT_DISPATCH != vt )
-            ThrowError( DISP_E_TYPEMISMATCH );
-    
-        if ( sizeof( IDispatch* ) != safeArray->cbElements )
-            ThrowError( DISP_E_TYPEMISMATCH );
-    
-        CComPtr<IDispatch>  dispatchEntry;
-        entry = *(void**)(void*)element;
-        dispatchEntry.Attach( (IDispatch*)entry );
-        variant = dispatchEntry;
-    }
-    // If the element itself is another variant, assign a dereferenced version
-    // to the variant.
-    else if ( ( safeArray->fFeatures & FADF_VARIANT ) == FADF_VARIANT )
-    {
-        if ( VT_VARIANT != vt )
-            ThrowError( DISP_E_TYPEMISMATCH );
-    
-        if ( sizeof( VARIANT ) != safeArray->cbElements )
-            ThrowError( DISP_E_TYPEMISMATCH );
-    
-        CComVariant   variantEntry;
-        entry = element;
-        variantEntry.Attach( (VARIANT*)entry );
-    
-        variant = variantEntry;
-    }
-    // If it's a simple type, assign it based on the type.
-    else
-    {
-        entry = element;
-    
-        switch( vt )
-        {
-        case VT_ERROR:
-            variant.scode = *(SCODE*) entry;
-            break;
-        
-        case VT_I4:
-            variant.lVal = *(long*) entry;
-            break;
-        
-        case VT_UI1:
-            variant.bVal = *(BYTE*) entry;
-            break;
-        
-        case VT_I2:
-            variant.iVal = *(short*) entry;
-            break;
-        
-        case VT_BOOL:
-#pragma warning(disable: 4310) // cast truncates constant value
-		    variant.boolVal = *(VARIANT_BOOL*) entry ? VARIANT_TRUE : VARIANT_FALSE;
-#pragma warning(default: 4310) // cast truncates constant value
-            break;
-        
-        case VT_R8:
-            variant.dblVal = *(double*) entry;
-            break;
-        
-        case VT_DATE:
-            variant.date = *(DATE*) entry;
-            break;
-        
-        case VT_R4:
-            variant.fltVal = *(float*) entry;
-            break;
-        
-        case VT_CY:
-            variant.cyVal = *(CY*)entry;
-        
-        default:
-            ThrowError( DISP_E_TYPEMISMATCH );
-        }
-    
-        // Set the variant's data type.
-        variant.vt = vt;
-    }
-
-} // SafeArrayGetElementAsVariant
-
-
-//------------------------------------------------------------------------------
-// SafeArrayPutElementFromVariant
-// Like SafeArrayPutElement, except that it gets the element's value from the
-// variant
-//------------------------------------------------------------------------------
-
-inline void SafeArrayPutElementFromVariant(  SAFEARRAY*          safeArray,
-                                             long*               index,
-                                             const VARIANT&      variant )
-{
-    const void*     element = NULL;
-
-    // If the array element type itself is a variant, then we just use
-    // that variant directly.
-    if ( ( safeArray->fFeatures & FADF_VARIANT ) == FADF_VARIANT )
-    {
-        element = &variant;
-    }
-    else
-    {
-        // Based on the data type of the variant, we obtain a direct reference
-        // to the variant's data
-        switch ( VT_TYPEMASK & variant.vt )
-        {
-        case VT_BSTR:
-        case VT_UNKNOWN:
-        case VT_DISPATCH:
-            element = variant.byref;
-            break;
-        
-        case VT_VARIANT:
-            element = variant.pvarVal;
-            break;
-        
-        case VT_ERROR:
-        case VT_I4:
-        case VT_UI1:
-        case VT_I2:
-        case VT_BOOL:
-        case VT_R8:
-        case VT_DATE:
-        case VT_R4:
-        case VT_CY:
-            element = &variant.byref;
-            break;
-        
-        default:
-            ThrowError( DISP_E_TYPEMISMATCH );
-        }
-    }
-
-    // Put the element into the array.
-    CheckResult( SafeArrayPutElement( safeArray, index, const_cast<void*>( element ) ) );
-
-} // SafeArrayPutElementFromVariant
-
-
-//------------------------------------------------------------------------------
-// GetTypeSize
-// Given a variant type, determines how many bytes it takes to store data of
-// that type.
-//------------------------------------------------------------------------------
-
-inline void GetTypeSize( VARTYPE vt, ULONG& size )
-{
-    switch ( vt ) 
-    {
-    case VT_BOOL:
-        size = sizeof( VARIANT_BOOL );
-        break;
-    
-    case VT_I2:
-        size = sizeof( short );
-        break;
-    
-    case VT_ERROR:
-        size = sizeof( SCODE );
-        break;
-    
-    case VT_I4:
-        size = sizeof( long );
-        break;
-    
-    case VT_BSTR:
-        size = sizeof( BSTR );
-        break;
-    
-    case VT_R4:
-        size = sizeof( float );
-        break;
-    
-    case VT_DATE:
-        size = sizeof( DATE );
-        break;
-    
-    case VT_R8:
-        size = sizeof( double );
-        break;
-    
-    case VT_UI1:
-        size = sizeof( BYTE );
-        break;
-    
-    case VT_CY:
-        size = sizeof( CY );
-        break;
-    
-    case VT_VARIANT:
-        size = sizeof( VARIANT );
-        break;
-    
-    case VT_DISPATCH:
-        size = sizeof( IDispatch* );
-        break;
-    
-    case VT_UNKNOWN:
-        size = sizeof( IUnknown* );
-        break;
-    
-    default:
-        ThrowError( DISP_E_TYPEMISMATCH );
-    }
-
-} // GetTypeSize
-
-
-//------------------------------------------------------------------------------
-// WriteSafeArrayHeader
-// Writes the array's header information, such as the number of dimensions
-// and the bounds of each dimension (lower/upper)
-//------------------------------------------------------------------------------
-
-inline void WriteSafeArrayHeader( SAFEARRAY* safeArray, IStream* pStream )
-{
-    unsigned int        dimension;
-    CStream             stream( pStream );
-
-    // Write out the dimension count
-    stream.Write( safeArray->cDims );
-
-    // Write out the lower bound and the number of elements in each dimension.
-    for ( dimension = 0; dimension < safeArray->cDims; dimension++ )
-    {
-        stream.Write( safeArray->rgsabound[dimension].lLbound );
-        stream.Write( safeArray->rgsabound[dimension].cElements );
-    }
-
-} // WriteSafeArrayHeader
-
-
-//------------------------------------------------------------------------------
-// ReadSafeArrayHeader
-//------------------------------------------------------------------------------
-
-inline void ReadSafeArrayHeader( VARIANT* variant, VARTYPE vt, IStream* pStream )
-{
-    unsigned short      dimensions;
-    unsigned short      dimension;
-    CStream             stream( pStream );
-
-    // Read the dimension count
-    stream.Read( dimensions );
-
-    CheckResult( SafeArrayAllocDescriptor( dimensions, &variant->parray ) );
-
-    // Read the lower bound and the number of elements in this dimension.
-    for ( dimension = 0; dimension < dimensions; dimension++ )
-    {
-        stream.Read( variant->parray->rgsabound[dimension].lLbound );
-        stream.Read( variant->parray->rgsabound[dimension].cElements );
-    }
-
-    // Set the element size.
-    GetTypeSize( vt, variant->parray->cbElements );
-
-    // Set the features mask.
-    switch ( vt )
-    {
-    case VT_BSTR:
-        variant->parray->fFeatures |= FADF_BSTR;
-        break;
-    
-    case VT_UNKNOWN:
-        variant->parray->fFeatures |= FADF_UNKNOWN;
-        break;
-    
-    case VT_DISPATCH:
-        variant->parray->fFeatures |= FADF_DISPATCH;
-        break;
-    
-    case VT_VARIANT:
-        variant->parray->fFeatures |= FADF_VARIANT;
-        break;
-    }
-
-    CheckResult( SafeArrayAllocData( variant->parray ) );
-
-    // Set variant's type
-    variant->vt = (VARTYPE) ( vt | VT_ARRAY );
-
-} // ReadSafeArrayHeader
-
-
-
-//------------------------------------------------------------------------------
-// WriteSafeArrayElements
-// Walks the elements of a multi-dimensional safe array, streaming each
-// element out.
-//------------------------------------------------------------------------------
-
-inline void WriteSafeArrayElements( VARTYPE vt, SAFEARRAY* safeArray, IStream* pStream )
-{
-    bool                more = true;
-    long*               index = NULL;
-    CStream             stream( pStream );
-    long                NoOfElements = 0;
-
-    //check whether array has elements:
-    for ( int dimension = 0; dimension < safeArray->cDims; dimension++ )
-    {
-        NoOfElements += safeArray->rgsabound[dimension].cElements;
-    }
-    if( NoOfElements == 0)
-        return;
-    CWalkSafeArrayElements  walk( safeArray );
-        
-    // Walk the list.
-    while( more )
-    {
-        CComVariant         tempVariant;
-
-        // Get the variant for this element and stream it out.
-        walk.GetIndex( index );
-        SafeArrayGetElementAsVariant( safeArray, index, vt, tempVariant );
-
-        // If the array's type is VT_VARIANT, then write out the element's data
-        // type so that it can be known when the variant is streamed back out.
-        if ( VT_VARIANT == vt )
-            stream.Write( tempVariant.vt );
-
-        // Write the variant to the stream.
-        WriteDataToStream( &tempVariant, stream );
-    
-        // Increment the index and determine if we've hit the end.
-        walk.Next( more );
-    }
-
-} // WriteSafeArrayElements
-
-
-
-//------------------------------------------------------------------------------
-// ReadSafeArrayElements
-// Read the elements from the stream into the safe array.
-//------------------------------------------------------------------------------
-
-inline void ReadSafeArrayElements( VARTYPE vt, SAFEARRAY* safeArray, IStream* pStream )
-{
-    bool        more = true;
-    long*       index = NULL;
-    CStream     stream( pStream );
-    long        NoOfElements = 0;
-
-    //check whether array has elements:
-    for ( int dimension = 0; dimension < safeArray->cDims; dimension++ )
-    {
-        NoOfElements += safeArray->rgsabound[dimension].cElements;
-    }
-    if( NoOfElements == 0)
-        return;
-    CWalkSafeArrayElements  walk( safeArray );
-
-    // Walk the list.
-    while( more )
-    {
-        CComVariant tempVariant;
-
-        VARTYPE elementType = vt;
-
-        // If the array's data type is VT_VARIANT, then read the elements type.
-        if ( VT_VARIANT == vt )
-            stream.Read( elementType );
-
-        // Get the variant from the stream and put it in the array as an element.
-        ReadDataFromStream( elementType, stream, tempVariant );
-        walk.GetIndex( index );
-        SafeArrayPutElementFromVariant( safeArray, index, tempVariant );
-    
-        // Increment the index and determine if we've hit the end.
-        walk.Next( more );
-    }
-
-} // ReadSafeArrayElements
-
-
-//------------------------------------------------------------------------------
-// GetPersistStreamInterface
-// Get IPersistStream for the given object.
-//------------------------------------------------------------------------------
-
-inline void GetPersistStreamInterface( IUnknown* pUnknown, IPersistStream** ppPersistStream )
-{
-    CComPtr<IPersistStreamInit>     persistStreamInit;
-    CComPtr<IPersistStream>         persistStream;
-    HRESULT                         hr;
-
-    // See if the object supports IPersistStreamInit.
-    hr = pUnknown->QueryInterface( &persistStreamInit );
-    if ( FAILED( hr ) && E_NOINTERFACE != hr )
-        ThrowError( hr );
-
-    // If the object doesn't support IPersistStreamInit, see
-    // if supports IPersistStream
-    if ( !persistStreamInit )
-    {
-        hr = pUnknown->QueryInterface( &persistStream );
-        if ( FAILED( hr ) && E_NOINTERFACE != hr )
-            ThrowError( hr );
-    }
-
-    // Return either IPersistStreamInit or IPersistStream, whichever
-    // one was retrieved.  Since these interfaces are binary
-    // compatible, we can use the same pointer to refer to either.
-    if ( persistStream )
-        *ppPersistStream = persistStream.Detach();
-    else
-        *ppPersistStream = (IPersistStream*)persistStreamInit.Detach();
-
-} // GetPersistStreamInterface
-
-
-//------------------------------------------------------------------------------
-// SaveObjectToStream
-// Wrapper for OleSaveToStream.  Difference is that this function
-// takes an IUnknown instead of an IPersistStream and uses the IUnknown
-// to get an IPersistStream using GetPersistStreamInterface, which is
-// smart enough to QI for both IPersistStreamInit and IPersistStream.
-// As with OleSaveToStream, the object pointer may be NULL.
-//------------------------------------------------------------------------------
-
-inline void SaveObjectToStream( IUnknown* pUnknown, IStream* pStream )
-{
-    CComPtr<IPersistStream>       persistStream;
-
-    // Get IPersistStream interface for the object. 
-    if ( pUnknown )
-    {
-        GetPersistStreamInterface( pUnknown, &persistStream );
-
-        // If we didn't get IPersistStream, then fail.  For now,
-        // these are the only two interfaces we're supporting.
-        // Later, we can add support for others such as IStorage,
-        // IPersistMemory, IPersistStorage, IPersistPropertyBag, etc.
-        if ( !persistStream )
-            ThrowError( E_NOINTERFACE );
-    }
-
-    // Save the object to the stream.
-    CheckResult( OleSaveToStream( persistStream, pStream ) );
-
-} // SaveObjectToStream
-
-
-//------------------------------------------------------------------------------
-// WriteDataToStream
-// Writes the given variant's data to the stream.
-// Used by WriteToStream.
-// The passed in variant is assumed to be fully dereferenced (i.e. no VT_BYREF)
-//------------------------------------------------------------------------------
-
-inline void WriteDataToStream( const VARIANT* variant, IStream* pStream )
-{
-    SAFEARRAY*          safeArray;
-    IDispatch*          pDispatch;
-    CComPtr<IUnknown>   unknown;
-    CStream             stream( pStream );
-
-    ValidatePointer( variant );
-
-    // If it's an array write out individual value.
-    if ( V_ISARRAY( variant ) )
-    {
-        // Get the array.
-        if ( V_ISBYREF( variant ) )
-            safeArray = *variant->pparray;
-        else
-            safeArray = variant->parray;
-    
-        WriteSafeArrayHeader( safeArray, stream );
-        
-        //write out the safe array elements:
-        WriteSafeArrayElements( (VARTYPE)( VT_TYPEMASK & variant->vt ), safeArray, stream );
-    }
-    // It's not an array, so write the individual value
-    else
-    {
-        switch ( variant->vt )
-        {
-        case VT_EMPTY:
-        case VT_NULL:
-            break;
-        
-        case VT_BOOL:
-            // A VARIANT_BOOL is 16 bits.
-            stream.Write( V_BOOL( variant ) );
-            break;
-        
-        case VT_UI1:
-            stream.Write( V_UI1( variant ) );
-            break;
-        
-        case VT_I2:
-            stream.Write( V_I2( variant ) );
-            break;
-        
-        case VT_I4:
-            stream.Write( V_I4( variant ) );
-            break;
-        
-        case VT_CY:
-            stream.Write( variant->cyVal.Lo );
-            stream.Write( variant->cyVal.Hi );
-            break;
-        
-        case VT_R4:
-            stream.Write( V_R4( variant ) );
-            break;
-        
-        case VT_R8:
-            stream.Write( V_R8( variant ) );
-            break;
-        
-        case VT_DATE:
-            // A Variant DATE is a double.
-            stream.Write( V_DATE( variant ) );
-            break;
-        
-        case VT_BSTR:
-            stream.Write( V_BSTR( variant ) );
-            break;
-        
-        case VT_ERROR:
-            stream.Write( V_ERROR( variant ) );
-            break;
-        
-        case VT_DISPATCH:
-            pDispatch = V_DISPATCH( variant );
-            if ( pDispatch )
-                CheckResult( pDispatch->QueryInterface( &unknown ) );
-
-            SaveObjectToStream( unknown, stream );
-            break;
-
-        case VT_UNKNOWN:
-            SaveObjectToStream( V_UNKNOWN( variant ), stream );
-            break;
-
-        default:
-            ThrowError( DISP_E_TYPEMISMATCH );
-        }
-    }
-
-} // WriteDataToStream
-
-
-//------------------------------------------------------------------------------
-// WriteToStream
-// Writes the given variant to the stream.
-// First writes out the data type of the variant followed by the 
-// variant's data.
-//------------------------------------------------------------------------------
-
-inline void WriteToStream( const VARIANT* variantParam, IStream* pStream )
-{
-    CComVariant     variantCopy;
-    const VARIANT*  variant;
-    CStream         stream( pStream );
-
-    ValidatePointer( variantParam );
-
-    // Use dereferenced copy if incoming is byref.
-    if ( V_ISBYREF( variantParam ) )
-    {
-        CheckResult( VariantCopyInd( &variantCopy, (VARIANT*) variantParam ) );
-        variant = &variantCopy;
-    }
-    else
-    {
-        variant = variantParam;
-    }
-
-    // Write the VT type.
-    stream.Write( variant->vt );
-
-    // Write out the actual data.
-    WriteDataToStream( variant, pStream );
-
-} // WriteToStream
-
-
-//------------------------------------------------------------------------------
-// ReadDataFromStream
-// Given the variant's data type, reads the variant's data from the stream.
-//------------------------------------------------------------------------------
-
-inline void ReadDataFromStream( VARTYPE vt, IStream* pStream, VARIANT& variant )
-{
-    CComPtr<IUnknown>       unknown;
-    CComPtr<IDispatch>      dispatch;
-    CStream                 stream( pStream );
-
-    // If it's a blob, then read it in as an array of bytes, otherwise read
-    // individual value.
-    if ( vt & VT_ARRAY )
-    {
-        VARTYPE elementVT = (VARTYPE) ( VT_TYPEMASK & vt );
-
-        // Read the variant header.
-        ReadSafeArrayHeader( &variant, elementVT, stream );
-    
-        // Read the elements from the stream.
-        ReadSafeArrayElements( elementVT, variant.parray, stream );
-    }
-    // It's not an array, so read the individual value
-    else
-    {
-        switch ( vt )
-        {
-        case VT_EMPTY:
-        case VT_NULL:
-            break;
-        
-        case VT_BOOL:
-            // A VARIANT_BOOL is 16 bits.
-            stream.Read( V_BOOL( &variant ) );
-            break;
-        
-        case VT_UI1:
-            stream.Read( V_UI1( &variant ) );
-            break;
-        
-        case VT_I2:
-            stream.Read( V_I2( &variant ) );
-            break;
-        
-        case VT_I4:
-            stream.Read( V_I4( &variant ) );
-            break;
-        
-        case VT_CY:
-            stream.Read( variant.cyVal.Lo );
-            stream.Read( variant.cyVal.Hi );
-            break;
-        
-        case VT_R4:
-            stream.Read( V_R4( &variant ) );
-            break;
-        
-        case VT_R8:
-            stream.Read( V_R8( &variant ) );
-            break;
-        
-        case VT_DATE:
-            stream.Read( V_DATE( &variant ) );
-            break;
-        
-        case VT_BSTR:
-            stream.Read( &variant.bstrVal );
-            break;
-        
-        case VT_ERROR:
-            stream.Read( V_ERROR( &variant ) );
-            break;
-        
-        case VT_DISPATCH:
-            CheckResult( OleLoadFromStream( pStream, IID_IUnknown, (void**)(IUnknown*)&unknown ) );
-            CheckResult( unknown->QueryInterface( &dispatch ) );
-            V_DISPATCH( &variant ) = dispatch.Detach();
-            break;
-
-        case VT_UNKNOWN:
-            CheckResult( OleLoadFromStream( pStream, IID_IUnknown, (void**)(IUnknown*)&unknown ) );
-            V_UNKNOWN( &variant ) = unknown.Detach();
-            break;
-        
-        default:
-            ThrowError( DISP_E_TYPEMISMATCH );
-        }
-    
-        variant.vt = vt;
-    }
-
-} // ReadDataFromStream
-
-
-//------------------------------------------------------------------------------
-// ReadFromStream
-// Reads the variant from the stream.
-// First reads the variant's data type and then calls ReadDataFromStream
-// to read the variant's data.
-//------------------------------------------------------------------------------
-
-inline void ReadFromStream( IStream* pStream, VARIANT& variant )
-{
-    VARTYPE             vt;
-    CStream             stream( pStream );
-
-    // Read the VT type.
-    stream.Read( vt );
-
-    ReadDataFromStream( vt, pStream, variant );
-
-} // ReadFromStream
-
-
-} // namespace VariantStreaming
-
-
-//------------------------------------------------------------------------------
-// WriteVariantToStream
-// Writes the given variant to the stream.
-//------------------------------------------------------------------------------
-
-inline void WriteVariantToStream( const VARIANT* variant, IStream* pStream )
-{
-    // Write the version number of this class.
-    CStream( pStream ).Write( VariantStreaming::variantVersion );
-
-    // Call the main routine to write a variant from the stream.
-    VariantStreaming::WriteToStream( variant, pStream );
-
-} // WriteVariantToStream
-
-
-//------------------------------------------------------------------------------
-// ReadVariantFromStream
-// The passed in variant should be initialized.
-//------------------------------------------------------------------------------
-
-inline void ReadVariantFromStream( IStream* pStream, VARIANT& variant )
-{
-    long    version;
-
-    // Read the version.  If the version is later needed by the reading
-    // code, it can be passed as parameter to ReadFromStream, and
-    // internally in ReadSafeArrayElements.
-    CStream( pStream ).Read( version );
-
-    // Call the main routine to read a variant from the stream.
-    VariantStreaming::ReadFromStream( pStream, variant );
-
-} // ReadVariantFromStream
-
-
-//------------------------------------------------------------------------------
-// WriteVariantToBlob
-// Streams out a variant to a BLOB.
-// The returned BLOB data structure is owned by the caller and should be
-// freed using CoTaskMemFree
-//------------------------------------------------------------------------------
-
-inline void WriteVariantToBlob( const VARIANT& v, BLOB& blob )
-{
-    CComPtr<IStream>    stream;
-    
-    // Create an IStream object that stores data in memory.
-    CheckResult( ::CreateStreamOnHGlobal( NULL, TRUE, &stream ) );
-
-    // Stream out the input variant into the memory stream
-    ::WriteVariantToStream( &v, stream );
-
-    // Convert the stream to task memory.
-    StreamToTaskMemory( stream, blob );
-
-} // WriteVariantToBlob
-
-
-//------------------------------------------------------------------------------
-// ReadVariantFromBlob
-// Given a BLOB, streams out a variant.  The caller owns the data in the
-// blob parameter.
-//------------------------------------------------------------------------------
-
-inline void ReadVariantFromBlob( const BLOB& blob, VARIANT& v )
-{
-    CComPtr<IStream>    stream;
-
-    // Converts the given BLOB to a stream.
-    BlobToStream( blob, &stream );
-
-    // Convert the stream into the output variant.
-    ReadVariantFromStream( stream, v );
-
-} // ReadVariantFromBlob
+//==============================================================================
+// Public domain variant streaming code.
+//
+// Use global functions WriteVariantToStream and ReadVariantFromStream to
+// read and write a variant to a stream.
+// Use global functions ReadVariantFromBlob and WriteVariantToBlob to
+// read and write a variant to a blob.
+// Use global functions ReadVariantsFromBlob and WriteVariantsToBlob to
+// read and write many variants to one blob.
+// Use global function ReadVariantInto to read an array into one of the same
+// shape in place.
+// Use global function WriteVariantSliceToStream to write part of an array as
+// an array of its own.
+// Use classes CVariantEncoder and CVariantDecoder to encode and decode many
+// variants with memory kept from one call to the next.
+// Use class CVariantArrayWriter to write an array to a stream an element or
+// a chunk of elements at a time, without building a SAFEARRAY first.
+// Use global function VisitVariantInStream to have a CVariantVisitor called
+// back with a streamed variant's values, without building the variant, and
+// AggregateVariantInStream to sum up its numbers the same way.
+// Use class CVariantView to look at a streamed variant in memory, such as a
+// blob, decoding only the parts asked for.
+// Use global function WriteVariantMapToStream to stream a map of names to
+// values with a directory, so that CVariantView::Find reads any one value.
+// Use global functions WriteChunkedVariantToStream and
+// ReadVariantFromMemoryInParallel to read a large array on several threads,
+// and WriteVariantToStreamInParallel to write one.
+// Use class CVariantPushReader to read a variant from bytes pushed to it as
+// they arrive, such as from a non-blocking socket.
+// Use classes CAsyncVariantWriter and CAsyncVariantReader to write and read
+// variants over a CAsyncByteStream without blocking a thread.
+// Use classes CVariantRecordWriter and CVariantRecordReader to keep many
+// variants in one stream, such as a file, and read any one of them directly.
+// Use classes CVariantSchemaWriter and CVariantSchemaReader to stream many
+// records of the same few shapes, writing each shape only once.
+// Use classes CVariantBatchWriter and CVariantBatchReader to store a batch of
+// rows as columns, and read back single columns or rows.
+//
+//==============================================================================
+
+#pragma once
+
+#include <atlbase.h>
+#include "stream.h"
+
+
+//==============================================================================
+// CVariantVisitor
+// Called back by VisitVariantInStream with the contents of a streamed variant
+// in the order they were streamed, in place of building the variant.  An
+// array calls BeginArray, then back once per element, then EndArray.  An
+// element of an array of variants that is itself an array nests another
+// BeginArray and EndArray pair.
+// Bounds are given in SafeArrayCreate's order and the elements come with the
+// last dimension varying fastest.  Nothing passed in is owned by the visitor
+// and none of it lasts beyond the call.
+//==============================================================================
+
+class CVariantVisitor
+{
+public:
+    // vt is the type of the elements, without VT_ARRAY.
+    virtual void BeginArray( VARTYPE vt, USHORT dimensions, const SAFEARRAYBOUND* bounds ) = 0;
+
+    // Any value other than a string.
+    virtual void Scalar( const VARIANT& value ) = 0;
+
+    // A string's characters, which are not necessarily null terminated.
+    virtual void String( const WCHAR* chars, UINT length ) = 0;
+
+    virtual void EndArray() = 0;
+
+    // A run of elements of an array of a fixed size type, laid out as in a
+    // SAFEARRAY of that type.  By default each element is passed to Scalar.
+    virtual void Elements( VARTYPE vt, const void* data, ULONG count );
+
+}; // class CVariantVisitor
+
+
+//==============================================================================
+// CVariantZone
+// Statistics about the values in a record or a block of an array, kept by
+// CVariantRecordWriter so that readers can skip what can't match.  Numbers
+// are all the numeric values at any depth, dates and currency included.
+// Strings are counted apart by an estimate of how many different ones there
+// are, which is exact up to a few dozen.
+//==============================================================================
+
+struct CVariantZone
+{
+    double          minimum;
+    double          maximum;
+    ULONG           numberCount;
+    ULONG           nullCount;
+    ULONG           distinctStrings;
+
+    // Whether any number in the zone could be between low and high.
+    inline bool MayHold( double low, double high ) const
+    {
+        return numberCount && minimum <= high && maximum >= low;
+    }
+
+}; // struct CVariantZone
+
+
+//==============================================================================
+// CVariantAggregate
+// Count, sum, minimum and maximum of the numbers in a streamed variant, as
+// worked out by AggregateVariantInStream.  The minimum and maximum mean
+// nothing while the count is zero.
+//==============================================================================
+
+struct CVariantAggregate
+{
+    ULONGLONG       count;
+    double          sum;
+    double          minimum;
+    double          maximum;
+
+    inline double GetMean() const
+    {
+        return count ? sum / (LONGLONG)count : 0;
+    }
+
+}; // struct CVariantAggregate
+
+
+//==============================================================================
+// CVariantAllocator
+// Where CVariantEncoder allocates the blobs it hands out, and CVariantDecoder
+// the arrays of a CDecodedVariant, in place of the task allocator.  Memory
+// need not be zeroed.  Free is passed NULL or memory from Allocate.
+// CVariantSlabPool is one.
+//==============================================================================
+
+class CVariantAllocator
+{
+public:
+    // Fails by returning NULL.
+    virtual void* Allocate( SIZE_T size ) = 0;
+
+    virtual void Free( void* data ) = 0;
+
+}; // class CVariantAllocator
+
+
+//==============================================================================
+// namespace VariantStreaming
+// Internal namespace used to keep support calls in this header file private.
+//==============================================================================
+
+namespace VariantStreaming
+{
+
+
+//==============================================================================
+// Types
+//==============================================================================
+
+const long variantVersion = 1;
+
+// Version of variants written by WriteChunkedVariantToStream, which follow
+// the version with a table of where each chunk of the array's elements
+// starts:
+//      ULONG       elements per chunk, the last chunk may hold fewer
+//      ULONG       number of chunks
+//      ULONGLONG   offset of each chunk, from the start of the variant's type
+// The variant itself is streamed just as at variantVersion.
+const long chunkedVersion = 2;
+
+// Version of maps written by WriteVariantMapToStream, which follow the
+// version with a directory of the map's names:
+//      ULONG       number of entries
+//      ULONG       number of slots, a power of two larger than the entries
+//      ULONG       slots[slot count], an entry's number plus one, or 0
+//      per entry   ULONG hash of the name, ULONGLONG offset of the name,
+//                  ULONGLONG offset of the value
+// An entry is in the slot its name's hash picks, or in the first free one
+// after it.  Offsets count from the start of the variant's type, and point
+// at an element's type.  The map itself is streamed just as at
+// variantVersion, as a 2 x N array of variants holding names and values.
+const long mapVersion = 3;
+const ULONG mapEntrySize = sizeof( ULONG ) + 2 * sizeof( ULONGLONG );
+
+// Most memory WriteVariantToStreamInParallel encodes chunks into before
+// writing them out, unless a single chunk is larger.
+const ULONG parallelWindowSize = 0x1000000;
+
+// How deeply arrays may be nested inside arrays of variants, unless the
+// caller says otherwise.
+const ULONG defaultMaxDepth = 256;
+
+// How many bytes CAsyncVariantReader asks its stream for at a time.
+const ULONG asyncBufferSize = 0x1000;
+
+// Containers of records written by CVariantRecordWriter are laid out as:
+//      ULONG       recordMagic
+//      long        recordVersion
+//      ...         each record as WriteVariantToStream writes it
+//      ULONGLONG   offsets[record count], from the start of the container
+//      BSTR        keys[record count], if recordsKeyed, as CStream writes them
+//      ULONGLONG   offset of the offsets
+//      ULONG       record count
+//      ULONG       flags
+//      ULONG       recordMagic
+// so that a reader finds the index from the end and any record from there.
+const ULONG recordMagic = 0x43525356;
+const long recordVersion = 1;
+const ULONG recordsKeyed = 0x1;
+const ULONG recordsHaveStatistics = 0x2;
+const ULONG recordTrailerSize = sizeof( ULONGLONG ) + 3 * sizeof( ULONG );
+
+// With recordsHaveStatistics, the keys are followed by:
+//      ULONG           elements per block
+//      per record      CVariantZone, ULONG elements, LONG lower bound
+//      CVariantZone    blocks[total block count], in record order
+// Records that are one dimensional arrays of numbers have a zone for each
+// block of their elements, and give the array's element count and lower
+// bound; other records have no blocks and give zeros.  A zone is written as
+// its minimum and maximum, then its three counts.
+const ULONG defaultBlockElements = 4096;
+
+// Sessions written by CVariantSchemaWriter are laid out as:
+//      ULONG       schemaMagic
+//      long        schemaVersion
+//      per record  ULONG shape id, the shape if it is new, the payload
+// A shape is the record's type and, for an array, its dimension count and
+// bounds as WriteSafeArrayHeader writes them, then for an array of variants
+// the type of each element in streamed order.  Shapes are numbered from 0 in
+// the order they first appear.  The payload is the rest of what
+// WriteVariantToStream writes for the record.  An id of schemaReset forgets
+// every shape and starts the numbering again, which the writer does before
+// holding more than schemaShapeLimit shapes or schemaShapeBytes of them.
+const ULONG schemaMagic = 0x53535356;
+const long schemaVersion = 1;
+const ULONG schemaReset = 0xFFFFFFFF;
+const ULONG schemaShapeLimit = 0x1000;
+const ULONG schemaShapeBytes = 0x1000000;
+
+// Batches written by CVariantBatchWriter are laid out as:
+//      ULONG       batchMagic
+//      long        batchVersion
+//      ULONG       row count
+//      ULONG       column count
+//      LONG        the rows' lower bound
+//      ULONGLONG   offsets[column count + 1], from the start of the batch
+//      ...         each column as WriteVariantToStream writes it
+// A column is a one dimensional array, from 0, holding one element for each
+// row.  It is an array of its elements' type if they all have the same one
+// and it is a number, a boolean or a string, and an array of variants if
+// not.  The last offset is where the batch ends.
+const ULONG batchMagic = 0x42535356;
+const long batchVersion = 1;
+const ULONG batchHeaderSize = 4 * sizeof( ULONG ) + sizeof( LONG );
+
+// Blobs written by WriteVariantsToBlob are laid out as:
+//      ULONG       variantsMagic
+//      long        variantsVersion
+//      ULONG       variant count
+//      ...         each variant as WriteVariantToStream writes it, less the
+//                  version
+const ULONG variantsMagic = 0x4D535356;
+const long variantsVersion = 1;
+
+// Smallest block CStringArena allocates strings from.
+const ULONG arenaBlockSize = 0x10000;
+
+// How many of the smallest string hashes CZoneBuilder keeps to estimate how
+// many different strings it has seen.
+const ULONG distinctSampleSize = 32;
+
+
+//==============================================================================
+// Prototype
+//==============================================================================
+
+inline BYTE* GetWalkElement( SAFEARRAY* safeArray, BYTE* data, ULONGLONG position );
+inline ULONGLONG GetElementCount( SAFEARRAY* safeArray );
+
+
+//==============================================================================
+// CWalkSafeArrayElements
+// Walks the elements of a multi-dimensional safe array.  Array must have at
+// least one element.
+// Example:
+//      bool more = true;
+//
+//      CWalkSafeArrayElements  walk( safeArray );
+//
+//      // Walk the list.
+//      while( more )
+//          {
+//          ... walk.GetIndex( index ) ...
+//
+//          more = walk.Next();
+//          }
+//==============================================================================
+
+class CWalkSafeArrayElements
+{
+public:
+    CWalkSafeArrayElements( SAFEARRAY* safeArray )
+        :   m_SafeArray( safeArray ),
+            m_index( NULL ),
+            m_isInitialized( false )
+    {
+    }
+    
+    inline ~CWalkSafeArrayElements()
+    {
+        ::CoTaskMemFree( m_index );
+    }
+    
+    inline void GetIndex( long*& index )
+    {
+        if ( !m_isInitialized )
+            Initialize();
+
+        index = m_index;
+    }
+    
+    void Next( bool& more )
+    {
+        if ( !m_isInitialized )
+            Initialize();
+
+        more = false;
+        
+        // Increment the index and determine if we've hit the end.
+        for ( int dimension = 0; dimension < m_SafeArray->cDims; dimension++ )
+        {
+            m_index[m_SafeArray->cDims - dimension - 1]++;
+            
+            if (    m_index[m_SafeArray->cDims - dimension - 1] >=
+                m_SafeArray->rgsabound[dimension].lLbound + (long)m_SafeArray->rgsabound[dimension].cElements )
+            {
+                m_index[m_SafeArray->cDims - dimension - 1] = m_SafeArray->rgsabound[dimension].lLbound;
+            }
+            else
+            {
+                more = true;
+                break;
+            }
+        }
+    }
+
+private:
+    void Initialize()
+    {
+        // Allocate an index
+        m_index = (long*)::CoTaskMemAlloc( m_SafeArray->cDims * sizeof( long ) );
+        VerifyAllocation( m_index );
+        
+        // Initialize the index.
+        for ( int dimension = 0; dimension < m_SafeArray->cDims; dimension++ )
+            m_index[m_SafeArray->cDims - dimension - 1] = m_SafeArray->rgsabound[dimension].lLbound;
+
+        m_isInitialized = true;
+    }
+    
+private:
+    bool                m_isInitialized;
+    SAFEARRAY*          m_SafeArray;
+    long*               m_index;
+    
+}; // class CWalkSafeArrayElements
+
+
+//==============================================================================
+// CWalkSafeArrayData
+// Walks the memory of a multi-dimensional safe array in the same order that
+// CWalkSafeArrayElements walks its indexes.  The safe array's rgsabound is
+// stored in reverse order of its memory layout, so for arrays of more than one
+// dimension consecutive elements of the walk are not adjacent in memory.
+// Array must have at least one element.
+// Example:
+//      CWalkSafeArrayData  walk( safeArray, data );
+//
+//      for ( ULONG i = 0; i < count; i++ )
+//          {
+//          ... walk.GetElement() ...
+//
+//          walk.Next();
+//          }
+//==============================================================================
+
+class CWalkSafeArrayData
+{
+public:
+    CWalkSafeArrayData( SAFEARRAY* safeArray, void* data )
+        :   m_SafeArray( safeArray ),
+            m_element( (BYTE*)data ),
+            m_count( NULL ),
+            m_stride( NULL )
+    {
+        SIZE_T  stride = safeArray->cbElements;
+
+        // Most arrays fit the counts and strides kept in the object.
+        m_count = m_inline;
+        if ( safeArray->cDims > inlineDimensions )
+        {
+            m_count = (SIZE_T*)::CoTaskMemAlloc( safeArray->cDims * sizeof( SIZE_T ) * 2 );
+            VerifyAllocation( m_count );
+        }
+        m_stride = m_count + safeArray->cDims;
+
+        // The last bound is the one that changes fastest in memory.
+        for ( int dimension = safeArray->cDims - 1; dimension >= 0; dimension-- )
+        {
+            m_count[dimension] = 0;
+            m_stride[dimension] = stride;
+            stride *= safeArray->rgsabound[dimension].cElements;
+        }
+    }
+
+    inline ~CWalkSafeArrayData()
+    {
+        if ( m_count != m_inline )
+            ::CoTaskMemFree( m_count );
+    }
+
+    inline BYTE* GetElement()
+    {
+        return m_element;
+    }
+
+    void Next()
+    {
+        // The first bound is the one that changes fastest in the walk.
+        for ( int dimension = 0; dimension < m_SafeArray->cDims; dimension++ )
+        {
+            m_element += m_stride[dimension];
+
+            if ( ++m_count[dimension] < m_SafeArray->rgsabound[dimension].cElements )
+                break;
+
+            m_element -= m_stride[dimension] * m_count[dimension];
+            m_count[dimension] = 0;
+        }
+    }
+
+private:
+    enum { inlineDimensions = 8 };
+
+    SAFEARRAY*          m_SafeArray;
+    BYTE*               m_element;
+    SIZE_T*             m_count;
+    SIZE_T*             m_stride;
+    SIZE_T              m_inline[2 * inlineDimensions];
+
+}; // class CWalkSafeArrayData
+
+
+//==============================================================================
+// CSafeArrayData
+// Keeps a safe array's data accessed (locked) for the lifetime of the object.
+//==============================================================================
+
+class CSafeArrayData
+{
+public:
+    CSafeArrayData( SAFEARRAY* safeArray )
+        :   m_SafeArray( safeArray ),
+            m_data( NULL )
+    {
+        CheckResult( ::SafeArrayAccessData( safeArray, &m_data ) );
+    }
+
+    inline ~CSafeArrayData()
+    {
+        ::SafeArrayUnaccessData( m_SafeArray );
+    }
+
+    inline operator BYTE*()
+    {
+        return (BYTE*)m_data;
+    }
+
+private:
+    SAFEARRAY*          m_SafeArray;
+    void*               m_data;
+
+}; // class CSafeArrayData
+
+
+//==============================================================================
+// CTaskMemory
+// Scratch buffer allocated with CoTaskMemAlloc and freed on destruction.
+//==============================================================================
+
+class CTaskMemory
+{
+public:
+    // No memory is allocated for a size of 0, until Reserve.
+    CTaskMemory( ULONG size )
+        :   m_data( size ? (BYTE*)::CoTaskMemAlloc( size ) : NULL ),
+            m_size( size )
+    {
+        if ( size )
+            VerifyAllocation( m_data );
+    }
+
+    inline ~CTaskMemory()
+    {
+        ::CoTaskMemFree( m_data );
+    }
+
+    inline operator BYTE*()
+    {
+        return m_data;
+    }
+
+    // Makes the buffer at least size bytes.  Its contents are not kept.
+    void Reserve( ULONG size )
+    {
+        if ( size <= m_size )
+            return;
+
+        ::CoTaskMemFree( m_data );
+        m_data = (BYTE*)::CoTaskMemAlloc( size );
+        m_size = m_data ? size : 0;
+        VerifyAllocation( m_data );
+    }
+
+private:
+    BYTE*               m_data;
+    ULONG               m_size;
+
+}; // class CTaskMemory
+
+
+//==============================================================================
+// CSafeArrayListData
+// Keeps many safe arrays' data accessed (locked) for the lifetime of the
+// object, as CSafeArrayData does one.  The arrays are kept in the given
+// list, which must have room for all of them.
+//==============================================================================
+
+class CSafeArrayListData
+{
+public:
+    CSafeArrayListData( SAFEARRAY** arrays )
+        :   m_arrays( arrays ),
+            m_count( 0 )
+    {
+    }
+
+    inline ~CSafeArrayListData()
+    {
+        while ( m_count )
+            ::SafeArrayUnaccessData( m_arrays[--m_count] );
+    }
+
+    // Accesses the next array, returning its data.
+    BYTE* Add( SAFEARRAY* safeArray )
+    {
+        void*   data;
+
+        CheckResult( ::SafeArrayAccessData( safeArray, &data ) );
+        m_arrays[m_count++] = safeArray;
+
+        return (BYTE*)data;
+    }
+
+private:
+    SAFEARRAY**         m_arrays;
+    ULONG               m_count;
+
+}; // class CSafeArrayListData
+
+
+//==============================================================================
+// CStringArena
+// Hands out strings laid out as BSTRs are, a byte length ahead of the
+// characters and a null after them, from blocks of at least arenaBlockSize
+// bytes, so that decoding many strings takes a few allocations rather than
+// one each.  The strings can be read, and copied, as any BSTR can, but are
+// never freed with SysFreeString: they go all at once when the arena is
+// reset or freed.  Reset keeps the blocks for the next strings.
+//==============================================================================
+
+class CStringArena
+{
+public:
+    CStringArena()
+        :   m_first( NULL ),
+            m_current( NULL ),
+            m_next( NULL ),
+            m_end( NULL )
+    {
+    }
+
+    inline ~CStringArena()
+    {
+        Free();
+    }
+
+    // Reads a string as CStream::Read( BSTR* ) does, into the arena.
+    BSTR Read( CStream& stream )
+    {
+        UINT    bytes;
+        BSTR    value;
+
+        stream.Read( bytes );
+        value = Allocate( bytes );
+        stream.Read( (BYTE*)value, bytes );
+        value[bytes / sizeof( WCHAR )] = L'\0';
+
+        return value;
+    }
+
+    // Room for a string of bytes / 2 characters, with bytes bytes to fill in.
+    BSTR Allocate( UINT bytes )
+    {
+        DWORD*  length;
+        SIZE_T  size;
+
+        if ( bytes > 0x7FFFFFF0 )
+            ThrowError( E_OUTOFMEMORY );
+
+        // The length, the characters and the null, to a DWORD boundary.
+        size = ( sizeof( DWORD ) + bytes + sizeof( WCHAR ) + 3 ) & ~3;
+        if ( size > (SIZE_T)( m_end - m_next ) )
+            NextBlock( size );
+
+        length = (DWORD*)m_next;
+        *length = bytes & ~1;
+        m_next += size;
+
+        return (BSTR)( length + 1 );
+    }
+
+    // Starts again from the first block, keeping them all.
+    void Reset()
+    {
+        m_current = m_first;
+        m_next = m_first ? (BYTE*)( m_first + 1 ) : NULL;
+        m_end = m_first ? m_next + m_first->size : NULL;
+    }
+
+    void Free()
+    {
+        while ( m_first )
+        {
+            Block*  next = m_first->next;
+
+            ::CoTaskMemFree( m_first );
+            m_first = next;
+        }
+
+        Reset();
+    }
+
+private:
+    struct Block
+    {
+        Block*          next;
+        SIZE_T          size;
+    };
+
+    // Moves on to the next block, or to a new one after the current one if
+    // the next is missing or too small for size bytes.
+    void NextBlock( SIZE_T size )
+    {
+        Block*  block = m_current ? m_current->next : m_first;
+
+        if ( !block || block->size < size )
+        {
+            SIZE_T  blockSize = size > arenaBlockSize ? size : arenaBlockSize;
+            Block*  added = (Block*)::CoTaskMemAlloc( sizeof( Block ) + blockSize );
+
+            VerifyAllocation( added );
+            added->next = block;
+            added->size = blockSize;
+            if ( m_current )
+                m_current->next = added;
+            else
+                m_first = added;
+            block = added;
+        }
+
+        m_current = block;
+        m_next = (BYTE*)( block + 1 );
+        m_end = m_next + block->size;
+    }
+
+private:
+    Block*              m_first;
+    Block*              m_current;
+    BYTE*               m_next;
+    BYTE*               m_end;
+
+}; // class CStringArena
+
+
+//==============================================================================
+// CodecScratch
+// Memory kept from one call to the next by CVariantEncoder and
+// CVariantDecoder, so that encoding or decoding variants of the sizes seen
+// before allocates nothing but the results: the buffer a blob is encoded
+// into, CArrayStack's frames and the buffer elements of multi-dimensional
+// arrays are gathered in.  All zeros is empty.  Strings are decoded into the
+// arena, if there is one, rather than allocated as BSTRs, and arrays from the
+// allocator, if there is one, rather than by SafeArrayAllocDescriptor.
+//==============================================================================
+
+struct CodecScratch
+{
+    BLOB                buffer;
+    void*               frames;
+    ULONG               frameCapacity;
+    BYTE*               bulk;
+    CStringArena*       arena;
+    CVariantAllocator*  allocator;
+};
+
+
+//------------------------------------------------------------------------------
+// FreeScratch
+// Frees the scratch's memory, leaving it empty.
+//------------------------------------------------------------------------------
+
+inline void FreeScratch( CodecScratch& scratch )
+{
+    ::CoTaskMemFree( scratch.buffer.pBlobData );
+    ::CoTaskMemFree( scratch.frames );
+    ::CoTaskMemFree( scratch.bulk );
+    ::ZeroMemory( &scratch, sizeof( scratch ) );
+
+} // FreeScratch
+
+
+//------------------------------------------------------------------------------
+// TrimScratch
+// Frees the buffer the scratch encodes into if it has grown beyond size
+// bytes.
+//------------------------------------------------------------------------------
+
+inline void TrimScratch( CodecScratch& scratch, ULONG size )
+{
+    if ( scratch.buffer.cbSize > size )
+    {
+        ::CoTaskMemFree( scratch.buffer.pBlobData );
+        scratch.buffer.pBlobData = NULL;
+        scratch.buffer.cbSize = 0;
+    }
+
+} // TrimScratch
+
+
+//==============================================================================
+// CArrayStack
+// Heap allocated stack of the arrays being streamed.  An array of variants
+// may hold arrays, which are streamed in place of the element that holds
+// them.  Rather than recursing, the encoder and decoder push the inner array,
+// stream it, and pop back to the outer one, so the nesting depth is bounded
+// by maxDepth instead of by the thread's stack.  Each array's data is kept
+// accessed while it is on the stack.  Arrays that are only being counted
+// through, with no SAFEARRAY behind them, are pushed by type and count.  A
+// stack given a CodecScratch keeps its frames there, for the next stack to
+// start with.
+// Example:
+//      CArrayStack     stack( maxDepth );
+//
+//      stack.Push( safeArray, vt );
+//
+//      while ( !stack.IsEmpty() )
+//          {
+//          if ( !stack.Top().IsMore() )
+//              stack.Pop();
+//          else
+//              ... stack.Top().NextElement() ...
+//          }
+//==============================================================================
+
+class CArrayStack
+{
+public:
+    struct Frame
+    {
+        SAFEARRAY*      safeArray;
+        VARTYPE         vt;
+        BYTE*           data;
+        ULONGLONG       next;
+        ULONGLONG       count;
+        bool            isAccessed;
+
+        inline bool IsMore()
+        {
+            return next < count;
+        }
+
+        inline BYTE* NextElement()
+        {
+            return GetWalkElement( safeArray, data, next++ );
+        }
+    };
+
+    CArrayStack( ULONG maxDepth, CodecScratch* scratch = NULL )
+        :   m_frames( scratch ? (Frame*)scratch->frames : NULL ),
+            m_depth( 0 ),
+            m_capacity( scratch ? scratch->frameCapacity : 0 ),
+            m_maxDepth( maxDepth ),
+            m_scratch( scratch )
+    {
+    }
+
+    inline ~CArrayStack()
+    {
+        while ( m_depth )
+            Pop();
+
+        if ( !m_scratch )
+            ::CoTaskMemFree( m_frames );
+    }
+
+    // The scratch the stack keeps its frames in, if any, for the arrays on
+    // it to use too.
+    inline CodecScratch* GetScratch()
+    {
+        return m_scratch;
+    }
+
+    inline CStringArena* GetArena()
+    {
+        return m_scratch ? m_scratch->arena : NULL;
+    }
+
+    inline CVariantAllocator* GetAllocator()
+    {
+        return m_scratch ? m_scratch->allocator : NULL;
+    }
+
+    inline bool IsEmpty()
+    {
+        return 0 == m_depth;
+    }
+
+    inline Frame& Top()
+    {
+        return m_frames[m_depth - 1];
+    }
+
+    inline ULONG GetDepth()
+    {
+        return m_depth;
+    }
+
+    // Fails if one more array would nest deeper than allowed.  Arrays that
+    // are streamed in bulk are never pushed, but still count.
+    inline void CheckDepth()
+    {
+        if ( m_depth >= m_maxDepth )
+            ThrowError( HRESULT_FROM_WIN32( ERROR_STACK_OVERFLOW ) );
+    }
+
+    // Pushing may move the frames, so references from Top() don't survive it.
+    void Push( SAFEARRAY* safeArray, VARTYPE vt )
+    {
+        Frame&  frame = Grow();
+
+        CheckResult( ::SafeArrayAccessData( safeArray, (void**)&frame.data ) );
+        frame.safeArray = safeArray;
+        frame.vt = vt;
+        frame.next = 0;
+        frame.count = GetElementCount( safeArray );
+        frame.isAccessed = true;
+
+        m_depth++;
+    }
+
+    // Pushes count elements of an array from first on, given data the
+    // caller has accessed and keeps accessed.  Threads streaming different
+    // parts of one array share the caller's access rather than each taking
+    // their own.
+    void Push( SAFEARRAY* safeArray, VARTYPE vt, BYTE* data, ULONGLONG first, ULONGLONG count )
+    {
+        Frame&  frame = Grow();
+
+        frame.safeArray = safeArray;
+        frame.vt = vt;
+        frame.data = data;
+        frame.next = first;
+        frame.count = first + count;
+        frame.isAccessed = false;
+
+        m_depth++;
+    }
+
+    void Push( VARTYPE vt, ULONGLONG count )
+    {
+        Frame&  frame = Grow();
+
+        frame.safeArray = NULL;
+        frame.data = NULL;
+        frame.vt = vt;
+        frame.next = 0;
+        frame.count = count;
+        frame.isAccessed = false;
+
+        m_depth++;
+    }
+
+    inline void Pop()
+    {
+        m_depth--;
+        if ( m_frames[m_depth].isAccessed )
+            ::SafeArrayUnaccessData( m_frames[m_depth].safeArray );
+    }
+
+private:
+    // Makes room for one more frame and returns it.
+    Frame& Grow()
+    {
+        CheckDepth();
+
+        if ( m_depth == m_capacity )
+        {
+            ULONG   capacity = m_capacity ? m_capacity * 2 : 8;
+            Frame*  frames = (Frame*)::CoTaskMemRealloc( m_frames, capacity * sizeof( Frame ) );
+
+            VerifyAllocation( frames );
+            m_frames = frames;
+            m_capacity = capacity;
+
+            if ( m_scratch )
+            {
+                m_scratch->frames = frames;
+                m_scratch->frameCapacity = capacity;
+            }
+        }
+
+        return m_frames[m_depth];
+    }
+
+private:
+    Frame*              m_frames;
+    ULONG               m_depth;
+    ULONG               m_capacity;
+    ULONG               m_maxDepth;
+    CodecScratch*       m_scratch;
+
+}; // class CArrayStack
+
+
+//------------------------------------------------------------------------------
+// GetTypeSize
+// Given a variant type, determines how many bytes it takes to store data of
+// that type.
+//------------------------------------------------------------------------------
+
+inline void GetTypeSize( VARTYPE vt, ULONG& size )
+{
+    switch ( vt ) 
+    {
+    case VT_BOOL:
+        size = sizeof( VARIANT_BOOL );
+        break;
+    
+    case VT_I2:
+        size = sizeof( short );
+        break;
+    
+    case VT_ERROR:
+        size = sizeof( SCODE );
+        break;
+    
+    case VT_I4:
+        size = sizeof( long );
+        break;
+    
+    case VT_BSTR:
+        size = sizeof( BSTR );
+        break;
+    
+    case VT_R4:
+        size = sizeof( float );
+        break;
+    
+    case VT_DATE:
+        size = sizeof( DATE );
+        break;
+    
+    case VT_R8:
+        size = sizeof( double );
+        break;
+    
+    case VT_UI1:
+        size = sizeof( BYTE );
+        break;
+    
+    case VT_CY:
+        size = sizeof( CY );
+        break;
+    
+    case VT_VARIANT:
+        size = sizeof( VARIANT );
+        break;
+    
+    case VT_DISPATCH:
+        size = sizeof( IDispatch* );
+        break;
+    
+    case VT_UNKNOWN:
+        size = sizeof( IUnknown* );
+        break;
+    
+    case VT_I1:
+        size = sizeof( CHAR );
+        break;
+    
+    case VT_UI2:
+        size = sizeof( USHORT );
+        break;
+    
+    case VT_UI4:
+        size = sizeof( ULONG );
+        break;
+    
+    case VT_I8:
+        size = sizeof( LONGLONG );
+        break;
+    
+    case VT_UI8:
+        size = sizeof( ULONGLONG );
+        break;
+    
+    case VT_INT:
+        size = sizeof( INT );
+        break;
+    
+    case VT_UINT:
+        size = sizeof( UINT );
+        break;
+    
+    default:
+        ThrowError( DISP_E_TYPEMISMATCH );
+    }
+
+} // GetTypeSize
+
+
+//------------------------------------------------------------------------------
+// IsFixedSizeType
+// Determines whether data of the given type is streamed as its raw in-memory
+// bytes, so that arrays of it can be streamed in bulk instead of an element
+// at a time.  VT_BOOL is left out since its values are normalized on the way
+// out.
+//------------------------------------------------------------------------------
+
+inline bool IsFixedSizeType( VARTYPE vt )
+{
+    switch ( vt )
+    {
+    case VT_I1:
+    case VT_UI1:
+    case VT_I2:
+    case VT_UI2:
+    case VT_I4:
+    case VT_UI4:
+    case VT_I8:
+    case VT_UI8:
+    case VT_INT:
+    case VT_UINT:
+    case VT_R4:
+    case VT_R8:
+    case VT_DATE:
+    case VT_CY:
+    case VT_ERROR:
+        return true;
+    }
+
+    return false;
+
+} // IsFixedSizeType
+
+
+//------------------------------------------------------------------------------
+// GetElementCount
+// Returns the total number of elements in the array.  Each dimension's count
+// is 32 bits, but the total may not be.
+//------------------------------------------------------------------------------
+
+inline ULONGLONG GetElementCount( SAFEARRAY* safeArray )
+{
+    ULONGLONG   count = safeArray->cDims ? 1 : 0;
+
+    for ( int dimension = 0; dimension < safeArray->cDims; dimension++ )
+        count *= safeArray->rgsabound[dimension].cElements;
+
+    return count;
+
+} // GetElementCount
+
+
+//------------------------------------------------------------------------------
+// IsWalkContiguous
+// Determines whether CWalkSafeArrayElements visits the array's elements in
+// memory order, which is the case when at most one dimension has more than
+// one element.
+//------------------------------------------------------------------------------
+
+inline bool IsWalkContiguous( SAFEARRAY* safeArray )
+{
+    int         spans = 0;
+
+    for ( int dimension = 0; dimension < safeArray->cDims; dimension++ )
+    {
+        if ( safeArray->rgsabound[dimension].cElements > 1 )
+            spans++;
+    }
+
+    return spans <= 1;
+
+} // IsWalkContiguous
+
+
+//------------------------------------------------------------------------------
+// GetWalkElement
+// Returns a pointer to the element that CWalkSafeArrayElements visits in the
+// given position, counting from zero.  The array's data must be accessed.
+//------------------------------------------------------------------------------
+
+inline BYTE* GetWalkElement( SAFEARRAY* safeArray, BYTE* data, ULONGLONG position )
+{
+    SIZE_T      stride = safeArray->cbElements;
+    SIZE_T      offset = 0;
+    int         dimension;
+
+    if ( 1 == safeArray->cDims )
+        return data + (SIZE_T)position * stride;
+
+    // The walk moves fastest through the first bound, which is the one that
+    // moves slowest through memory.
+    for ( dimension = 1; dimension < safeArray->cDims; dimension++ )
+        stride *= safeArray->rgsabound[dimension].cElements;
+
+    for ( dimension = 0; dimension < safeArray->cDims; dimension++ )
+    {
+        ULONG   elements = safeArray->rgsabound[dimension].cElements;
+
+        offset += (SIZE_T)( position % elements ) * stride;
+        position /= elements;
+
+        if ( dimension + 1 < safeArray->cDims )
+            stride /= safeArray->rgsabound[dimension + 1].cElements;
+    }
+
+    return data + offset;
+
+} // GetWalkElement
+
+
+//------------------------------------------------------------------------------
+// Size of the buffer used to gather or scatter the elements of a
+// multi-dimensional array of a fixed size type.
+//------------------------------------------------------------------------------
+
+const ULONG bulkBufferSize = 0x10000;
+
+
+//------------------------------------------------------------------------------
+// GetBulkBuffer
+// Returns the scratch's buffer of bulkBufferSize bytes, allocating it the
+// first time.
+//------------------------------------------------------------------------------
+
+inline BYTE* GetBulkBuffer( CodecScratch& scratch )
+{
+    if ( !scratch.bulk )
+    {
+        scratch.bulk = (BYTE*)::CoTaskMemAlloc( bulkBufferSize );
+        VerifyAllocation( scratch.bulk );
+    }
+
+    return scratch.bulk;
+
+} // GetBulkBuffer
+
+
+//------------------------------------------------------------------------------
+// WriteSafeArrayData
+// Streams out the elements of an array of a fixed size type straight from the
+// array's memory.  The output is the same as streaming the elements one at a
+// time in CWalkSafeArrayElements order.  Elements are gathered in the
+// scratch's buffer, if one is given.
+//------------------------------------------------------------------------------
+
+inline void WriteSafeArrayData( SAFEARRAY* safeArray, IStream* pStream, CodecScratch* scratch = NULL )
+{
+    CStream             stream( pStream );
+    ULONGLONG           count = GetElementCount( safeArray );
+    ULONG               size = safeArray->cbElements;
+
+    if ( 0 == count )
+        return;
+
+    CSafeArrayData      data( safeArray );
+
+    // One dimensional arrays are written out as a single block.
+    if ( IsWalkContiguous( safeArray ) )
+    {
+        stream.Write( (BYTE*)data, count * size );
+        return;
+    }
+
+    // Otherwise gather the elements into a buffer and write it out whenever
+    // it fills up.
+    CTaskMemory         own( scratch ? 0 : bulkBufferSize );
+    BYTE*               buffer = scratch ? GetBulkBuffer( *scratch ) : (BYTE*)own;
+    CWalkSafeArrayData  walk( safeArray, data );
+    ULONG               used = 0;
+
+    for ( ULONGLONG element = 0; element < count; element++ )
+    {
+        if ( used + size > bulkBufferSize )
+        {
+            stream.Write( (BYTE*)buffer, used );
+            used = 0;
+        }
+
+        ::CopyMemory( buffer + used, walk.GetElement(), size );
+        used += size;
+
+        walk.Next();
+    }
+
+    stream.Write( (BYTE*)buffer, used );
+
+} // WriteSafeArrayData
+
+
+//------------------------------------------------------------------------------
+// ReadSafeArrayData
+// Mirror of WriteSafeArrayData.  Reads the elements of an array of a fixed
+// size type straight into the array's memory.
+//------------------------------------------------------------------------------
+
+inline void ReadSafeArrayData( SAFEARRAY* safeArray, IStream* pStream, CodecScratch* scratch = NULL )
+{
+    CStream             stream( pStream );
+    ULONGLONG           count = GetElementCount( safeArray );
+    ULONG               size = safeArray->cbElements;
+
+    if ( 0 == count )
+        return;
+
+    CSafeArrayData      data( safeArray );
+
+    // One dimensional arrays are read as a single block.
+    if ( IsWalkContiguous( safeArray ) )
+    {
+        stream.Read( (BYTE*)data, count * size );
+        return;
+    }
+
+    // Otherwise read a buffer at a time and scatter the elements.
+    CTaskMemory         own( scratch ? 0 : bulkBufferSize );
+    BYTE*               buffer = scratch ? GetBulkBuffer( *scratch ) : (BYTE*)own;
+    CWalkSafeArrayData  walk( safeArray, data );
+    ULONG               perBuffer = bulkBufferSize / size;
+
+    for ( ULONGLONG element = 0; element < count; )
+    {
+        ULONG           run = count - element < perBuffer ? (ULONG)( count - element ) : perBuffer;
+
+        stream.Read( (BYTE*)buffer, run * size );
+
+        for ( ULONG i = 0; i < run; i++ )
+        {
+            ::CopyMemory( walk.GetElement(), buffer + i * size, size );
+            walk.Next();
+        }
+
+        element += run;
+    }
+
+} // ReadSafeArrayData
+
+
+//------------------------------------------------------------------------------
+// WriteSafeArrayHeader
+// Writes the array's header information, such as the number of dimensions
+// and the bounds of each dimension (lower/upper)
+//------------------------------------------------------------------------------
+
+inline void WriteSafeArrayHeader( SAFEARRAY* safeArray, IStream* pStream )
+{
+    unsigned int        dimension;
+    CStream             stream( pStream );
+
+    // Write out the dimension count
+    stream.Write( safeArray->cDims );
+
+    // Write out the lower bound and the number of elements in each dimension.
+    for ( dimension = 0; dimension < safeArray->cDims; dimension++ )
+    {
+        stream.Write( safeArray->rgsabound[dimension].lLbound );
+        stream.Write( safeArray->rgsabound[dimension].cElements );
+    }
+
+} // WriteSafeArrayHeader
+
+
+//------------------------------------------------------------------------------
+// AllocSafeArrayData
+// Given an array descriptor whose bounds are filled in, sets the element size
+// and features for elements of the given type and allocates the data, from
+// the allocator if one is given.
+//------------------------------------------------------------------------------
+
+inline void AllocSafeArrayData( SAFEARRAY* safeArray, VARTYPE vt, CVariantAllocator* allocator = NULL )
+{
+    // Set the element size.
+    GetTypeSize( vt, safeArray->cbElements );
+
+    // Set the features mask.
+    switch ( vt )
+    {
+    case VT_BSTR:
+        safeArray->fFeatures |= FADF_BSTR;
+        break;
+    
+    case VT_UNKNOWN:
+        safeArray->fFeatures |= FADF_UNKNOWN;
+        break;
+    
+    case VT_DISPATCH:
+        safeArray->fFeatures |= FADF_DISPATCH;
+        break;
+    
+    case VT_VARIANT:
+        safeArray->fFeatures |= FADF_VARIANT;
+        break;
+    }
+
+    if ( !allocator )
+    {
+        CheckResult( SafeArrayAllocData( safeArray ) );
+        return;
+    }
+
+    ULONGLONG   count = GetElementCount( safeArray );
+
+    if ( count > ( (SIZE_T)-1 ) / safeArray->cbElements )
+        ThrowError( E_OUTOFMEMORY );
+
+    safeArray->pvData = allocator->Allocate( (SIZE_T)count * safeArray->cbElements );
+    VerifyAllocation( safeArray->pvData );
+    ::ZeroMemory( safeArray->pvData, (SIZE_T)count * safeArray->cbElements );
+
+} // AllocSafeArrayData
+
+
+//------------------------------------------------------------------------------
+// AllocSafeArrayDescriptor
+// Mirror of SafeArrayAllocDescriptor that takes the descriptor from the
+// allocator.  Such arrays are freed by FreeDecoded, not SafeArrayDestroy.
+//------------------------------------------------------------------------------
+
+inline SAFEARRAY* AllocSafeArrayDescriptor( USHORT dimensions, CVariantAllocator& allocator )
+{
+    SAFEARRAY*  safeArray;
+    SIZE_T      size = sizeof( SAFEARRAY ) + ( dimensions - 1 ) * sizeof( SAFEARRAYBOUND );
+
+    if ( !dimensions )
+        ThrowError( E_INVALIDARG );
+
+    safeArray = (SAFEARRAY*)allocator.Allocate( size );
+    VerifyAllocation( safeArray );
+    ::ZeroMemory( safeArray, size );
+    safeArray->cDims = dimensions;
+
+    return safeArray;
+
+} // AllocSafeArrayDescriptor
+
+
+//------------------------------------------------------------------------------
+// ReadSafeArrayHeader
+// Reads the array's bounds and creates it, from the allocator if one is
+// given.
+//------------------------------------------------------------------------------
+
+inline void ReadSafeArrayHeader( VARIANT* variant, VARTYPE vt, IStream* pStream, CVariantAllocator* allocator = NULL )
+{
+    unsigned short      dimensions;
+    unsigned short      dimension;
+    CStream             stream( pStream );
+
+    // Read the dimension count
+    stream.Read( dimensions );
+
+    if ( allocator )
+        variant->parray = AllocSafeArrayDescriptor( dimensions, *allocator );
+    else
+        CheckResult( SafeArrayAllocDescriptor( dimensions, &variant->parray ) );
+
+    // Read the lower bound and the number of elements in this dimension.
+    for ( dimension = 0; dimension < dimensions; dimension++ )
+    {
+        stream.Read( variant->parray->rgsabound[dimension].lLbound );
+        stream.Read( variant->parray->rgsabound[dimension].cElements );
+    }
+
+    AllocSafeArrayData( variant->parray, vt, allocator );
+
+    // Set variant's type
+    variant->vt = (VARTYPE) ( vt | VT_ARRAY );
+
+} // ReadSafeArrayHeader
+
+
+
+//------------------------------------------------------------------------------
+// GetPersistStreamInterface
+// Get IPersistStream for the given object.
+//------------------------------------------------------------------------------
+
+inline void GetPersistStreamInterface( IUnknown* pUnknown, IPersistStream** ppPersistStream )
+{
+    CComPtr<IPersistStreamInit>     persistStreamInit;
+    CComPtr<IPersistStream>         persistStream;
+    HRESULT                         hr;
+
+    // See if the object supports IPersistStreamInit.
+    hr = pUnknown->QueryInterface( &persistStreamInit );
+    if ( FAILED( hr ) && E_NOINTERFACE != hr )
+        ThrowError( hr );
+
+    // If the object doesn't support IPersistStreamInit, see
+    // if supports IPersistStream
+    if ( !persistStreamInit )
+    {
+        hr = pUnknown->QueryInterface( &persistStream );
+        if ( FAILED( hr ) && E_NOINTERFACE != hr )
+            ThrowError( hr );
+    }
+
+    // Return either IPersistStreamInit or IPersistStream, whichever
+    // one was retrieved.  Since these interfaces are binary
+    // compatible, we can use the same pointer to refer to either.
+    if ( persistStream )
+        *ppPersistStream = persistStream.Detach();
+    else
+        *ppPersistStream = (IPersistStream*)persistStreamInit.Detach();
+
+} // GetPersistStreamInterface
+
+
+//------------------------------------------------------------------------------
+// SaveObjectToStream
+// Wrapper for OleSaveToStream.  Difference is that this function
+// takes an IUnknown instead of an IPersistStream and uses the IUnknown
+// to get an IPersistStream using GetPersistStreamInterface, which is
+// smart enough to QI for both IPersistStreamInit and IPersistStream.
+// As with OleSaveToStream, the object pointer may be NULL.
+//------------------------------------------------------------------------------
+
+inline void SaveObjectToStream( IUnknown* pUnknown, IStream* pStream )
+{
+    CComPtr<IPersistStream>       persistStream;
+
+    // Get IPersistStream interface for the object. 
+    if ( pUnknown )
+    {
+        GetPersistStreamInterface( pUnknown, &persistStream );
+
+        // If we didn't get IPersistStream, then fail.  For now,
+        // these are the only two interfaces we're supporting.
+        // Later, we can add support for others such as IStorage,
+        // IPersistMemory, IPersistStorage, IPersistPropertyBag, etc.
+        if ( !persistStream )
+            ThrowError( E_NOINTERFACE );
+    }
+
+    // Save the object to the stream.
+    CheckResult( OleSaveToStream( persistStream, pStream ) );
+
+} // SaveObjectToStream
+
+
+//------------------------------------------------------------------------------
+// WriteValueToStream
+// Writes the data of a variant that is not an array to the stream.
+// The passed in variant is assumed to be fully dereferenced (i.e. no VT_BYREF)
+//------------------------------------------------------------------------------
+
+inline void WriteValueToStream( const VARIANT* variant, IStream* pStream )
+{
+    IDispatch*          pDispatch;
+    CComPtr<IUnknown>   unknown;
+    CStream             stream( pStream );
+
+    switch ( variant->vt )
+    {
+    case VT_EMPTY:
+    case VT_NULL:
+        break;
+    
+    case VT_BOOL:
+        // A VARIANT_BOOL is 16 bits.
+        stream.Write( V_BOOL( variant ) );
+        break;
+    
+    case VT_UI1:
+        stream.Write( V_UI1( variant ) );
+        break;
+    
+    case VT_I2:
+        stream.Write( V_I2( variant ) );
+        break;
+    
+    case VT_I4:
+        stream.Write( V_I4( variant ) );
+        break;
+    
+    case VT_CY:
+        stream.Write( variant->cyVal.Lo );
+        stream.Write( variant->cyVal.Hi );
+        break;
+    
+    case VT_R4:
+        stream.Write( V_R4( variant ) );
+        break;
+    
+    case VT_R8:
+        stream.Write( V_R8( variant ) );
+        break;
+    
+    case VT_DATE:
+        // A Variant DATE is a double.
+        stream.Write( V_DATE( variant ) );
+        break;
+    
+    case VT_BSTR:
+        stream.Write( V_BSTR( variant ) );
+        break;
+    
+    case VT_ERROR:
+        stream.Write( V_ERROR( variant ) );
+        break;
+    
+    case VT_I1:
+        stream.Write( V_I1( variant ) );
+        break;
+    
+    case VT_UI2:
+        stream.Write( V_UI2( variant ) );
+        break;
+    
+    case VT_UI4:
+        stream.Write( V_UI4( variant ) );
+        break;
+    
+    case VT_I8:
+        stream.Write( V_I8( variant ) );
+        break;
+    
+    case VT_UI8:
+        stream.Write( V_UI8( variant ) );
+        break;
+    
+    case VT_INT:
+        stream.Write( V_INT( variant ) );
+        break;
+    
+    case VT_UINT:
+        stream.Write( V_UINT( variant ) );
+        break;
+    
+    case VT_DISPATCH:
+        pDispatch = V_DISPATCH( variant );
+        if ( pDispatch )
+            CheckResult( pDispatch->QueryInterface( &unknown ) );
+
+        SaveObjectToStream( unknown, stream );
+        break;
+
+    case VT_UNKNOWN:
+        SaveObjectToStream( V_UNKNOWN( variant ), stream );
+        break;
+
+    default:
+        ThrowError( DISP_E_TYPEMISMATCH );
+    }
+
+} // WriteValueToStream
+
+
+//------------------------------------------------------------------------------
+// ReadValueFromStream
+// Given the data type of a variant that is not an array, reads the variant's
+// data from the stream.
+//------------------------------------------------------------------------------
+
+inline void ReadValueFromStream( VARTYPE vt, IStream* pStream, VARIANT& variant, CStringArena* arena = NULL )
+{
+    CComPtr<IUnknown>       unknown;
+    CComPtr<IDispatch>      dispatch;
+    CStream                 stream( pStream );
+
+    switch ( vt )
+    {
+    case VT_EMPTY:
+    case VT_NULL:
+        break;
+    
+    case VT_BOOL:
+        // A VARIANT_BOOL is 16 bits.
+        stream.Read( V_BOOL( &variant ) );
+        break;
+    
+    case VT_UI1:
+        stream.Read( V_UI1( &variant ) );
+        break;
+    
+    case VT_I2:
+        stream.Read( V_I2( &variant ) );
+        break;
+    
+    case VT_I4:
+        stream.Read( V_I4( &variant ) );
+        break;
+    
+    case VT_CY:
+        stream.Read( variant.cyVal.Lo );
+        stream.Read( variant.cyVal.Hi );
+        break;
+    
+    case VT_R4:
+        stream.Read( V_R4( &variant ) );
+        break;
+    
+    case VT_R8:
+        stream.Read( V_R8( &variant ) );
+        break;
+    
+    case VT_DATE:
+        stream.Read( V_DATE( &variant ) );
+        break;
+    
+    case VT_BSTR:
+        if ( arena )
+            variant.bstrVal = arena->Read( stream );
+        else
+            stream.Read( &variant.bstrVal );
+        break;
+    
+    case VT_ERROR:
+        stream.Read( V_ERROR( &variant ) );
+        break;
+    
+    case VT_I1:
+        stream.Read( V_I1( &variant ) );
+        break;
+    
+    case VT_UI2:
+        stream.Read( V_UI2( &variant ) );
+        break;
+    
+    case VT_UI4:
+        stream.Read( V_UI4( &variant ) );
+        break;
+    
+    case VT_I8:
+        stream.Read( V_I8( &variant ) );
+        break;
+    
+    case VT_UI8:
+        stream.Read( V_UI8( &variant ) );
+        break;
+    
+    case VT_INT:
+        stream.Read( V_INT( &variant ) );
+        break;
+    
+    case VT_UINT:
+        stream.Read( V_UINT( &variant ) );
+        break;
+    
+    case VT_DISPATCH:
+        CheckResult( OleLoadFromStream( pStream, IID_IUnknown, (void**)(IUnknown*)&unknown ) );
+        CheckResult( unknown->QueryInterface( &dispatch ) );
+        V_DISPATCH( &variant ) = dispatch.Detach();
+        break;
+
+    case VT_UNKNOWN:
+        CheckResult( OleLoadFromStream( pStream, IID_IUnknown, (void**)(IUnknown*)&unknown ) );
+        V_UNKNOWN( &variant ) = unknown.Detach();
+        break;
+    
+    default:
+        ThrowError( DISP_E_TYPEMISMATCH );
+    }
+
+    variant.vt = vt;
+
+} // ReadValueFromStream
+
+
+//------------------------------------------------------------------------------
+// GetElementValue
+// Fills in a variant with the value of an element of an array that is not an
+// array of variants.  The variant does not own the value, so it must not be
+// cleared.
+//------------------------------------------------------------------------------
+
+inline void GetElementValue( const BYTE* element, VARTYPE vt, ULONG size, VARIANT& variant )
+{
+    variant.vt = vt;
+    ::CopyMemory( &variant.byref, element, size );
+
+    if ( VT_BOOL == vt )
+    {
+#pragma warning(disable: 4310) // cast truncates constant value
+        variant.boolVal = variant.boolVal ? VARIANT_TRUE : VARIANT_FALSE;
+#pragma warning(default: 4310) // cast truncates constant value
+    }
+
+} // GetElementValue
+
+
+//------------------------------------------------------------------------------
+// BeginWriteSafeArray
+// Writes out the array's header.  Arrays of fixed size types are written out
+// in full, others are pushed on the stack for WriteSafeArray to walk.
+//------------------------------------------------------------------------------
+
+inline void BeginWriteSafeArray(    SAFEARRAY*      safeArray,
+                                    VARTYPE         vt,
+                                    CArrayStack&    stack,
+                                    IStream*        pStream )
+{
+    stack.CheckDepth();
+
+    WriteSafeArrayHeader( safeArray, pStream );
+
+    if ( IsFixedSizeType( vt ) )
+        WriteSafeArrayData( safeArray, pStream, stack.GetScratch() );
+    else if ( GetElementCount( safeArray ) )
+        stack.Push( safeArray, vt );
+
+} // BeginWriteSafeArray
+
+
+//------------------------------------------------------------------------------
+// WriteStackedArrays
+// Writes out the elements of the arrays on the stack, and any arrays nested
+// in them, until the stack is empty.  Elements are written in
+// CWalkSafeArrayElements order.  An array of variants writes each element's
+// data type ahead of its data, and an element that is itself an array is
+// written out in full before moving on to the next one.
+//------------------------------------------------------------------------------
+
+inline void WriteStackedArrays( CArrayStack& stack, IStream* pStream )
+{
+    CStream             stream( pStream );
+
+    while ( !stack.IsEmpty() )
+    {
+        CArrayStack::Frame&     frame = stack.Top();
+
+        if ( !frame.IsMore() )
+        {
+            stack.Pop();
+            continue;
+        }
+
+        BYTE*   element = frame.NextElement();
+
+        if ( VT_VARIANT == frame.vt )
+        {
+            const VARIANT*  variant = (const VARIANT*)element;
+
+            // Write out the element's data type so that it can be known when
+            // the element is streamed back in.
+            stream.Write( variant->vt );
+
+            if ( V_ISARRAY( variant ) )
+            {
+                BeginWriteSafeArray(    V_ISBYREF( variant ) ? *variant->pparray : variant->parray,
+                                        (VARTYPE)( VT_TYPEMASK & variant->vt ),
+                                        stack,
+                                        stream );
+            }
+            else
+            {
+                WriteValueToStream( variant, stream );
+            }
+        }
+        else
+        {
+            VARIANT     value;
+
+            GetElementValue( element, frame.vt, frame.safeArray->cbElements, value );
+            WriteValueToStream( &value, stream );
+        }
+    }
+
+} // WriteStackedArrays
+
+
+//------------------------------------------------------------------------------
+// WriteSafeArray
+// Writes out the array, and any arrays nested in it, without recursing.
+// The stack keeps its frames in the scratch, if one is given.
+//------------------------------------------------------------------------------
+
+inline void WriteSafeArray( SAFEARRAY* safeArray, VARTYPE vt, IStream* pStream, ULONG maxDepth, CodecScratch* scratch = NULL )
+{
+    CArrayStack         stack( maxDepth, scratch );
+
+    BeginWriteSafeArray( safeArray, vt, stack, pStream );
+    WriteStackedArrays( stack, pStream );
+
+} // WriteSafeArray
+
+
+//------------------------------------------------------------------------------
+// BeginReadSafeArray
+// Reads the array's header into the variant.  Arrays of fixed size types are
+// read in full, others are pushed on the stack for ReadSafeArray to fill in.
+//------------------------------------------------------------------------------
+
+inline void BeginReadSafeArray(     VARIANT&        variant,
+                                    VARTYPE         vt,
+                                    CArrayStack&    stack,
+                                    IStream*        pStream )
+{
+    stack.CheckDepth();
+
+    ReadSafeArrayHeader( &variant, vt, pStream, stack.GetAllocator() );
+
+    if ( IsFixedSizeType( vt ) )
+        ReadSafeArrayData( variant.parray, pStream, stack.GetScratch() );
+    else if ( GetElementCount( variant.parray ) )
+        stack.Push( variant.parray, vt );
+
+} // BeginReadSafeArray
+
+
+//------------------------------------------------------------------------------
+// ReadStackedArrays
+// Mirror of WriteStackedArrays.  Reads the elements of the arrays on the
+// stack, and any arrays nested in them, straight into the elements of the
+// arrays until the stack is empty.
+//------------------------------------------------------------------------------
+
+inline void ReadStackedArrays( CArrayStack& stack, IStream* pStream )
+{
+    CStream             stream( pStream );
+
+    while ( !stack.IsEmpty() )
+    {
+        CArrayStack::Frame&     frame = stack.Top();
+
+        if ( !frame.IsMore() )
+        {
+            stack.Pop();
+            continue;
+        }
+
+        BYTE*   element = frame.NextElement();
+
+        if ( VT_VARIANT == frame.vt )
+        {
+            VARIANT&    elementVariant = *(VARIANT*)element;
+            VARTYPE     elementType;
+
+            // Array of variants, so read the element's type first.
+            stream.Read( elementType );
+
+            if ( elementType & VT_ARRAY )
+                BeginReadSafeArray( elementVariant, (VARTYPE)( VT_TYPEMASK & elementType ), stack, stream );
+            else
+                ReadValueFromStream( elementType, stream, elementVariant, stack.GetArena() );
+        }
+        else
+        {
+            VARIANT     value;
+
+            // Read the value and hand it over to the array.
+            value.vt = VT_EMPTY;
+            ReadValueFromStream( frame.vt, stream, value, stack.GetArena() );
+            ::CopyMemory( element, &value.byref, frame.safeArray->cbElements );
+        }
+    }
+
+} // ReadStackedArrays
+
+
+//------------------------------------------------------------------------------
+// ReadSafeArray
+// Mirror of WriteSafeArray.  Reads the array, and any arrays nested in it,
+// into new arrays without recursing.
+//------------------------------------------------------------------------------
+
+inline void ReadSafeArray( VARIANT& variant, VARTYPE vt, IStream* pStream, ULONG maxDepth, CodecScratch* scratch = NULL )
+{
+    CArrayStack         stack( maxDepth, scratch );
+
+    BeginReadSafeArray( variant, vt, stack, pStream );
+    ReadStackedArrays( stack, pStream );
+
+} // ReadSafeArray
+
+
+//------------------------------------------------------------------------------
+// WriteDataToStream
+// Writes the given variant's data to the stream.
+// Used by WriteToStream.
+// The passed in variant is assumed to be fully dereferenced (i.e. no VT_BYREF)
+//------------------------------------------------------------------------------
+
+inline void WriteDataToStream( const VARIANT* variant, IStream* pStream, ULONG maxDepth, CodecScratch* scratch = NULL )
+{
+    ValidatePointer( variant );
+
+    // If it's an array write out individual value.
+    if ( V_ISARRAY( variant ) )
+    {
+        WriteSafeArray( V_ISBYREF( variant ) ? *variant->pparray : variant->parray,
+                        (VARTYPE)( VT_TYPEMASK & variant->vt ),
+                        pStream,
+                        maxDepth,
+                        scratch );
+    }
+    // It's not an array, so write the individual value
+    else
+    {
+        WriteValueToStream( variant, pStream );
+    }
+
+} // WriteDataToStream
+
+
+//------------------------------------------------------------------------------
+// WriteToStream
+// Writes the given variant to the stream.
+// First writes out the data type of the variant followed by the 
+// variant's data.  Arrays are walked with the scratch's memory, if one is
+// given.
+//------------------------------------------------------------------------------
+
+inline void WriteToStream( const VARIANT* variantParam, IStream* pStream, ULONG maxDepth, CodecScratch* scratch = NULL )
+{
+    CComVariant     variantCopy;
+    const VARIANT*  variant;
+    CStream         stream( pStream );
+
+    ValidatePointer( variantParam );
+
+    // Use dereferenced copy if incoming is byref.
+    if ( V_ISBYREF( variantParam ) )
+    {
+        CheckResult( VariantCopyInd( &variantCopy, (VARIANT*) variantParam ) );
+        variant = &variantCopy;
+    }
+    else
+    {
+        variant = variantParam;
+    }
+
+    // Write the VT type.
+    stream.Write( variant->vt );
+
+    // Write out the actual data.
+    WriteDataToStream( variant, pStream, maxDepth, scratch );
+
+} // WriteToStream
+
+
+//------------------------------------------------------------------------------
+// ReadDataFromStream
+// Given the variant's data type, reads the variant's data from the stream.
+//------------------------------------------------------------------------------
+
+inline void ReadDataFromStream( VARTYPE vt, IStream* pStream, VARIANT& variant, ULONG maxDepth, CodecScratch* scratch = NULL )
+{
+    // If it's an array, read it and its elements, otherwise read the
+    // individual value.
+    if ( vt & VT_ARRAY )
+        ReadSafeArray( variant, (VARTYPE) ( VT_TYPEMASK & vt ), pStream, maxDepth, scratch );
+    else
+        ReadValueFromStream( vt, pStream, variant, scratch ? scratch->arena : NULL );
+
+} // ReadDataFromStream
+
+
+//------------------------------------------------------------------------------
+// ReadFromStream
+// Reads the variant from the stream.
+// First reads the variant's data type and then calls ReadDataFromStream
+// to read the variant's data.  Arrays are walked with the scratch's memory,
+// if one is given.
+//------------------------------------------------------------------------------
+
+inline void ReadFromStream( IStream* pStream, VARIANT& variant, ULONG maxDepth, CodecScratch* scratch = NULL )
+{
+    VARTYPE             vt;
+    CStream             stream( pStream );
+
+    // Read the VT type.
+    stream.Read( vt );
+
+    ReadDataFromStream( vt, pStream, variant, maxDepth, scratch );
+
+} // ReadFromStream
+
+
+//------------------------------------------------------------------------------
+// ReadSafeArrayHeaderInto
+// Reads an array's header as ReadSafeArrayHeader does, but keeps the
+// variant's array if it already has the same element type and bounds and is
+// not locked, returning true.  Otherwise the variant is cleared and a new
+// array made.  Only arrays of up to 8 dimensions are kept.
+//------------------------------------------------------------------------------
+
+inline bool ReadSafeArrayHeaderInto( VARIANT& variant, VARTYPE vt, IStream* pStream )
+{
+    SAFEARRAYBOUND      bounds[8];
+    USHORT              dimensions;
+    USHORT              dimension;
+    SAFEARRAY*          safeArray = ( vt | VT_ARRAY ) == variant.vt ? variant.parray : NULL;
+    CStream             stream( pStream );
+
+    stream.Read( dimensions );
+
+    if ( dimensions > sizeof( bounds ) / sizeof( bounds[0] ) )
+    {
+        CheckResult( ::VariantClear( &variant ) );
+        CheckResult( SafeArrayAllocDescriptor( dimensions, &variant.parray ) );
+
+        for ( dimension = 0; dimension < dimensions; dimension++ )
+        {
+            stream.Read( variant.parray->rgsabound[dimension].lLbound );
+            stream.Read( variant.parray->rgsabound[dimension].cElements );
+        }
+    }
+    else
+    {
+        bool    isSame = safeArray && safeArray->cDims == dimensions && !safeArray->cLocks;
+
+        for ( dimension = 0; dimension < dimensions; dimension++ )
+        {
+            stream.Read( bounds[dimension].lLbound );
+            stream.Read( bounds[dimension].cElements );
+
+            if ( isSame )
+            {
+                isSame =    bounds[dimension].lLbound == safeArray->rgsabound[dimension].lLbound &&
+                            bounds[dimension].cElements == safeArray->rgsabound[dimension].cElements;
+            }
+        }
+
+        if ( isSame )
+            return true;
+
+        CheckResult( ::VariantClear( &variant ) );
+        CheckResult( SafeArrayAllocDescriptor( dimensions, &variant.parray ) );
+        ::CopyMemory( variant.parray->rgsabound, bounds, dimensions * sizeof( SAFEARRAYBOUND ) );
+    }
+
+    AllocSafeArrayData( variant.parray, vt );
+    variant.vt = (VARTYPE)( vt | VT_ARRAY );
+
+    return false;
+
+} // ReadSafeArrayHeaderInto
+
+
+//------------------------------------------------------------------------------
+// ClearSafeArrayElements
+// Frees what the elements of an array of strings, objects or variants hold
+// and empties them, keeping the array.
+//------------------------------------------------------------------------------
+
+inline void ClearSafeArrayElements( SAFEARRAY* safeArray, VARTYPE vt )
+{
+    ULONGLONG   count = GetElementCount( safeArray );
+
+    for ( ULONGLONG element = 0; element < count; element++ )
+    {
+        switch ( vt )
+        {
+        case VT_BSTR:
+            ::SysFreeString( ( (BSTR*)safeArray->pvData )[element] );
+            ( (BSTR*)safeArray->pvData )[element] = NULL;
+            break;
+
+        case VT_UNKNOWN:
+        case VT_DISPATCH:
+            if ( ( (IUnknown**)safeArray->pvData )[element] )
+                ( (IUnknown**)safeArray->pvData )[element]->Release();
+            ( (IUnknown**)safeArray->pvData )[element] = NULL;
+            break;
+
+        case VT_VARIANT:
+            CheckResult( ::VariantClear( &( (VARIANT*)safeArray->pvData )[element] ) );
+            break;
+        }
+    }
+
+} // ClearSafeArrayElements
+
+
+//------------------------------------------------------------------------------
+// ReadDataInto
+// Reads the variant's data as ReadDataFromStream does, overwriting the
+// variant.  An array with the same element type and bounds as the variant's
+// is read into the variant's array in place; only the arrays nested in an
+// array of variants are made anew.
+//------------------------------------------------------------------------------
+
+inline void ReadDataInto( VARTYPE vt, IStream* pStream, VARIANT& variant, ULONG maxDepth, CodecScratch* scratch )
+{
+    VARTYPE         elementType = (VARTYPE)( VT_TYPEMASK & vt );
+    CArrayStack     stack( maxDepth, scratch );
+
+    if ( !( vt & VT_ARRAY ) )
+    {
+        CheckResult( ::VariantClear( &variant ) );
+        ReadValueFromStream( vt, pStream, variant );
+        return;
+    }
+
+    stack.CheckDepth();
+
+    if ( ReadSafeArrayHeaderInto( variant, elementType, pStream ) && !IsFixedSizeType( elementType ) )
+        ClearSafeArrayElements( variant.parray, elementType );
+
+    if ( IsFixedSizeType( elementType ) )
+        ReadSafeArrayData( variant.parray, pStream, scratch );
+    else if ( GetElementCount( variant.parray ) )
+        stack.Push( variant.parray, elementType );
+
+    ReadStackedArrays( stack, pStream );
+
+} // ReadDataInto
+
+
+//------------------------------------------------------------------------------
+// ReadVersion
+// Reads the version a streamed variant starts with, and moves past the chunk
+// table that follows it at chunkedVersion, or the directory at mapVersion,
+// which readers going through the variant from start to end have no use
+// for.  Reader is a CStream or a CMemoryCursor.
+//------------------------------------------------------------------------------
+
+template <class Reader>
+inline void ReadVersion( Reader& reader )
+{
+    long        version;
+    ULONG       count;
+    ULONG       slotCount;
+    ULONG       value;
+    ULONGLONG   offset;
+
+    reader.Read( version );
+
+    if ( chunkedVersion == version )
+    {
+        // Elements per chunk, then the chunks.
+        reader.Read( value );
+        reader.Read( count );
+
+        for ( ULONG chunk = 0; chunk < count; chunk++ )
+            reader.Read( offset );
+    }
+    else if ( mapVersion == version )
+    {
+        reader.Read( count );
+        reader.Read( slotCount );
+
+        for ( ULONG slot = 0; slot < slotCount; slot++ )
+            reader.Read( value );
+
+        for ( ULONG entry = 0; entry < count; entry++ )
+        {
+            reader.Read( value );
+            reader.Read( offset );
+            reader.Read( offset );
+        }
+    }
+
+} // ReadVersion
+
+
+//------------------------------------------------------------------------------
+// VisitValue
+// Reads a value that is not an array and passes it to the visitor.  Strings
+// are read into the scratch buffer rather than into a BSTR.
+//------------------------------------------------------------------------------
+
+inline void VisitValue(     VARTYPE             vt,
+                            CTaskMemory&        scratch,
+                            CVariantVisitor&    visitor,
+                            IStream*            pStream )
+{
+    CStream         stream( pStream );
+
+    if ( VT_BSTR == vt )
+    {
+        UINT        size;
+
+        stream.Read( size );
+        scratch.Reserve( size );
+        stream.Read( (BYTE*)scratch, size );
+
+        visitor.String( (const WCHAR*)(BYTE*)scratch, size / sizeof( WCHAR ) );
+    }
+    else
+    {
+        CComVariant     value;
+
+        ReadValueFromStream( vt, stream, value );
+        visitor.Scalar( value );
+    }
+
+} // VisitValue
+
+
+//------------------------------------------------------------------------------
+// BeginVisitArray
+// Reads the array's header and passes it to the visitor.  Arrays of fixed
+// size types are read a buffer at a time and passed on in full, others are
+// pushed on the stack for VisitSafeArray to walk.
+//------------------------------------------------------------------------------
+
+inline void BeginVisitArray(    VARTYPE             vt,
+                                CArrayStack&        stack,
+                                CTaskMemory&        scratch,
+                                CVariantVisitor&    visitor,
+                                IStream*            pStream )
+{
+    CStream             stream( pStream );
+    USHORT              dimensions;
+    USHORT              dimension;
+    SAFEARRAYBOUND*     bounds;
+    ULONGLONG           count;
+    ULONG               size;
+
+    stack.CheckDepth();
+
+    GetTypeSize( vt, size );
+
+    stream.Read( dimensions );
+    scratch.Reserve( dimensions * sizeof( SAFEARRAYBOUND ) );
+    bounds = (SAFEARRAYBOUND*)(BYTE*)scratch;
+    count = dimensions ? 1 : 0;
+
+    // The stream holds the bounds in the order a SAFEARRAY does, which is
+    // the reverse of SafeArrayCreate's.
+    for ( dimension = dimensions; dimension > 0; dimension-- )
+    {
+        stream.Read( bounds[dimension - 1].lLbound );
+        stream.Read( bounds[dimension - 1].cElements );
+        count *= bounds[dimension - 1].cElements;
+    }
+
+    visitor.BeginArray( vt, dimensions, bounds );
+
+    if ( !IsFixedSizeType( vt ) && count )
+    {
+        stack.Push( vt, count );
+        return;
+    }
+
+    if ( IsFixedSizeType( vt ) )
+    {
+        ULONG   perBuffer = bulkBufferSize / size;
+
+        scratch.Reserve( bulkBufferSize );
+
+        while ( count )
+        {
+            ULONG   run = count < perBuffer ? (ULONG)count : perBuffer;
+
+            stream.Read( (BYTE*)scratch, run * size );
+            visitor.Elements( vt, (BYTE*)scratch, run );
+
+            count -= run;
+        }
+    }
+
+    visitor.EndArray();
+
+} // BeginVisitArray
+
+
+//------------------------------------------------------------------------------
+// VisitSafeArray
+// Mirror of ReadSafeArray.  Reads the array, and any arrays nested in it,
+// passing their contents to the visitor instead of building arrays.
+//------------------------------------------------------------------------------
+
+inline void VisitSafeArray( VARTYPE vt, IStream* pStream, CVariantVisitor& visitor, ULONG maxDepth )
+{
+    CStream             stream( pStream );
+    CArrayStack         stack( maxDepth );
+    CTaskMemory         scratch( bulkBufferSize );
+
+    BeginVisitArray( vt, stack, scratch, visitor, stream );
+
+    while ( !stack.IsEmpty() )
+    {
+        CArrayStack::Frame&     frame = stack.Top();
+
+        if ( !frame.IsMore() )
+        {
+            stack.Pop();
+            visitor.EndArray();
+            continue;
+        }
+
+        frame.next++;
+
+        if ( VT_VARIANT == frame.vt )
+        {
+            VARTYPE     elementType;
+
+            // Array of variants, so read the element's type first.
+            stream.Read( elementType );
+
+            if ( elementType & VT_ARRAY )
+                BeginVisitArray( (VARTYPE)( VT_TYPEMASK & elementType ), stack, scratch, visitor, stream );
+            else
+                VisitValue( elementType, scratch, visitor, stream );
+        }
+        else
+        {
+            VisitValue( frame.vt, scratch, visitor, stream );
+        }
+    }
+
+} // VisitSafeArray
+
+
+//------------------------------------------------------------------------------
+// VisitFromStream
+// Reads the variant's data type and passes the variant's contents to the
+// visitor.
+//------------------------------------------------------------------------------
+
+inline void VisitFromStream( IStream* pStream, CVariantVisitor& visitor, ULONG maxDepth )
+{
+    VARTYPE             vt;
+    CStream             stream( pStream );
+
+    // Read the VT type.
+    stream.Read( vt );
+
+    if ( vt & VT_ARRAY )
+    {
+        VisitSafeArray( (VARTYPE)( VT_TYPEMASK & vt ), pStream, visitor, maxDepth );
+    }
+    else
+    {
+        CTaskMemory     scratch( sizeof( WCHAR ) );
+
+        VisitValue( vt, scratch, visitor, pStream );
+    }
+
+} // VisitFromStream
+
+
+
+//------------------------------------------------------------------------------
+// ReadMemory
+// Reads a value of type Q from streamed data in memory, which may not be
+// aligned, and moves past it.  Fails if the data ends first.
+//------------------------------------------------------------------------------
+
+template <class Q>
+inline void ReadMemory( const BYTE*& data, const BYTE* end, Q& value )
+{
+    if ( (SIZE_T)( end - data ) < sizeof( value ) )
+        ThrowError( E_FAIL );
+
+    ::CopyMemory( &value, data, sizeof( value ) );
+    data += sizeof( value );
+
+} // ReadMemory
+
+
+//------------------------------------------------------------------------------
+// WriteMemory
+// Mirror of ReadMemory, for memory already known to be large enough.
+//------------------------------------------------------------------------------
+
+template <class Q>
+inline void WriteMemory( BYTE*& data, const Q& value )
+{
+    ::CopyMemory( data, &value, sizeof( value ) );
+    data += sizeof( value );
+
+} // WriteMemory
+
+
+//------------------------------------------------------------------------------
+// SkipMemory
+// Moves past size bytes of streamed data in memory.  Fails if the data ends
+// first.
+//------------------------------------------------------------------------------
+
+inline void SkipMemory( const BYTE*& data, const BYTE* end, ULONGLONG size )
+{
+    if ( (ULONGLONG)( end - data ) < size )
+        ThrowError( E_FAIL );
+
+    data += (SIZE_T)size;
+
+} // SkipMemory
+
+
+//------------------------------------------------------------------------------
+// GetStreamedSize
+// Determines how many bytes a value of the given type, that is not an array,
+// takes in the stream.  Returns false for types whose size varies: strings,
+// objects and variants.
+//------------------------------------------------------------------------------
+
+inline bool GetStreamedSize( VARTYPE vt, ULONG& size )
+{
+    switch ( vt )
+    {
+    case VT_EMPTY:
+    case VT_NULL:
+        size = 0;
+        return true;
+
+    case VT_BSTR:
+    case VT_DISPATCH:
+    case VT_UNKNOWN:
+    case VT_VARIANT:
+        return false;
+
+    default:
+        GetTypeSize( vt, size );
+        return true;
+    }
+
+} // GetStreamedSize
+
+
+//------------------------------------------------------------------------------
+// ReadArrayHeaderFromMemory
+// Reads an array's header from streamed data in memory, leaving bounds
+// pointing at the bounds as they were streamed and data just past them.
+//------------------------------------------------------------------------------
+
+inline void ReadArrayHeaderFromMemory(  const BYTE*&    data,
+                                        const BYTE*     end,
+                                        USHORT&         dimensions,
+                                        const BYTE*&    bounds,
+                                        ULONGLONG&      count )
+{
+    ReadMemory( data, end, dimensions );
+
+    bounds = data;
+    count = dimensions ? 1 : 0;
+
+    for ( USHORT dimension = 0; dimension < dimensions; dimension++ )
+    {
+        SAFEARRAYBOUND  bound;
+
+        ReadMemory( data, end, bound.lLbound );
+        ReadMemory( data, end, bound.cElements );
+        count *= bound.cElements;
+    }
+
+} // ReadArrayHeaderFromMemory
+
+
+//------------------------------------------------------------------------------
+// SkipObject
+// Moves past an object streamed with SaveObjectToStream.  Objects don't
+// record their size, so the object is loaded, from the memory in place, to
+// find where it ends.
+//------------------------------------------------------------------------------
+
+inline void SkipObject( const BYTE*& data, const BYTE* end )
+{
+    CMemoryReadStream       stream( data, end - data );
+    CComPtr<IUnknown>       unknown;
+
+    CheckResult( OleLoadFromStream( &stream, IID_IUnknown, (void**)(IUnknown*)&unknown ) );
+
+    data += (SIZE_T)stream.GetPosition();
+
+} // SkipObject
+
+
+//==============================================================================
+// CMemoryCursor
+// Position in streamed data in memory, for SkipValue.
+//==============================================================================
+
+class CMemoryCursor
+{
+public:
+    CMemoryCursor( const BYTE* data, const BYTE* end )
+        :   m_data( data ),
+            m_end( end )
+    {
+    }
+
+    template <class Q>
+    inline void Read( Q& value )
+    {
+        ReadMemory( m_data, m_end, value );
+    }
+
+    inline void Skip( ULONGLONG size )
+    {
+        SkipMemory( m_data, m_end, size );
+    }
+
+    // Fails unless count elements of the given size are left.
+    inline void CheckRemaining( ULONGLONG count, ULONG size )
+    {
+        if ( size && count > (ULONGLONG)( m_end - m_data ) / size )
+            ThrowError( E_FAIL );
+    }
+
+    inline void SkipObject()
+    {
+        VariantStreaming::SkipObject( m_data, m_end );
+    }
+
+    inline const BYTE* GetData()
+    {
+        return m_data;
+    }
+
+private:
+    const BYTE*         m_data;
+    const BYTE*         m_end;
+
+}; // class CMemoryCursor
+
+
+//==============================================================================
+// CStreamCursor
+// Position in a seekable stream, for SkipValue.  Skipping seeks past the
+// data rather than reading it.
+//==============================================================================
+
+class CStreamCursor
+{
+public:
+    CStreamCursor( IStream* pStream )
+        :   m_stream( pStream )
+    {
+    }
+
+    template <class Q>
+    inline void Read( Q& value )
+    {
+        m_stream.Read( value );
+    }
+
+    inline void Skip( ULONGLONG size )
+    {
+        LARGE_INTEGER   offset;
+
+        offset.QuadPart = (LONGLONG)size;
+        CheckResult( ( (IStream*)m_stream )->Seek( offset, STREAM_SEEK_CUR, NULL ) );
+    }
+
+    // Only guards against the size overflowing.  Seeking past the end of the
+    // stream is caught by the next read.
+    inline void CheckRemaining( ULONGLONG count, ULONG size )
+    {
+        if ( size && count > ~(ULONGLONG)0 / size )
+            ThrowError( E_FAIL );
+    }
+
+    inline void SkipObject()
+    {
+        CComPtr<IUnknown>   unknown;
+
+        CheckResult( OleLoadFromStream( m_stream, IID_IUnknown, (void**)(IUnknown*)&unknown ) );
+    }
+
+private:
+    CStream             m_stream;
+
+}; // class CStreamCursor
+
+
+//------------------------------------------------------------------------------
+// BeginSkip
+// Moves past a value in streamed data.  An array of a type whose streamed
+// size is fixed is skipped in one step, other arrays are pushed on the stack
+// for SkipValue to walk.
+//------------------------------------------------------------------------------
+
+template <class Cursor>
+inline void BeginSkip( VARTYPE vt, Cursor& cursor, CArrayStack& stack )
+{
+    ULONG       size;
+
+    if ( vt & VT_ARRAY )
+    {
+        USHORT          dimensions;
+        ULONGLONG       count;
+
+        vt = (VARTYPE)( VT_TYPEMASK & vt );
+
+        stack.CheckDepth();
+
+        cursor.Read( dimensions );
+        count = dimensions ? 1 : 0;
+        for ( USHORT dimension = 0; dimension < dimensions; dimension++ )
+        {
+            SAFEARRAYBOUND  bound;
+
+            cursor.Read( bound.lLbound );
+            cursor.Read( bound.cElements );
+            count *= bound.cElements;
+        }
+
+        if ( GetStreamedSize( vt, size ) )
+        {
+            cursor.CheckRemaining( count, size );
+            cursor.Skip( count * size );
+        }
+        else if ( count )
+        {
+            stack.Push( vt, count );
+        }
+    }
+    else if ( VT_BSTR == vt )
+    {
+        UINT    length;
+
+        cursor.Read( length );
+        cursor.Skip( length );
+    }
+    else if ( VT_DISPATCH == vt || VT_UNKNOWN == vt )
+    {
+        cursor.SkipObject();
+    }
+    else if ( GetStreamedSize( vt, size ) )
+    {
+        cursor.Skip( size );
+    }
+    else
+    {
+        ThrowError( DISP_E_TYPEMISMATCH );
+    }
+
+} // BeginSkip
+
+
+//------------------------------------------------------------------------------
+// SkipValue
+// Moves past the data of a value of the given type, which may be an array
+// holding other arrays.
+//------------------------------------------------------------------------------
+
+template <class Cursor>
+inline void SkipValue( VARTYPE vt, Cursor& cursor, ULONG maxDepth )
+{
+    CArrayStack         stack( maxDepth );
+
+    BeginSkip( vt, cursor, stack );
+
+    while ( !stack.IsEmpty() )
+    {
+        CArrayStack::Frame&     frame = stack.Top();
+        VARTYPE                 elementType = frame.vt;
+
+        if ( !frame.IsMore() )
+        {
+            stack.Pop();
+            continue;
+        }
+
+        frame.next++;
+
+        // Elements of an array of variants carry their own type.
+        if ( VT_VARIANT == elementType )
+            cursor.Read( elementType );
+
+        BeginSkip( elementType, cursor, stack );
+    }
+
+} // SkipValue
+
+
+//------------------------------------------------------------------------------
+// SkipData
+// SkipValue for streamed data in memory.  Returns where the next value
+// starts.
+//------------------------------------------------------------------------------
+
+inline const BYTE* SkipData( VARTYPE vt, const BYTE* data, const BYTE* end, ULONG maxDepth )
+{
+    CMemoryCursor       cursor( data, end );
+
+    SkipValue( vt, cursor, maxDepth );
+
+    return cursor.GetData();
+
+} // SkipData
+
+
+//------------------------------------------------------------------------------
+// CheckSlice
+// Fails unless the slice lies within the array's bounds.  Both are in
+// SafeArrayCreate's order, and the slice's lower bounds are the indexes of
+// its first element in the array.
+//------------------------------------------------------------------------------
+
+inline void CheckSlice( USHORT dimensions, const SAFEARRAYBOUND* bounds, const SAFEARRAYBOUND* slice )
+{
+    ValidatePointer( slice );
+
+    for ( USHORT dimension = 0; dimension < dimensions; dimension++ )
+    {
+        if (    slice[dimension].lLbound < bounds[dimension].lLbound ||
+                (LONGLONG)slice[dimension].lLbound - bounds[dimension].lLbound + slice[dimension].cElements >
+                    bounds[dimension].cElements )
+        {
+            ThrowError( DISP_E_BADINDEX );
+        }
+    }
+
+} // CheckSlice
+
+
+//------------------------------------------------------------------------------
+// GetSlicePosition
+// Given the position of an element of a slice, in streamed order, returns
+// the position of the same element in the array the slice is taken from.
+//------------------------------------------------------------------------------
+
+inline ULONGLONG GetSlicePosition(  USHORT                  dimensions,
+                                    const SAFEARRAYBOUND*   bounds,
+                                    const SAFEARRAYBOUND*   slice,
+                                    ULONGLONG               position )
+{
+    ULONGLONG       source = 0;
+    ULONGLONG       stride = 1;
+
+    // The last dimension varies fastest.
+    for ( USHORT dimension = dimensions; dimension > 0; dimension-- )
+    {
+        const SAFEARRAYBOUND&   bound = bounds[dimension - 1];
+        const SAFEARRAYBOUND&   range = slice[dimension - 1];
+
+        source += ( (ULONGLONG)( range.lLbound - bound.lLbound ) + position % range.cElements ) * stride;
+        position /= range.cElements;
+        stride *= bound.cElements;
+    }
+
+    return source;
+
+} // GetSlicePosition
+
+
+//------------------------------------------------------------------------------
+// CreateSlice
+// Creates the array a slice is decoded into and hands it to the variant.
+// The slice's bounds become the array's, so its elements keep their indexes.
+//------------------------------------------------------------------------------
+
+inline void CreateSlice( VARTYPE vt, USHORT dimensions, const SAFEARRAYBOUND* slice, VARIANT& variant )
+{
+    variant.parray = ::SafeArrayCreate( vt, dimensions, (SAFEARRAYBOUND*)slice );
+    VerifyAllocation( variant.parray );
+    variant.vt = (VARTYPE)( vt | VT_ARRAY );
+
+} // CreateSlice
+
+
+//------------------------------------------------------------------------------
+// BeginReadArrayFromStream
+// Reads the header of an array streamed by WriteVariantToStream, leaving the
+// bounds in SafeArrayCreate's order and start at the offset of the first
+// element.  The array itself counts towards maxDepth.
+//------------------------------------------------------------------------------
+
+inline void BeginReadArrayFromStream(   IStream*        pStream,
+                                        VARTYPE&        vt,
+                                        USHORT&         dimensions,
+                                        CTaskMemory&    bounds,
+                                        ULONGLONG&      start,
+                                        ULONG           maxDepth )
+{
+    CStream             stream( pStream );
+    SAFEARRAYBOUND*     bound;
+    LARGE_INTEGER       zero = { 0 };
+    ULARGE_INTEGER      position;
+
+    if ( !maxDepth )
+        ThrowError( HRESULT_FROM_WIN32( ERROR_STACK_OVERFLOW ) );
+
+    ReadVersion( stream );
+    stream.Read( vt );
+    if ( !( vt & VT_ARRAY ) )
+        ThrowError( DISP_E_TYPEMISMATCH );
+    vt = (VARTYPE)( VT_TYPEMASK & vt );
+
+    stream.Read( dimensions );
+    bounds.Reserve( dimensions * sizeof( SAFEARRAYBOUND ) );
+
+    for ( USHORT dimension = dimensions; dimension > 0; dimension-- )
+    {
+        bound = (SAFEARRAYBOUND*)(BYTE*)bounds + dimension - 1;
+        stream.Read( bound->lLbound );
+        stream.Read( bound->cElements );
+    }
+
+    CheckResult( pStream->Seek( zero, STREAM_SEEK_CUR, &position ) );
+    start = position.QuadPart;
+
+} // BeginReadArrayFromStream
+
+
+//------------------------------------------------------------------------------
+// SeekElement
+// Positions the stream at the array's element at the given position, from
+// the element at current.  Elements whose streamed size is fixed are sought
+// directly.  Others are skipped over, going back to the first element if
+// need be.
+//------------------------------------------------------------------------------
+
+inline void SeekElement(    VARTYPE         vt,
+                            ULONGLONG       start,
+                            ULONGLONG&      current,
+                            ULONGLONG       position,
+                            IStream*        pStream,
+                            ULONG           maxDepth )
+{
+    CStreamCursor       cursor( pStream );
+    LARGE_INTEGER       offset;
+    ULONG               size;
+
+    if ( GetStreamedSize( vt, size ) )
+    {
+        offset.QuadPart = (LONGLONG)( start + position * size );
+        CheckResult( pStream->Seek( offset, STREAM_SEEK_SET, NULL ) );
+
+        current = position;
+        return;
+    }
+
+    if ( position < current )
+    {
+        offset.QuadPart = (LONGLONG)start;
+        CheckResult( pStream->Seek( offset, STREAM_SEEK_SET, NULL ) );
+
+        current = 0;
+    }
+
+    for ( ; current < position; current++ )
+    {
+        VARTYPE     elementType = vt;
+
+        if ( VT_VARIANT == vt )
+            cursor.Read( elementType );
+
+        SkipValue( elementType, cursor, maxDepth );
+    }
+
+} // SeekElement
+
+
+//------------------------------------------------------------------------------
+// ReadElementFromStream
+// Reads an element of an array of the given type straight into an element of
+// another array of that type.
+//------------------------------------------------------------------------------
+
+inline void ReadElementFromStream( VARTYPE vt, BYTE* element, ULONG size, IStream* pStream, ULONG maxDepth )
+{
+    if ( VT_VARIANT == vt )
+    {
+        VARTYPE     elementType;
+
+        // Array of variants, so read the element's type first.
+        CStream( pStream ).Read( elementType );
+        ReadDataFromStream( elementType, pStream, *(VARIANT*)element, maxDepth );
+    }
+    else
+    {
+        VARIANT     value;
+
+        // Read the value and hand it over to the array.
+        value.vt = VT_EMPTY;
+        ReadValueFromStream( vt, pStream, value );
+        ::CopyMemory( element, &value.byref, size );
+    }
+
+} // ReadElementFromStream
+
+
+//------------------------------------------------------------------------------
+// GetChunkOffsets
+// Works out where each run of chunkElements elements of the array will start
+// once streamed, counting from its first element, without streaming it.  One
+// more offset than there are chunks is set, for where the last chunk ends.
+// Returns false if the array holds objects, whose size is not known until
+// they are saved.
+//------------------------------------------------------------------------------
+
+inline bool GetChunkOffsets(    SAFEARRAY*      safeArray,
+                                VARTYPE         vt,
+                                ULONG           chunkElements,
+                                ULONGLONG*      offsets,
+                                ULONG           maxDepth )
+{
+    CArrayStack         stack( maxDepth );
+    ULONGLONG           offset = 0;
+    ULONG               size;
+
+    stack.Push( safeArray, vt );
+
+    while ( !stack.IsEmpty() )
+    {
+        CArrayStack::Frame&     frame = stack.Top();
+
+        if ( !frame.IsMore() )
+        {
+            stack.Pop();
+            continue;
+        }
+
+        if ( 1 == stack.GetDepth() && 0 == frame.next % chunkElements )
+            offsets[frame.next / chunkElements] = offset;
+
+        BYTE*           element = frame.NextElement();
+        const VARIANT*  variant = NULL;
+        VARTYPE         elementType = frame.vt;
+
+        if ( VT_VARIANT == frame.vt )
+        {
+            variant = (const VARIANT*)element;
+            elementType = variant->vt;
+            offset += sizeof( VARTYPE );
+        }
+
+        if ( elementType & VT_ARRAY )
+        {
+            SAFEARRAY*  inner = V_ISBYREF( variant ) ? *variant->pparray : variant->parray;
+            VARTYPE     innerType = (VARTYPE)( VT_TYPEMASK & elementType );
+
+            // As BeginWriteSafeArray.
+            stack.CheckDepth();
+            offset += sizeof( USHORT ) + inner->cDims * sizeof( SAFEARRAYBOUND );
+
+            if ( IsFixedSizeType( innerType ) )
+                offset += GetElementCount( inner ) * inner->cbElements;
+            else if ( GetElementCount( inner ) )
+                stack.Push( inner, innerType );
+        }
+        else if ( VT_BSTR == elementType )
+        {
+            BSTR    value = variant ? V_BSTR( variant ) : *(BSTR*)element;
+
+            offset += sizeof( UINT ) + ::SysStringLen( value ) * sizeof( WCHAR );
+        }
+        else if ( GetStreamedSize( elementType, size ) )
+        {
+            offset += size;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    offsets[( GetElementCount( safeArray ) + chunkElements - 1 ) / chunkElements] = offset;
+
+    return true;
+
+} // GetChunkOffsets
+
+
+//------------------------------------------------------------------------------
+// BeginWriteChunkedArray
+// Decides whether the variant is an array to stream in chunks and, if so,
+// works out where its chunks start and writes the version, the chunk table
+// and the variant's type.  Returns false, having written nothing, for a
+// variant to stream as WriteVariantToStream does.  offsets is left with the
+// chunks' offsets from the array's first element, as from GetChunkOffsets.
+//------------------------------------------------------------------------------
+
+inline bool BeginWriteChunkedArray( const VARIANT*  variant,
+                                    ULONG           chunkElements,
+                                    SAFEARRAY*&     safeArray,
+                                    VARTYPE&        vt,
+                                    CTaskMemory&    offsets,
+                                    IStream*        pStream,
+                                    ULONG           maxDepth )
+{
+    CStream             stream( pStream );
+    ULONGLONG           chunkCount;
+    ULONG               header;
+
+    ValidatePointer( variant );
+
+    if ( !V_ISARRAY( variant ) || !chunkElements )
+        return false;
+
+    safeArray = V_ISBYREF( variant ) ? *variant->pparray : variant->parray;
+    vt = (VARTYPE)( VT_TYPEMASK & variant->vt );
+    ValidatePointer( safeArray );
+
+    chunkCount = ( GetElementCount( safeArray ) + chunkElements - 1 ) / chunkElements;
+    if ( chunkCount >= 0xFFFFFFFF / sizeof( ULONGLONG ) )
+        ThrowError( E_INVALIDARG );
+
+    if ( IsFixedSizeType( vt ) || chunkCount < 2 )
+        return false;
+
+    offsets.Reserve( ( (ULONG)chunkCount + 1 ) * sizeof( ULONGLONG ) );
+
+    if ( !GetChunkOffsets( safeArray, vt, chunkElements, (ULONGLONG*)(BYTE*)offsets, maxDepth ) )
+        return false;
+
+    // Offsets in the table count from the variant's type, ahead of the
+    // array's header.
+    header = sizeof( VARTYPE ) + sizeof( USHORT ) + safeArray->cDims * sizeof( SAFEARRAYBOUND );
+
+    stream.Write( chunkedVersion );
+    stream.Write( chunkElements );
+    stream.Write( (ULONG)chunkCount );
+    for ( ULONG chunk = 0; chunk < chunkCount; chunk++ )
+        stream.Write( header + ( (ULONGLONG*)(BYTE*)offsets )[chunk] );
+
+    stream.Write( (VARTYPE)( VT_ARRAY | vt ) );
+
+    return true;
+
+} // BeginWriteChunkedArray
+
+
+//------------------------------------------------------------------------------
+// HashString
+// FNV-1a over a string's bytes, which need not be aligned.
+//------------------------------------------------------------------------------
+
+inline ULONG HashString( const void* chars, UINT size )
+{
+    ULONG   hash = 2166136261UL;
+
+    for ( UINT i = 0; i < size; i++ )
+        hash = ( ( hash ^ ( (const BYTE*)chars )[i] ) * 16777619UL ) & 0xFFFFFFFF;
+
+    return hash;
+
+} // HashString
+
+
+//------------------------------------------------------------------------------
+// BeginWriteMap
+// Checks that the variant is a 2 x N array of variants with a string for
+// each name, works out where its names and values will be streamed and
+// writes the version and the directory.  Values may be anything but objects,
+// whose size isn't known until they are saved.
+//------------------------------------------------------------------------------
+
+inline void BeginWriteMap( const VARIANT* map, IStream* pStream, ULONG maxDepth )
+{
+    CStream             stream( pStream );
+    SAFEARRAY*          safeArray;
+    ULONG               count;
+    ULONG               slotCount;
+    ULONG               header;
+    ULONG*              slots;
+    ULONG*              hashes;
+    ULONGLONG*          offsets;
+
+    ValidatePointer( map );
+
+    if ( ( VT_ARRAY | VT_VARIANT ) != ( map->vt & ~VT_BYREF ) )
+        ThrowError( DISP_E_TYPEMISMATCH );
+
+    safeArray = V_ISBYREF( map ) ? *map->pparray : map->parray;
+    ValidatePointer( safeArray );
+
+    // The SAFEARRAY holds its bounds last dimension first.
+    if ( 2 != safeArray->cDims || 2 != safeArray->rgsabound[1].cElements )
+        ThrowError( DISP_E_TYPEMISMATCH );
+
+    count = safeArray->rgsabound[0].cElements;
+    if ( count >= 0x10000000 )
+        ThrowError( E_INVALIDARG );
+
+    for ( slotCount = 1; slotCount < 2 * count; slotCount *= 2 )
+        ;
+
+    CTaskMemory         offsetsBuffer( ( 2 * count + 1 ) * sizeof( ULONGLONG ) );
+    CTaskMemory         slotsBuffer( slotCount * sizeof( ULONG ) );
+    CTaskMemory         hashesBuffer( count * sizeof( ULONG ) );
+
+    offsets = (ULONGLONG*)(BYTE*)offsetsBuffer;
+    slots = (ULONG*)(BYTE*)slotsBuffer;
+    hashes = (ULONG*)(BYTE*)hashesBuffer;
+
+    // Every element's offset, as for chunks of one element.  Names come
+    // first in streamed order, then values.
+    if ( !GetChunkOffsets( safeArray, VT_VARIANT, 1, offsets, maxDepth ) )
+        ThrowError( DISP_E_TYPEMISMATCH );
+
+    ::ZeroMemory( slots, slotCount * sizeof( ULONG ) );
+
+    CSafeArrayData      data( safeArray );
+
+    for ( ULONG entry = 0; entry < count; entry++ )
+    {
+        // In memory, each name is followed by its value.
+        const VARIANT&  name = ( (const VARIANT*)(BYTE*)data )[2 * entry];
+        ULONG           slot;
+
+        if ( VT_BSTR != name.vt )
+            ThrowError( DISP_E_TYPEMISMATCH );
+
+        hashes[entry] = HashString( name.bstrVal, ::SysStringByteLen( name.bstrVal ) );
+
+        for ( slot = hashes[entry] & ( slotCount - 1 ); slots[slot]; slot = ( slot + 1 ) & ( slotCount - 1 ) )
+            ;
+
+        slots[slot] = entry + 1;
+    }
+
+    // Offsets count from the map's type, ahead of the array's header.
+    header = sizeof( VARTYPE ) + sizeof( USHORT ) + 2 * sizeof( SAFEARRAYBOUND );
+
+    stream.Write( mapVersion );
+    stream.Write( count );
+    stream.Write( slotCount );
+    for ( ULONG slot = 0; slot < slotCount; slot++ )
+        stream.Write( slots[slot] );
+
+    for ( ULONG entry = 0; entry < count; entry++ )
+    {
+        stream.Write( hashes[entry] );
+        stream.Write( header + offsets[entry] );
+        stream.Write( header + offsets[count + entry] );
+    }
+
+} // BeginWriteMap
+
+
+//==============================================================================
+// CParallelTasks
+// Runs a numbered set of tasks on several threads, the calling thread among
+// them.  Tasks are not dealt out up front: whenever a thread finishes one it
+// takes the next task not yet started, so a thread whose tasks are quick goes
+// on to do more of them.  A task that fails stops further tasks from
+// starting, and Run raises the failure, with its HRESULT, on the calling
+// thread once every thread has finished.
+// Example:
+//      CParallelTasks  tasks( Task, &context, count );
+//
+//      tasks.Run( threads );
+//==============================================================================
+
+class CParallelTasks
+{
+public:
+    typedef void (*Task)( void* context, ULONG task );
+
+    CParallelTasks( Task task, void* context, ULONG count )
+        :   m_task( task ),
+            m_context( context ),
+            m_count( count ),
+            m_next( 0 ),
+            m_failed( 0 )
+    {
+        if ( count > 0x7FFFFFFF )
+            ThrowError( E_INVALIDARG );
+    }
+
+    // Runs the tasks on up to threads threads, or one per processor if
+    // threads is 0.  Fewer threads are used if they can't be created.
+    void Run( ULONG threads )
+    {
+        if ( !threads )
+        {
+            SYSTEM_INFO     info;
+
+            ::GetSystemInfo( &info );
+            threads = info.dwNumberOfProcessors;
+        }
+
+        if ( threads > m_count )
+            threads = m_count;
+        if ( threads < 1 )
+            return;
+
+        CTaskMemory     memory( threads * sizeof( HANDLE ) );
+        HANDLE*         handles = (HANDLE*)(BYTE*)memory;
+        ULONG           started;
+
+        for ( started = 0; started < threads - 1; started++ )
+        {
+            handles[started] = ::CreateThread( NULL, 0, ThreadProc, this, 0, NULL );
+            if ( !handles[started] )
+                break;
+        }
+
+        Work();
+
+        for ( ULONG thread = 0; thread < started; thread++ )
+        {
+            ::WaitForSingleObject( handles[thread], INFINITE );
+            ::CloseHandle( handles[thread] );
+        }
+
+        if ( FAILED( m_failed ) )
+            ThrowError( m_failed );
+    }
+
+private:
+    static DWORD WINAPI ThreadProc( void* parameter )
+    {
+        ( (CParallelTasks*)parameter )->Work();
+        return 0;
+    }
+
+    void Work()
+    {
+        HRESULT     hr;
+
+        while ( !m_failed )
+        {
+            ULONG   task = (ULONG)::InterlockedIncrement( &m_next ) - 1;
+
+            if ( task >= m_count )
+                break;
+
+            hr = RunTask( task );
+            if ( FAILED( hr ) )
+                ::InterlockedExchange( &m_failed, hr );
+        }
+    }
+
+    // Keeps a failure raised by ThrowError on the thread it happened on.
+    // Other exceptions are left alone.  Nothing here may need unwinding.
+    HRESULT RunTask( ULONG task )
+    {
+        HRESULT     hr = S_OK;
+
+        __try
+        {
+            m_task( m_context, task );
+        }
+        __except( FilterStreamError( GetExceptionInformation(), hr ) )
+        {
+            return hr;
+        }
+
+        return S_OK;
+    }
+
+private:
+    Task                m_task;
+    void*               m_context;
+    ULONG               m_count;
+    LONG volatile       m_next;
+    LONG volatile       m_failed;
+
+}; // class CParallelTasks
+
+
+//==============================================================================
+// CChunkReader
+// Reads the chunks of an array streamed by WriteChunkedVariantToStream into
+// the array, already created and accessed, as tasks for CParallelTasks.  Each
+// chunk is read from its own stream on the memory into its own range of
+// elements, so the threads share nothing they write to.
+//==============================================================================
+
+class CChunkReader
+{
+public:
+    // offsets has one more entry than there are chunks, for where the last
+    // chunk ends.
+    CChunkReader(   SAFEARRAY*          safeArray,
+                    VARTYPE             vt,
+                    BYTE*               data,
+                    const BYTE*         body,
+                    const ULONGLONG*    offsets,
+                    ULONG               chunkElements,
+                    ULONG               maxDepth )
+        :   m_safeArray( safeArray ),
+            m_vt( vt ),
+            m_data( data ),
+            m_body( body ),
+            m_offsets( offsets ),
+            m_chunkElements( chunkElements ),
+            m_count( GetElementCount( safeArray ) ),
+            m_maxDepth( maxDepth )
+    {
+    }
+
+    static void ReadChunk( void* context, ULONG chunk )
+    {
+        CChunkReader&       reader = *(CChunkReader*)context;
+        ULONGLONG           first = (ULONGLONG)chunk * reader.m_chunkElements;
+        ULONGLONG           count = reader.m_count - first;
+        ULONGLONG           size = reader.m_offsets[chunk + 1] - reader.m_offsets[chunk];
+        CMemoryReadStream   stream( reader.m_body + reader.m_offsets[chunk], size );
+        CArrayStack         stack( reader.m_maxDepth );
+
+        if ( count > reader.m_chunkElements )
+            count = reader.m_chunkElements;
+
+        stack.Push( reader.m_safeArray, reader.m_vt, reader.m_data, first, count );
+        ReadStackedArrays( stack, &stream );
+
+        // Each chunk ends where the next one starts.
+        if ( stream.GetPosition() != size )
+            ThrowError( E_FAIL );
+    }
+
+private:
+    SAFEARRAY*          m_safeArray;
+    VARTYPE             m_vt;
+    BYTE*               m_data;
+    const BYTE*         m_body;
+    const ULONGLONG*    m_offsets;
+    ULONG               m_chunkElements;
+    ULONGLONG           m_count;
+    ULONG               m_maxDepth;
+
+}; // class CChunkReader
+
+
+//==============================================================================
+// CChunkWriter
+// Mirror of CChunkReader.  Encodes a run of chunks of an array, already
+// accessed, into a window of memory as tasks for CParallelTasks, each chunk
+// into the part of the window where GetChunkOffsets says it goes.
+//==============================================================================
+
+class CChunkWriter
+{
+public:
+    // offsets are those of the window's chunks, and one more for where the
+    // last of them ends.  firstChunk is the number of the window's first
+    // chunk in the array.
+    CChunkWriter(   SAFEARRAY*          safeArray,
+                    VARTYPE             vt,
+                    BYTE*               data,
+                    BYTE*               window,
+                    const ULONGLONG*    offsets,
+                    ULONG               firstChunk,
+                    ULONG               chunkElements,
+                    ULONG               maxDepth )
+        :   m_safeArray( safeArray ),
+            m_vt( vt ),
+            m_data( data ),
+            m_window( window ),
+            m_offsets( offsets ),
+            m_firstChunk( firstChunk ),
+            m_chunkElements( chunkElements ),
+            m_count( GetElementCount( safeArray ) ),
+            m_maxDepth( maxDepth )
+    {
+    }
+
+    static void WriteChunk( void* context, ULONG chunk )
+    {
+        CChunkWriter&       writer = *(CChunkWriter*)context;
+        ULONGLONG           first = (ULONGLONG)( writer.m_firstChunk + chunk ) * writer.m_chunkElements;
+        ULONGLONG           count = writer.m_count - first;
+        ULONGLONG           size = writer.m_offsets[chunk + 1] - writer.m_offsets[chunk];
+        CMemoryWriteStream  stream( writer.m_window + ( writer.m_offsets[chunk] - writer.m_offsets[0] ), size );
+        CArrayStack         stack( writer.m_maxDepth );
+
+        if ( count > writer.m_chunkElements )
+            count = writer.m_chunkElements;
+
+        stack.Push( writer.m_safeArray, writer.m_vt, writer.m_data, first, count );
+        WriteStackedArrays( stack, &stream );
+
+        // The array changed since its chunks were measured.
+        if ( stream.GetPosition() != size )
+            ThrowError( E_FAIL );
+    }
+
+private:
+    SAFEARRAY*          m_safeArray;
+    VARTYPE             m_vt;
+    BYTE*               m_data;
+    BYTE*               m_window;
+    const ULONGLONG*    m_offsets;
+    ULONG               m_firstChunk;
+    ULONG               m_chunkElements;
+    ULONGLONG           m_count;
+    ULONG               m_maxDepth;
+
+}; // class CChunkWriter
+
+
+//------------------------------------------------------------------------------
+// GetNumber
+// Given an element of a numeric type, or the data of a variant of one, gets
+// its value as a double.  Returns false for types that aren't numbers.
+//------------------------------------------------------------------------------
+
+inline bool GetNumber( VARTYPE vt, const void* data, double& value )
+{
+    switch ( vt )
+    {
+    case VT_I1:
+        value = *(const CHAR*)data;
+        return true;
+
+    case VT_UI1:
+        value = *(const BYTE*)data;
+        return true;
+
+    case VT_I2:
+        value = *(const SHORT*)data;
+        return true;
+
+    case VT_UI2:
+        value = *(const USHORT*)data;
+        return true;
+
+    case VT_I4:
+        value = *(const LONG*)data;
+        return true;
+
+    case VT_UI4:
+        value = *(const ULONG*)data;
+        return true;
+
+    case VT_INT:
+        value = *(const INT*)data;
+        return true;
+
+    case VT_UINT:
+        value = *(const UINT*)data;
+        return true;
+
+    case VT_I8:
+        value = (double)*(const LONGLONG*)data;
+        return true;
+
+    case VT_UI8:
+        // Halved to go through a signed conversion.
+        value = (double)(LONGLONG)( *(const ULONGLONG*)data >> 1 ) * 2 + (double)(LONG)( *(const ULONGLONG*)data & 1 );
+        return true;
+
+    case VT_R4:
+        value = *(const float*)data;
+        return true;
+
+    case VT_R8:
+    case VT_DATE:
+        value = *(const double*)data;
+        return true;
+
+    case VT_CY:
+        value = (double)( (const CY*)data )->int64 / 10000;
+        return true;
+    }
+
+    return false;
+
+} // GetNumber
+
+
+//------------------------------------------------------------------------------
+// IsNumberType
+// Determines whether GetNumber takes values of the given type.
+//------------------------------------------------------------------------------
+
+inline bool IsNumberType( VARTYPE vt )
+{
+    ULONGLONG   zero = 0;
+    double      number;
+
+    return GetNumber( vt, &zero, number );
+
+} // IsNumberType
+
+
+//==============================================================================
+// CZoneBuilder
+// Gathers the statistics for a CVariantZone from the values added to it.
+// The number of different strings is estimated from the smallest of their
+// hashes: with k of them kept, the kth smallest out of n spread evenly over
+// 32 bits is about 2^32 * k / n.
+//==============================================================================
+
+class CZoneBuilder
+{
+public:
+    CZoneBuilder()
+    {
+        Reset();
+    }
+
+    void Reset()
+    {
+        m_zone.minimum = 0;
+        m_zone.maximum = 0;
+        m_zone.numberCount = 0;
+        m_zone.nullCount = 0;
+        m_zone.distinctStrings = 0;
+        m_hashCount = 0;
+    }
+
+    inline void AddNumber( double value )
+    {
+        if ( !m_zone.numberCount || value < m_zone.minimum )
+            m_zone.minimum = value;
+        if ( !m_zone.numberCount || value > m_zone.maximum )
+            m_zone.maximum = value;
+
+        m_zone.numberCount++;
+    }
+
+    inline void AddNull()
+    {
+        m_zone.nullCount++;
+    }
+
+    void AddString( const WCHAR* chars, UINT length )
+    {
+        ULONG   hash = HashString( chars, length * sizeof( WCHAR ) );
+        ULONG   position;
+
+        // Keep it if it is one of the smallest, in order, once only.
+        if ( distinctSampleSize == m_hashCount && hash >= m_hashes[m_hashCount - 1] )
+            return;
+
+        for ( position = 0; position < m_hashCount && m_hashes[position] < hash; position++ )
+            ;
+
+        if ( position < m_hashCount && m_hashes[position] == hash )
+            return;
+
+        if ( m_hashCount < distinctSampleSize )
+            m_hashCount++;
+
+        for ( ULONG i = m_hashCount - 1; i > position; i-- )
+            m_hashes[i] = m_hashes[i - 1];
+        m_hashes[position] = hash;
+    }
+
+    // Adds a value that isn't an array.  Values other than numbers, strings
+    // and nulls aren't counted.
+    void AddValue( const VARIANT& value )
+    {
+        double  number;
+
+        if ( VT_EMPTY == value.vt || VT_NULL == value.vt )
+            AddNull();
+        else if ( VT_BSTR == value.vt )
+            AddString( value.bstrVal, ::SysStringLen( value.bstrVal ) );
+        else if ( GetNumber( value.vt, &value.byref, number ) )
+            AddNumber( number );
+    }
+
+    // Adds count elements of a fixed size type laid out as in a SAFEARRAY.
+    void AddElements( VARTYPE vt, const BYTE* data, ULONGLONG count, ULONG size )
+    {
+        double  number;
+
+        for ( ULONGLONG element = 0; element < count; element++ )
+        {
+            if ( !GetNumber( vt, data + element * size, number ) )
+                return;
+
+            AddNumber( number );
+        }
+    }
+
+    void GetZone( CVariantZone& zone )
+    {
+        zone = m_zone;
+
+        if ( m_hashCount < distinctSampleSize )
+            zone.distinctStrings = m_hashCount;
+        else
+            zone.distinctStrings = (ULONG)( ( (ULONGLONG)( distinctSampleSize - 1 ) << 32 ) / ( (ULONGLONG)m_hashes[m_hashCount - 1] + 1 ) );
+    }
+
+private:
+    CVariantZone        m_zone;
+    ULONG               m_hashes[distinctSampleSize];
+    ULONG               m_hashCount;
+
+}; // class CZoneBuilder
+
+
+//------------------------------------------------------------------------------
+// AddVariantToZone
+// Adds every value in the variant, at any depth, to the zone.  Nested arrays
+// are walked on a stack rather than by recursing.  The variant is assumed to
+// be fully dereferenced.
+//------------------------------------------------------------------------------
+
+inline void AddVariantToZone( const VARIANT& variant, CZoneBuilder& zone, ULONG maxDepth )
+{
+    CArrayStack         stack( maxDepth );
+    const VARIANT*      next = &variant;
+
+    for ( ;; )
+    {
+        // Values straight away, arrays of numbers in one go, and other
+        // arrays onto the stack.
+        if ( next && V_ISARRAY( next ) )
+        {
+            SAFEARRAY*  safeArray = V_ISBYREF( next ) ? *next->pparray : next->parray;
+            VARTYPE     vt = (VARTYPE)( VT_TYPEMASK & next->vt );
+            ULONGLONG   count = GetElementCount( safeArray );
+
+            stack.CheckDepth();
+
+            if ( IsFixedSizeType( vt ) && count )
+            {
+                CSafeArrayData  data( safeArray );
+
+                zone.AddElements( vt, data, count, safeArray->cbElements );
+            }
+            else if ( count )
+            {
+                stack.Push( safeArray, vt );
+            }
+        }
+        else if ( next )
+        {
+            zone.AddValue( *next );
+        }
+
+        next = NULL;
+
+        while ( !next && !stack.IsEmpty() )
+        {
+            CArrayStack::Frame&     frame = stack.Top();
+            VARIANT                 value;
+
+            if ( !frame.IsMore() )
+            {
+                stack.Pop();
+                continue;
+            }
+
+            BYTE*   element = frame.NextElement();
+
+            if ( VT_VARIANT == frame.vt )
+            {
+                next = (const VARIANT*)element;
+            }
+            else
+            {
+                GetElementValue( element, frame.vt, frame.safeArray->cbElements, value );
+                zone.AddValue( value );
+            }
+        }
+
+        if ( !next )
+            return;
+    }
+
+} // AddVariantToZone
+
+
+//------------------------------------------------------------------------------
+// WriteZone, ReadZone
+// Write and read a zone as a record container keeps it.
+//------------------------------------------------------------------------------
+
+inline void WriteZone( CStream& stream, const CVariantZone& zone )
+{
+    stream.Write( zone.minimum );
+    stream.Write( zone.maximum );
+    stream.Write( zone.numberCount );
+    stream.Write( zone.nullCount );
+    stream.Write( zone.distinctStrings );
+
+} // WriteZone
+
+
+inline void ReadZone( CStream& stream, CVariantZone& zone )
+{
+    stream.Read( zone.minimum );
+    stream.Read( zone.maximum );
+    stream.Read( zone.numberCount );
+    stream.Read( zone.nullCount );
+    stream.Read( zone.distinctStrings );
+
+} // ReadZone
+
+
+//==============================================================================
+// RecordStatistics
+// A record's zone, and where its array's blocks are when it has them.
+//==============================================================================
+
+struct RecordStatistics
+{
+    CVariantZone        zone;
+    ULONG               elementCount;
+    LONG                lowerBound;
+    ULONG               firstBlock;
+    ULONG               blockCount;
+
+}; // struct RecordStatistics
+
+
+//------------------------------------------------------------------------------
+// AddToAggregate
+// Adds a run's count, sum, minimum and maximum to the aggregate.
+//------------------------------------------------------------------------------
+
+inline void AddToAggregate( CVariantAggregate&  aggregate,
+                            ULONGLONG           count,
+                            double              sum,
+                            double              minimum,
+                            double              maximum )
+{
+    if ( !count )
+        return;
+
+    if ( !aggregate.count || minimum < aggregate.minimum )
+        aggregate.minimum = minimum;
+    if ( !aggregate.count || maximum > aggregate.maximum )
+        aggregate.maximum = maximum;
+
+    aggregate.count += count;
+    aggregate.sum += sum;
+
+} // AddToAggregate
+
+
+//------------------------------------------------------------------------------
+// AggregateDoubles, AggregateLongs
+// Aggregate a run of doubles or longs straight from the stream's bytes.  Four
+// lanes are kept apart, each with its own sum, minimum and maximum, and
+// combined at the end, so that the loop has no dependency from one element
+// to the next and compilers can vectorize it.  Longs are summed exactly.
+//------------------------------------------------------------------------------
+
+inline void AggregateDoubles( const double UNALIGNED* data, ULONG count, CVariantAggregate& aggregate )
+{
+    double  sum[4] = { 0, 0, 0, 0 };
+    double  minimum[4];
+    double  maximum[4];
+    ULONG   i;
+
+    if ( !count )
+        return;
+
+    for ( i = 0; i < 4; i++ )
+        minimum[i] = maximum[i] = data[0];
+
+    for ( i = 0; i + 4 <= count; i += 4 )
+    {
+        for ( ULONG lane = 0; lane < 4; lane++ )
+        {
+            double  value = data[i + lane];
+
+            sum[lane] += value;
+            minimum[lane] = value < minimum[lane] ? value : minimum[lane];
+            maximum[lane] = value > maximum[lane] ? value : maximum[lane];
+        }
+    }
+
+    for ( ; i < count; i++ )
+    {
+        sum[0] += data[i];
+        minimum[0] = data[i] < minimum[0] ? data[i] : minimum[0];
+        maximum[0] = data[i] > maximum[0] ? data[i] : maximum[0];
+    }
+
+    for ( i = 1; i < 4; i++ )
+    {
+        minimum[0] = minimum[i] < minimum[0] ? minimum[i] : minimum[0];
+        maximum[0] = maximum[i] > maximum[0] ? maximum[i] : maximum[0];
+    }
+
+    AddToAggregate( aggregate, count, ( sum[0] + sum[1] ) + ( sum[2] + sum[3] ), minimum[0], maximum[0] );
+
+} // AggregateDoubles
+
+
+inline void AggregateLongs( const LONG UNALIGNED* data, ULONG count, CVariantAggregate& aggregate )
+{
+    LONGLONG    sum[4] = { 0, 0, 0, 0 };
+    LONG        minimum[4];
+    LONG        maximum[4];
+    ULONG       i;
+
+    if ( !count )
+        return;
+
+    for ( i = 0; i < 4; i++ )
+        minimum[i] = maximum[i] = data[0];
+
+    for ( i = 0; i + 4 <= count; i += 4 )
+    {
+        for ( ULONG lane = 0; lane < 4; lane++ )
+        {
+            LONG    value = data[i + lane];
+
+            sum[lane] += value;
+            minimum[lane] = value < minimum[lane] ? value : minimum[lane];
+            maximum[lane] = value > maximum[lane] ? value : maximum[lane];
+        }
+    }
+
+    for ( ; i < count; i++ )
+    {
+        sum[0] += data[i];
+        minimum[0] = data[i] < minimum[0] ? data[i] : minimum[0];
+        maximum[0] = data[i] > maximum[0] ? data[i] : maximum[0];
+    }
+
+    for ( i = 1; i < 4; i++ )
+    {
+        minimum[0] = minimum[i] < minimum[0] ? minimum[i] : minimum[0];
+        maximum[0] = maximum[i] > maximum[0] ? maximum[i] : maximum[0];
+    }
+
+    AddToAggregate( aggregate, count, (double)( sum[0] + sum[1] + sum[2] + sum[3] ), minimum[0], maximum[0] );
+
+} // AggregateLongs
+
+
+//------------------------------------------------------------------------------
+// AggregateInRange
+// Aggregates only the elements of a run between low and high.  Elements
+// outside the range are masked out rather than branched around, so this
+// vectorizes as well.
+//------------------------------------------------------------------------------
+
+template <class Q>
+inline void AggregateInRange(   const Q UNALIGNED*  data,
+                                ULONG               count,
+                                double              low,
+                                double              high,
+                                CVariantAggregate&  aggregate )
+{
+    double      sum = 0;
+    double      minimum = high;
+    double      maximum = low;
+    ULONG       matched = 0;
+
+    for ( ULONG i = 0; i < count; i++ )
+    {
+        double  value = data[i];
+        bool    isIn = value >= low && value <= high;
+
+        sum += isIn ? value : 0;
+        matched += isIn;
+        minimum = isIn && value < minimum ? value : minimum;
+        maximum = isIn && value > maximum ? value : maximum;
+    }
+
+    AddToAggregate( aggregate, matched, sum, minimum, maximum );
+
+} // AggregateInRange
+
+
+//==============================================================================
+// CAggregateVisitor
+// Visitor that aggregates the numbers in a streamed variant as they go by,
+// optionally only those within a range.  Runs of doubles and longs go to the
+// kernels above; other numbers are added one at a time.
+//==============================================================================
+
+class CAggregateVisitor : public CVariantVisitor
+{
+public:
+    CAggregateVisitor( CVariantAggregate& aggregate, bool isFiltered, double low, double high )
+        :   m_aggregate( aggregate ),
+            m_isFiltered( isFiltered ),
+            m_low( low ),
+            m_high( high )
+    {
+        m_aggregate.count = 0;
+        m_aggregate.sum = 0;
+        m_aggregate.minimum = 0;
+        m_aggregate.maximum = 0;
+    }
+
+    virtual void BeginArray( VARTYPE, USHORT, const SAFEARRAYBOUND* )
+    {
+    }
+
+    virtual void Scalar( const VARIANT& value )
+    {
+        double  number;
+
+        if ( GetNumber( value.vt, &value.byref, number ) && ( !m_isFiltered || ( number >= m_low && number <= m_high ) ) )
+            AddToAggregate( m_aggregate, 1, number, number, number );
+    }
+
+    virtual void String( const WCHAR*, UINT )
+    {
+    }
+
+    virtual void EndArray()
+    {
+    }
+
+    virtual void Elements( VARTYPE vt, const void* data, ULONG count )
+    {
+        if ( VT_R8 == vt && m_isFiltered )
+            AggregateInRange( (const double*)data, count, m_low, m_high, m_aggregate );
+        else if ( VT_R8 == vt )
+            AggregateDoubles( (const double*)data, count, m_aggregate );
+        else if ( VT_I4 == vt && m_isFiltered )
+            AggregateInRange( (const LONG*)data, count, m_low, m_high, m_aggregate );
+        else if ( VT_I4 == vt )
+            AggregateLongs( (const LONG*)data, count, m_aggregate );
+        else
+            CVariantVisitor::Elements( vt, data, count );
+    }
+
+private:
+    CVariantAggregate&  m_aggregate;
+    bool                m_isFiltered;
+    double              m_low;
+    double              m_high;
+
+}; // class CAggregateVisitor
+
+
+//==============================================================================
+// CShapeRegistry
+// The shapes seen so far in a schema session, kept as the bytes they are
+// streamed as and numbered in the order they were added.  A new shape is
+// built in place at the end of the others with Reserve, then looked up with
+// Find, through a hash table, and kept with Add.
+//==============================================================================
+
+class CShapeRegistry
+{
+public:
+    CShapeRegistry()
+        :   m_data( NULL ),
+            m_used( 0 ),
+            m_capacity( 0 ),
+            m_offsets( NULL ),
+            m_count( 0 ),
+            m_offsetCapacity( 0 ),
+            m_slots( NULL ),
+            m_slotCount( 0 )
+    {
+    }
+
+    inline ~CShapeRegistry()
+    {
+        ::CoTaskMemFree( m_data );
+        ::CoTaskMemFree( m_offsets );
+        ::CoTaskMemFree( m_slots );
+    }
+
+    inline ULONG GetCount()
+    {
+        return m_count;
+    }
+
+    inline ULONG GetSize()
+    {
+        return m_used;
+    }
+
+    // Returns room for a new shape of size bytes.  What was already written
+    // there by an earlier call is kept, but the memory may move.
+    BYTE* Reserve( ULONG size )
+    {
+        ULONG   capacity = m_capacity ? m_capacity : 0x100;
+        BYTE*   data;
+
+        if ( size > 0xFFFFFFFF - m_used )
+            ThrowError( E_OUTOFMEMORY );
+
+        while ( capacity < m_used + size )
+        {
+            if ( capacity > 0x7FFFFFFF )
+                capacity = 0xFFFFFFFF;
+            else
+                capacity *= 2;
+        }
+
+        if ( capacity != m_capacity )
+        {
+            data = (BYTE*)::CoTaskMemRealloc( m_data, capacity );
+            VerifyAllocation( data );
+            m_data = data;
+            m_capacity = capacity;
+        }
+
+        return m_data + m_used;
+    }
+
+    // Returns the number of the shape that is the size bytes built with
+    // Reserve, or schemaReset if there is none.
+    ULONG Find( ULONG size )
+    {
+        const BYTE*     shape = m_data + m_used;
+
+        if ( !m_slotCount )
+            return schemaReset;
+
+        for (   ULONG slot = HashString( shape, size ) & ( m_slotCount - 1 );
+                m_slots[slot];
+                slot = ( slot + 1 ) & ( m_slotCount - 1 ) )
+        {
+            ULONG   id = m_slots[slot] - 1;
+
+            if ( m_offsets[id + 1] - m_offsets[id] == size && 0 == memcmp( m_data + m_offsets[id], shape, size ) )
+                return id;
+        }
+
+        return schemaReset;
+    }
+
+    // Keeps the size bytes built with Reserve as the next shape and returns
+    // its number.
+    ULONG Add( ULONG size )
+    {
+        ULONG   slot;
+
+        if ( m_count + 2 > m_offsetCapacity )
+        {
+            ULONG   capacity = m_offsetCapacity ? m_offsetCapacity * 2 : 64;
+            ULONG*  offsets = (ULONG*)::CoTaskMemRealloc( m_offsets, capacity * sizeof( ULONG ) );
+
+            VerifyAllocation( offsets );
+            m_offsets = offsets;
+            m_offsetCapacity = capacity;
+        }
+
+        if ( 2 * ( m_count + 1 ) > m_slotCount )
+            Rehash( m_slotCount ? 2 * m_slotCount : 128 );
+
+        m_offsets[m_count] = m_used;
+        m_used += size;
+        m_offsets[m_count + 1] = m_used;
+
+        for (   slot = HashString( m_data + m_offsets[m_count], size ) & ( m_slotCount - 1 );
+                m_slots[slot];
+                slot = ( slot + 1 ) & ( m_slotCount - 1 ) )
+            ;
+
+        m_slots[slot] = m_count + 1;
+
+        return m_count++;
+    }
+
+    inline const BYTE* GetShape( ULONG id, ULONG& size )
+    {
+        size = m_offsets[id + 1] - m_offsets[id];
+
+        return m_data + m_offsets[id];
+    }
+
+    // Forgets every shape, keeping the memory.
+    void Clear()
+    {
+        m_used = 0;
+        m_count = 0;
+
+        if ( m_slots )
+            ::ZeroMemory( m_slots, m_slotCount * sizeof( ULONG ) );
+    }
+
+private:
+    void Rehash( ULONG slotCount )
+    {
+        ULONG*  slots = (ULONG*)::CoTaskMemAlloc( slotCount * sizeof( ULONG ) );
+
+        VerifyAllocation( slots );
+        ::ZeroMemory( slots, slotCount * sizeof( ULONG ) );
+
+        ::CoTaskMemFree( m_slots );
+        m_slots = slots;
+        m_slotCount = slotCount;
+
+        for ( ULONG id = 0; id < m_count; id++ )
+        {
+            ULONG   slot;
+
+            for (   slot = HashString( m_data + m_offsets[id], m_offsets[id + 1] - m_offsets[id] ) & ( slotCount - 1 );
+                    slots[slot];
+                    slot = ( slot + 1 ) & ( slotCount - 1 ) )
+                ;
+
+            slots[slot] = id + 1;
+        }
+    }
+
+private:
+    BYTE*               m_data;
+    ULONG               m_used;
+    ULONG               m_capacity;
+    ULONG*              m_offsets;
+    ULONG               m_count;
+    ULONG               m_offsetCapacity;
+    ULONG*              m_slots;
+    ULONG               m_slotCount;
+
+}; // class CShapeRegistry
+
+
+//------------------------------------------------------------------------------
+// GetBatchRow
+// Returns the array of a row of a batch, which must be a one dimensional
+// array of variants.
+//------------------------------------------------------------------------------
+
+inline SAFEARRAY* GetBatchRow( const VARIANT& row )
+{
+    SAFEARRAY*  safeArray;
+
+    if ( !V_ISARRAY( &row ) || VT_VARIANT != ( VT_TYPEMASK & row.vt ) )
+        ThrowError( E_INVALIDARG );
+
+    safeArray = V_ISBYREF( &row ) ? *row.pparray : row.parray;
+    ValidatePointer( safeArray );
+
+    if ( 1 != safeArray->cDims )
+        ThrowError( E_INVALIDARG );
+
+    return safeArray;
+
+} // GetBatchRow
+
+
+//------------------------------------------------------------------------------
+// GetColumnType
+// The type of the array a column of a batch is written as: its elements'
+// type if they all have the same one and it is a number, a boolean or a
+// string, otherwise VT_VARIANT.  rows holds each row's first element.
+//------------------------------------------------------------------------------
+
+inline VARTYPE GetColumnType( const VARIANT* const* rows, ULONG count, ULONG column )
+{
+    VARTYPE     vt = rows[0][column].vt;
+
+    if ( !IsFixedSizeType( vt ) && VT_BOOL != vt && VT_BSTR != vt )
+        return VT_VARIANT;
+
+    for ( ULONG row = 1; row < count; row++ )
+    {
+        if ( rows[row][column].vt != vt )
+            return VT_VARIANT;
+    }
+
+    return vt;
+
+} // GetColumnType
+
+
+//------------------------------------------------------------------------------
+// WriteColumn
+// Writes a column of a batch exactly as WriteVariantToStream writes a one
+// dimensional array, from 0, holding the column's elements, without building
+// the array.  Elements of fixed size types are gathered and written in bulk.
+//------------------------------------------------------------------------------
+
+inline void WriteColumn(    const VARIANT* const*   rows,
+                            ULONG                   count,
+                            ULONG                   column,
+                            CTaskMemory&            buffer,
+                            IStream*                pStream,
+                            ULONG                   maxDepth )
+{
+    CStream     stream( pStream );
+    VARTYPE     vt = GetColumnType( rows, count, column );
+    ULONG       size;
+    ULONG       row;
+
+    if ( !maxDepth )
+        ThrowError( HRESULT_FROM_WIN32( ERROR_STACK_OVERFLOW ) );
+
+    // As WriteVariantToStream and WriteSafeArrayHeader.
+    stream.Write( variantVersion );
+    stream.Write( (VARTYPE)( VT_ARRAY | vt ) );
+    stream.Write( (USHORT)1 );
+    stream.Write( (LONG)0 );
+    stream.Write( count );
+
+    if ( IsFixedSizeType( vt ) )
+    {
+        ULONG   perBuffer;
+
+        GetTypeSize( vt, size );
+        perBuffer = bulkBufferSize / size;
+        buffer.Reserve( bulkBufferSize );
+
+        for ( row = 0; row < count; )
+        {
+            ULONG   gathered;
+
+            for ( gathered = 0; gathered < perBuffer && row < count; gathered++, row++ )
+                ::CopyMemory( (BYTE*)buffer + gathered * size, &rows[row][column].byref, size );
+
+            stream.Write( (BYTE*)buffer, (ULONGLONG)gathered * size );
+        }
+
+        return;
+    }
+
+    // As WriteStackedArrays.
+    for ( row = 0; row < count; row++ )
+    {
+        const VARIANT*  element = &rows[row][column];
+
+        if ( VT_VARIANT == vt )
+        {
+            stream.Write( element->vt );
+
+            if ( V_ISARRAY( element ) )
+            {
+                WriteSafeArray( V_ISBYREF( element ) ? *element->pparray : element->parray,
+                                (VARTYPE)( VT_TYPEMASK & element->vt ),
+                                stream,
+                                maxDepth - 1 );
+                continue;
+            }
+        }
+
+        WriteValueToStream( element, stream );
+    }
+
+} // WriteColumn
+
+
+//------------------------------------------------------------------------------
+// EncodeToScratch
+// Writes the variant as WriteVariantToStream does into the scratch's buffer,
+// growing it as needed, and returns where it starts.  Good until the
+// scratch is next used.
+//------------------------------------------------------------------------------
+
+inline const BYTE* EncodeToScratch( const VARIANT& variant, CodecScratch& scratch, ULONG maxDepth, ULONG& size )
+{
+    CTaskMemoryWriteStream  memory( scratch.buffer );
+
+    CStream( &memory ).Write( variantVersion );
+    WriteToStream( &variant, &memory, maxDepth, &scratch );
+
+    size = (ULONG)memory.GetSize();
+
+    return memory.GetData();
+
+} // EncodeToScratch
+
+
+//------------------------------------------------------------------------------
+// DecodeWithScratch
+// Reads a variant written by WriteVariantToStream from memory in place,
+// walking its arrays with the scratch's memory.  Its strings go in the
+// arena, or in BSTRs if it is NULL, and its arrays come from the allocator,
+// or from SafeArrayAllocDescriptor if it is NULL.  The variant should be
+// initialized.
+//------------------------------------------------------------------------------
+
+inline void DecodeWithScratch(  const void*         data,
+                                ULONG               size,
+                                VARIANT&            variant,
+                                CodecScratch&       scratch,
+                                CStringArena*       arena,
+                                CVariantAllocator*  allocator,
+                                ULONG               maxDepth )
+{
+    CMemoryReadStream   memory( data, size );
+    CStream             stream( &memory );
+
+    scratch.arena = arena;
+    scratch.allocator = allocator;
+    ReadVersion( stream );
+    ReadFromStream( &memory, variant, maxDepth, &scratch );
+
+} // DecodeWithScratch
+
+
+//------------------------------------------------------------------------------
+// CopyToBlob
+// Copies size bytes into a new blob of exactly that size, from the allocator
+// if one is given, otherwise to be freed with CoTaskMemFree.
+//------------------------------------------------------------------------------
+
+inline void CopyToBlob( const BYTE* data, ULONG size, BLOB& blob, CVariantAllocator* allocator = NULL )
+{
+    BYTE*   copy = NULL;
+
+    if ( size )
+    {
+        copy = (BYTE*)( allocator ? allocator->Allocate( size ) : ::CoTaskMemAlloc( size ) );
+        VerifyAllocation( copy );
+        ::CopyMemory( copy, data, size );
+    }
+
+    blob.cbSize = size;
+    blob.pBlobData = copy;
+
+} // CopyToBlob
+
+
+//------------------------------------------------------------------------------
+// ForgetArenaString
+// Lets go of the variant's string, or of the strings of an array of strings,
+// where they came from a CStringArena.  An array of variants is pushed on the
+// stack for its elements to be let go of in turn.
+//------------------------------------------------------------------------------
+
+inline void ForgetArenaString( VARIANT& variant, CArrayStack& stack )
+{
+    if ( VT_BSTR == variant.vt )
+        variant.vt = VT_EMPTY;
+    else if ( ( VT_BSTR | VT_ARRAY ) == variant.vt )
+        ::ZeroMemory( variant.parray->pvData, (SIZE_T)GetElementCount( variant.parray ) * sizeof( BSTR ) );
+    else if ( ( VT_VARIANT | VT_ARRAY ) == variant.vt && GetElementCount( variant.parray ) )
+        stack.Push( variant.parray, VT_VARIANT );
+
+} // ForgetArenaString
+
+
+//------------------------------------------------------------------------------
+// ForgetArenaStrings
+// Lets go of every string in a variant decoded into a CStringArena, nested
+// arrays and all, so that clearing the variant leaves them to the arena.
+//------------------------------------------------------------------------------
+
+inline void ForgetArenaStrings( VARIANT& variant )
+{
+    CArrayStack     stack( 0xFFFFFFFF );
+
+    ForgetArenaString( variant, stack );
+
+    while ( !stack.IsEmpty() )
+    {
+        CArrayStack::Frame&     frame = stack.Top();
+
+        if ( frame.IsMore() )
+            ForgetArenaString( *(VARIANT*)frame.NextElement(), stack );
+        else
+            stack.Pop();
+    }
+
+} // ForgetArenaStrings
+
+
+//------------------------------------------------------------------------------
+// FreeDecodedArray
+// Frees an array made by AllocSafeArrayDescriptor and its data.
+//------------------------------------------------------------------------------
+
+inline void FreeDecodedArray( SAFEARRAY* safeArray, CVariantAllocator& allocator )
+{
+    allocator.Free( safeArray->pvData );
+    allocator.Free( safeArray );
+
+} // FreeDecodedArray
+
+
+//------------------------------------------------------------------------------
+// FreeDecodedValue
+// Empties a variant decoded with its strings in an arena and its arrays
+// from the allocator.  Objects are released.  An array of variants is pushed
+// on the stack for its elements to be freed before it is.
+//------------------------------------------------------------------------------
+
+inline void FreeDecodedValue( VARIANT& variant, CArrayStack& stack, CVariantAllocator& allocator )
+{
+    SAFEARRAY*  safeArray;
+    VARTYPE     vt;
+    ULONGLONG   count;
+
+    if ( !V_ISARRAY( &variant ) )
+    {
+        if ( VT_BSTR == variant.vt )
+            variant.vt = VT_EMPTY;
+        ::VariantClear( &variant );
+        return;
+    }
+
+    safeArray = variant.parray;
+    vt = (VARTYPE)( VT_TYPEMASK & variant.vt );
+    count = GetElementCount( safeArray );
+    variant.vt = VT_EMPTY;
+
+    if ( VT_VARIANT == vt && count )
+    {
+        stack.Push( safeArray, vt );
+        return;
+    }
+
+    if ( VT_UNKNOWN == vt || VT_DISPATCH == vt )
+    {
+        for ( ULONGLONG element = 0; element < count; element++ )
+        {
+            IUnknown*   unknown = ( (IUnknown**)safeArray->pvData )[element];
+
+            if ( unknown )
+                unknown->Release();
+        }
+    }
+
+    FreeDecodedArray( safeArray, allocator );
+
+} // FreeDecodedValue
+
+
+//------------------------------------------------------------------------------
+// FreeDecoded
+// Frees everything in a variant decoded with its arrays from the allocator,
+// nested arrays and all, leaving its strings to their arena.
+//------------------------------------------------------------------------------
+
+inline void FreeDecoded( VARIANT& variant, CVariantAllocator& allocator )
+{
+    CArrayStack     stack( 0xFFFFFFFF );
+
+    FreeDecodedValue( variant, stack, allocator );
+
+    while ( !stack.IsEmpty() )
+    {
+        CArrayStack::Frame&     frame = stack.Top();
+        SAFEARRAY*              safeArray = frame.safeArray;
+
+        if ( frame.IsMore() )
+        {
+            FreeDecodedValue( *(VARIANT*)frame.NextElement(), stack, allocator );
+        }
+        else
+        {
+            stack.Pop();
+            FreeDecodedArray( safeArray, allocator );
+        }
+    }
+
+} // FreeDecoded
+
+
+} // namespace VariantStreaming
+
+
+//------------------------------------------------------------------------------
+// CVariantVisitor::Elements
+//------------------------------------------------------------------------------
+
+inline void CVariantVisitor::Elements( VARTYPE vt, const void* data, ULONG count )
+{
+    ULONG       size;
+    VARIANT     value;
+
+    VariantStreaming::GetTypeSize( vt, size );
+
+    for ( ULONG i = 0; i < count; i++ )
+    {
+        VariantStreaming::GetElementValue( (const BYTE*)data + i * size, vt, size, value );
+        Scalar( value );
+    }
+
+} // CVariantVisitor::Elements
+
+
+//------------------------------------------------------------------------------
+// WriteVariantToStream
+// Writes the given variant to the stream.
+// maxDepth limits how deeply arrays may be nested in arrays of variants.
+//------------------------------------------------------------------------------
+
+inline void WriteVariantToStream(   const VARIANT*  variant,
+                                    IStream*        pStream,
+                                    ULONG           maxDepth = VariantStreaming::defaultMaxDepth )
+{
+    // Write the version number of this class.
+    CStream( pStream ).Write( VariantStreaming::variantVersion );
+
+    // Call the main routine to write a variant from the stream.
+    VariantStreaming::WriteToStream( variant, pStream, maxDepth );
+
+} // WriteVariantToStream
+
+
+//------------------------------------------------------------------------------
+// ReadVariantFromStream
+// The passed in variant should be initialized.
+// maxDepth limits how deeply arrays may be nested in arrays of variants, which
+// guards against malformed or hostile streams.
+//------------------------------------------------------------------------------
+
+inline void ReadVariantFromStream(  IStream*        pStream,
+                                    VARIANT&        variant,
+                                    ULONG           maxDepth = VariantStreaming::defaultMaxDepth )
+{
+    CStream     stream( pStream );
+
+    // Read the version, and the chunk table if there is one.  If the version
+    // is later needed by the reading code, it can be passed as parameter to
+    // ReadFromStream, and internally in ReadSafeArray.
+    VariantStreaming::ReadVersion( stream );
+
+    // Call the main routine to read a variant from the stream.
+    VariantStreaming::ReadFromStream( pStream, variant, maxDepth );
+
+} // ReadVariantFromStream
+
+
+//------------------------------------------------------------------------------
+// ReadVariantInto
+// Reads a variant as ReadVariantFromStream does, overwriting the given one.
+// If both are arrays of the same element type and bounds, the variant's
+// array is kept and its data overwritten in place, so that reading arrays
+// of one shape over and over allocates nothing; otherwise the variant is
+// cleared and a new array made.  An array of variants keeps only its own
+// memory.  Should reading fail, the variant holds what was read so far.
+//------------------------------------------------------------------------------
+
+inline void ReadVariantInto(    IStream*        pStream,
+                                VARIANT&        variant,
+                                ULONG           maxDepth = VariantStreaming::defaultMaxDepth )
+{
+    CStream     stream( pStream );
+    VARTYPE     vt;
+
+    VariantStreaming::ReadVersion( stream );
+    stream.Read( vt );
+
+    VariantStreaming::ReadDataInto( vt, pStream, variant, maxDepth, NULL );
+
+} // ReadVariantInto
+
+
+//------------------------------------------------------------------------------
+// VisitVariantInStream
+// Reads a variant written by WriteVariantToStream, passing its contents to
+// the visitor as they are read.  No SAFEARRAY or BSTR is created, so arrays
+// larger than memory can be processed.  Objects are still loaded, one at a
+// time.
+// maxDepth limits how deeply arrays may be nested in arrays of variants.
+//------------------------------------------------------------------------------
+
+inline void VisitVariantInStream(   IStream*            pStream,
+                                    CVariantVisitor&    visitor,
+                                    ULONG               maxDepth = VariantStreaming::defaultMaxDepth )
+{
+    CStream     stream( pStream );
+
+    VariantStreaming::ReadVersion( stream );
+
+    VariantStreaming::VisitFromStream( pStream, visitor, maxDepth );
+
+} // VisitVariantInStream
+
+
+//------------------------------------------------------------------------------
+// AggregateVariantInStream
+// Works out the count, sum, minimum and maximum of the numbers in a variant
+// written by WriteVariantToStream, at any depth, without reading it into a
+// SAFEARRAY.  Arrays of doubles and longs are aggregated a run at a time
+// straight from the bytes read, so a file larger than memory can be
+// aggregated through a stream on it, and a blob or mapped view through a
+// CMemoryReadStream.  Strings and empty values are not counted.
+// The second form counts only the numbers between low and high inclusive.
+//
+// Example:
+//      CMemoryReadStream   stream( view, size );
+//      CVariantAggregate   aggregate;
+//
+//      AggregateVariantInStream( &stream, 0, 100, aggregate );
+//      mean = aggregate.GetMean();
+//------------------------------------------------------------------------------
+
+inline void AggregateVariantInStream(   IStream*            pStream,
+                                        CVariantAggregate&  aggregate,
+                                        ULONG               maxDepth = VariantStreaming::defaultMaxDepth )
+{
+    VariantStreaming::CAggregateVisitor visitor( aggregate, false, 0, 0 );
+
+    VisitVariantInStream( pStream, visitor, maxDepth );
+
+} // AggregateVariantInStream
+
+
+inline void AggregateVariantInStream(   IStream*            pStream,
+                                        double              low,
+                                        double              high,
+                                        CVariantAggregate&  aggregate,
+                                        ULONG               maxDepth = VariantStreaming::defaultMaxDepth )
+{
+    VariantStreaming::CAggregateVisitor visitor( aggregate, true, low, high );
+
+    VisitVariantInStream( pStream, visitor, maxDepth );
+
+} // AggregateVariantInStream
+
+
+//------------------------------------------------------------------------------
+// ReadVariantElementFromStream
+// Reads one element of an array streamed by WriteVariantToStream, given its
+// position in streamed order (the last dimension varying fastest), without
+// reading the rest of the array.  Elements of fixed size types are sought
+// directly; strings and variants are found by reading their sizes and types
+// and seeking past them.  The stream must be seekable and positioned at the
+// start of the variant, and is left within it.
+// The passed in variant should be initialized.
+//------------------------------------------------------------------------------
+
+inline void ReadVariantElementFromStream(   IStream*        pStream,
+                                            ULONGLONG       position,
+                                            VARIANT&        element,
+                                            ULONG           maxDepth = VariantStreaming::defaultMaxDepth )
+{
+    VARTYPE                         vt;
+    USHORT                          dimensions;
+    VariantStreaming::CTaskMemory   bounds( sizeof( SAFEARRAYBOUND ) );
+    ULONGLONG                       start;
+    ULONGLONG                       current = 0;
+    ULONGLONG                       count = 1;
+
+    VariantStreaming::BeginReadArrayFromStream( pStream, vt, dimensions, bounds, start, maxDepth );
+
+    for ( USHORT dimension = 0; dimension < dimensions; dimension++ )
+        count *= ( (SAFEARRAYBOUND*)(BYTE*)bounds )[dimension].cElements;
+    if ( !dimensions || position >= count )
+        ThrowError( DISP_E_BADINDEX );
+
+    VariantStreaming::SeekElement( vt, start, current, position, pStream, maxDepth - 1 );
+
+    if ( VT_VARIANT == vt )
+    {
+        // Array of variants, so read the element's type first.
+        CStream( pStream ).Read( vt );
+        VariantStreaming::ReadDataFromStream( vt, pStream, element, maxDepth - 1 );
+    }
+    else
+    {
+        VariantStreaming::ReadValueFromStream( vt, pStream, element );
+    }
+
+} // ReadVariantElementFromStream
+
+
+//------------------------------------------------------------------------------
+// WriteVariantSliceToStream
+// Writes a sub-rectangle of the variant's array to the stream as
+// WriteVariantToStream would write an array holding only those elements,
+// straight from the array's memory, without copying them into a new array
+// first.  The slice gives, in SafeArrayCreate's order, the index of the
+// first element and the number of elements to write in each dimension, and
+// becomes the streamed array's bounds, so its elements keep their indexes.
+// Runs of elements of fixed size types are written in one go where they lie
+// next to each other in memory, and gathered where they don't.
+//------------------------------------------------------------------------------
+
+inline void WriteVariantSliceToStream(  const VARIANT*          variant,
+                                        const SAFEARRAYBOUND*   slice,
+                                        IStream*                pStream,
+                                        ULONG                   maxDepth = VariantStreaming::defaultMaxDepth )
+{
+    VariantStreaming::CTaskMemory   bounds( sizeof( SAFEARRAYBOUND ) );
+    SAFEARRAY*                      safeArray;
+    VARTYPE                         vt;
+    USHORT                          dimensions;
+    USHORT                          dimension;
+    ULONGLONG                       count;
+    ULONG                           size;
+    SIZE_T                          stride;
+    CStream                         stream( pStream );
+
+    ValidatePointer( variant );
+    if ( !V_ISARRAY( variant ) )
+        ThrowError( DISP_E_TYPEMISMATCH );
+    if ( !maxDepth )
+        ThrowError( HRESULT_FROM_WIN32( ERROR_STACK_OVERFLOW ) );
+
+    safeArray = V_ISBYREF( variant ) ? *variant->pparray : variant->parray;
+    ValidatePointer( safeArray );
+    vt = (VARTYPE)( VT_TYPEMASK & variant->vt );
+    dimensions = safeArray->cDims;
+    size = safeArray->cbElements;
+
+    // The array keeps its bounds in the reverse of SafeArrayCreate's order.
+    bounds.Reserve( dimensions * sizeof( SAFEARRAYBOUND ) );
+    for ( dimension = 0; dimension < dimensions; dimension++ )
+        ( (SAFEARRAYBOUND*)(BYTE*)bounds )[dimension] = safeArray->rgsabound[dimensions - 1 - dimension];
+
+    VariantStreaming::CheckSlice( dimensions, (SAFEARRAYBOUND*)(BYTE*)bounds, slice );
+
+    // As WriteVariantToStream and WriteSafeArrayHeader, with the slice's
+    // bounds.
+    stream.Write( VariantStreaming::variantVersion );
+    stream.Write( (VARTYPE)( vt | VT_ARRAY ) );
+    stream.Write( dimensions );
+
+    count = dimensions ? 1 : 0;
+    for ( dimension = dimensions; dimension > 0; dimension-- )
+    {
+        stream.Write( slice[dimension - 1].lLbound );
+        stream.Write( slice[dimension - 1].cElements );
+        count *= slice[dimension - 1].cElements;
+    }
+
+    if ( !count )
+        return;
+
+    VariantStreaming::CSafeArrayData    data( safeArray );
+
+    if ( VariantStreaming::IsFixedSizeType( vt ) )
+    {
+        // Elements along the last dimension are next to each other in the
+        // stream, and this far apart in memory.
+        ULONG       run = slice[dimensions - 1].cElements;
+        ULONG       perBuffer = VariantStreaming::bulkBufferSize / size;
+
+        stride = size;
+        for ( dimension = 1; dimension < dimensions; dimension++ )
+            stride *= safeArray->rgsabound[dimension].cElements;
+
+        VariantStreaming::CTaskMemory   buffer( stride == size || 1 == run ? 0 : VariantStreaming::bulkBufferSize );
+
+        for ( ULONGLONG element = 0; element < count; element += run )
+        {
+            ULONGLONG   position = VariantStreaming::GetSlicePosition( dimensions, (SAFEARRAYBOUND*)(BYTE*)bounds, slice, element );
+            BYTE*       source = VariantStreaming::GetWalkElement( safeArray, data, position );
+
+            if ( stride == size || 1 == run )
+            {
+                stream.Write( source, (ULONGLONG)run * size );
+                continue;
+            }
+
+            // Otherwise gather a buffer at a time.
+            for ( ULONG done = 0; done < run; )
+            {
+                ULONG   piece = run - done < perBuffer ? run - done : perBuffer;
+
+                for ( ULONG i = 0; i < piece; i++ )
+                    ::CopyMemory( buffer + i * size, source + ( done + i ) * stride, size );
+                stream.Write( buffer, piece * size );
+
+                done += piece;
+            }
+        }
+
+        return;
+    }
+
+    for ( ULONGLONG element = 0; element < count; element++ )
+    {
+        ULONGLONG   position = VariantStreaming::GetSlicePosition( dimensions, (SAFEARRAYBOUND*)(BYTE*)bounds, slice, element );
+        BYTE*       source = VariantStreaming::GetWalkElement( safeArray, data, position );
+
+        if ( VT_VARIANT == vt )
+        {
+            // As WriteStackedArrays, an element's type ahead of its data.
+            stream.Write( ( (const VARIANT*)source )->vt );
+            VariantStreaming::WriteDataToStream( (const VARIANT*)source, pStream, maxDepth - 1 );
+        }
+        else
+        {
+            VARIANT     value;
+
+            VariantStreaming::GetElementValue( source, vt, size, value );
+            VariantStreaming::WriteValueToStream( &value, pStream );
+        }
+    }
+
+} // WriteVariantSliceToStream
+
+
+//------------------------------------------------------------------------------
+// ReadVariantSliceFromStream
+// Reads a sub-rectangle of an array streamed by WriteVariantToStream into a
+// new array, reading only the parts of the stream it needs.  The slice gives,
+// in SafeArrayCreate's order, the index of the first element and the number
+// of elements to read in each dimension.  The new array has the slice's
+// bounds, so its elements keep their indexes.  Runs of elements of fixed size
+// types are read in one go.  The stream must be seekable and positioned at
+// the start of the variant, and is left within it.
+// The passed in variant should be initialized.
+//------------------------------------------------------------------------------
+
+inline void ReadVariantSliceFromStream( IStream*                pStream,
+                                        const SAFEARRAYBOUND*   slice,
+                                        VARIANT&                variant,
+                                        ULONG                   maxDepth = VariantStreaming::defaultMaxDepth )
+{
+    VARTYPE                         vt;
+    USHORT                          dimensions;
+    VariantStreaming::CTaskMemory   bounds( sizeof( SAFEARRAYBOUND ) );
+    ULONGLONG                       start;
+    ULONGLONG                       current = 0;
+    ULONGLONG                       count;
+    ULONG                           size;
+    CStream                         stream( pStream );
+
+    VariantStreaming::BeginReadArrayFromStream( pStream, vt, dimensions, bounds, start, maxDepth );
+    VariantStreaming::CheckSlice( dimensions, (SAFEARRAYBOUND*)(BYTE*)bounds, slice );
+    VariantStreaming::CreateSlice( vt, dimensions, slice, variant );
+
+    count = VariantStreaming::GetElementCount( variant.parray );
+    size = variant.parray->cbElements;
+    if ( !count )
+        return;
+
+    VariantStreaming::CSafeArrayData    data( variant.parray );
+
+    if ( VariantStreaming::IsFixedSizeType( vt ) )
+    {
+        // Elements along the last dimension are next to each other in the
+        // stream, so read each such run in one go.
+        VariantStreaming::CTaskMemory   buffer( VariantStreaming::bulkBufferSize );
+        ULONG                           run = slice[dimensions - 1].cElements;
+        ULONG                           perBuffer = VariantStreaming::bulkBufferSize / size;
+        bool                            isContiguous = VariantStreaming::IsWalkContiguous( variant.parray );
+
+        for ( ULONGLONG element = 0; element < count; element += run )
+        {
+            ULONGLONG   position = VariantStreaming::GetSlicePosition( dimensions, (SAFEARRAYBOUND*)(BYTE*)bounds, slice, element );
+
+            VariantStreaming::SeekElement( vt, start, current, position, pStream, maxDepth - 1 );
+
+            if ( isContiguous )
+            {
+                stream.Read( VariantStreaming::GetWalkElement( variant.parray, data, element ), (ULONGLONG)run * size );
+                continue;
+            }
+
+            // Otherwise read a buffer at a time and scatter the elements.
+            for ( ULONG done = 0; done < run; )
+            {
+                ULONG   piece = run - done < perBuffer ? run - done : perBuffer;
+
+                stream.Read( (BYTE*)buffer, piece * size );
+                for ( ULONG i = 0; i < piece; i++ )
+                    ::CopyMemory( VariantStreaming::GetWalkElement( variant.parray, data, element + done + i ), buffer + i * size, size );
+
+                done += piece;
+            }
+        }
+
+        return;
+    }
+
+    for ( ULONGLONG element = 0; element < count; element++ )
+    {
+        ULONGLONG   position = VariantStreaming::GetSlicePosition( dimensions, (SAFEARRAYBOUND*)(BYTE*)bounds, slice, element );
+
+        VariantStreaming::SeekElement( vt, start, current, position, pStream, maxDepth - 1 );
+        VariantStreaming::ReadElementFromStream(    vt,
+                                                    VariantStreaming::GetWalkElement( variant.parray, data, element ),
+                                                    size,
+                                                    pStream,
+                                                    maxDepth - 1 );
+        current = position + 1;
+    }
+
+} // ReadVariantSliceFromStream
+
+
+//------------------------------------------------------------------------------
+// WriteVariantToBlob
+// Streams out a variant to a BLOB.
+// The returned BLOB data structure is owned by the caller and should be
+// freed using CoTaskMemFree.  The variant is encoded straight into task
+// memory, which is handed over as the blob.
+//------------------------------------------------------------------------------
+
+inline void WriteVariantToBlob( const VARIANT& v, BLOB& blob )
+{
+    CTaskMemoryWriteStream  memory;
+
+    ::WriteVariantToStream( &v, &memory );
+
+    memory.Detach( blob );
+
+} // WriteVariantToBlob
+
+
+//------------------------------------------------------------------------------
+// ReadVariantFromBlob
+// Given a BLOB, streams out a variant.  The caller owns the data in the
+// blob parameter, which is read in place.
+//------------------------------------------------------------------------------
+
+inline void ReadVariantFromBlob( const BLOB& blob, VARIANT& v )
+{
+    CMemoryReadStream   memory( blob.pBlobData, blob.cbSize );
+
+    ReadVariantFromStream( &memory, v );
+
+} // ReadVariantFromBlob
+
+
+//------------------------------------------------------------------------------
+// ReadVariantInto
+// Reads a variant from a BLOB in place, overwriting the given one as
+// ReadVariantInto does from a stream.
+//------------------------------------------------------------------------------
+
+inline void ReadVariantInto( const BLOB& blob, VARIANT& variant )
+{
+    CMemoryReadStream   memory( blob.pBlobData, blob.cbSize );
+
+    ReadVariantInto( &memory, variant );
+
+} // ReadVariantInto
+
+
+//------------------------------------------------------------------------------
+// WriteVariantsToBlob
+// Streams out count variants to one BLOB behind one header, writing them
+// straight into the blob's memory as it grows.  Much cheaper for many small
+// variants than a WriteVariantToBlob each.  The returned BLOB data is owned
+// by the caller and should be freed using CoTaskMemFree.
+//------------------------------------------------------------------------------
+
+inline void WriteVariantsToBlob(    const VARIANT*  variants,
+                                    ULONG           count,
+                                    BLOB&           blob,
+                                    ULONG           maxDepth = VariantStreaming::defaultMaxDepth )
+{
+    CTaskMemoryWriteStream  memory;
+    CStream                 stream( &memory );
+
+    if ( count )
+        ValidatePointer( variants );
+
+    stream.Write( VariantStreaming::variantsMagic );
+    stream.Write( VariantStreaming::variantsVersion );
+    stream.Write( count );
+
+    for ( ULONG variant = 0; variant < count; variant++ )
+        VariantStreaming::WriteToStream( &variants[variant], &memory, maxDepth );
+
+    memory.Detach( blob );
+
+} // WriteVariantsToBlob
+
+
+//------------------------------------------------------------------------------
+// GetVariantCountFromBlob
+// How many variants a BLOB written by WriteVariantsToBlob holds.
+//------------------------------------------------------------------------------
+
+inline ULONG GetVariantCountFromBlob( const BLOB& blob )
+{
+    VariantStreaming::CMemoryCursor     cursor( blob.pBlobData, blob.pBlobData + blob.cbSize );
+    ULONG                               magic;
+    long                                version;
+    ULONG                               count;
+
+    cursor.Read( magic );
+    cursor.Read( version );
+    cursor.Read( count );
+    if ( VariantStreaming::variantsMagic != magic || VariantStreaming::variantsVersion != version )
+        ThrowError( E_FAIL );
+
+    return count;
+
+} // GetVariantCountFromBlob
+
+
+//------------------------------------------------------------------------------
+// ReadVariantsFromBlob
+// Mirror of WriteVariantsToBlob.  Reads the variants in place from the
+// blob's memory into count variants, which should be initialized.  Fails if
+// the blob holds a different number of variants.  The caller owns the data
+// in the blob parameter.
+//------------------------------------------------------------------------------
+
+inline void ReadVariantsFromBlob(   const BLOB&     blob,
+                                    VARIANT*        variants,
+                                    ULONG           count,
+                                    ULONG           maxDepth = VariantStreaming::defaultMaxDepth )
+{
+    CMemoryReadStream   memory( blob.pBlobData, blob.cbSize );
+    LARGE_INTEGER       header;
+
+    if ( GetVariantCountFromBlob( blob ) != count )
+        ThrowError( E_INVALIDARG );
+    if ( count )
+        ValidatePointer( variants );
+
+    header.QuadPart = sizeof( ULONG ) + sizeof( long ) + sizeof( ULONG );
+    CheckResult( memory.Seek( header, STREAM_SEEK_SET, NULL ) );
+
+    for ( ULONG variant = 0; variant < count; variant++ )
+        VariantStreaming::ReadFromStream( &memory, variants[variant], maxDepth );
+
+} // ReadVariantsFromBlob
+
+
+//------------------------------------------------------------------------------
+// WriteChunkedVariantToStream
+// Writes the given variant to the stream as WriteVariantToStream does, but
+// with a table of where each run of chunkElements elements of an array
+// starts, so that ReadVariantFromMemoryInParallel can read the runs on
+// several threads.  Other readers skip the table.  Only arrays of strings and
+// of variants are chunked: arrays of fixed size types are read in bulk
+// anyway, and an object's size isn't known until it is saved.  Anything
+// else, and arrays that fit in one chunk, are written unchanged.
+//------------------------------------------------------------------------------
+
+inline void WriteChunkedVariantToStream(    const VARIANT*  variant,
+                                            IStream*        pStream,
+                                            ULONG           chunkElements,
+                                            ULONG           maxDepth = VariantStreaming::defaultMaxDepth )
+{
+    VariantStreaming::CTaskMemory   offsets( sizeof( ULONGLONG ) );
+    SAFEARRAY*                      safeArray;
+    VARTYPE                         vt;
+
+    if ( !VariantStreaming::BeginWriteChunkedArray( variant, chunkElements, safeArray, vt, offsets, pStream, maxDepth ) )
+    {
+        WriteVariantToStream( variant, pStream, maxDepth );
+        return;
+    }
+
+    VariantStreaming::WriteSafeArray( safeArray, vt, pStream, maxDepth );
+
+} // WriteChunkedVariantToStream
+
+
+//------------------------------------------------------------------------------
+// WriteChunkedVariantToBlob
+// Streams out a variant to a BLOB with WriteChunkedVariantToStream.
+// The returned BLOB data structure is owned by the caller and should be
+// freed using CoTaskMemFree
+//------------------------------------------------------------------------------
+
+inline void WriteChunkedVariantToBlob( const VARIANT& v, BLOB& blob, ULONG chunkElements )
+{
+    CComPtr<IStream>    stream;
+
+    CheckResult( ::CreateStreamOnHGlobal( NULL, TRUE, &stream ) );
+
+    ::WriteChunkedVariantToStream( &v, stream, chunkElements );
+
+    StreamToTaskMemory( stream, blob );
+
+} // WriteChunkedVariantToBlob
+
+
+//------------------------------------------------------------------------------
+// WriteVariantMapToStream
+// Streams out a map of names to values, given as a 2 x N array of variants
+// whose element ( 0, i ) is the i'th name, a string, and ( 1, i ) its value.
+// The array is streamed as WriteVariantToStream would, after a directory
+// that lets CVariantView::Find go straight to any value by its name, so the
+// map reads back as the same array with any of the other readers.  Values
+// may not be objects.
+//------------------------------------------------------------------------------
+
+inline void WriteVariantMapToStream(    const VARIANT*  map,
+                                        IStream*        pStream,
+                                        ULONG           maxDepth = VariantStreaming::defaultMaxDepth )
+{
+    VariantStreaming::BeginWriteMap( map, pStream, maxDepth );
+
+    VariantStreaming::WriteToStream( map, pStream, maxDepth );
+
+} // WriteVariantMapToStream
+
+
+//------------------------------------------------------------------------------
+// WriteVariantMapToBlob
+// Streams out a map to a BLOB with WriteVariantMapToStream.
+// The returned BLOB data structure is owned by the caller and should be
+// freed using CoTaskMemFree
+//------------------------------------------------------------------------------
+
+inline void WriteVariantMapToBlob( const VARIANT& map, BLOB& blob )
+{
+    CComPtr<IStream>    stream;
+
+    CheckResult( ::CreateStreamOnHGlobal( NULL, TRUE, &stream ) );
+
+    ::WriteVariantMapToStream( &map, stream );
+
+    StreamToTaskMemory( stream, blob );
+
+} // WriteVariantMapToBlob
+
+
+//------------------------------------------------------------------------------
+// WriteVariantToStreamInParallel
+// Writes the same bytes as WriteChunkedVariantToStream, encoding the chunks
+// on up to threads threads, or one per processor if threads is 0.  Chunks
+// are encoded a window of up to parallelWindowSize bytes at a time, each
+// into its own part of the window, and the window is written out once all
+// its chunks are done, so the stream is written in order from the calling
+// thread.  What isn't chunked is written on the calling thread.
+//------------------------------------------------------------------------------
+
+inline void WriteVariantToStreamInParallel( const VARIANT*  variant,
+                                            IStream*        pStream,
+                                            ULONG           chunkElements,
+                                            ULONG           threads = 0,
+                                            ULONG           maxDepth = VariantStreaming::defaultMaxDepth )
+{
+    VariantStreaming::CTaskMemory   offsets( sizeof( ULONGLONG ) );
+    VariantStreaming::CTaskMemory   window( sizeof( ULONGLONG ) );
+    CStream                         stream( pStream );
+    SAFEARRAY*                      safeArray;
+    VARTYPE                         vt;
+    ULONG                           chunkCount;
+    ULONG                           last;
+
+    if ( !VariantStreaming::BeginWriteChunkedArray( variant, chunkElements, safeArray, vt, offsets, pStream, maxDepth ) )
+    {
+        WriteVariantToStream( variant, pStream, maxDepth );
+        return;
+    }
+
+    VariantStreaming::WriteSafeArrayHeader( safeArray, pStream );
+
+    VariantStreaming::CSafeArrayData    data( safeArray );
+    const ULONGLONG*                    offset = (const ULONGLONG*)(BYTE*)offsets;
+
+    chunkCount = (ULONG)( ( VariantStreaming::GetElementCount( safeArray ) + chunkElements - 1 ) / chunkElements );
+
+    for ( ULONG first = 0; first < chunkCount; first = last )
+    {
+        ULONGLONG   size;
+
+        // As many chunks as fit in the window, but at least one.
+        for ( last = first + 1; last < chunkCount; last++ )
+        {
+            if ( offset[last + 1] - offset[first] > VariantStreaming::parallelWindowSize )
+                break;
+        }
+
+        size = offset[last] - offset[first];
+        if ( size > 0xFFFFFFFF )
+            ThrowError( E_OUTOFMEMORY );
+        window.Reserve( (ULONG)size );
+
+        VariantStreaming::CChunkWriter      writer( safeArray, vt, data, window, offset + first, first, chunkElements, maxDepth );
+        VariantStreaming::CParallelTasks    tasks( VariantStreaming::CChunkWriter::WriteChunk, &writer, last - first );
+
+        tasks.Run( threads );
+        stream.Write( (BYTE*)window, size );
+    }
+
+} // WriteVariantToStreamInParallel
+
+
+//------------------------------------------------------------------------------
+// ReadVariantFromMemoryInParallel
+// Reads a variant streamed into memory, such as a blob or a mapped file, in
+// place.  An array written by WriteChunkedVariantToStream is created up front
+// and its chunks are read into it on up to threads threads, or one per
+// processor if threads is 0.  Anything else is read on the calling thread as
+// ReadVariantFromStream reads it.  Objects can't be loaded on the other
+// threads, so chunks holding them fail to read; WriteChunkedVariantToStream
+// doesn't chunk arrays that hold objects.
+// The passed in variant should be initialized.
+//------------------------------------------------------------------------------
+
+inline void ReadVariantFromMemoryInParallel(    const void*     data,
+                                                SIZE_T          size,
+                                                VARIANT&        variant,
+                                                ULONG           threads = 0,
+                                                ULONG           maxDepth = VariantStreaming::defaultMaxDepth )
+{
+    const BYTE*         end = (const BYTE*)data + size;
+    const BYTE*         body;
+    long                version;
+    ULONG               chunkElements;
+    ULONG               chunkCount;
+    ULONGLONG*          offsets;
+    VARTYPE             vt;
+
+    ValidatePointer( data );
+
+    VariantStreaming::CMemoryCursor     cursor( (const BYTE*)data, end );
+
+    cursor.Read( version );
+    if ( VariantStreaming::chunkedVersion != version )
+    {
+        CMemoryReadStream   stream( data, size );
+
+        ReadVariantFromStream( &stream, variant, maxDepth );
+        return;
+    }
+
+    cursor.Read( chunkElements );
+    cursor.Read( chunkCount );
+    cursor.CheckRemaining( chunkCount, sizeof( ULONGLONG ) );
+    if ( !chunkElements || chunkCount >= 0xFFFFFFFF / sizeof( ULONGLONG ) )
+        ThrowError( E_FAIL );
+
+    // One more offset than there are chunks, for where the last one ends.
+    VariantStreaming::CTaskMemory   table( ( chunkCount + 1 ) * sizeof( ULONGLONG ) );
+
+    offsets = (ULONGLONG*)(BYTE*)table;
+    for ( ULONG chunk = 0; chunk < chunkCount; chunk++ )
+        cursor.Read( offsets[chunk] );
+
+    body = cursor.GetData();
+    offsets[chunkCount] = end - body;
+
+    CMemoryReadStream   header( body, end - body );
+
+    CStream( &header ).Read( vt );
+    if ( !( vt & VT_ARRAY ) )
+        ThrowError( E_FAIL );
+    if ( !maxDepth )
+        ThrowError( HRESULT_FROM_WIN32( ERROR_STACK_OVERFLOW ) );
+    vt = (VARTYPE)( VT_TYPEMASK & vt );
+
+    VariantStreaming::ReadSafeArrayHeader( &variant, vt, &header );
+
+    // The table must cover the array, the first chunk starting straight after
+    // the header and each of the others no earlier than the one before.
+    if ( chunkCount != ( VariantStreaming::GetElementCount( variant.parray ) + chunkElements - 1 ) / chunkElements )
+        ThrowError( E_FAIL );
+    if ( !chunkCount || VariantStreaming::IsFixedSizeType( vt ) )
+    {
+        VariantStreaming::ReadSafeArrayData( variant.parray, &header );
+        return;
+    }
+    if ( offsets[0] != header.GetPosition() )
+        ThrowError( E_FAIL );
+    for ( ULONG next = 1; next <= chunkCount; next++ )
+    {
+        if ( offsets[next] < offsets[next - 1] )
+            ThrowError( E_FAIL );
+    }
+
+    VariantStreaming::CSafeArrayData    arrayData( variant.parray );
+    VariantStreaming::CChunkReader      reader( variant.parray, vt, arrayData, body, offsets, chunkElements, maxDepth );
+    VariantStreaming::CParallelTasks    tasks( VariantStreaming::CChunkReader::ReadChunk, &reader, chunkCount );
+
+    tasks.Run( threads );
+
+} // ReadVariantFromMemoryInParallel
+
+
+//==============================================================================
+// CVariantArrayWriter
+// Writes an array to a stream as it is produced, so that the whole array
+// never has to be in memory.  Begin writes the header, Write and WriteData
+// supply the elements, and End checks that all of them were supplied.  What
+// is written is the same as WriteVariantToStream writes for the equivalent
+// array, so ReadVariantFromStream reads it back as a SAFEARRAY.
+// The bounds are given as for SafeArrayCreate, and the elements are supplied
+// with the last dimension varying fastest.
+// Example:
+//      SAFEARRAYBOUND          bounds[2] = { { rows, 0 }, { columns, 0 } };
+//      CVariantArrayWriter     writer( pStream );
+//
+//      writer.Begin( VT_R8, 2, bounds );
+//      while ( ... more rows ... )
+//          writer.WriteData( row, columns );
+//      writer.End();
+//==============================================================================
+
+class CVariantArrayWriter
+{
+public:
+    //------------------------------------------------------------------------------
+    // Construct on the stream to write to.  maxDepth limits how deeply arrays
+    // may be nested, counting the array being written.
+    //------------------------------------------------------------------------------
+
+    CVariantArrayWriter(    IStream*    pStream,
+                            ULONG       maxDepth = VariantStreaming::defaultMaxDepth )
+        :   m_stream( pStream ),
+            m_descriptor( NULL ),
+            m_vt( VT_EMPTY ),
+            m_remaining( 0 ),
+            m_maxDepth( maxDepth )
+    {
+    }
+
+    inline ~CVariantArrayWriter()
+    {
+        if ( m_descriptor )
+            ::SafeArrayDestroyDescriptor( m_descriptor );
+    }
+
+
+    //------------------------------------------------------------------------------
+    // Begin
+    // Writes the variant's header and the array's bounds.  vt is the type of
+    // the elements, without VT_ARRAY.
+    //------------------------------------------------------------------------------
+
+    void Begin( VARTYPE vt, USHORT dimensions, const SAFEARRAYBOUND* bounds )
+    {
+        USHORT      dimension;
+
+        ValidatePointer( bounds );
+        if ( m_descriptor || ( vt & ~VT_TYPEMASK ) )
+            ThrowError( E_INVALIDARG );
+        if ( !m_maxDepth )
+            ThrowError( HRESULT_FROM_WIN32( ERROR_STACK_OVERFLOW ) );
+
+        // Describe the array, without allocating its data, so that its
+        // header is written just as a real array's would be.  A SAFEARRAY
+        // holds its bounds in the reverse of the order SafeArrayCreate takes.
+        CheckResult( ::SafeArrayAllocDescriptor( dimensions, &m_descriptor ) );
+        for ( dimension = 0; dimension < dimensions; dimension++ )
+            m_descriptor->rgsabound[dimension] = bounds[dimensions - dimension - 1];
+        VariantStreaming::GetTypeSize( vt, m_descriptor->cbElements );
+
+        m_vt = vt;
+        m_remaining = VariantStreaming::GetElementCount( m_descriptor );
+
+        m_stream.Write( VariantStreaming::variantVersion );
+        m_stream.Write( (VARTYPE)( vt | VT_ARRAY ) );
+        VariantStreaming::WriteSafeArrayHeader( m_descriptor, m_stream );
+    }
+
+
+    //------------------------------------------------------------------------------
+    // Write
+    // Writes the next element.  For an array of variants the element is
+    // written as is, and may itself be an array.  Otherwise it is changed to
+    // the array's type first.
+    //------------------------------------------------------------------------------
+
+    void Write( const VARIANT& element )
+    {
+        NextElements( 1 );
+
+        if ( VT_VARIANT == m_vt )
+        {
+            VariantStreaming::WriteToStream( &element, m_stream, m_maxDepth - 1 );
+        }
+        else
+        {
+            CComVariant     value;
+
+            CheckResult( ::VariantChangeType( &value, (VARIANT*)&element, 0, m_vt ) );
+            VariantStreaming::WriteValueToStream( &value, m_stream );
+        }
+    }
+
+
+    //------------------------------------------------------------------------------
+    // WriteData
+    // Writes the next count elements straight from memory.  Only for arrays
+    // of fixed size types, such as numbers and dates, whose elements are laid
+    // out as in a SAFEARRAY of that type.
+    //------------------------------------------------------------------------------
+
+    void WriteData( const void* data, ULONGLONG count )
+    {
+        if ( !VariantStreaming::IsFixedSizeType( m_vt ) )
+            ThrowError( DISP_E_TYPEMISMATCH );
+
+        NextElements( count );
+
+        m_stream.Write( data, count * m_descriptor->cbElements );
+    }
+
+
+    //------------------------------------------------------------------------------
+    // GetRemaining
+    // Returns the number of elements still to be written.
+    //------------------------------------------------------------------------------
+
+    inline ULONGLONG GetRemaining()
+    {
+        return m_remaining;
+    }
+
+
+    //------------------------------------------------------------------------------
+    // End
+    // Finishes the array.  Fails if any of its elements were not written, in
+    // which case what was written cannot be read back.  Begin may then be
+    // called again to write another array.
+    //------------------------------------------------------------------------------
+
+    void End()
+    {
+        if ( !m_descriptor || m_remaining )
+            ThrowError( E_UNEXPECTED );
+
+        ::SafeArrayDestroyDescriptor( m_descriptor );
+        m_descriptor = NULL;
+    }
+
+private:
+    // Accounts for the next count elements, failing if there are not that
+    // many left.
+    inline void NextElements( ULONGLONG count )
+    {
+        if ( !m_descriptor )
+            ThrowError( E_UNEXPECTED );
+        if ( count > m_remaining )
+            ThrowError( DISP_E_BADINDEX );
+
+        m_remaining -= count;
+    }
+
+private:
+    CStream             m_stream;
+    SAFEARRAY*          m_descriptor;
+    VARTYPE             m_vt;
+    ULONGLONG           m_remaining;
+    ULONG               m_maxDepth;
+
+}; // class CVariantArrayWriter
+
+
+//==============================================================================
+// CVariantView
+// Read-only view of a variant streamed by WriteVariantToStream, over the
+// streamed bytes in memory, such as a blob or a mapped file.  Opening the view
+// reads only the variant's type and, for an array, its bounds.  Elements are
+// found and decoded as they are asked for, and an element that is itself an
+// array is opened as another view.  Strings are returned as pointers into
+// the memory, so no SAFEARRAY or BSTR is created unless Copy is called.
+// The memory must outlast the view and any views of its elements.
+// Elements of arrays of fixed size types are found directly.  Elements of
+// other arrays are found by skipping over the ones before them, starting from
+// the element last asked for, so walking them in order is cheap.  For random
+// access, BuildIndex records where every so many elements start.
+// Example:
+//      CVariantView    view;
+//      CVariantView    element;
+//
+//      view.Open( blob );
+//      view.GetElement( 10, element );
+//      element.GetString( chars, length );
+//==============================================================================
+
+class CVariantView
+{
+public:
+    CVariantView()
+        :   m_vt( VT_EMPTY ),
+            m_value( NULL ),
+            m_end( NULL ),
+            m_dimensions( 0 ),
+            m_bounds( NULL ),
+            m_elements( NULL ),
+            m_count( 0 ),
+            m_elementSize( 0 ),
+            m_isFixedSize( false ),
+            m_cursor( NULL ),
+            m_cursorPosition( 0 ),
+            m_index( NULL ),
+            m_indexInterval( 0 ),
+            m_directory( NULL ),
+            m_entryCount( 0 ),
+            m_slotCount( 0 ),
+            m_maxDepth( VariantStreaming::defaultMaxDepth )
+    {
+    }
+
+    inline ~CVariantView()
+    {
+        ::CoTaskMemFree( m_index );
+    }
+
+
+    //------------------------------------------------------------------------------
+    // Open
+    // Opens the view on a streamed variant.  maxDepth limits how deeply arrays
+    // may be nested in arrays of variants.
+    //------------------------------------------------------------------------------
+
+    void Open(  const void*     data,
+                SIZE_T          size,
+                ULONG           maxDepth = VariantStreaming::defaultMaxDepth )
+    {
+        const BYTE*     value = (const BYTE*)data;
+        const BYTE*     end = value + size;
+        VARTYPE         vt;
+        long            version;
+
+        ValidatePointer( data );
+
+        VariantStreaming::CMemoryCursor     cursor( value, end );
+
+        VariantStreaming::ReadVersion( cursor );
+        cursor.Read( vt );
+        value = cursor.GetData();
+
+        m_maxDepth = maxDepth;
+        Parse( vt, value, end );
+
+        // A map's directory comes after its version.
+        ::CopyMemory( &version, data, sizeof( version ) );
+        if ( VariantStreaming::mapVersion == version )
+            OpenDirectory( (const BYTE*)data + sizeof( version ) );
+    }
+
+    inline void Open( const BLOB& blob, ULONG maxDepth = VariantStreaming::defaultMaxDepth )
+    {
+        Open( blob.pBlobData, blob.cbSize, maxDepth );
+    }
+
+
+    //------------------------------------------------------------------------------
+    // Type and shape.  GetType includes VT_ARRAY for an array.  Bounds are
+    // numbered as for SafeArrayCreate.
+    //------------------------------------------------------------------------------
+
+    inline VARTYPE GetType()
+    {
+        return m_vt;
+    }
+
+    inline bool IsArray()
+    {
+        return 0 != ( m_vt & VT_ARRAY );
+    }
+
+    inline USHORT GetDimensions()
+    {
+        return m_dimensions;
+    }
+
+    SAFEARRAYBOUND GetBound( USHORT dimension )
+    {
+        SAFEARRAYBOUND      bound;
+        const BYTE*         data;
+
+        if ( dimension >= m_dimensions )
+            ThrowError( DISP_E_BADINDEX );
+
+        // The stream holds the bounds in the order a SAFEARRAY does.
+        data = m_bounds + ( m_dimensions - dimension - 1 ) * ( sizeof( LONG ) + sizeof( ULONG ) );
+        ::CopyMemory( &bound.lLbound, data, sizeof( LONG ) );
+        ::CopyMemory( &bound.cElements, data + sizeof( LONG ), sizeof( ULONG ) );
+
+        return bound;
+    }
+
+    inline ULONGLONG GetElementCount()
+    {
+        return m_count;
+    }
+
+
+    //------------------------------------------------------------------------------
+    // GetElement
+    // Opens a view on an array's element, given its position in the order
+    // elements are streamed, with the last dimension varying fastest.
+    //------------------------------------------------------------------------------
+
+    void GetElement( ULONGLONG position, CVariantView& element )
+    {
+        VARTYPE         vt = (VARTYPE)( VT_TYPEMASK & m_vt );
+        const BYTE*     data;
+
+        if ( !IsArray() )
+            ThrowError( DISP_E_TYPEMISMATCH );
+        if ( position >= m_count )
+            ThrowError( DISP_E_BADINDEX );
+
+        if ( m_isFixedSize )
+        {
+            data = m_elements + (SIZE_T)( position * m_elementSize );
+        }
+        else
+        {
+            ULONGLONG   indexed = m_index ? position / m_indexInterval * m_indexInterval : 0;
+
+            // Skip forward from the element last asked for, or from the
+            // nearest indexed element, or the first, if that is closer.
+            if ( position < m_cursorPosition || indexed > m_cursorPosition )
+            {
+                m_cursor = m_elements + ( m_index ? (SIZE_T)m_index[position / m_indexInterval] : 0 );
+                m_cursorPosition = indexed;
+            }
+
+            for ( ; m_cursorPosition < position; m_cursorPosition++ )
+            {
+                VARTYPE     elementType = vt;
+
+                if ( VT_VARIANT == vt )
+                    VariantStreaming::ReadMemory( m_cursor, m_end, elementType );
+
+                m_cursor = VariantStreaming::SkipData( elementType, m_cursor, m_end, m_maxDepth - 1 );
+            }
+
+            data = m_cursor;
+        }
+
+        // Elements of an array of variants carry their own type.
+        if ( VT_VARIANT == vt )
+            VariantStreaming::ReadMemory( data, m_end, vt );
+
+        element.m_maxDepth = m_maxDepth - 1;
+        element.Parse( vt, data, m_end );
+    }
+
+
+    //------------------------------------------------------------------------------
+    // BuildIndex
+    // Records where every interval'th element of an array of strings, variants
+    // or objects starts, so that GetElement skips over fewer than interval
+    // elements to find any element.  Walks the whole array once.  Arrays of
+    // other types don't need an index.
+    //------------------------------------------------------------------------------
+
+    void BuildIndex( ULONG interval = 64 )
+    {
+        VARTYPE         vt = (VARTYPE)( VT_TYPEMASK & m_vt );
+        ULONGLONG       entries;
+        const BYTE*     data = m_elements;
+
+        if ( !IsArray() || !interval )
+            ThrowError( E_INVALIDARG );
+        if ( m_isFixedSize )
+            return;
+
+        entries = ( m_count + interval - 1 ) / interval;
+        if ( entries * sizeof( ULONGLONG ) > 0xFFFFFFFF )
+            ThrowError( E_OUTOFMEMORY );
+
+        ::CoTaskMemFree( m_index );
+        m_index = (ULONGLONG*)::CoTaskMemAlloc( (ULONG)( entries * sizeof( ULONGLONG ) ) );
+        m_indexInterval = interval;
+        VerifyAllocation( m_index );
+
+        for ( ULONGLONG position = 0; position < m_count; position++ )
+        {
+            VARTYPE     elementType = vt;
+
+            if ( 0 == position % interval )
+                m_index[position / interval] = data - m_elements;
+
+            if ( VT_VARIANT == vt )
+                VariantStreaming::ReadMemory( data, m_end, elementType );
+
+            data = VariantStreaming::SkipData( elementType, data, m_end, m_maxDepth - 1 );
+        }
+    }
+
+
+    //------------------------------------------------------------------------------
+    // GetIndexedElement
+    // Opens a view on an array's element, given its indexes as for
+    // SafeArrayGetElement.
+    //------------------------------------------------------------------------------
+
+    void GetIndexedElement( const long* indexes, CVariantView& element )
+    {
+        ULONGLONG       position = 0;
+
+        ValidatePointer( indexes );
+
+        for ( USHORT dimension = 0; dimension < m_dimensions; dimension++ )
+        {
+            SAFEARRAYBOUND  bound = GetBound( dimension );
+
+            if ( indexes[dimension] < bound.lLbound || (LONGLONG)indexes[dimension] - bound.lLbound >= bound.cElements )
+                ThrowError( DISP_E_BADINDEX );
+
+            position = position * bound.cElements + ( indexes[dimension] - bound.lLbound );
+        }
+
+        GetElement( position, element );
+    }
+
+
+    //------------------------------------------------------------------------------
+    // Find
+    // Opens a view on the value of a map, a 2 x N array of variants holding
+    // names and values, given its name.  Returns false if no name matches;
+    // of names that are the same, the first is found.  A map written by
+    // WriteVariantMapToStream goes to the value through its directory,
+    // without looking at the other entries.  Other maps, such as those
+    // nested in a map, are looked through name by name.
+    //------------------------------------------------------------------------------
+
+    bool Find( LPCWSTR name, CVariantView& value )
+    {
+        UINT            size;
+        ULONG           hash;
+        ULONGLONG       count;
+        CVariantView    element;
+
+        ValidatePointer( name );
+        size = ::lstrlenW( name ) * sizeof( WCHAR );
+
+        if ( m_directory )
+        {
+            const BYTE*     slots = m_directory + 2 * sizeof( ULONG );
+            const BYTE*     entries = slots + m_slotCount * sizeof( ULONG );
+            ULONG           slot;
+
+            hash = VariantStreaming::HashString( name, size );
+            slot = hash & ( m_slotCount - 1 );
+
+            for ( ULONG probe = 0; probe < m_slotCount; probe++, slot = ( slot + 1 ) & ( m_slotCount - 1 ) )
+            {
+                ULONG       entry;
+                ULONG       entryHash;
+                ULONGLONG   nameOffset;
+                ULONGLONG   valueOffset;
+
+                ::CopyMemory( &entry, slots + slot * sizeof( ULONG ), sizeof( entry ) );
+                if ( !entry )
+                    return false;
+                if ( entry > m_entryCount )
+                    ThrowError( E_FAIL );
+
+                VariantStreaming::CMemoryCursor     cursor( entries + ( entry - 1 ) * VariantStreaming::mapEntrySize, m_end );
+
+                cursor.Read( entryHash );
+                cursor.Read( nameOffset );
+                cursor.Read( valueOffset );
+
+                if ( entryHash != hash )
+                    continue;
+
+                OpenEntry( nameOffset, element );
+                if ( element.IsString( name, size ) )
+                {
+                    OpenEntry( valueOffset, value );
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        if ( ( VT_ARRAY | VT_VARIANT ) != m_vt || 2 != m_dimensions || 2 != GetBound( 0 ).cElements )
+            ThrowError( DISP_E_TYPEMISMATCH );
+
+        count = GetBound( 1 ).cElements;
+
+        for ( ULONGLONG entry = 0; entry < count; entry++ )
+        {
+            GetElement( entry, element );
+            if ( element.IsString( name, size ) )
+            {
+                GetElement( count + entry, value );
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+
+    //------------------------------------------------------------------------------
+    // GetValue
+    // Fills in a variant with a value that is not an array, a string or an
+    // object.  Nothing is allocated, so the variant need not be cleared.
+    //------------------------------------------------------------------------------
+
+    void GetValue( VARIANT& value )
+    {
+        const BYTE*     data = m_value;
+        ULONG           size;
+
+        if ( IsArray() || !VariantStreaming::GetStreamedSize( m_vt, size ) )
+            ThrowError( DISP_E_TYPEMISMATCH );
+
+        VariantStreaming::SkipMemory( data, m_end, size );
+
+        value.vt = m_vt;
+        ::CopyMemory( &value.byref, m_value, size );
+    }
+
+
+    //------------------------------------------------------------------------------
+    // GetString
+    // Returns a string's characters, which point into the viewed memory, may
+    // not be aligned and are not null terminated.
+    //------------------------------------------------------------------------------
+
+    void GetString( const WCHAR UNALIGNED*& chars, UINT& length )
+    {
+        const BYTE*     data = m_value;
+        UINT            size;
+
+        if ( VT_BSTR != m_vt )
+            ThrowError( DISP_E_TYPEMISMATCH );
+
+        VariantStreaming::ReadMemory( data, m_end, size );
+        chars = (const WCHAR UNALIGNED*)data;
+        VariantStreaming::SkipMemory( data, m_end, size );
+
+        length = size / sizeof( WCHAR );
+    }
+
+
+    //------------------------------------------------------------------------------
+    // Copy
+    // Decodes the viewed variant in full, as ReadVariantFromStream would,
+    // reading the memory in place.  The passed in variant should be
+    // initialized.
+    //------------------------------------------------------------------------------
+
+    void Copy( VARIANT& variant )
+    {
+        const BYTE*         end;
+        ULONG               size;
+
+        // Values and strings are copied straight from the memory.
+        if ( VT_BSTR == m_vt )
+        {
+            const WCHAR UNALIGNED*  chars;
+            UINT                    length;
+
+            GetString( chars, length );
+            variant.bstrVal = ::SysAllocStringLen( (const OLECHAR*)chars, length );
+            VerifyAllocation( variant.bstrVal );
+            variant.vt = VT_BSTR;
+            return;
+        }
+
+        if ( !IsArray() && VariantStreaming::GetStreamedSize( m_vt, size ) )
+        {
+            GetValue( variant );
+            return;
+        }
+
+        end = VariantStreaming::SkipData( m_vt, m_value, m_end, m_maxDepth );
+
+        CMemoryReadStream   stream( m_value, end - m_value );
+
+        VariantStreaming::ReadDataFromStream( m_vt, &stream, variant, m_maxDepth );
+    }
+
+    //------------------------------------------------------------------------------
+    // CopySlice
+    // Decodes a sub-rectangle of the viewed array into a new array.  The slice
+    // gives, in SafeArrayCreate's order, the index of the first element and
+    // the number of elements in each dimension.  The new array has the
+    // slice's bounds, so its elements keep their indexes.
+    // The passed in variant should be initialized.
+    //------------------------------------------------------------------------------
+
+    void CopySlice( const SAFEARRAYBOUND* slice, VARIANT& variant )
+    {
+        VARTYPE             vt = (VARTYPE)( VT_TYPEMASK & m_vt );
+        SAFEARRAYBOUND*     bounds;
+        ULONGLONG           count;
+        ULONG               size;
+
+        if ( !IsArray() )
+            ThrowError( DISP_E_TYPEMISMATCH );
+
+        VariantStreaming::CTaskMemory   boundsBuffer( m_dimensions * sizeof( SAFEARRAYBOUND ) );
+
+        bounds = (SAFEARRAYBOUND*)(BYTE*)boundsBuffer;
+        for ( USHORT dimension = 0; dimension < m_dimensions; dimension++ )
+            bounds[dimension] = GetBound( dimension );
+
+        VariantStreaming::CheckSlice( m_dimensions, bounds, slice );
+        VariantStreaming::CreateSlice( vt, m_dimensions, slice, variant );
+
+        count = VariantStreaming::GetElementCount( variant.parray );
+        size = variant.parray->cbElements;
+        if ( !count )
+            return;
+
+        VariantStreaming::CSafeArrayData    data( variant.parray );
+        CVariantView                        element;
+
+        for ( ULONGLONG position = 0; position < count; position++ )
+        {
+            BYTE*   target = VariantStreaming::GetWalkElement( variant.parray, data, position );
+
+            GetElement( VariantStreaming::GetSlicePosition( m_dimensions, bounds, slice, position ), element );
+
+            if ( VT_VARIANT == vt )
+            {
+                element.Copy( *(VARIANT*)target );
+            }
+            else
+            {
+                VARIANT     value;
+
+                // Decode the value and hand it over to the array.
+                value.vt = VT_EMPTY;
+                element.Copy( value );
+                ::CopyMemory( target, &value.byref, size );
+            }
+        }
+    }
+
+private:
+    // Views are not copied, since they may own an index.
+    CVariantView( const CVariantView& );
+    CVariantView& operator=( const CVariantView& );
+
+    // Checks a map's directory, which starts with its entry and slot counts,
+    // and keeps it for Find.  The map must be a 2 x N array of variants with
+    // an entry for each of its N names.
+    void OpenDirectory( const BYTE* directory )
+    {
+        VariantStreaming::CMemoryCursor     cursor( directory, m_end );
+        ULONG                               entryCount;
+        ULONG                               slotCount;
+
+        cursor.Read( entryCount );
+        cursor.Read( slotCount );
+        cursor.CheckRemaining( slotCount, sizeof( ULONG ) );
+        cursor.Skip( slotCount * sizeof( ULONG ) );
+        cursor.CheckRemaining( entryCount, VariantStreaming::mapEntrySize );
+
+        if ( !slotCount || ( slotCount & ( slotCount - 1 ) ) || entryCount >= slotCount )
+            ThrowError( E_FAIL );
+        if ( ( VT_ARRAY | VT_VARIANT ) != m_vt || 2 != m_dimensions || 2 != GetBound( 0 ).cElements || entryCount != GetBound( 1 ).cElements )
+            ThrowError( E_FAIL );
+
+        m_directory = directory;
+        m_entryCount = entryCount;
+        m_slotCount = slotCount;
+    }
+
+    // Opens a view on a map's name or value, given its offset from the map's
+    // type as the directory gives it.
+    void OpenEntry( ULONGLONG offset, CVariantView& element )
+    {
+        const BYTE*     data = m_value - sizeof( VARTYPE );
+        VARTYPE         vt;
+
+        if ( offset >= (ULONGLONG)( m_end - data ) )
+            ThrowError( E_FAIL );
+
+        data += (SIZE_T)offset;
+        VariantStreaming::ReadMemory( data, m_end, vt );
+
+        element.m_maxDepth = m_maxDepth - 1;
+        element.Parse( vt, data, m_end );
+    }
+
+    // Whether the view is of a string of the given characters.
+    bool IsString( LPCWSTR chars, UINT size )
+    {
+        const WCHAR UNALIGNED*  viewed;
+        UINT                    length;
+
+        if ( VT_BSTR != m_vt )
+            return false;
+
+        GetString( viewed, length );
+
+        return length * sizeof( WCHAR ) == size && 0 == memcmp( (const void*)viewed, chars, size );
+    }
+
+    // Points the view at the data of a value of the given type.  Only an
+    // array's header is read.
+    void Parse( VARTYPE vt, const BYTE* data, const BYTE* end )
+    {
+        ::CoTaskMemFree( m_index );
+        m_index = NULL;
+        m_directory = NULL;
+        m_entryCount = 0;
+        m_slotCount = 0;
+
+        m_vt = vt;
+        m_value = data;
+        m_end = end;
+        m_dimensions = 0;
+        m_bounds = NULL;
+        m_elements = NULL;
+        m_count = 0;
+        m_isFixedSize = false;
+
+        if ( vt & VT_ARRAY )
+        {
+            if ( !m_maxDepth )
+                ThrowError( HRESULT_FROM_WIN32( ERROR_STACK_OVERFLOW ) );
+
+            VariantStreaming::ReadArrayHeaderFromMemory( data, end, m_dimensions, m_bounds, m_count );
+            m_elements = data;
+
+            m_isFixedSize = VariantStreaming::GetStreamedSize( (VARTYPE)( VT_TYPEMASK & vt ), m_elementSize );
+            if ( m_isFixedSize && m_elementSize && m_count > (ULONGLONG)( end - data ) / m_elementSize )
+                ThrowError( E_FAIL );
+        }
+
+        m_cursor = m_elements;
+        m_cursorPosition = 0;
+    }
+
+private:
+    VARTYPE             m_vt;
+    const BYTE*         m_value;
+    const BYTE*         m_end;
+    USHORT              m_dimensions;
+    const BYTE*         m_bounds;
+    const BYTE*         m_elements;
+    ULONGLONG           m_count;
+    ULONG               m_elementSize;
+    bool                m_isFixedSize;
+    const BYTE*         m_cursor;
+    ULONGLONG           m_cursorPosition;
+    ULONGLONG*          m_index;
+    ULONG               m_indexInterval;
+    const BYTE*         m_directory;
+    ULONG               m_entryCount;
+    ULONG               m_slotCount;
+    ULONG               m_maxDepth;
+
+}; // class CVariantView
+
+
+//==============================================================================
+// CVariantPushReader
+// Reads a variant written by WriteVariantToStream from bytes pushed to it as
+// they arrive, in pieces of any size, such as from a non-blocking socket.
+// Push decodes what it is given straight into the variant and remembers
+// where it stopped, down to the byte, so nothing is buffered beyond the odd
+// partial value.  Once IsComplete, Detach hands the variant over and the
+// reader starts on the next one.  Push stops at the end of the variant, so
+// bytes left over belong to whatever follows it.
+// Objects can't be read this way, as how much of the stream an object takes
+// is only known to the object.  Malformed data raises an error, after which
+// the reader must be Reset before it is used again.
+// Example:
+//      CVariantPushReader  reader;
+//
+//      while ( received = recv( ... ) )
+//          {
+//          for ( used = 0; used < received; )
+//              {
+//              used += reader.Push( buffer + used, received - used );
+//              if ( reader.IsComplete() )
+//                  reader.Detach( variant );
+//              }
+//          }
+//==============================================================================
+
+class CVariantPushReader
+{
+public:
+    CVariantPushReader( ULONG maxDepth = VariantStreaming::defaultMaxDepth )
+        :   m_stack( maxDepth ),
+            m_state( stateVersion ),
+            m_got( 0 ),
+            m_size( 0 ),
+            m_vt( VT_EMPTY ),
+            m_target( NULL ),
+            m_element( NULL ),
+            m_destination( NULL ),
+            m_descriptor( NULL ),
+            m_dimension( 0 )
+    {
+        ::VariantInit( &m_variant );
+    }
+
+    inline ~CVariantPushReader()
+    {
+        Reset();
+    }
+
+    //------------------------------------------------------------------------------
+    // Push
+    // Decodes as much of the given bytes as belong to the variant, and returns
+    // how many that was.  Fewer than size are used only once the variant is
+    // complete.
+    //------------------------------------------------------------------------------
+
+    ULONG Push( const void* data, ULONG size )
+    {
+        const BYTE*     next = (const BYTE*)data;
+        const BYTE*     end = next + size;
+
+        if ( size )
+            ValidatePointer( data );
+
+        while ( next < end && stateComplete != m_state )
+            Step( next, end );
+
+        return (ULONG)( next - (const BYTE*)data );
+
+    } // Push
+
+    inline bool IsComplete()
+    {
+        return stateComplete == m_state;
+    }
+
+    //------------------------------------------------------------------------------
+    // Detach
+    // Hands the complete variant over, clearing what the given variant held,
+    // and gets ready for the next one.
+    //------------------------------------------------------------------------------
+
+    void Detach( VARIANT& variant )
+    {
+        if ( !IsComplete() )
+            ThrowError( E_UNEXPECTED );
+
+        CheckResult( ::VariantClear( &variant ) );
+        variant = m_variant;
+        ::VariantInit( &m_variant );
+        m_state = stateVersion;
+
+    } // Detach
+
+    //------------------------------------------------------------------------------
+    // Reset
+    // Drops whatever has been read so far and gets ready for a new variant.
+    //------------------------------------------------------------------------------
+
+    void Reset()
+    {
+        while ( !m_stack.IsEmpty() )
+            m_stack.Pop();
+
+        if ( m_descriptor )
+            ::SafeArrayDestroyDescriptor( m_descriptor );
+        m_descriptor = NULL;
+
+        ::VariantClear( &m_variant );
+        m_state = stateVersion;
+        m_got = 0;
+
+    } // Reset
+
+private:
+    // What the next bytes are.
+    enum State
+    {
+        stateVersion,
+        stateChunkTable,
+        stateDirectory,
+        stateSkip,
+        stateType,
+        stateElementType,
+        stateDimensions,
+        stateBound,
+        stateStringLength,
+        stateString,
+        stateValue,
+        stateElements,
+        stateComplete
+    };
+
+    //------------------------------------------------------------------------------
+    // Gather
+    // Copies bytes to the destination until size of them have been copied
+    // across however many calls it takes, and returns whether they have.
+    //------------------------------------------------------------------------------
+
+    bool Gather( const BYTE*& next, const BYTE* end, void* destination, ULONGLONG size )
+    {
+        ULONGLONG   piece = size - m_got;
+
+        if ( piece > (ULONGLONG)( end - next ) )
+            piece = end - next;
+
+        ::CopyMemory( (BYTE*)destination + m_got, next, (SIZE_T)piece );
+        next += (SIZE_T)piece;
+        m_got += piece;
+
+        if ( m_got < size )
+            return false;
+
+        m_got = 0;
+        return true;
+
+    } // Gather
+
+    //------------------------------------------------------------------------------
+    // Step
+    // Moves on through the given bytes as far as the current state goes.
+    //------------------------------------------------------------------------------
+
+    void Step( const BYTE*& next, const BYTE* end )
+    {
+        switch ( m_state )
+        {
+        case stateVersion:
+            if ( Gather( next, end, m_scratch, sizeof( long ) ) )
+            {
+                long    version;
+
+                ::CopyMemory( &version, m_scratch, sizeof( version ) );
+
+                if ( VariantStreaming::chunkedVersion == version )
+                    m_state = stateChunkTable;
+                else if ( VariantStreaming::mapVersion == version )
+                    m_state = stateDirectory;
+                else
+                    m_state = stateType;
+            }
+            break;
+
+        case stateChunkTable:
+            // Elements per chunk and the number of chunks, whose offsets are
+            // of no use when reading from start to end.
+            if ( Gather( next, end, m_scratch, 2 * sizeof( ULONG ) ) )
+            {
+                ULONG   chunkCount;
+
+                ::CopyMemory( &chunkCount, m_scratch + sizeof( ULONG ), sizeof( chunkCount ) );
+                m_size = (ULONGLONG)chunkCount * sizeof( ULONGLONG );
+                m_state = m_size ? stateSkip : stateType;
+            }
+            break;
+
+        case stateDirectory:
+            // A map's entry and slot counts, with a directory that is of no
+            // use when reading from start to end either.
+            if ( Gather( next, end, m_scratch, 2 * sizeof( ULONG ) ) )
+            {
+                ULONG   entryCount;
+                ULONG   slotCount;
+
+                ::CopyMemory( &entryCount, m_scratch, sizeof( entryCount ) );
+                ::CopyMemory( &slotCount, m_scratch + sizeof( ULONG ), sizeof( slotCount ) );
+                m_size = (ULONGLONG)slotCount * sizeof( ULONG ) + (ULONGLONG)entryCount * VariantStreaming::mapEntrySize;
+                m_state = m_size ? stateSkip : stateType;
+            }
+            break;
+
+        case stateSkip:
+            {
+                ULONGLONG   piece = (ULONGLONG)( end - next ) < m_size ? (ULONGLONG)( end - next ) : m_size;
+
+                next += (SIZE_T)piece;
+                m_size -= piece;
+                if ( !m_size )
+                    m_state = stateType;
+            }
+            break;
+
+        case stateType:
+            if ( Gather( next, end, m_scratch, sizeof( VARTYPE ) ) )
+                BeginValue( GetScratchType(), &m_variant, NULL );
+            break;
+
+        case stateElementType:
+            if ( Gather( next, end, m_scratch, sizeof( VARTYPE ) ) )
+                BeginValue( GetScratchType(), m_target, NULL );
+            break;
+
+        case stateDimensions:
+            if ( Gather( next, end, m_scratch, sizeof( USHORT ) ) )
+            {
+                USHORT  dimensions;
+
+                ::CopyMemory( &dimensions, m_scratch, sizeof( dimensions ) );
+                CheckResult( ::SafeArrayAllocDescriptor( dimensions, &m_descriptor ) );
+                m_dimension = 0;
+                m_state = stateBound;
+            }
+            break;
+
+        case stateBound:
+            // The lower bound and the number of elements.
+            if ( Gather( next, end, m_scratch, sizeof( LONG ) + sizeof( ULONG ) ) )
+            {
+                SAFEARRAYBOUND& bound = m_descriptor->rgsabound[m_dimension];
+
+                ::CopyMemory( &bound.lLbound, m_scratch, sizeof( LONG ) );
+                ::CopyMemory( &bound.cElements, m_scratch + sizeof( LONG ), sizeof( ULONG ) );
+
+                if ( ++m_dimension == m_descriptor->cDims )
+                    EndArrayHeader();
+            }
+            break;
+
+        case stateStringLength:
+            if ( Gather( next, end, m_scratch, sizeof( UINT ) ) )
+                BeginString();
+            break;
+
+        case stateString:
+            // An odd byte, if there is one, lands on the terminator, which is
+            // put back once the string is in.
+            if ( Gather( next, end, m_destination, m_size ) )
+            {
+                ( (WCHAR*)m_destination )[m_size / sizeof( WCHAR )] = L'\0';
+                NextValue();
+            }
+            break;
+
+        case stateValue:
+            if ( Gather( next, end, m_destination, m_size ) )
+            {
+                if ( m_target )
+                    m_target->vt = m_vt;
+                NextValue();
+            }
+            break;
+
+        case stateElements:
+            if ( Gather( next, end, m_destination, m_size ) )
+                NextValue();
+            break;
+        }
+
+    } // Step
+
+    inline VARTYPE GetScratchType()
+    {
+        VARTYPE     vt;
+
+        ::CopyMemory( &vt, m_scratch, sizeof( vt ) );
+        return vt;
+    }
+
+    //------------------------------------------------------------------------------
+    // BeginValue
+    // Starts on a value of the given type, going into either a variant or an
+    // element of an array that isn't an array of variants.  A variant's type
+    // is only set once what it holds can be cleared.
+    //------------------------------------------------------------------------------
+
+    void BeginValue( VARTYPE vt, VARIANT* target, BYTE* element )
+    {
+        ULONG   size;
+
+        m_vt = vt;
+        m_target = target;
+        m_element = element;
+
+        if ( vt & VT_ARRAY )
+        {
+            m_vt = (VARTYPE)( VT_TYPEMASK & vt );
+            if ( VT_UNKNOWN == m_vt || VT_DISPATCH == m_vt )
+                ThrowError( DISP_E_TYPEMISMATCH );
+
+            m_stack.CheckDepth();
+            m_state = stateDimensions;
+            return;
+        }
+
+        if ( VT_BSTR == vt )
+        {
+            m_state = stateStringLength;
+            return;
+        }
+
+        if ( !VariantStreaming::GetStreamedSize( vt, size ) )
+            ThrowError( DISP_E_TYPEMISMATCH );
+
+        if ( !size )
+        {
+            target->vt = vt;
+            NextValue();
+            return;
+        }
+
+        m_destination = target ? (BYTE*)&target->byref : element;
+        m_size = size;
+        m_state = stateValue;
+
+    } // BeginValue
+
+    //------------------------------------------------------------------------------
+    // BeginString
+    // Allocates the string, now that its length is known, and hands it to
+    // its variant or element so that it is freed with them.
+    //------------------------------------------------------------------------------
+
+    void BeginString()
+    {
+        UINT    bytes;
+        BSTR    string;
+
+        ::CopyMemory( &bytes, m_scratch, sizeof( bytes ) );
+
+        string = ::SysAllocStringLen( NULL, bytes / sizeof( WCHAR ) );
+        VerifyAllocation( string );
+        string[bytes / sizeof( WCHAR )] = L'\0';
+
+        if ( m_target )
+        {
+            m_target->bstrVal = string;
+            m_target->vt = VT_BSTR;
+        }
+        else
+        {
+            *(BSTR*)m_element = string;
+        }
+
+        m_destination = (BYTE*)string;
+        m_size = bytes;
+
+        if ( bytes )
+            m_state = stateString;
+        else
+            NextValue();
+
+    } // BeginString
+
+    //------------------------------------------------------------------------------
+    // EndArrayHeader
+    // Allocates the array, now that its bounds are known, and pushes it to
+    // have its elements read.
+    //------------------------------------------------------------------------------
+
+    void EndArrayHeader()
+    {
+        SAFEARRAY*  safeArray = m_descriptor;
+
+        VariantStreaming::AllocSafeArrayData( safeArray, m_vt );
+        m_descriptor = NULL;
+
+        m_target->parray = safeArray;
+        m_target->vt = (VARTYPE)( VT_ARRAY | m_vt );
+
+        if ( VariantStreaming::GetElementCount( safeArray ) )
+            m_stack.Push( safeArray, m_vt );
+
+        NextValue();
+
+    } // EndArrayHeader
+
+    //------------------------------------------------------------------------------
+    // NextValue
+    // Moves on to whatever follows the value just read: the next element of
+    // the innermost array still being read, or the end of the variant.
+    // Arrays of fixed size types are read as their raw bytes, in one piece
+    // when the elements are streamed in memory order.
+    //------------------------------------------------------------------------------
+
+    void NextValue()
+    {
+        while ( !m_stack.IsEmpty() )
+        {
+            VariantStreaming::CArrayStack::Frame&   frame = m_stack.Top();
+
+            if ( !frame.IsMore() )
+            {
+                m_stack.Pop();
+                continue;
+            }
+
+            if ( VariantStreaming::IsFixedSizeType( frame.vt ) )
+            {
+                m_size = frame.safeArray->cbElements;
+
+                if ( VariantStreaming::IsWalkContiguous( frame.safeArray ) )
+                {
+                    m_destination = frame.data;
+                    m_size *= frame.count;
+                    frame.next = frame.count;
+                }
+                else
+                {
+                    m_destination = frame.NextElement();
+                }
+
+                m_state = stateElements;
+            }
+            else if ( VT_VARIANT == frame.vt )
+            {
+                m_target = (VARIANT*)frame.NextElement();
+                m_state = stateElementType;
+            }
+            else
+            {
+                BeginValue( frame.vt, NULL, frame.NextElement() );
+            }
+
+            return;
+        }
+
+        m_state = stateComplete;
+
+    } // NextValue
+
+private:
+    VariantStreaming::CArrayStack   m_stack;
+    VARIANT                         m_variant;
+    State                           m_state;
+    BYTE                            m_scratch[16];
+    ULONGLONG                       m_got;
+    ULONGLONG                       m_size;
+    VARTYPE                         m_vt;
+    VARIANT*                        m_target;
+    BYTE*                           m_element;
+    BYTE*                           m_destination;
+    SAFEARRAY*                      m_descriptor;
+    USHORT                          m_dimension;
+
+}; // class CVariantPushReader
+
+
+//==============================================================================
+// CAsyncVariantWriter
+// Writes a variant to a CAsyncByteStream without blocking.  The variant is
+// streamed to memory up front, as that never waits, and its bytes are then
+// handed to the stream as it takes them, the writer waiting on the executor
+// whenever the stream is full.  The completion is called from the executor
+// once all of it has been taken, or the stream has failed.
+// One write at a time; the writer may start another from its completion.
+// Example:
+//      CAsyncVariantWriter writer;
+//
+//      writer.BeginWrite( variant, &pipe, &executor, &completion );
+//==============================================================================
+
+class CAsyncVariantWriter : public CAsyncOperation
+{
+public:
+    CAsyncVariantWriter()
+        :   m_stream( NULL ),
+            m_executor( NULL ),
+            m_completion( NULL ),
+            m_written( 0 )
+    {
+        m_blob.cbSize = 0;
+        m_blob.pBlobData = NULL;
+    }
+
+    inline ~CAsyncVariantWriter()
+    {
+        ::CoTaskMemFree( m_blob.pBlobData );
+    }
+
+    //------------------------------------------------------------------------------
+    // BeginWrite
+    // Starts writing the variant.  Everything from here on, including the
+    // first write, happens on the executor.
+    //------------------------------------------------------------------------------
+
+    void BeginWrite(    const VARIANT&      variant,
+                        CAsyncByteStream*   stream,
+                        CAsyncExecutor*     executor,
+                        CAsyncCompletion*   completion )
+    {
+        ValidatePointer( stream );
+        ValidatePointer( executor );
+        ValidatePointer( completion );
+
+        ::CoTaskMemFree( m_blob.pBlobData );
+        m_blob.pBlobData = NULL;
+        WriteVariantToBlob( variant, m_blob );
+
+        m_stream = stream;
+        m_executor = executor;
+        m_completion = completion;
+        m_written = 0;
+
+        executor->Post( this );
+
+    } // BeginWrite
+
+    virtual void Resume()
+    {
+        HRESULT     hr = S_OK;
+
+        while ( m_written < m_blob.cbSize )
+        {
+            ULONG   written;
+
+            hr = m_stream->WriteSome(   m_blob.pBlobData + m_written,
+                                        m_blob.cbSize - m_written,
+                                        written,
+                                        this,
+                                        m_executor );
+            if ( E_PENDING == hr )
+                return;
+            if ( FAILED( hr ) )
+                break;
+
+            m_written += written;
+        }
+
+        m_completion->OnComplete( hr );
+    }
+
+private:
+    CAsyncByteStream*   m_stream;
+    CAsyncExecutor*     m_executor;
+    CAsyncCompletion*   m_completion;
+    BLOB                m_blob;
+    ULONG               m_written;
+
+}; // class CAsyncVariantWriter
+
+
+//==============================================================================
+// CAsyncVariantReader
+// Reads a variant from a CAsyncByteStream without blocking.  Bytes are pushed
+// to a CVariantPushReader as they come, the reader waiting on the executor
+// whenever the stream has none ready.  The completion is called from the
+// executor once the variant is in, for Detach to hand over, or has failed.
+// Bytes read past the end of a variant are kept for the next BeginRead, so
+// one reader reads a run of variants from a stream.
+// One read at a time; the reader may start another from its completion.
+// Example:
+//      CAsyncVariantReader reader;
+//
+//      reader.BeginRead( &pipe, &executor, &completion );
+//      ...
+//      // In completion.OnComplete.
+//      reader.Detach( variant );
+//==============================================================================
+
+class CAsyncVariantReader : public CAsyncOperation
+{
+public:
+    CAsyncVariantReader( ULONG maxDepth = VariantStreaming::defaultMaxDepth )
+        :   m_reader( maxDepth ),
+            m_stream( NULL ),
+            m_executor( NULL ),
+            m_completion( NULL ),
+            m_next( 0 ),
+            m_end( 0 )
+    {
+    }
+
+    //------------------------------------------------------------------------------
+    // BeginRead
+    // Starts reading a variant.  Everything from here on, including the first
+    // read, happens on the executor.
+    //------------------------------------------------------------------------------
+
+    void BeginRead( CAsyncByteStream*   stream,
+                    CAsyncExecutor*     executor,
+                    CAsyncCompletion*   completion )
+    {
+        ValidatePointer( stream );
+        ValidatePointer( executor );
+        ValidatePointer( completion );
+
+        // The last variant must have been handed over.
+        if ( m_reader.IsComplete() )
+            ThrowError( E_UNEXPECTED );
+
+        m_stream = stream;
+        m_executor = executor;
+        m_completion = completion;
+
+        executor->Post( this );
+
+    } // BeginRead
+
+    // Hands over the variant once the read has completed.
+    inline void Detach( VARIANT& variant )
+    {
+        m_reader.Detach( variant );
+    }
+
+    virtual void Resume()
+    {
+        HRESULT     hr = TryRead();
+
+        if ( E_PENDING != hr )
+            m_completion->OnComplete( hr );
+    }
+
+private:
+    //------------------------------------------------------------------------------
+    // TryRead
+    // Reads what it can, reporting a failure raised by ThrowError, with its
+    // HRESULT, rather than raising it, and leaving the reader ready to start
+    // over.  Other exceptions, such as access violations, are left to the
+    // handlers further out.
+    //------------------------------------------------------------------------------
+
+    HRESULT TryRead()
+    {
+        HRESULT     hr = S_OK;
+
+        __try
+        {
+            return Read();
+        }
+        __except( FilterStreamError( GetExceptionInformation(), hr ) )
+        {
+            m_reader.Reset();
+            return hr;
+        }
+
+    } // TryRead
+
+    //------------------------------------------------------------------------------
+    // Read
+    // Pushes the bytes on hand to the reader and reads more until the variant
+    // is complete or the stream has none ready.  A stream that ends part way
+    // through a variant fails.
+    //------------------------------------------------------------------------------
+
+    HRESULT Read()
+    {
+        for ( ;; )
+        {
+            ULONG       read;
+            HRESULT     hr;
+
+            m_next += m_reader.Push( m_buffer + m_next, m_end - m_next );
+            if ( m_reader.IsComplete() )
+                return S_OK;
+
+            hr = m_stream->ReadSome( m_buffer, sizeof( m_buffer ), read, this, m_executor );
+            if ( FAILED( hr ) )
+                return hr;
+            if ( !read )
+                ThrowError( E_FAIL );
+
+            m_next = 0;
+            m_end = read;
+        }
+
+    } // Read
+
+private:
+    CVariantPushReader  m_reader;
+    CAsyncByteStream*   m_stream;
+    CAsyncExecutor*     m_executor;
+    CAsyncCompletion*   m_completion;
+    BYTE                m_buffer[VariantStreaming::asyncBufferSize];
+    ULONG               m_next;
+    ULONG               m_end;
+
+}; // class CAsyncVariantReader
+
+
+//==============================================================================
+// CVariantRecordWriter
+// Writes many variants, as records, to one stream such as a file.  Begin
+// writes the container's header, Write adds each record, optionally with a
+// key, and End writes an index of where each record starts, which lets
+// CVariantRecordReader go straight to any of them.  Until End is called the
+// container can't be read.  Each record is written as WriteVariantToStream
+// writes it.
+// With EnableStatistics, a CVariantZone is kept for each record, and for
+// each block of the elements of records that are one dimensional arrays of
+// numbers, so that readers can pass over what can't match.
+// Example:
+//      CVariantRecordWriter    writer( pStream );
+//
+//      writer.EnableStatistics();
+//      writer.Begin();
+//      while ( ... more records ... )
+//          writer.Write( variant, key );
+//      writer.End();
+//==============================================================================
+
+class CVariantRecordWriter
+{
+public:
+    CVariantRecordWriter(   IStream*    pStream,
+                            ULONG       maxDepth = VariantStreaming::defaultMaxDepth )
+        :   m_stream( pStream ),
+            m_start( 0 ),
+            m_offsets( NULL ),
+            m_keys( NULL ),
+            m_count( 0 ),
+            m_capacity( 0 ),
+            m_isKeyed( false ),
+            m_isOpen( false ),
+            m_maxDepth( maxDepth ),
+            m_blockElements( 0 ),
+            m_statistics( NULL ),
+            m_blocks( NULL ),
+            m_blockCount( 0 ),
+            m_blockCapacity( 0 )
+    {
+    }
+
+    inline ~CVariantRecordWriter()
+    {
+        Clear();
+    }
+
+
+    //------------------------------------------------------------------------------
+    // EnableStatistics
+    // Keeps statistics for the records from the next Begin on, with a zone
+    // for every blockElements elements of arrays of numbers.
+    //------------------------------------------------------------------------------
+
+    void EnableStatistics( ULONG blockElements = VariantStreaming::defaultBlockElements )
+    {
+        if ( m_isOpen || !blockElements )
+            ThrowError( E_INVALIDARG );
+
+        m_blockElements = blockElements;
+    }
+
+
+    //------------------------------------------------------------------------------
+    // Begin
+    // Writes the container's header at the stream's current position, which
+    // the container's offsets are measured from.
+    //------------------------------------------------------------------------------
+
+    void Begin()
+    {
+        if ( m_isOpen )
+            ThrowError( E_UNEXPECTED );
+
+        Clear();
+        m_start = GetPosition();
+
+        m_stream.Write( VariantStreaming::recordMagic );
+        m_stream.Write( VariantStreaming::recordVersion );
+        m_isOpen = true;
+    }
+
+
+    //------------------------------------------------------------------------------
+    // Write
+    // Adds a record.  key may be NULL, and needn't be unique, but if any
+    // record has a key they are all kept.  The record is only indexed once
+    // it is written in full, so a write that fails leaves the container as
+    // it was, less the stream space the partial record took.
+    //------------------------------------------------------------------------------
+
+    void Write( const VARIANT& variant, LPCWSTR key = NULL )
+    {
+        CComBSTR    keyCopy;
+        ULONGLONG   offset;
+
+        if ( !m_isOpen )
+            ThrowError( E_UNEXPECTED );
+
+        if ( m_count == m_capacity )
+            Grow();
+
+        if ( key )
+        {
+            keyCopy = key;
+            VerifyAllocation( keyCopy.m_str );
+        }
+
+        offset = GetPosition() - m_start;
+        WriteVariantToStream( &variant, m_stream, m_maxDepth );
+
+        if ( m_blockElements )
+            AddStatistics( variant );
+
+        m_offsets[m_count] = offset;
+        m_keys[m_count] = keyCopy.Detach();
+        if ( key )
+            m_isKeyed = true;
+        m_count++;
+    }
+
+
+    //------------------------------------------------------------------------------
+    // End
+    // Writes the index and the trailer that leads to it, finishing the
+    // container.  Begin may then be called to write another.
+    //------------------------------------------------------------------------------
+
+    void End()
+    {
+        ULONGLONG   indexOffset;
+
+        if ( !m_isOpen )
+            ThrowError( E_UNEXPECTED );
+
+        indexOffset = GetPosition() - m_start;
+
+        if ( m_count )
+            m_stream.Write( m_offsets, (ULONGLONG)m_count * sizeof( ULONGLONG ) );
+
+        if ( m_isKeyed )
+        {
+            for ( ULONG record = 0; record < m_count; record++ )
+                m_stream.Write( m_keys[record] );
+        }
+
+        if ( m_blockElements )
+        {
+            m_stream.Write( m_blockElements );
+
+            for ( ULONG record = 0; record < m_count; record++ )
+            {
+                VariantStreaming::WriteZone( m_stream, m_statistics[record].zone );
+                m_stream.Write( m_statistics[record].elementCount );
+                m_stream.Write( m_statistics[record].lowerBound );
+            }
+
+            for ( ULONG block = 0; block < m_blockCount; block++ )
+                VariantStreaming::WriteZone( m_stream, m_blocks[block] );
+        }
+
+        m_stream.Write( indexOffset );
+        m_stream.Write( m_count );
+        m_stream.Write( ( m_isKeyed ? VariantStreaming::recordsKeyed : 0UL ) |
+                        ( m_blockElements ? VariantStreaming::recordsHaveStatistics : 0UL ) );
+        m_stream.Write( VariantStreaming::recordMagic );
+
+        m_isOpen = false;
+        Clear();
+    }
+
+
+    //------------------------------------------------------------------------------
+    // GetCount
+    // Returns the number of records written since Begin.
+    //------------------------------------------------------------------------------
+
+    inline ULONG GetCount()
+    {
+        return m_count;
+    }
+
+private:
+    inline ULONGLONG GetPosition()
+    {
+        LARGE_INTEGER       zero = { 0 };
+        ULARGE_INTEGER      position;
+
+        CheckResult( ( (IStream*)m_stream )->Seek( zero, STREAM_SEEK_CUR, &position ) );
+
+        return position.QuadPart;
+    }
+
+    // Makes room for more records.
+    void Grow()
+    {
+        ULONG       capacity = m_capacity ? m_capacity * 2 : 64;
+        ULONGLONG*  offsets;
+        BSTR*       keys;
+
+        if ( capacity <= m_capacity )
+            ThrowError( E_OUTOFMEMORY );
+
+        offsets = (ULONGLONG*)::CoTaskMemRealloc( m_offsets, capacity * sizeof( ULONGLONG ) );
+        VerifyAllocation( offsets );
+        m_offsets = offsets;
+
+        keys = (BSTR*)::CoTaskMemRealloc( m_keys, capacity * sizeof( BSTR ) );
+        VerifyAllocation( keys );
+        m_keys = keys;
+
+        if ( m_blockElements )
+        {
+            VariantStreaming::RecordStatistics*     statistics;
+
+            statistics = (VariantStreaming::RecordStatistics*)::CoTaskMemRealloc(
+                                m_statistics,
+                                capacity * sizeof( VariantStreaming::RecordStatistics ) );
+            VerifyAllocation( statistics );
+            m_statistics = statistics;
+        }
+
+        m_capacity = capacity;
+    }
+
+    //------------------------------------------------------------------------------
+    // AddStatistics
+    // Works out the next record's zone, and its blocks' zones if it is a one
+    // dimensional array of numbers.  The blocks are only kept once they are
+    // all worked out.
+    //------------------------------------------------------------------------------
+
+    void AddStatistics( const VARIANT& variantParam )
+    {
+        VariantStreaming::RecordStatistics&     statistics = m_statistics[m_count];
+        VariantStreaming::CZoneBuilder          zone;
+        CComVariant                             variantCopy;
+        const VARIANT*                          variant = &variantParam;
+        SAFEARRAY*                              safeArray;
+        ULONG                                   blockCount = m_blockCount;
+
+        if ( V_ISBYREF( variant ) )
+        {
+            CheckResult( ::VariantCopyInd( &variantCopy, (VARIANT*)variant ) );
+            variant = &variantCopy;
+        }
+
+        VariantStreaming::AddVariantToZone( *variant, zone, m_maxDepth );
+        zone.GetZone( statistics.zone );
+
+        statistics.elementCount = 0;
+        statistics.lowerBound = 0;
+        statistics.firstBlock = m_blockCount;
+        statistics.blockCount = 0;
+
+        if ( !V_ISARRAY( variant ) || variant->parray->cDims != 1 ||
+             !VariantStreaming::IsNumberType( (VARTYPE)( VT_TYPEMASK & variant->vt ) ) )
+            return;
+
+        safeArray = variant->parray;
+        statistics.elementCount = safeArray->rgsabound[0].cElements;
+        statistics.lowerBound = safeArray->rgsabound[0].lLbound;
+
+        ULONG                               count = safeArray->rgsabound[0].cElements;
+        VariantStreaming::CSafeArrayData    data( safeArray );
+
+        for ( ULONG first = 0; first < count; first += m_blockElements )
+        {
+            ULONG   elements = count - first < m_blockElements ? count - first : m_blockElements;
+
+            if ( blockCount == m_blockCapacity )
+            {
+                ULONG           capacity = m_blockCapacity ? m_blockCapacity * 2 : 64;
+                CVariantZone*   blocks;
+
+                if ( capacity <= m_blockCapacity )
+                    ThrowError( E_OUTOFMEMORY );
+
+                blocks = (CVariantZone*)::CoTaskMemRealloc( m_blocks, capacity * sizeof( CVariantZone ) );
+                VerifyAllocation( blocks );
+                m_blocks = blocks;
+                m_blockCapacity = capacity;
+            }
+
+            zone.Reset();
+            zone.AddElements(   (VARTYPE)( VT_TYPEMASK & variant->vt ),
+                                (BYTE*)data + (ULONGLONG)first * safeArray->cbElements,
+                                elements,
+                                safeArray->cbElements );
+            zone.GetZone( m_blocks[blockCount++] );
+            statistics.blockCount++;
+        }
+
+        m_blockCount = blockCount;
+    }
+
+    // Forgets the records written so far.
+    void Clear()
+    {
+        for ( ULONG record = 0; record < m_count; record++ )
+            ::SysFreeString( m_keys[record] );
+
+        ::CoTaskMemFree( m_offsets );
+        ::CoTaskMemFree( m_keys );
+        ::CoTaskMemFree( m_statistics );
+        ::CoTaskMemFree( m_blocks );
+
+        m_offsets = NULL;
+        m_keys = NULL;
+        m_statistics = NULL;
+        m_blocks = NULL;
+        m_count = 0;
+        m_capacity = 0;
+        m_blockCount = 0;
+        m_blockCapacity = 0;
+        m_isKeyed = false;
+    }
+
+private:
+    CStream                                 m_stream;
+    ULONGLONG                               m_start;
+    ULONGLONG*                              m_offsets;
+    BSTR*                                   m_keys;
+    ULONG                                   m_count;
+    ULONG                                   m_capacity;
+    bool                                    m_isKeyed;
+    bool                                    m_isOpen;
+    ULONG                                   m_maxDepth;
+    ULONG                                   m_blockElements;
+    VariantStreaming::RecordStatistics*     m_statistics;
+    CVariantZone*                           m_blocks;
+    ULONG                                   m_blockCount;
+    ULONG                                   m_blockCapacity;
+
+}; // class CVariantRecordWriter
+
+
+//==============================================================================
+// CVariantRecordReader
+// Reads records from a container written by CVariantRecordWriter.  Open
+// reads the index, and the keys if there are any, from the end of the
+// stream, after which reading any record is a seek to where it starts and a
+// ReadVariantFromStream.  The container is taken to start at the stream's
+// position when Open is called and to end at the end of the stream.
+// If the container has statistics, FindInRange passes over records with no
+// numbers in a range, and ReadBlock reads just the blocks of an array whose
+// zones say they may have some.
+// Example:
+//      CVariantRecordReader    reader( pStream );
+//      ULONG                   record;
+//
+//      reader.Open();
+//      reader.Read( reader.GetCount() - 1, variant );
+//      if ( reader.Find( L"key", record ) )
+//          reader.Read( record, variant );
+//      for ( record = reader.FindInRange( 0, low, high ); record < reader.GetCount();
+//            record = reader.FindInRange( record + 1, low, high ) )
+//          reader.Read( record, variant );
+//==============================================================================
+
+class CVariantRecordReader
+{
+public:
+    CVariantRecordReader(   IStream*    pStream,
+                            ULONG       maxDepth = VariantStreaming::defaultMaxDepth )
+        :   m_stream( pStream ),
+            m_start( 0 ),
+            m_offsets( NULL ),
+            m_keys( NULL ),
+            m_count( 0 ),
+            m_maxDepth( maxDepth ),
+            m_blockElements( 0 ),
+            m_statistics( NULL ),
+            m_blocks( NULL )
+    {
+    }
+
+    inline ~CVariantRecordReader()
+    {
+        Clear();
+    }
+
+
+    //------------------------------------------------------------------------------
+    // Open
+    // Reads the container's index.  Fails if the stream doesn't hold a
+    // complete container.
+    //------------------------------------------------------------------------------
+
+    void Open()
+    {
+        ULONGLONG   size;
+        ULONGLONG   indexOffset;
+        ULONG       count;
+        ULONG       flags;
+        ULONG       magic;
+        long        version;
+        ULONGLONG   headerSize = sizeof( ULONG ) + sizeof( long );
+        ULONGLONG   trailerOffset;
+
+        Clear();
+
+        m_start = Seek( 0, STREAM_SEEK_CUR );
+        size = Seek( 0, STREAM_SEEK_END ) - m_start;
+        if ( size < headerSize + VariantStreaming::recordTrailerSize )
+            ThrowError( E_FAIL );
+
+        Seek( m_start, STREAM_SEEK_SET );
+        m_stream.Read( magic );
+        m_stream.Read( version );
+        if ( VariantStreaming::recordMagic != magic || VariantStreaming::recordVersion != version )
+            ThrowError( E_FAIL );
+
+        trailerOffset = size - VariantStreaming::recordTrailerSize;
+        Seek( m_start + trailerOffset, STREAM_SEEK_SET );
+        m_stream.Read( indexOffset );
+        m_stream.Read( count );
+        m_stream.Read( flags );
+        m_stream.Read( magic );
+
+        // The offsets must fit between the records and the trailer.
+        if ( VariantStreaming::recordMagic != magic ||
+             indexOffset < headerSize ||
+             indexOffset > trailerOffset ||
+             count > ( trailerOffset - indexOffset ) / sizeof( ULONGLONG ) ||
+             count > 0xFFFFFFFF / sizeof( ULONGLONG ) )
+            ThrowError( E_FAIL );
+
+        if ( count )
+        {
+            m_offsets = (ULONGLONG*)::CoTaskMemAlloc( count * sizeof( ULONGLONG ) );
+            VerifyAllocation( m_offsets );
+
+            Seek( m_start + indexOffset, STREAM_SEEK_SET );
+            m_stream.Read( m_offsets, (ULONGLONG)count * sizeof( ULONGLONG ) );
+        }
+
+        // Each record starts after the one before and before the index.
+        for ( ULONG record = 0; record < count; record++ )
+        {
+            if ( m_offsets[record] < ( record ? m_offsets[record - 1] + 1 : headerSize ) ||
+                 m_offsets[record] >= indexOffset )
+                ThrowError( E_FAIL );
+        }
+
+        m_count = count;
+
+        if ( flags & VariantStreaming::recordsKeyed )
+        {
+            m_keys = (BSTR*)::CoTaskMemAlloc( count * sizeof( BSTR ) );
+            VerifyAllocation( m_keys );
+            ::ZeroMemory( m_keys, count * sizeof( BSTR ) );
+
+            for ( ULONG key = 0; key < count; key++ )
+                m_stream.Read( &m_keys[key] );
+        }
+
+        if ( flags & VariantStreaming::recordsHaveStatistics )
+            ReadStatistics( m_start + trailerOffset );
+    }
+
+
+    //------------------------------------------------------------------------------
+    // GetCount
+    // Returns the number of records in the container.
+    //------------------------------------------------------------------------------
+
+    inline ULONG GetCount()
+    {
+        return m_count;
+    }
+
+
+    //------------------------------------------------------------------------------
+    // Read
+    // Reads the given record, counting from zero.  The passed in variant
+    // should be initialized.
+    //------------------------------------------------------------------------------
+
+    void Read( ULONG record, VARIANT& variant )
+    {
+        if ( record >= m_count )
+            ThrowError( DISP_E_BADINDEX );
+
+        Seek( m_start + m_offsets[record], STREAM_SEEK_SET );
+        ReadVariantFromStream( m_stream, variant, m_maxDepth );
+    }
+
+
+    //------------------------------------------------------------------------------
+    // Find
+    // Looks for the first record with the given key, returning false if there
+    // is none.  Keys are held in memory, so looking one up reads no records.
+    //------------------------------------------------------------------------------
+
+    bool Find( LPCWSTR key, ULONG& record )
+    {
+        UINT    length;
+
+        ValidatePointer( key );
+        if ( !m_keys )
+            return false;
+
+        length = lstrlenW( key );
+
+        for ( record = 0; record < m_count; record++ )
+        {
+            if ( ::SysStringLen( m_keys[record] ) == length &&
+                 0 == memcmp( m_keys[record], key, length * sizeof( WCHAR ) ) )
+                return true;
+        }
+
+        return false;
+    }
+
+
+    //------------------------------------------------------------------------------
+    // HasStatistics
+    // Whether the container was written with statistics.
+    //------------------------------------------------------------------------------
+
+    inline bool HasStatistics()
+    {
+        return NULL != m_statistics;
+    }
+
+
+    //------------------------------------------------------------------------------
+    // GetZone
+    // Returns the statistics for all the values in the given record.
+    //------------------------------------------------------------------------------
+
+    const CVariantZone& GetZone( ULONG record )
+    {
+        return GetStatistics( record ).zone;
+    }
+
+
+    //------------------------------------------------------------------------------
+    // FindInRange
+    // Returns the first record from first on that may hold a number between
+    // low and high, or GetCount if none may.  Only the statistics are looked
+    // at, so the record found may still turn out not to.
+    //------------------------------------------------------------------------------
+
+    ULONG FindInRange( ULONG first, double low, double high )
+    {
+        if ( !m_statistics )
+            ThrowError( E_UNEXPECTED );
+
+        for ( ULONG record = first; record < m_count; record++ )
+        {
+            if ( m_statistics[record].zone.MayHold( low, high ) )
+                return record;
+        }
+
+        return m_count;
+    }
+
+
+    //------------------------------------------------------------------------------
+    // GetBlockCount, GetBlockZone
+    // The blocks of a record that is a one dimensional array of numbers, each
+    // of GetBlockElements elements but the last, and their statistics.  Other
+    // records have none.
+    //------------------------------------------------------------------------------
+
+    inline ULONG GetBlockElements()
+    {
+        return m_blockElements;
+    }
+
+    ULONG GetBlockCount( ULONG record )
+    {
+        return GetStatistics( record ).blockCount;
+    }
+
+    const CVariantZone& GetBlockZone( ULONG record, ULONG block )
+    {
+        const VariantStreaming::RecordStatistics&   statistics = GetStatistics( record );
+
+        if ( block >= statistics.blockCount )
+            ThrowError( DISP_E_BADINDEX );
+
+        return m_blocks[statistics.firstBlock + block];
+    }
+
+
+    //------------------------------------------------------------------------------
+    // ReadBlock
+    // Reads one block of a record's array into a new array, whose bounds keep
+    // the elements' indexes.  Only the block's elements are read.  The passed
+    // in variant should be initialized.
+    //------------------------------------------------------------------------------
+
+    void ReadBlock( ULONG record, ULONG block, VARIANT& variant )
+    {
+        const VariantStreaming::RecordStatistics&   statistics = GetStatistics( record );
+        SAFEARRAYBOUND                              slice;
+        ULONG                                       first = block * m_blockElements;
+
+        if ( block >= statistics.blockCount )
+            ThrowError( DISP_E_BADINDEX );
+
+        // The last block may be short.
+        slice.lLbound = statistics.lowerBound + first;
+        slice.cElements = statistics.elementCount - first < m_blockElements ? statistics.elementCount - first : m_blockElements;
+
+        Seek( m_start + m_offsets[record], STREAM_SEEK_SET );
+        ReadVariantSliceFromStream( m_stream, &slice, variant, m_maxDepth );
+    }
+
+private:
+    const VariantStreaming::RecordStatistics& GetStatistics( ULONG record )
+    {
+        if ( !m_statistics )
+            ThrowError( E_UNEXPECTED );
+        if ( record >= m_count )
+            ThrowError( DISP_E_BADINDEX );
+
+        return m_statistics[record];
+    }
+
+    //------------------------------------------------------------------------------
+    // ReadStatistics
+    // Reads the statistics that follow the keys, which must end by the given
+    // position.
+    //------------------------------------------------------------------------------
+
+    void ReadStatistics( ULONGLONG end )
+    {
+        ULONGLONG   zoneSize = 2 * sizeof( double ) + 3 * sizeof( ULONG );
+        ULONGLONG   blockCount = 0;
+
+        m_stream.Read( m_blockElements );
+        if ( !m_blockElements || m_count > 0xFFFFFFFF / sizeof( VariantStreaming::RecordStatistics ) )
+            ThrowError( E_FAIL );
+
+        m_statistics = (VariantStreaming::RecordStatistics*)::CoTaskMemAlloc(
+                            m_count * sizeof( VariantStreaming::RecordStatistics ) );
+        VerifyAllocation( m_statistics );
+
+        for ( ULONG record = 0; record < m_count; record++ )
+        {
+            VariantStreaming::RecordStatistics&     statistics = m_statistics[record];
+
+            VariantStreaming::ReadZone( m_stream, statistics.zone );
+            m_stream.Read( statistics.elementCount );
+            m_stream.Read( statistics.lowerBound );
+
+            statistics.blockCount = (ULONG)( ( (ULONGLONG)statistics.elementCount + m_blockElements - 1 ) / m_blockElements );
+
+            statistics.firstBlock = (ULONG)blockCount;
+            blockCount += statistics.blockCount;
+            if ( blockCount > 0xFFFFFFFF / sizeof( CVariantZone ) )
+                ThrowError( E_FAIL );
+        }
+
+        if ( blockCount * zoneSize > end - Seek( 0, STREAM_SEEK_CUR ) )
+            ThrowError( E_FAIL );
+
+        m_blocks = (CVariantZone*)::CoTaskMemAlloc( (ULONG)blockCount * sizeof( CVariantZone ) );
+        VerifyAllocation( m_blocks );
+
+        for ( ULONG block = 0; block < blockCount; block++ )
+            VariantStreaming::ReadZone( m_stream, m_blocks[block] );
+
+        if ( Seek( 0, STREAM_SEEK_CUR ) > end )
+            ThrowError( E_FAIL );
+    }
+
+    inline ULONGLONG Seek( ULONGLONG offset, DWORD origin )
+    {
+        LARGE_INTEGER       move;
+        ULARGE_INTEGER      position;
+
+        move.QuadPart = (LONGLONG)offset;
+        CheckResult( ( (IStream*)m_stream )->Seek( move, origin, &position ) );
+
+        return position.QuadPart;
+    }
+
+    void Clear()
+    {
+        if ( m_keys )
+        {
+            for ( ULONG key = 0; key < m_count; key++ )
+                ::SysFreeString( m_keys[key] );
+        }
+
+        ::CoTaskMemFree( m_offsets );
+        ::CoTaskMemFree( m_keys );
+        ::CoTaskMemFree( m_statistics );
+        ::CoTaskMemFree( m_blocks );
+
+        m_offsets = NULL;
+        m_keys = NULL;
+        m_statistics = NULL;
+        m_blocks = NULL;
+        m_count = 0;
+        m_blockElements = 0;
+    }
+
+private:
+    CStream                                 m_stream;
+    ULONGLONG                               m_start;
+    ULONGLONG*                              m_offsets;
+    BSTR*                                   m_keys;
+    ULONG                                   m_count;
+    ULONG                                   m_maxDepth;
+    ULONG                                   m_blockElements;
+    VariantStreaming::RecordStatistics*     m_statistics;
+    CVariantZone*                           m_blocks;
+
+}; // class CVariantRecordReader
+
+
+//==============================================================================
+// CVariantSchemaWriter
+// Writes many records, such as small arrays of variants, to one long-lived
+// stream, writing each record's shape only the first time it appears.  A
+// shape is the record's type, and for an array its bounds and, for an array
+// of variants, the type of each element; a record whose shape has been seen
+// before is written as the shape's number followed by the values alone.
+// Only CVariantSchemaReader can read the stream, from its start, as the
+// shapes are known only to a reader that has seen them go by.
+// Example:
+//      CVariantSchemaWriter    writer( pStream );
+//
+//      writer.Begin();
+//      while ( ... more records ... )
+//          writer.Write( variant );
+//==============================================================================
+
+class CVariantSchemaWriter
+{
+public:
+    CVariantSchemaWriter(   IStream*    pStream,
+                            ULONG       maxDepth = VariantStreaming::defaultMaxDepth )
+        :   m_stream( pStream ),
+            m_isOpen( false ),
+            m_maxDepth( maxDepth )
+    {
+    }
+
+
+    //------------------------------------------------------------------------------
+    // Begin
+    // Writes the session's header, forgetting any shapes written before.
+    //------------------------------------------------------------------------------
+
+    void Begin()
+    {
+        m_shapes.Clear();
+
+        m_stream.Write( VariantStreaming::schemaMagic );
+        m_stream.Write( VariantStreaming::schemaVersion );
+        m_isOpen = true;
+    }
+
+
+    //------------------------------------------------------------------------------
+    // Write
+    // Writes a record, with its shape if the shape is new.
+    //------------------------------------------------------------------------------
+
+    void Write( const VARIANT& record )
+    {
+        CComVariant     copy;
+        const VARIANT*  variant = &record;
+        ULONG           size;
+        ULONG           id;
+
+        if ( !m_isOpen )
+            ThrowError( E_UNEXPECTED );
+
+        // Use a dereferenced copy if the record is byref.
+        if ( V_ISBYREF( &record ) )
+        {
+            CheckResult( VariantCopyInd( &copy, (VARIANT*)&record ) );
+            variant = &copy;
+        }
+
+        // Start over once there are too many shapes to keep.
+        if (    VariantStreaming::schemaShapeLimit == m_shapes.GetCount() ||
+                VariantStreaming::schemaShapeBytes < m_shapes.GetSize() )
+        {
+            m_stream.Write( VariantStreaming::schemaReset );
+            m_shapes.Clear();
+        }
+
+        size = BuildShape( *variant );
+        id = m_shapes.Find( size );
+
+        if ( VariantStreaming::schemaReset == id )
+        {
+            id = m_shapes.Add( size );
+            m_stream.Write( id );
+            m_stream.Write( m_shapes.GetShape( id, size ), size );
+        }
+        else
+        {
+            m_stream.Write( id );
+        }
+
+        WritePayload( *variant );
+    }
+
+
+    //------------------------------------------------------------------------------
+    // GetShapeCount
+    // How many shapes the reader has been sent since the last reset.
+    //------------------------------------------------------------------------------
+
+    inline ULONG GetShapeCount()
+    {
+        return m_shapes.GetCount();
+    }
+
+private:
+    // Builds the variant's shape where the registry will keep it, and
+    // returns its size.
+    ULONG BuildShape( const VARIANT& variant )
+    {
+        SAFEARRAY*  safeArray;
+        ULONGLONG   count = 0;
+        ULONGLONG   size = sizeof( VARTYPE );
+        BYTE*       shape;
+
+        if ( !V_ISARRAY( &variant ) )
+        {
+            shape = m_shapes.Reserve( (ULONG)size );
+            VariantStreaming::WriteMemory( shape, variant.vt );
+            return (ULONG)size;
+        }
+
+        safeArray = variant.parray;
+        ValidatePointer( safeArray );
+
+        size += sizeof( USHORT ) + safeArray->cDims * ( sizeof( LONG ) + sizeof( ULONG ) );
+
+        if ( VT_VARIANT == ( VT_TYPEMASK & variant.vt ) )
+        {
+            count = VariantStreaming::GetElementCount( safeArray );
+            size += count * sizeof( VARTYPE );
+        }
+
+        if ( size > 0xFFFFFFFF )
+            ThrowError( E_OUTOFMEMORY );
+
+        shape = m_shapes.Reserve( (ULONG)size );
+
+        // As WriteSafeArrayHeader.
+        VariantStreaming::WriteMemory( shape, variant.vt );
+        VariantStreaming::WriteMemory( shape, safeArray->cDims );
+        for ( USHORT dimension = 0; dimension < safeArray->cDims; dimension++ )
+        {
+            VariantStreaming::WriteMemory( shape, safeArray->rgsabound[dimension].lLbound );
+            VariantStreaming::WriteMemory( shape, safeArray->rgsabound[dimension].cElements );
+        }
+
+        if ( count )
+        {
+            VariantStreaming::CSafeArrayData    data( safeArray );
+
+            for ( ULONGLONG element = 0; element < count; element++ )
+                VariantStreaming::WriteMemory( shape, ( (const VARIANT*)VariantStreaming::GetWalkElement( safeArray, data, element ) )->vt );
+        }
+
+        return (ULONG)size;
+    }
+
+    // Writes what WriteVariantToStream writes for the variant, less its
+    // shape.
+    void WritePayload( const VARIANT& variant )
+    {
+        VARTYPE     vt = (VARTYPE)( VT_TYPEMASK & variant.vt );
+        SAFEARRAY*  safeArray = variant.parray;
+        ULONGLONG   count;
+
+        if ( !V_ISARRAY( &variant ) )
+        {
+            VariantStreaming::WriteValueToStream( &variant, m_stream );
+            return;
+        }
+
+        if ( !m_maxDepth )
+            ThrowError( HRESULT_FROM_WIN32( ERROR_STACK_OVERFLOW ) );
+
+        if ( VariantStreaming::IsFixedSizeType( vt ) )
+        {
+            VariantStreaming::WriteSafeArrayData( safeArray, m_stream );
+            return;
+        }
+
+        count = VariantStreaming::GetElementCount( safeArray );
+        if ( !count )
+            return;
+
+        if ( VT_VARIANT != vt )
+        {
+            VariantStreaming::CArrayStack   stack( m_maxDepth );
+
+            stack.Push( safeArray, vt );
+            VariantStreaming::WriteStackedArrays( stack, m_stream );
+            return;
+        }
+
+        // The elements' types are in the shape.
+        VariantStreaming::CSafeArrayData    data( safeArray );
+
+        for ( ULONGLONG element = 0; element < count; element++ )
+        {
+            const VARIANT*  value = (const VARIANT*)VariantStreaming::GetWalkElement( safeArray, data, element );
+
+            if ( V_ISARRAY( value ) )
+            {
+                VariantStreaming::WriteSafeArray(   V_ISBYREF( value ) ? *value->pparray : value->parray,
+                                                    (VARTYPE)( VT_TYPEMASK & value->vt ),
+                                                    m_stream,
+                                                    m_maxDepth - 1 );
+            }
+            else
+            {
+                VariantStreaming::WriteValueToStream( value, m_stream );
+            }
+        }
+    }
+
+private:
+    CStream                             m_stream;
+    VariantStreaming::CShapeRegistry    m_shapes;
+    bool                                m_isOpen;
+    ULONG                               m_maxDepth;
+
+}; // class CVariantSchemaWriter
+
+
+//==============================================================================
+// CVariantSchemaReader
+// Reads the records written by CVariantSchemaWriter, in order, learning
+// their shapes as they go by.
+// Example:
+//      CVariantSchemaReader    reader( pStream );
+//      CComVariant             variant;
+//
+//      reader.Begin();
+//      while ( reader.Read( variant ) )
+//          {
+//          ...
+//          variant.Clear();
+//          }
+//==============================================================================
+
+class CVariantSchemaReader
+{
+public:
+    CVariantSchemaReader(   IStream*    pStream,
+                            ULONG       maxDepth = VariantStreaming::defaultMaxDepth )
+        :   m_stream( pStream ),
+            m_isOpen( false ),
+            m_maxDepth( maxDepth )
+    {
+    }
+
+
+    //------------------------------------------------------------------------------
+    // Begin
+    // Reads and checks the session's header.
+    //------------------------------------------------------------------------------
+
+    void Begin()
+    {
+        ULONG       magic;
+        long        version;
+
+        m_stream.Read( magic );
+        m_stream.Read( version );
+        if ( VariantStreaming::schemaMagic != magic || VariantStreaming::schemaVersion != version )
+            ThrowError( E_FAIL );
+
+        m_shapes.Clear();
+        m_isOpen = true;
+    }
+
+
+    //------------------------------------------------------------------------------
+    // Read
+    // Reads the next record into the variant, which should be empty.  Returns
+    // false, having read nothing, if the stream ends where a record would
+    // start.
+    //------------------------------------------------------------------------------
+
+    bool Read( VARIANT& record )
+    {
+        ULONG           id;
+        ULONG           read;
+        ULONG           size;
+        const BYTE*     shape;
+
+        if ( !m_isOpen )
+            ThrowError( E_UNEXPECTED );
+
+        CheckResult( ( (IStream*)m_stream )->Read( &id, sizeof( id ), &read ) );
+        if ( !read )
+            return false;
+        if ( sizeof( id ) != read )
+            ThrowError( E_FAIL );
+
+        if ( VariantStreaming::schemaReset == id )
+        {
+            m_shapes.Clear();
+            m_stream.Read( id );
+        }
+
+        if ( id == m_shapes.GetCount() )
+            ReadShape();
+        else if ( id > m_shapes.GetCount() )
+            ThrowError( E_FAIL );
+
+        shape = m_shapes.GetShape( id, size );
+        ReadPayload( shape, size, record );
+
+        return true;
+    }
+
+private:
+    // Reads a new shape into the registry.
+    void ReadShape()
+    {
+        VARTYPE     vt;
+        USHORT      dimensions;
+        ULONG       header = sizeof( VARTYPE );
+        ULONGLONG   count = 1;
+        BYTE*       shape;
+
+        m_stream.Read( vt );
+        if ( vt & VT_ARRAY )
+        {
+            m_stream.Read( dimensions );
+            header += sizeof( USHORT ) + dimensions * ( sizeof( LONG ) + sizeof( ULONG ) );
+        }
+
+        shape = m_shapes.Reserve( header );
+        VariantStreaming::WriteMemory( shape, vt );
+
+        if ( !( vt & VT_ARRAY ) )
+        {
+            m_shapes.Add( header );
+            return;
+        }
+
+        VariantStreaming::WriteMemory( shape, dimensions );
+        m_stream.Read( shape, header - sizeof( VARTYPE ) - sizeof( USHORT ) );
+
+        if ( VT_VARIANT != ( VT_TYPEMASK & vt ) )
+        {
+            m_shapes.Add( header );
+            return;
+        }
+
+        // An array of variants is followed by its elements' types.
+        for ( USHORT dimension = 0; dimension < dimensions; dimension++ )
+        {
+            ULONG   elements;
+
+            ::CopyMemory( &elements, shape + dimension * ( sizeof( LONG ) + sizeof( ULONG ) ) + sizeof( LONG ), sizeof( ULONG ) );
+
+            count *= elements;
+            if ( count > ( 0xFFFFFFFF - header ) / sizeof( VARTYPE ) )
+                ThrowError( E_FAIL );
+        }
+
+        shape = m_shapes.Reserve( header + (ULONG)count * sizeof( VARTYPE ) );
+        m_stream.Read( shape + header, count * sizeof( VARTYPE ) );
+        m_shapes.Add( header + (ULONG)count * sizeof( VARTYPE ) );
+    }
+
+    // Mirror of CVariantSchemaWriter::WritePayload.  Builds the record from
+    // its shape and reads its values.
+    void ReadPayload( const BYTE* shape, ULONG size, VARIANT& record )
+    {
+        VariantStreaming::CMemoryCursor     cursor( shape, shape + size );
+        VARTYPE                             vt;
+        USHORT                              dimensions;
+        ULONGLONG                           count;
+
+        cursor.Read( vt );
+        if ( !( vt & VT_ARRAY ) )
+        {
+            VariantStreaming::ReadValueFromStream( vt, m_stream, record );
+            return;
+        }
+
+        if ( !m_maxDepth )
+            ThrowError( HRESULT_FROM_WIN32( ERROR_STACK_OVERFLOW ) );
+
+        // As ReadSafeArrayHeader.
+        cursor.Read( dimensions );
+        CheckResult( SafeArrayAllocDescriptor( dimensions, &record.parray ) );
+
+        for ( USHORT dimension = 0; dimension < dimensions; dimension++ )
+        {
+            cursor.Read( record.parray->rgsabound[dimension].lLbound );
+            cursor.Read( record.parray->rgsabound[dimension].cElements );
+        }
+
+        VariantStreaming::AllocSafeArrayData( record.parray, (VARTYPE)( VT_TYPEMASK & vt ) );
+        record.vt = (VARTYPE)( VT_ARRAY | ( VT_TYPEMASK & vt ) );
+        vt = (VARTYPE)( VT_TYPEMASK & vt );
+
+        if ( VariantStreaming::IsFixedSizeType( vt ) )
+        {
+            VariantStreaming::ReadSafeArrayData( record.parray, m_stream );
+            return;
+        }
+
+        count = VariantStreaming::GetElementCount( record.parray );
+        if ( !count )
+            return;
+
+        if ( VT_VARIANT != vt )
+        {
+            VariantStreaming::CArrayStack   stack( m_maxDepth );
+
+            stack.Push( record.parray, vt );
+            VariantStreaming::ReadStackedArrays( stack, m_stream );
+            return;
+        }
+
+        VariantStreaming::CSafeArrayData    data( record.parray );
+
+        for ( ULONGLONG element = 0; element < count; element++ )
+        {
+            VARIANT&    value = *(VARIANT*)VariantStreaming::GetWalkElement( record.parray, data, element );
+            VARTYPE     elementType;
+
+            cursor.Read( elementType );
+
+            if ( elementType & VT_ARRAY )
+                VariantStreaming::ReadSafeArray( value, (VARTYPE)( VT_TYPEMASK & elementType ), m_stream, m_maxDepth - 1 );
+            else
+                VariantStreaming::ReadValueFromStream( elementType, m_stream, value );
+        }
+    }
+
+private:
+    CStream                             m_stream;
+    VariantStreaming::CShapeRegistry    m_shapes;
+    bool                                m_isOpen;
+    ULONG                               m_maxDepth;
+
+}; // class CVariantSchemaReader
+
+
+//==============================================================================
+// CVariantBatchWriter
+// Writes a batch of rows, each a one dimensional array of variants with the
+// same bounds, turned into columns: the first elements of every row, then
+// the second elements and so on.  Each column is written as an array, of
+// its values' type when they share a number, boolean or string type, so that
+// a column's values lie together and can be read, scanned or compressed
+// without the rest of the batch.  The stream must be seekable, as the
+// columns' offsets are written ahead of them once they are known.
+// CVariantBatchReader reads the batch back by row or by column.
+// Example:
+//      CVariantBatchWriter     writer( pStream );
+//
+//      writer.Write( rows, count );
+//==============================================================================
+
+class CVariantBatchWriter
+{
+public:
+    CVariantBatchWriter(    IStream*    pStream,
+                            ULONG       maxDepth = VariantStreaming::defaultMaxDepth )
+        :   m_stream( pStream ),
+            m_rows( sizeof( VARIANT* ) ),
+            m_arrays( sizeof( SAFEARRAY* ) ),
+            m_offsets( sizeof( ULONGLONG ) ),
+            m_buffer( sizeof( ULONGLONG ) ),
+            m_maxDepth( maxDepth )
+    {
+    }
+
+
+    //------------------------------------------------------------------------------
+    // Write
+    // Writes count rows as a batch at the stream's current position, leaving
+    // the stream at the end of it.  Another batch may follow.
+    //------------------------------------------------------------------------------
+
+    void Write( const VARIANT* rows, ULONG count )
+    {
+        const VARIANT**     elements;
+        ULONGLONG*          offsets;
+        ULONG               columns = 0;
+        LONG                lowerBound = 0;
+        ULONGLONG           start;
+        ULONGLONG           offsetsStart;
+
+        if ( count > 0xFFFFFFFF / sizeof( VARIANT* ) )
+            ThrowError( E_OUTOFMEMORY );
+        if ( count )
+            ValidatePointer( rows );
+
+        m_rows.Reserve( count * sizeof( VARIANT* ) );
+        m_arrays.Reserve( count * sizeof( SAFEARRAY* ) );
+        elements = (const VARIANT**)(BYTE*)m_rows;
+
+        // Every row must have the first row's bounds.  The rows stay locked
+        // until the batch is written.
+        VariantStreaming::CSafeArrayListData    rowData( (SAFEARRAY**)(BYTE*)m_arrays );
+
+        for ( ULONG row = 0; row < count; row++ )
+        {
+            SAFEARRAY*  safeArray = VariantStreaming::GetBatchRow( rows[row] );
+
+            if ( !row )
+            {
+                columns = safeArray->rgsabound[0].cElements;
+                lowerBound = safeArray->rgsabound[0].lLbound;
+            }
+            else if (   safeArray->rgsabound[0].cElements != columns ||
+                        safeArray->rgsabound[0].lLbound != lowerBound )
+            {
+                ThrowError( E_INVALIDARG );
+            }
+
+            elements[row] = (const VARIANT*)rowData.Add( safeArray );
+        }
+
+        if ( columns >= 0xFFFFFFFF / sizeof( ULONGLONG ) )
+            ThrowError( E_OUTOFMEMORY );
+
+        m_offsets.Reserve( ( columns + 1 ) * sizeof( ULONGLONG ) );
+        offsets = (ULONGLONG*)(BYTE*)m_offsets;
+        ::ZeroMemory( offsets, ( columns + 1 ) * sizeof( ULONGLONG ) );
+
+        start = Seek( 0, STREAM_SEEK_CUR );
+        m_stream.Write( VariantStreaming::batchMagic );
+        m_stream.Write( VariantStreaming::batchVersion );
+        m_stream.Write( count );
+        m_stream.Write( columns );
+        m_stream.Write( lowerBound );
+
+        // Leave room for the offsets and fill them in at the end.
+        offsetsStart = Seek( 0, STREAM_SEEK_CUR );
+        m_stream.Write( offsets, ( columns + 1 ) * sizeof( ULONGLONG ) );
+
+        for ( ULONG column = 0; column < columns; column++ )
+        {
+            offsets[column] = Seek( 0, STREAM_SEEK_CUR ) - start;
+            VariantStreaming::WriteColumn( elements, count, column, m_buffer, m_stream, m_maxDepth );
+        }
+
+        offsets[columns] = Seek( 0, STREAM_SEEK_CUR ) - start;
+
+        Seek( offsetsStart, STREAM_SEEK_SET );
+        m_stream.Write( offsets, ( columns + 1 ) * sizeof( ULONGLONG ) );
+        Seek( start + offsets[columns], STREAM_SEEK_SET );
+    }
+
+private:
+    inline ULONGLONG Seek( ULONGLONG offset, DWORD origin )
+    {
+        LARGE_INTEGER       move;
+        ULARGE_INTEGER      position;
+
+        move.QuadPart = (LONGLONG)offset;
+        CheckResult( ( (IStream*)m_stream )->Seek( move, origin, &position ) );
+
+        return position.QuadPart;
+    }
+
+private:
+    CStream                         m_stream;
+    VariantStreaming::CTaskMemory   m_rows;
+    VariantStreaming::CTaskMemory   m_arrays;
+    VariantStreaming::CTaskMemory   m_offsets;
+    VariantStreaming::CTaskMemory   m_buffer;
+    ULONG                           m_maxDepth;
+
+}; // class CVariantBatchWriter
+
+
+//==============================================================================
+// CVariantBatchReader
+// Reads a batch written by CVariantBatchWriter from a seekable stream: a
+// single column as an array, one row, or every row.  Only the columns asked
+// for are read.
+// Example:
+//      CVariantBatchReader     reader( pStream );
+//      CComVariant             column;
+//
+//      reader.Open();
+//      reader.ReadColumn( 2, column );
+//==============================================================================
+
+class CVariantBatchReader
+{
+public:
+    CVariantBatchReader(    IStream*    pStream,
+                            ULONG       maxDepth = VariantStreaming::defaultMaxDepth )
+        :   m_stream( pStream ),
+            m_start( 0 ),
+            m_offsets( NULL ),
+            m_rowCount( 0 ),
+            m_columnCount( 0 ),
+            m_lowerBound( 0 ),
+            m_maxDepth( maxDepth )
+    {
+    }
+
+    inline ~CVariantBatchReader()
+    {
+        ::CoTaskMemFree( m_offsets );
+    }
+
+
+    //------------------------------------------------------------------------------
+    // Open
+    // Reads the header of the batch at the stream's current position.
+    //------------------------------------------------------------------------------
+
+    void Open()
+    {
+        ULONG       magic;
+        long        version;
+        ULONGLONG   offsetsEnd;
+
+        ::CoTaskMemFree( m_offsets );
+        m_offsets = NULL;
+        m_rowCount = 0;
+        m_columnCount = 0;
+
+        m_start = Seek( 0, STREAM_SEEK_CUR );
+        m_stream.Read( magic );
+        m_stream.Read( version );
+        if ( VariantStreaming::batchMagic != magic || VariantStreaming::batchVersion != version )
+            ThrowError( E_FAIL );
+
+        m_stream.Read( m_rowCount );
+        m_stream.Read( m_columnCount );
+        m_stream.Read( m_lowerBound );
+        if ( m_columnCount >= 0xFFFFFFFF / sizeof( ULONGLONG ) )
+            ThrowError( E_FAIL );
+
+        m_offsets = (ULONGLONG*)::CoTaskMemAlloc( ( m_columnCount + 1 ) * sizeof( ULONGLONG ) );
+        VerifyAllocation( m_offsets );
+        m_stream.Read( m_offsets, ( m_columnCount + 1 ) * sizeof( ULONGLONG ) );
+
+        // Each column starts after the offsets and after the one before.
+        offsetsEnd = VariantStreaming::batchHeaderSize + ( m_columnCount + 1 ) * sizeof( ULONGLONG );
+        for ( ULONG column = 0; column <= m_columnCount; column++ )
+        {
+            if ( m_offsets[column] < ( column ? m_offsets[column - 1] : offsetsEnd ) )
+                ThrowError( E_FAIL );
+        }
+    }
+
+
+    //------------------------------------------------------------------------------
+    // GetRowCount, GetColumnCount
+    // The batch's size.
+    //------------------------------------------------------------------------------
+
+    inline ULONG GetRowCount()
+    {
+        return m_rowCount;
+    }
+
+    inline ULONG GetColumnCount()
+    {
+        return m_columnCount;
+    }
+
+
+    //------------------------------------------------------------------------------
+    // ReadColumn
+    // Reads a column into the variant, which should be empty, as a one
+    // dimensional array from 0 with an element for each row.
+    //------------------------------------------------------------------------------
+
+    void ReadColumn( ULONG column, VARIANT& variant )
+    {
+        if ( column >= m_columnCount )
+            ThrowError( DISP_E_BADINDEX );
+
+        Seek( m_start + m_offsets[column], STREAM_SEEK_SET );
+        ReadVariantFromStream( m_stream, variant, m_maxDepth );
+    }
+
+
+    //------------------------------------------------------------------------------
+    // ReadRow
+    // Reads a row into the variant, which should be empty, as the array of
+    // variants it was written as.  Each column is sought to the row's
+    // element, directly for numbers and by skipping the elements before it
+    // otherwise.
+    //------------------------------------------------------------------------------
+
+    void ReadRow( ULONG row, VARIANT& variant )
+    {
+        VARIANT*    elements;
+
+        if ( row >= m_rowCount )
+            ThrowError( DISP_E_BADINDEX );
+
+        CreateRow( variant );
+        elements = (VARIANT*)variant.parray->pvData;
+
+        for ( ULONG column = 0; column < m_columnCount; column++ )
+        {
+            Seek( m_start + m_offsets[column], STREAM_SEEK_SET );
+            ReadVariantElementFromStream( m_stream, row, elements[column], m_maxDepth );
+        }
+    }
+
+
+    //------------------------------------------------------------------------------
+    // ReadRows
+    // Reads every row into rows, which should hold GetRowCount empty
+    // variants, a column at a time, and leaves the stream at the end of the
+    // batch.
+    //------------------------------------------------------------------------------
+
+    void ReadRows( VARIANT* rows )
+    {
+        if ( m_rowCount )
+            ValidatePointer( rows );
+
+        for ( ULONG row = 0; row < m_rowCount; row++ )
+            CreateRow( rows[row] );
+
+        for ( ULONG column = 0; column < m_columnCount; column++ )
+        {
+            CComVariant     values;
+            SAFEARRAY*      safeArray;
+            VARTYPE         vt;
+            ULONG           size;
+
+            ReadColumn( column, values );
+
+            safeArray = values.parray;
+            vt = (VARTYPE)( VT_TYPEMASK & values.vt );
+            if (    !V_ISARRAY( &values ) ||
+                    1 != safeArray->cDims ||
+                    safeArray->rgsabound[0].cElements != m_rowCount )
+                ThrowError( E_FAIL );
+
+            size = safeArray->cbElements;
+
+            // Hand each value over to its row, leaving nothing behind to free.
+            {
+                VariantStreaming::CSafeArrayData    data( safeArray );
+
+                for ( ULONG row = 0; row < m_rowCount; row++ )
+                {
+                    VARIANT&    element = ( (VARIANT*)rows[row].parray->pvData )[column];
+                    BYTE*       value = (BYTE*)data + row * size;
+
+                    if ( VT_VARIANT == vt )
+                    {
+                        ::CopyMemory( &element, value, sizeof( VARIANT ) );
+                        ( (VARIANT*)value )->vt = VT_EMPTY;
+                    }
+                    else
+                    {
+                        VariantStreaming::GetElementValue( value, vt, size, element );
+                        if ( VT_BSTR == vt )
+                            *(BSTR*)value = NULL;
+                    }
+                }
+            }
+        }
+
+        Seek( m_start + m_offsets[m_columnCount], STREAM_SEEK_SET );
+    }
+
+
+    //------------------------------------------------------------------------------
+    // End
+    // Leaves the stream at the end of the batch, where another may follow.
+    //------------------------------------------------------------------------------
+
+    void End()
+    {
+        if ( !m_offsets )
+            ThrowError( E_UNEXPECTED );
+
+        Seek( m_start + m_offsets[m_columnCount], STREAM_SEEK_SET );
+    }
+
+private:
+    // Makes the variant a row of empty elements.
+    void CreateRow( VARIANT& variant )
+    {
+        variant.parray = SafeArrayCreateVector( VT_VARIANT, m_lowerBound, m_columnCount );
+        VerifyAllocation( variant.parray );
+        variant.vt = VT_VARIANT | VT_ARRAY;
+    }
+
+    inline ULONGLONG Seek( ULONGLONG offset, DWORD origin )
+    {
+        LARGE_INTEGER       move;
+        ULARGE_INTEGER      position;
+
+        move.QuadPart = (LONGLONG)offset;
+        CheckResult( ( (IStream*)m_stream )->Seek( move, origin, &position ) );
+
+        return position.QuadPart;
+    }
+
+private:
+    CStream             m_stream;
+    ULONGLONG           m_start;
+    ULONGLONG*          m_offsets;
+    ULONG               m_rowCount;
+    ULONG               m_columnCount;
+    LONG                m_lowerBound;
+    ULONG               m_maxDepth;
+
+}; // class CVariantBatchReader
+
+
+//==============================================================================
+// CVariantEncoder
+// Encodes variants as WriteVariantToStream does, keeping its memory from one
+// call to the next: the buffer variants are encoded into and what arrays are
+// walked with.  Once it has encoded variants as large, encoding into its
+// buffer allocates nothing, and encoding to a blob only the blob, which
+// comes from the encoder's CVariantAllocator if it has been given one.  An
+// encoder is for one thread at a time.
+// Example:
+//      CVariantEncoder     encoder;
+//      const BYTE*         data;
+//      ULONG               size;
+//
+//      for ( ... )
+//      {
+//          data = encoder.Encode( variant, size );
+//          ... send size bytes of data ...
+//      }
+//==============================================================================
+
+class CVariantEncoder
+{
+public:
+    CVariantEncoder( ULONG maxDepth = VariantStreaming::defaultMaxDepth )
+        :   m_allocator( NULL ),
+            m_maxDepth( maxDepth )
+    {
+        ::ZeroMemory( &m_scratch, sizeof( m_scratch ) );
+    }
+
+    inline ~CVariantEncoder()
+    {
+        VariantStreaming::FreeScratch( m_scratch );
+    }
+
+
+    //------------------------------------------------------------------------------
+    // Encode
+    // Encodes the variant into the encoder's buffer and returns where it
+    // starts.  The data is good until the encoder is next used.
+    //------------------------------------------------------------------------------
+
+    const BYTE* Encode( const VARIANT& variant, ULONG& size )
+    {
+        return VariantStreaming::EncodeToScratch( variant, m_scratch, m_maxDepth, size );
+    }
+
+
+    //------------------------------------------------------------------------------
+    // SetAllocator
+    // Has blobs come from the allocator, which must outlive them, or from
+    // the task allocator again if it is NULL.
+    //------------------------------------------------------------------------------
+
+    void SetAllocator( CVariantAllocator* allocator )
+    {
+        m_allocator = allocator;
+    }
+
+
+    //------------------------------------------------------------------------------
+    // Encode
+    // Encodes the variant into a new blob of just the right size, to be
+    // freed with the encoder's allocator, or with CoTaskMemFree if it has
+    // none.
+    //------------------------------------------------------------------------------
+
+    void Encode( const VARIANT& variant, BLOB& blob )
+    {
+        const BYTE*     data;
+        ULONG           size;
+
+        data = Encode( variant, size );
+        VariantStreaming::CopyToBlob( data, size, blob, m_allocator );
+    }
+
+
+    //------------------------------------------------------------------------------
+    // Encode
+    // Writes the variant to the stream as WriteVariantToStream does.
+    //------------------------------------------------------------------------------
+
+    void Encode( const VARIANT& variant, IStream* pStream )
+    {
+        CStream( pStream ).Write( VariantStreaming::variantVersion );
+        VariantStreaming::WriteToStream( &variant, pStream, m_maxDepth, &m_scratch );
+    }
+
+
+    //------------------------------------------------------------------------------
+    // Trim
+    // Frees the encoder's buffer if it has grown beyond size bytes, such as
+    // after an unusually large variant.
+    //------------------------------------------------------------------------------
+
+    void Trim( ULONG size = 0 )
+    {
+        VariantStreaming::TrimScratch( m_scratch, size );
+    }
+
+private:
+    VariantStreaming::CodecScratch  m_scratch;
+    CVariantAllocator*              m_allocator;
+    ULONG                           m_maxDepth;
+
+}; // class CVariantEncoder
+
+
+//==============================================================================
+// CDecodedVariant
+// A variant CVariantDecoder decoded with its strings in an arena the
+// variant owns, rather than in a BSTR each.  The strings read as BSTRs do,
+// but belong to the arena, so the variant is only to be looked at; copy it
+// with CopyTo for one with BSTRs of its own.  Its arrays, likewise, may come
+// from the decoder's CVariantAllocator.  Clearing it keeps the arena's
+// memory for the next variant decoded into it.
+// Example:
+//      CVariantDecoder     decoder;
+//      CDecodedVariant     decoded;
+//
+//      for ( ... )
+//      {
+//          decoder.Decode( data, size, decoded );
+//          ... decoded.GetVariant() ...
+//      }
+//==============================================================================
+
+class CDecodedVariant
+{
+public:
+    CDecodedVariant()
+        :   m_allocator( NULL )
+    {
+        ::VariantInit( &m_variant );
+    }
+
+    inline ~CDecodedVariant()
+    {
+        Clear();
+    }
+
+    inline const VARIANT& GetVariant()
+    {
+        return m_variant;
+    }
+
+    // Copies the variant, strings and all, into one the caller owns.
+    void CopyTo( VARIANT& variant )
+    {
+        CheckResult( ::VariantCopy( &variant, &m_variant ) );
+    }
+
+    void Clear()
+    {
+        if ( m_allocator )
+        {
+            VariantStreaming::FreeDecoded( m_variant, *m_allocator );
+        }
+        else
+        {
+            VariantStreaming::ForgetArenaStrings( m_variant );
+            ::VariantClear( &m_variant );
+        }
+
+        m_allocator = NULL;
+        m_strings.Reset();
+    }
+
+private:
+    friend class CVariantDecoder;
+
+    VARIANT                         m_variant;
+    VariantStreaming::CStringArena  m_strings;
+    CVariantAllocator*              m_allocator;
+
+}; // class CDecodedVariant
+
+
+//==============================================================================
+// CVariantDecoder
+// Mirror of CVariantEncoder.  Decodes variants written by
+// WriteVariantToStream, keeping what arrays are walked with from one call to
+// the next, so that only the decoded variants are allocated.  Memory is read
+// in place.  Decoding into a CDecodedVariant puts the strings in its arena
+// rather than in a BSTR each.  A decoder is for one thread at a time.
+// Example:
+//      CVariantDecoder     decoder;
+//
+//      for ( ... )
+//      {
+//          CComVariant     variant;
+//
+//          decoder.Decode( data, size, variant );
+//      }
+//==============================================================================
+
+class CVariantDecoder
+{
+public:
+    CVariantDecoder( ULONG maxDepth = VariantStreaming::defaultMaxDepth )
+        :   m_allocator( NULL ),
+            m_maxDepth( maxDepth )
+    {
+        ::ZeroMemory( &m_scratch, sizeof( m_scratch ) );
+    }
+
+
+    //------------------------------------------------------------------------------
+    // SetAllocator
+    // Has the arrays of variants decoded into a CDecodedVariant come from the
+    // allocator, which must outlive them, or from SafeArrayAllocDescriptor
+    // again if it is NULL.  Plain variants always get arrays of their own.
+    //------------------------------------------------------------------------------
+
+    void SetAllocator( CVariantAllocator* allocator )
+    {
+        m_allocator = allocator;
+    }
+
+    inline ~CVariantDecoder()
+    {
+        VariantStreaming::FreeScratch( m_scratch );
+    }
+
+
+    //------------------------------------------------------------------------------
+    // Decode
+    // Decodes size bytes of memory into the variant, which should be
+    // initialized.
+    //------------------------------------------------------------------------------
+
+    void Decode( const void* data, ULONG size, VARIANT& variant )
+    {
+        VariantStreaming::DecodeWithScratch( data, size, variant, m_scratch, NULL, NULL, m_maxDepth );
+    }
+
+    void Decode( const BLOB& blob, VARIANT& variant )
+    {
+        Decode( blob.pBlobData, blob.cbSize, variant );
+    }
+
+
+    //------------------------------------------------------------------------------
+    // Decode
+    // Clears the decoded variant and decodes size bytes of memory into it,
+    // its strings into its arena and its arrays from the decoder's allocator,
+    // if it has one.
+    //------------------------------------------------------------------------------
+
+    void Decode( const void* data, ULONG size, CDecodedVariant& decoded )
+    {
+        decoded.Clear();
+        decoded.m_allocator = m_allocator;
+        VariantStreaming::DecodeWithScratch(    data,
+                                                size,
+                                                decoded.m_variant,
+                                                m_scratch,
+                                                &decoded.m_strings,
+                                                m_allocator,
+                                                m_maxDepth );
+    }
+
+    void Decode( const BLOB& blob, CDecodedVariant& decoded )
+    {
+        Decode( blob.pBlobData, blob.cbSize, decoded );
+    }
+
+
+    //------------------------------------------------------------------------------
+    // Decode
+    // Reads the variant from the stream as ReadVariantFromStream does.
+    //------------------------------------------------------------------------------
+
+    void Decode( IStream* pStream, VARIANT& variant )
+    {
+        CStream     stream( pStream );
+
+        m_scratch.arena = NULL;
+        m_scratch.allocator = NULL;
+        VariantStreaming::ReadVersion( stream );
+        VariantStreaming::ReadFromStream( pStream, variant, m_maxDepth, &m_scratch );
+    }
+
+private:
+    VariantStreaming::CodecScratch  m_scratch;
+    CVariantAllocator*              m_allocator;
+    ULONG                           m_maxDepth;
+
+}; // class CVariantDecoder
+
+
+//==============================================================================
+// CVariantSlabPool
+// CVariantAllocator that hands out memory from slabs in size classes of 16
+// bytes to 32 KB, each twice the last, keeping what is freed for the next
+// request of its class.  Blobs and arrays of similar sizes made and freed at
+// a high rate then come from the pool without going to the task allocator,
+// once the pool has grown to hold them.  Larger requests go to the task
+// allocator.  Memory is only given back when the pool is destroyed, which
+// must be after everything allocated from it is freed.  A pool is for one
+// thread at a time.
+// Example:
+//      CVariantSlabPool    pool;
+//      CVariantEncoder     encoder;
+//
+//      encoder.SetAllocator( &pool );
+//      encoder.Encode( variant, blob );
+//      ...
+//      pool.Free( blob.pBlobData );
+//==============================================================================
+
+class CVariantSlabPool : public CVariantAllocator
+{
+public:
+    enum { slabSize = 0x10000 };
+
+    CVariantSlabPool()
+        :   m_slabs( NULL ),
+            m_systemAllocations( 0 )
+    {
+        ::ZeroMemory( m_free, sizeof( m_free ) );
+    }
+
+    virtual ~CVariantSlabPool()
+    {
+        while ( m_slabs )
+        {
+            Block*  next = m_slabs->next;
+
+            ::CoTaskMemFree( m_slabs );
+            m_slabs = next;
+        }
+    }
+
+    virtual void* Allocate( SIZE_T size )
+    {
+        ULONG   sizeClass = 0;
+        Block*  block;
+
+        while ( sizeClass < classCount && GetClassSize( sizeClass ) < size )
+            sizeClass++;
+
+        // Too large for any class, so it is the task allocator's.
+        if ( classCount == sizeClass )
+        {
+            if ( size > (SIZE_T)-1 - sizeof( Block ) )
+                return NULL;
+
+            block = (Block*)::CoTaskMemAlloc( sizeof( Block ) + size );
+            if ( !block )
+                return NULL;
+
+            m_systemAllocations++;
+            block->sizeClass = classCount;
+            return block + 1;
+        }
+
+        if ( !m_free[sizeClass] && !AddSlab( sizeClass ) )
+            return NULL;
+
+        block = m_free[sizeClass];
+        m_free[sizeClass] = block->next;
+        block->sizeClass = sizeClass;
+
+        return block + 1;
+    }
+
+    virtual void Free( void* data )
+    {
+        Block*  block;
+        SIZE_T  sizeClass;
+
+        if ( !data )
+            return;
+
+        block = (Block*)data - 1;
+        sizeClass = block->sizeClass;
+
+        if ( classCount == sizeClass )
+        {
+            ::CoTaskMemFree( block );
+            return;
+        }
+
+        block->next = m_free[sizeClass];
+        m_free[sizeClass] = block;
+    }
+
+    // How many times the pool has gone to the task allocator, for slabs and
+    // for requests too large for it.
+    inline ULONG GetSystemAllocationCount()
+    {
+        return m_systemAllocations;
+    }
+
+private:
+    enum { classCount = 12, smallestClass = 16 };
+
+    // Ahead of each block, and of each slab.  Free blocks are linked through
+    // next, and slabs always.
+    union Block
+    {
+        Block*          next;
+        SIZE_T          sizeClass;
+        double          alignment[2];
+    };
+
+    static inline SIZE_T GetClassSize( ULONG sizeClass )
+    {
+        return (SIZE_T)smallestClass << sizeClass;
+    }
+
+    // Cuts a new slab into free blocks of the class.
+    bool AddSlab( ULONG sizeClass )
+    {
+        SIZE_T  blockSize = sizeof( Block ) + GetClassSize( sizeClass );
+        Block*  slab = (Block*)::CoTaskMemAlloc( slabSize );
+        BYTE*   next;
+        BYTE*   end;
+
+        if ( !slab )
+            return false;
+
+        m_systemAllocations++;
+        slab->next = m_slabs;
+        m_slabs = slab;
+
+        next = (BYTE*)( slab + 1 );
+        end = (BYTE*)slab + slabSize;
+        for ( ; next + blockSize <= end; next += blockSize )
+        {
+            Block*  block = (Block*)next;
+
+            block->next = m_free[sizeClass];
+            m_free[sizeClass] = block;
+        }
+
+        return true;
+    }
+
+private:
+    Block*              m_free[classCount];
+    Block*              m_slabs;
+    ULONG               m_systemAllocations;
+
+}; // class CVariantSlabPool
@@ -1,5 +1,5 @@
-#include <atlbase.h>
-#include "VariantStream.h"
-
-// Dummy file to test that "VariantStream.h" can be included by more than one source
+#include <atlbase.h>
+#include "VariantStream.h"
+
+// Dummy file to test that "VariantStream.h" can be included by more than one source
 // file in a project.
\ No newline at end of file
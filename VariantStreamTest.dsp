@@ -1,149 +1,249 @@
-# Microsoft Developer Studio Project File - Name="VariantStreamTest" - Package Owner=<4>
-# Microsoft Developer Studio Generated Build File, Format Version 6.00
-# ** DO NOT EDIT **
-
-# TARGTYPE "Win32 (x86) Application" 0x0101
-
-CFG=VariantStreamTest - Win32 Release
-!MESSAGE This is not a valid makefile. To build this project using NMAKE,
-!MESSAGE use the Export Makefile command and run
-!MESSAGE 
-!MESSAGE NMAKE /f "VariantStreamTest.mak".
-!MESSAGE 
-!MESSAGE You can specify a configuration when running NMAKE
-!MESSAGE by defining the macro CFG on the command line. For example:
-!MESSAGE 
-!MESSAGE NMAKE /f "VariantStreamTest.mak" CFG="VariantStreamTest - Win32 Release"
-!MESSAGE 
-!MESSAGE Possible choices for configuration are:
-!MESSAGE 
-!MESSAGE "VariantStreamTest - Win32 Release" (based on "Win32 (x86) Application")
-!MESSAGE "VariantStreamTest - Win32 Debug" (based on "Win32 (x86) Application")
-!MESSAGE 
-
-# Begin Project
-# PROP AllowPerConfigDependencies 0
-# PROP Scc_ProjName "VariantStreamTest"
-# PROP Scc_LocalPath "."
-CPP=cl.exe
-MTL=midl.exe
-RSC=rc.exe
-
-!IF  "$(CFG)" == "VariantStreamTest - Win32 Release"
-
-# PROP BASE Use_MFC 0
-# PROP BASE Use_Debug_Libraries 0
-# PROP BASE Output_Dir "Release"
-# PROP BASE Intermediate_Dir "Release"
-# PROP BASE Target_Dir ""
-# PROP Use_MFC 0
-# PROP Use_Debug_Libraries 0
-# PROP Output_Dir "Release"
-# PROP Intermediate_Dir "Release"
-# PROP Ignore_Export_Lib 0
-# PROP Target_Dir ""
-# ADD BASE CPP /nologo /W3 /GX /O2 /D "WIN32" /D "NDEBUG" /D "_WINDOWS" /D "_MBCS" /YX /FD /c
-# ADD CPP /nologo /MT /W4 /Zi /O1 /Ob2 /I "\FSDev\interfaces" /D "WIN32" /D "NDEBUG" /D "_WINDOWS" /D "_UNICODE" /D "UNICODE" /D "_ATL_STATIC_REGISTRY" /D "_ATL_MIN_CRT" /FR /YX"atlbase.h" /Fd"Release/VariantStreamTest.pdb" /FD /EHa /c
-# ADD BASE MTL /nologo /D "NDEBUG" /mktyplib203 /win32
-# ADD MTL /nologo /D "NDEBUG" /mktyplib203 /win32
-# ADD BASE RSC /l 0x409 /d "NDEBUG"
-# ADD RSC /l 0x409 /d "NDEBUG"
-BSC32=bscmake.exe
-# ADD BASE BSC32 /nologo
-# ADD BSC32 /nologo
-LINK32=link.exe
-# ADD BASE LINK32 kernel32.lib user32.lib gdi32.lib winspool.lib comdlg32.lib advapi32.lib shell32.lib ole32.lib oleaut32.lib uuid.lib odbc32.lib odbccp32.lib /nologo /subsystem:windows /machine:I386
-# ADD LINK32 kernel32.lib user32.lib gdi32.lib winspool.lib comdlg32.lib advapi32.lib shell32.lib ole32.lib oleaut32.lib uuid.lib odbc32.lib odbccp32.lib /nologo /subsystem:windows /debug /machine:I386 /FIXED:NO
-# SUBTRACT LINK32 /nodefaultlib
-
-!ELSEIF  "$(CFG)" == "VariantStreamTest - Win32 Debug"
-
-# PROP BASE Use_MFC 0
-# PROP BASE Use_Debug_Libraries 1
-# PROP BASE Output_Dir "Debug"
-# PROP BASE Intermediate_Dir "Debug"
-# PROP BASE Target_Dir ""
-# PROP Use_MFC 0
-# PROP Use_Debug_Libraries 1
-# PROP Output_Dir "Debug"
-# PROP Intermediate_Dir "Debug"
-# PROP Ignore_Export_Lib 0
-# PROP Target_Dir ""
-# ADD BASE CPP /nologo /W3 /Gm /GX /ZI /Od /D "WIN32" /D "_DEBUG" /D "_WINDOWS" /D "_MBCS" /YX /FD /GZ /c
-# ADD CPP /nologo /MDd /W4 /Gm /ZI /Od /I "\FSDev\interfaces" /D "WIN32" /D "_DEBUG" /D "_WINDOWS" /D "_UNICODE" /D "UNICODE" /YX"atlbase.h" /Fd"Debug/VariantStreamTest.pdb" /FD /GZ /EHa /c
-# ADD BASE MTL /nologo /D "_DEBUG" /mktyplib203 /win32
-# ADD MTL /nologo /D "_DEBUG" /mktyplib203 /win32
-# ADD BASE RSC /l 0x409 /d "_DEBUG"
-# ADD RSC /l 0x409 /d "_DEBUG"
-BSC32=bscmake.exe
-# ADD BASE BSC32 /nologo
-# ADD BSC32 /nologo
-LINK32=link.exe
-# ADD BASE LINK32 kernel32.lib user32.lib gdi32.lib winspool.lib comdlg32.lib advapi32.lib shell32.lib ole32.lib oleaut32.lib uuid.lib odbc32.lib odbccp32.lib /nologo /subsystem:windows /debug /machine:I386 /pdbtype:sept
-# ADD LINK32 kernel32.lib user32.lib gdi32.lib winspool.lib comdlg32.lib advapi32.lib shell32.lib ole32.lib oleaut32.lib uuid.lib odbc32.lib odbccp32.lib /nologo /subsystem:windows /debug /machine:I386 /pdbtype:sept /FIXED:NO
-# SUBTRACT LINK32 /nodefaultlib
-
-!ENDIF 
-
-# Begin Target
-
-# Name "VariantStreamTest - Win32 Release"
-# Name "VariantStreamTest - Win32 Debug"
-# Begin Group "Source Files"
-
-# PROP Default_Filter "cpp;c;cxx;rc;def;r;odl;idl;hpj;bat"
-# Begin Source File
-
-SOURCE=.\VariantStream.cpp
-# End Source File
-# Begin Source File
-
-SOURCE=.\VariantStream2.cpp
-# End Source File
-# End Group
-# Begin Group "Header Files"
-
-# PROP Default_Filter "h;hpp;hxx;hm;inl"
-# Begin Source File
-
-SOURCE=..\..\..\..\interfaces\ClassUtilities\ComVector.h
-# End Source File
-# Begin Source File
-
-SOURCE=.\NonValuetest.h
-# End Source File
-# Begin Source File
-
-SOURCE=.\NumericTest.h
-# End Source File
-# Begin Source File
-
-SOURCE=.\ObjectTest.h
-# End Source File
-# Begin Source File
-
-SOURCE=.\OneDimNumericArrayTest.h
-# End Source File
-# Begin Source File
-
-SOURCE=.\OneDimStringArrayTest.h
-# End Source File
-# Begin Source File
-
-SOURCE=.\OneDimVariantArrayTest.h
-# End Source File
-# Begin Source File
-
-SOURCE=.\StreamSupport.h
-# End Source File
-# Begin Source File
-
-SOURCE=..\..\..\..\interfaces\ClassUtilities\VariantStream.h
-# End Source File
-# End Group
-# Begin Group "Resource Files"
-
-# PROP Default_Filter "ico;cur;bmp;dlg;rc2;rct;bin;rgs;gif;jpg;jpeg;jpe"
-# End Group
-# End Target
-# End Project
+# Microsoft Developer Studio Project File - Name="VariantStreamTest" - Package Owner=<4>
+# Microsoft Developer Studio Generated Build File, Format Version 6.00
+# ** DO NOT EDIT **
+
+# TARGTYPE "Win32 (x86) Application" 0x0101
+
+CFG=VariantStreamTest - Win32 Release
+!MESSAGE This is not a valid makefile. To build this project using NMAKE,
+!MESSAGE use the Export Makefile command and run
+!MESSAGE 
+!MESSAGE NMAKE /f "VariantStreamTest.mak".
+!MESSAGE 
+!MESSAGE You can specify a configuration when running NMAKE
+!MESSAGE by defining the macro CFG on the command line. For example:
+!MESSAGE 
+!MESSAGE NMAKE /f "VariantStreamTest.mak" CFG="VariantStreamTest - Win32 Release"
+!MESSAGE 
+!MESSAGE Possible choices for configuration are:
+!MESSAGE 
+!MESSAGE "VariantStreamTest - Win32 Release" (based on "Win32 (x86) Application")
+!MESSAGE "VariantStreamTest - Win32 Debug" (based on "Win32 (x86) Application")
+!MESSAGE 
+
+# Begin Project
+# PROP AllowPerConfigDependencies 0
+# PROP Scc_ProjName "VariantStreamTest"
+# PROP Scc_LocalPath "."
+CPP=cl.exe
+MTL=midl.exe
+RSC=rc.exe
+
+!IF  "$(CFG)" == "VariantStreamTest - Win32 Release"
+
+# PROP BASE Use_MFC 0
+# PROP BASE Use_Debug_Libraries 0
+# PROP BASE Output_Dir "Release"
+# PROP BASE Intermediate_Dir "Release"
+# PROP BASE Target_Dir ""
+# PROP Use_MFC 0
+# PROP Use_Debug_Libraries 0
+# PROP Output_Dir "Release"
+# PROP Intermediate_Dir "Release"
+# PROP Ignore_Export_Lib 0
+# PROP Target_Dir ""
+# ADD BASE CPP /nologo /W3 /GX /O2 /D "WIN32" /D "NDEBUG" /D "_WINDOWS" /D "_MBCS" /YX /FD /c
+# ADD CPP /nologo /MT /W4 /Zi /O1 /Ob2 /I "\FSDev\interfaces" /D "WIN32" /D "NDEBUG" /D "_WINDOWS" /D "_UNICODE" /D "UNICODE" /D "_ATL_STATIC_REGISTRY" /D "_ATL_MIN_CRT" /FR /YX"atlbase.h" /Fd"Release/VariantStreamTest.pdb" /FD /EHa /c
+# ADD BASE MTL /nologo /D "NDEBUG" /mktyplib203 /win32
+# ADD MTL /nologo /D "NDEBUG" /mktyplib203 /win32
+# ADD BASE RSC /l 0x409 /d "NDEBUG"
+# ADD RSC /l 0x409 /d "NDEBUG"
+BSC32=bscmake.exe
+# ADD BASE BSC32 /nologo
+# ADD BSC32 /nologo
+LINK32=link.exe
+# ADD BASE LINK32 kernel32.lib user32.lib gdi32.lib winspool.lib comdlg32.lib advapi32.lib shell32.lib ole32.lib oleaut32.lib uuid.lib odbc32.lib odbccp32.lib /nologo /subsystem:windows /machine:I386
+# ADD LINK32 kernel32.lib user32.lib gdi32.lib winspool.lib comdlg32.lib advapi32.lib shell32.lib ole32.lib oleaut32.lib uuid.lib odbc32.lib odbccp32.lib shlwapi.lib /nologo /subsystem:windows /debug /machine:I386 /FIXED:NO
+# SUBTRACT LINK32 /nodefaultlib
+
+!ELSEIF  "$(CFG)" == "VariantStreamTest - Win32 Debug"
+
+# PROP BASE Use_MFC 0
+# PROP BASE Use_Debug_Libraries 1
+# PROP BASE Output_Dir "Debug"
+# PROP BASE Intermediate_Dir "Debug"
+# PROP BASE Target_Dir ""
+# PROP Use_MFC 0
+# PROP Use_Debug_Libraries 1
+# PROP Output_Dir "Debug"
+# PROP Intermediate_Dir "Debug"
+# PROP Ignore_Export_Lib 0
+# PROP Target_Dir ""
+# ADD BASE CPP /nologo /W3 /Gm /GX /ZI /Od /D "WIN32" /D "_DEBUG" /D "_WINDOWS" /D "_MBCS" /YX /FD /GZ /c
+# ADD CPP /nologo /MDd /W4 /Gm /ZI /Od /I "\FSDev\interfaces" /D "WIN32" /D "_DEBUG" /D "_WINDOWS" /D "_UNICODE" /D "UNICODE" /YX"atlbase.h" /Fd"Debug/VariantStreamTest.pdb" /FD /GZ /EHa /c
+# ADD BASE MTL /nologo /D "_DEBUG" /mktyplib203 /win32
+# ADD MTL /nologo /D "_DEBUG" /mktyplib203 /win32
+# ADD BASE RSC /l 0x409 /d "_DEBUG"
+# ADD RSC /l 0x409 /d "_DEBUG"
+BSC32=bscmake.exe
+# ADD BASE BSC32 /nologo
+# ADD BSC32 /nologo
+LINK32=link.exe
+# ADD BASE LINK32 kernel32.lib user32.lib gdi32.lib winspool.lib comdlg32.lib advapi32.lib shell32.lib ole32.lib oleaut32.lib uuid.lib odbc32.lib odbccp32.lib /nologo /subsystem:windows /debug /machine:I386 /pdbtype:sept
+# ADD LINK32 kernel32.lib user32.lib gdi32.lib winspool.lib comdlg32.lib advapi32.lib shell32.lib ole32.lib oleaut32.lib uuid.lib odbc32.lib odbccp32.lib shlwapi.lib /nologo /subsystem:windows /debug /machine:I386 /pdbtype:sept /FIXED:NO
+# SUBTRACT LINK32 /nodefaultlib
+
+!ENDIF 
+
+# Begin Target
+
+# Name "VariantStreamTest - Win32 Release"
+# Name "VariantStreamTest - Win32 Debug"
+# Begin Group "Source Files"
+
+# PROP Default_Filter "cpp;c;cxx;rc;def;r;odl;idl;hpj;bat"
+# Begin Source File
+
+SOURCE=.\VariantStream.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\VariantStream2.cpp
+# End Source File
+# End Group
+# Begin Group "Header Files"
+
+# PROP Default_Filter "h;hpp;hxx;hm;inl"
+# Begin Source File
+
+SOURCE=..\..\..\..\interfaces\ClassUtilities\ComVector.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\AggregateTest.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\AllocatorTest.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\ArrayWriterTest.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\AsyncVariantTest.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\AsyncWriteTest.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\BatchTest.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\Benchmark.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\CodecTest.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\LargeArrayTest.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\MapTest.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\NestedArrayTest.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\NonValuetest.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\NumericTest.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\ObjectTest.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\OneDimNumericArrayTest.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\OneDimStringArrayTest.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\OneDimVariantArrayTest.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\ParallelReadTest.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\ParallelWriteTest.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\PushReaderTest.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\ReadIntoTest.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\RecordFileTest.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\RingBufferTest.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\SchemaTest.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\SliceTest.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\TwoDimNumericArrayTest.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\VariantsBlobTest.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\ViewTest.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\VisitorTest.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\ZoneMapTest.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\StreamSupport.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\StringArenaTest.h
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\..\..\interfaces\ClassUtilities\VariantStream.h
+# End Source File
+# End Group
+# Begin Group "Resource Files"
+
+# PROP Default_Filter "ico;cur;bmp;dlg;rc2;rct;bin;rgs;gif;jpg;jpeg;jpe"
+# End Group
+# End Target
+# End Project
@@ -0,0 +1,190 @@
+#pragma once
+
+#include "StreamSupport.h"
+#include "Benchmark.h"
+#include "ParallelReadTest.h"
+
+class CVariantsBlobTest
+{
+public:
+
+    //------------------------------------------------------------------------------
+    // Makes the variant a small value: a long, a double or a short string.
+    //------------------------------------------------------------------------------
+
+    static HRESULT GetValue( ULONG index, VARIANT& variant )
+    {
+        switch ( index % 3 )
+        {
+        case 0:
+            variant.vt = VT_I4;
+            variant.lVal = index;
+            break;
+
+        case 1:
+            variant.vt = VT_R8;
+            variant.dblVal = index / 4.0;
+            break;
+
+        default:
+            variant.vt = VT_BSTR;
+            variant.bstrVal = ::SysAllocString( L"a short string" );
+            if ( !variant.bstrVal )
+                HR( E_OUTOFMEMORY );
+            break;
+        }
+
+        return S_OK;
+
+    } // GetValue
+
+
+    //------------------------------------------------------------------------------
+    // Reads count variants from the blob, reporting failure rather than
+    // raising it.
+    //------------------------------------------------------------------------------
+
+    static HRESULT TryRead( const BLOB& blob, VARIANT* variants, ULONG count )
+    {
+        HRESULT     hr = S_OK;
+
+        TryStreamCall( ReadVariantsFromBlob( blob, variants, count ), hr );
+
+        return hr;
+
+    } // TryRead
+
+
+    //------------------------------------------------------------------------------
+    // Test writing many variants to one blob and reading them back.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Test()
+    {
+        ULONG const         count = 50;
+        CComVariant         variants[count];
+        CComVariant         copies[count];
+        CComVariant         mixed;
+        CComVariant         rejected;
+        BLOB                blob;
+        BLOB                single;
+        HRESULT             hr = S_OK;
+
+        for( ULONG i = 0; i < count; ++i )
+            HR( GetValue( i, variants[i] ) );
+
+        // Arrays, empty variants and byref variants go in with the rest.
+        HR( CParallelReadTest::GetMixedArray( mixed ) );
+        variants[10] = mixed;
+        variants[11].Clear();
+        variants[12].Clear();
+        variants[12].vt = VT_VARIANT | VT_BYREF;
+        variants[12].pvarVal = &variants[0];
+
+        WriteVariantsToBlob( variants, count, blob );
+        if ( GetVariantCountFromBlob( blob ) != count )
+            hr = E_UNEXPECTED;
+
+        ReadVariantsFromBlob( blob, copies, count );
+        for( ULONG j = 0; j < count; ++j )
+        {
+            if ( FAILED( VerifySame( 12 == j ? variants[0] : variants[j], copies[j] ) ) )
+                hr = E_UNEXPECTED;
+        }
+
+        // Reading the wrong number of variants, or a blob of one variant,
+        // fails.
+        if ( E_INVALIDARG != TryRead( blob, copies, count - 1 ) )
+            hr = E_UNEXPECTED;
+
+        WriteVariantToBlob( variants[0], single );
+        if ( E_FAIL != TryRead( single, &rejected, 1 ) )
+            hr = E_UNEXPECTED;
+
+        ::CoTaskMemFree( blob.pBlobData );
+        ::CoTaskMemFree( single.pBlobData );
+        HR( hr );
+
+        // No variants at all is just the header.
+        WriteVariantsToBlob( NULL, 0, blob );
+        if ( blob.cbSize != 2 * sizeof( ULONG ) + sizeof( long ) || GetVariantCountFromBlob( blob ) )
+            hr = E_UNEXPECTED;
+        ReadVariantsFromBlob( blob, NULL, 0 );
+        ::CoTaskMemFree( blob.pBlobData );
+
+        return hr;
+
+    } // Test
+
+
+    //------------------------------------------------------------------------------
+    // Time writing and reading 100000 small variants a blob each, and in
+    // blobs of 1 to 100000 of them.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Benchmark()
+    {
+        ULONG const                     count = 100000;
+        CComVector<VARIANT>             a( count );
+        CComVectorData<VARIANT>         rg( a );
+        CComVector<VARIANT>             copies( count );
+        CComVectorData<VARIANT>         rgCopies( copies );
+        VariantStreaming::CTaskMemory   memory( count * sizeof( BLOB ) );
+        BLOB*                           blobs = (BLOB*)(BYTE*)memory;
+        CBenchmarkTimer                 timer;
+        ULONG                           time;
+        char                            label[128];
+        if ( !rg || !rgCopies )
+            HR( E_UNEXPECTED );
+
+        for( ULONG i = 0; i < count; ++i )
+            HR( GetValue( i, rg[i] ) );
+
+        timer.Start();
+        for( ULONG j = 0; j < count; ++j )
+            WriteVariantToBlob( rg[j], blobs[j] );
+        time = timer.ElapsedMicroseconds();
+        ReportBenchmark( "write 100000 variants a blob each", count, time );
+
+        timer.Start();
+        for( ULONG k = 0; k < count; ++k )
+            ReadVariantFromBlob( blobs[k], rgCopies[k] );
+        time = timer.ElapsedMicroseconds();
+        ReportBenchmark( "read 100000 variants a blob each", count, time );
+
+        for( ULONG m = 0; m < count; ++m )
+        {
+            ::CoTaskMemFree( blobs[m].pBlobData );
+            ::VariantClear( &rgCopies[m] );
+        }
+
+        for( ULONG size = 1; size <= count; size *= 10 )
+        {
+            ULONG   blobCount = count / size;
+
+            timer.Start();
+            for( ULONG n = 0; n < blobCount; ++n )
+                WriteVariantsToBlob( &rg[n * size], size, blobs[n] );
+            time = timer.ElapsedMicroseconds();
+            ::wsprintfA( label, "write 100000 variants in blobs of %lu", size );
+            ReportBenchmark( label, count, time );
+
+            timer.Start();
+            for( ULONG p = 0; p < blobCount; ++p )
+                ReadVariantsFromBlob( blobs[p], &rgCopies[p * size], size );
+            time = timer.ElapsedMicroseconds();
+            ::wsprintfA( label, "read 100000 variants in blobs of %lu", size );
+            ReportBenchmark( label, count, time );
+
+            for( ULONG q = 0; q < blobCount; ++q )
+                ::CoTaskMemFree( blobs[q].pBlobData );
+            for( ULONG r = 0; r < count; ++r )
+                ::VariantClear( &rgCopies[r] );
+        }
+
+        return S_OK;
+
+    } // Benchmark
+
+
+}; // class CVariantsBlobTest
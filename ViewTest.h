@@ -0,0 +1,211 @@
+#pragma once
+
+#include "StreamSupport.h"
+
+class CViewTest
+{
+public:
+
+    //------------------------------------------------------------------------------
+    // Verifies that the view's string is the given one.
+    //------------------------------------------------------------------------------
+
+    static HRESULT VerifyString( CVariantView& view, LPCWSTR expected )
+    {
+        const WCHAR UNALIGNED*  chars;
+        UINT                    length;
+
+        view.GetString( chars, length );
+
+        if ( length != (UINT)lstrlenW( expected ) || 0 != memcmp( (const void*)chars, expected, length * sizeof( WCHAR ) ) )
+            HR( E_UNEXPECTED );
+
+        return S_OK;
+
+    } // VerifyString
+
+
+    //------------------------------------------------------------------------------
+    // Views a 3 x 4 array of longs and checks its shape and every element,
+    // found by indexes, against the array.
+    //------------------------------------------------------------------------------
+
+    static HRESULT TestNumbers()
+    {
+        SAFEARRAYBOUND      bounds[2] = { { 3, 1 }, { 4, -2 } };
+        CComVariant         v1;
+        CVariantView        view;
+        BLOB                blob;
+        long*               data;
+        HRESULT             hr = S_OK;
+
+        v1.parray = SafeArrayCreate( VT_I4, 2, bounds );
+        if ( !v1.parray )
+            HR( E_OUTOFMEMORY );
+        v1.vt = VT_I4 | VT_ARRAY;
+
+        HR( SafeArrayAccessData( v1.parray, (void**)&data ) );
+        for( int i = 0; i < 12; ++i )
+            data[i] = i;
+        HR( SafeArrayUnaccessData( v1.parray ) );
+
+        WriteVariantToBlob( v1, blob );
+        view.Open( blob );
+
+        if ( view.GetType() != ( VT_I4 | VT_ARRAY ) || view.GetDimensions() != 2 || view.GetElementCount() != 12 )
+            hr = E_UNEXPECTED;
+
+        for( USHORT dimension = 0; dimension < 2; ++dimension )
+        {
+            SAFEARRAYBOUND  bound = view.GetBound( dimension );
+
+            if ( bound.lLbound != bounds[dimension].lLbound || bound.cElements != bounds[dimension].cElements )
+                hr = E_UNEXPECTED;
+        }
+
+        for( long row = 1; row < 4; ++row )
+        {
+            for( long column = -2; column < 2; ++column )
+            {
+                long            indexes[2] = { row, column };
+                long            expected;
+                CVariantView    element;
+                VARIANT         value;
+
+                view.GetIndexedElement( indexes, element );
+                element.GetValue( value );
+
+                if ( FAILED( SafeArrayGetElement( v1.parray, indexes, &expected ) ) )
+                    hr = E_UNEXPECTED;
+                if ( value.vt != VT_I4 || value.lVal != expected )
+                    hr = E_UNEXPECTED;
+            }
+        }
+
+        ::CoTaskMemFree( blob.pBlobData );
+
+        return hr;
+
+    } // TestNumbers
+
+
+    //------------------------------------------------------------------------------
+    // Views an array of variants holding a string, a number, an array of
+    // strings and an empty variant, out of order.
+    //------------------------------------------------------------------------------
+
+    static HRESULT TestVariants()
+    {
+        CComVariant             v1;
+        CComVariant             v2;
+        CVariantView            view;
+        CVariantView            element;
+        CVariantView            inner;
+        VARIANT                 value;
+        BLOB                    blob;
+        HRESULT                 hr = S_OK;
+        CComVector<VARIANT>     a( 4 );
+        CComVectorData<VARIANT> rg( a );
+        CComVector<BSTR>        strings( 2 );
+        CComVectorData<BSTR>    rgStrings( strings );
+        if ( !rg || !rgStrings )
+            HR( E_UNEXPECTED );
+
+        rgStrings[0] = ::SysAllocString( L"x" );
+        rgStrings[1] = ::SysAllocString( L"yz" );
+
+        rg[0].vt = VT_BSTR;
+        rg[0].bstrVal = ::SysAllocString( L"hello" );
+        rg[1].vt = VT_R8;
+        rg[1].dblVal = 2.5;
+        rg[2].vt = VT_BSTR | VT_ARRAY;
+        rg[2].parray = strings.Detach();
+
+        v1.vt = VT_VARIANT | VT_ARRAY;
+        v1.parray = a.Detach();
+
+        WriteVariantToBlob( v1, blob );
+        view.Open( blob );
+
+        // Later elements first, so the view has to go back to the start.
+        view.GetElement( 3, element );
+        if ( element.GetType() != VT_EMPTY )
+            hr = E_UNEXPECTED;
+
+        view.GetElement( 2, element );
+        if ( element.GetType() != ( VT_BSTR | VT_ARRAY ) || element.GetElementCount() != 2 )
+            hr = E_UNEXPECTED;
+
+        element.GetElement( 1, inner );
+        if ( FAILED( VerifyString( inner, L"yz" ) ) )
+            hr = E_UNEXPECTED;
+
+        view.GetElement( 0, element );
+        if ( FAILED( VerifyString( element, L"hello" ) ) )
+            hr = E_UNEXPECTED;
+
+        view.GetElement( 1, element );
+        element.GetValue( value );
+        if ( value.vt != VT_R8 || value.dblVal != 2.5 )
+            hr = E_UNEXPECTED;
+
+        // Decode the array of strings in full.
+        view.GetElement( 2, element );
+        element.Copy( v2 );
+        if ( v2.vt != ( VT_BSTR | VT_ARRAY ) || 0 != lstrcmpW( ( (BSTR*)v2.parray->pvData )[0], L"x" ) )
+            hr = E_UNEXPECTED;
+
+        ::CoTaskMemFree( blob.pBlobData );
+
+        return hr;
+
+    } // TestVariants
+
+
+    //------------------------------------------------------------------------------
+    // Opens a view on the first size bytes of the blob, reporting failure
+    // rather than raising it.
+    //------------------------------------------------------------------------------
+
+    static HRESULT TryOpen( CVariantView& view, const BLOB& blob, ULONG size )
+    {
+        HRESULT     hr = S_OK;
+
+        TryStreamCall( view.Open( blob.pBlobData, size ), hr );
+
+        return hr;
+
+    } // TryOpen
+
+
+    //------------------------------------------------------------------------------
+    // Test viewing streamed variants without decoding them.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Test()
+    {
+        CComVector<double>  numbers( 4 );
+        CComVariant         v1;
+        CVariantView        view;
+        BLOB                blob;
+        HRESULT             hr = S_OK;
+
+        HR( TestNumbers() );
+        HR( TestVariants() );
+
+        // A view on a truncated array should fail to open.
+        v1.vt = VT_R8 | VT_ARRAY;
+        v1.parray = numbers.Detach();
+        WriteVariantToBlob( v1, blob );
+
+        if ( FAILED( TryOpen( view, blob, blob.cbSize ) ) || E_FAIL != TryOpen( view, blob, blob.cbSize - 1 ) )
+            hr = E_UNEXPECTED;
+
+        ::CoTaskMemFree( blob.pBlobData );
+
+        return hr;
+
+    } // Test
+
+
+}; // class CViewTest
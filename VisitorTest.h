@@ -0,0 +1,282 @@
+#pragma once
+
+#include "StreamSupport.h"
+#include "Benchmark.h"
+
+
+//==============================================================================
+// CTraceVisitor
+// Records the calls made to it as text, numbers as whole numbers.
+//==============================================================================
+
+class CTraceVisitor : public CVariantVisitor
+{
+public:
+    CTraceVisitor()
+        :   m_used( 0 )
+    {
+        m_trace[0] = '\0';
+    }
+
+    virtual void BeginArray( VARTYPE vt, USHORT dimensions, const SAFEARRAYBOUND* bounds )
+    {
+        Append( "begin %u", vt );
+        for ( USHORT dimension = 0; dimension < dimensions; dimension++ )
+            Append( " %ld:%lu", bounds[dimension].lLbound, bounds[dimension].cElements );
+        Append( ";" );
+    }
+
+    virtual void Scalar( const VARIANT& value )
+    {
+        CComVariant     number;
+
+        if ( VT_EMPTY == value.vt )
+            Append( "empty;" );
+        else if ( SUCCEEDED( number.ChangeType( VT_I4, &value ) ) )
+            Append( "%ld;", number.lVal );
+        else
+            Append( "?;" );
+    }
+
+    virtual void String( const WCHAR* chars, UINT length )
+    {
+        Append( "'" );
+        for ( UINT i = 0; i < length; i++ )
+            Append( "%c", (char)chars[i] );
+        Append( "';" );
+    }
+
+    virtual void EndArray()
+    {
+        Append( "end;" );
+    }
+
+    inline LPCSTR GetTrace()
+    {
+        return m_trace;
+    }
+
+private:
+    void Append( LPCSTR format, ULONG value1 = 0, ULONG value2 = 0 )
+    {
+        char    line[64];
+        int     length = ::wsprintfA( line, format, value1, value2 );
+
+        if ( m_used + length < sizeof( m_trace ) )
+        {
+            ::CopyMemory( m_trace + m_used, line, length + 1 );
+            m_used += length;
+        }
+    }
+
+private:
+    char                m_trace[512];
+    int                 m_used;
+
+}; // class CTraceVisitor
+
+
+//==============================================================================
+// CSumVisitor
+// Adds up numbers and string lengths, for timing.
+//==============================================================================
+
+class CSumVisitor : public CVariantVisitor
+{
+public:
+    CSumVisitor()
+        :   m_sum( 0 )
+    {
+    }
+
+    virtual void BeginArray( VARTYPE, USHORT, const SAFEARRAYBOUND* )
+    {
+    }
+
+    virtual void Scalar( const VARIANT& value )
+    {
+        if ( VT_R8 == value.vt )
+            m_sum += value.dblVal;
+    }
+
+    virtual void String( const WCHAR*, UINT length )
+    {
+        m_sum += length;
+    }
+
+    virtual void EndArray()
+    {
+    }
+
+    virtual void Elements( VARTYPE vt, const void* data, ULONG count )
+    {
+        if ( VT_R8 != vt )
+            return;
+
+        for ( ULONG i = 0; i < count; i++ )
+            m_sum += ( (const double*)data )[i];
+    }
+
+    double              m_sum;
+
+}; // class CSumVisitor
+
+
+class CVisitorTest
+{
+public:
+
+    //------------------------------------------------------------------------------
+    // Creates an array of variants holding a string, a number, a 2 x 3 array of
+    // longs numbered in memory order and an empty variant.
+    //------------------------------------------------------------------------------
+
+    static HRESULT GetMixedArray( VARIANT& variant )
+    {
+        SAFEARRAYBOUND          bounds[2] = { { 2, 0 }, { 3, 1 } };
+        CComVector<VARIANT>     a( 4, 1 );
+        CComVectorData<VARIANT> rg( a );
+        long*                   data;
+        if ( !rg )
+            HR( E_UNEXPECTED );
+
+        rg[0].vt = VT_BSTR;
+        rg[0].bstrVal = ::SysAllocString( L"ab" );
+        rg[1].vt = VT_R8;
+        rg[1].dblVal = 7;
+        rg[2].vt = VT_I4 | VT_ARRAY;
+        rg[2].parray = SafeArrayCreate( VT_I4, 2, bounds );
+        if ( !rg[2].parray )
+            HR( E_OUTOFMEMORY );
+
+        HR( SafeArrayAccessData( rg[2].parray, (void**)&data ) );
+        for( int i = 0; i < 6; ++i )
+            data[i] = i;
+        HR( SafeArrayUnaccessData( rg[2].parray ) );
+
+        variant.vt = VT_VARIANT | VT_ARRAY;
+        variant.parray = a.Detach();
+
+        return S_OK;
+
+    } // GetMixedArray
+
+
+    //------------------------------------------------------------------------------
+    // Test visiting an array of variants, including a nested array and a
+    // plain value.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Test()
+    {
+        CComVariant         v1;
+        CComVariant         v2 = L"xyz";
+        CComPtr<IStream>    pStream;
+        CTraceVisitor       arrayTrace;
+        CTraceVisitor       valueTrace;
+
+        HR( GetMixedArray( v1 ) );
+
+        // Create a memory stream.
+        HR( CreateMemoryStream( &pStream ) );
+
+        // Write out the variant to the stream, rewind the stream and visit it.
+        WriteVariantToStream( &v1, pStream );
+        HR( RewindStream( pStream ) );
+        VisitVariantInStream( pStream, arrayTrace );
+
+        // The 2 x 3 array's elements come with the last dimension varying
+        // fastest.
+        if ( 0 != lstrcmpA( arrayTrace.GetTrace(),
+                            "begin 12 1:4;'ab';7;begin 3 0:2 1:3;0;2;4;1;3;5;end;empty;end;" ) )
+            HR( E_UNEXPECTED );
+
+        HR( RewindStream( pStream ) );
+        WriteVariantToStream( &v2, pStream );
+        HR( RewindStream( pStream ) );
+        VisitVariantInStream( pStream, valueTrace );
+
+        if ( 0 != lstrcmpA( valueTrace.GetTrace(), "'xyz';" ) )
+            HR( E_UNEXPECTED );
+
+        return S_OK;
+
+    } // Test
+
+
+    //------------------------------------------------------------------------------
+    // Time visiting against reading, for arrays of strings and of doubles.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Benchmark()
+    {
+        ULONG const             count = 100000;
+        CComVariant             strings;
+        CComVariant             numbers;
+        CComVector<BSTR>        a( count );
+        CComVectorData<BSTR>    rg( a );
+        if ( !rg )
+            HR( E_UNEXPECTED );
+
+        for( ULONG i = 0; i < count; ++i )
+            rg[i] = ::SysAllocString( L"a string of some length" );
+
+        strings.vt = VT_BSTR | VT_ARRAY;
+        strings.parray = a.Detach();
+
+        numbers.vt = VT_R8 | VT_ARRAY;
+        numbers.parray = SafeArrayCreateVector( VT_R8, 0, count * 10 );
+        if ( !numbers.parray )
+            HR( E_OUTOFMEMORY );
+
+        HR( BenchmarkVariant( "100000 strings", strings ) );
+        HR( BenchmarkVariant( "1000000 doubles", numbers ) );
+
+        return S_OK;
+
+    } // Benchmark
+
+
+    //------------------------------------------------------------------------------
+    // Times reading the variant back against visiting it.
+    //------------------------------------------------------------------------------
+
+    static HRESULT BenchmarkVariant( LPCSTR name, VARIANT& variant )
+    {
+        ULONG const         iterations = 20;
+        CComPtr<IStream>    pStream;
+        CBenchmarkTimer     timer;
+        ULONG               readTime = 0;
+        ULONG               visitTime = 0;
+        char                label[128];
+
+        HR( CreateMemoryStream( &pStream ) );
+        WriteVariantToStream( &variant, pStream );
+
+        for( ULONG i = 0; i < iterations; ++i )
+        {
+            CComVariant     copy;
+            CSumVisitor     visitor;
+
+            HR( RewindStream( pStream ) );
+            timer.Start();
+            ReadVariantFromStream( pStream, copy );
+            readTime += timer.ElapsedMicroseconds();
+
+            HR( RewindStream( pStream ) );
+            timer.Start();
+            VisitVariantInStream( pStream, visitor );
+            visitTime += timer.ElapsedMicroseconds();
+        }
+
+        ::wsprintfA( label, "read %s", name );
+        ReportBenchmark( label, iterations, readTime );
+        ::wsprintfA( label, "visit %s", name );
+        ReportBenchmark( label, iterations, visitTime );
+
+        return S_OK;
+
+    } // BenchmarkVariant
+
+
+}; // class CVisitorTest
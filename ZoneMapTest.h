@@ -0,0 +1,274 @@
+#pragma once
+
+#include "StreamSupport.h"
+#include "Benchmark.h"
+
+class CZoneMapTest
+{
+public:
+
+    //------------------------------------------------------------------------------
+    // Creates an array of count doubles numbered from first, with the given
+    // lower bound.
+    //------------------------------------------------------------------------------
+
+    static HRESULT GetNumbers( double first, ULONG count, long lowerBound, VARIANT& variant )
+    {
+        variant.parray = SafeArrayCreateVector( VT_R8, lowerBound, count );
+        if ( !variant.parray )
+            HR( E_OUTOFMEMORY );
+        variant.vt = VT_R8 | VT_ARRAY;
+
+        for( ULONG i = 0; i < count; ++i )
+            ( (double*)variant.parray->pvData )[i] = first + i;
+
+        return S_OK;
+
+    } // GetNumbers
+
+
+    //------------------------------------------------------------------------------
+    // Creates an array of variants holding numbers, strings, a null, an empty
+    // variant and a nested array of longs.
+    //------------------------------------------------------------------------------
+
+    static HRESULT GetMixedArray( VARIANT& variant )
+    {
+        CComVector<VARIANT>     a( 7 );
+        CComVectorData<VARIANT> rg( a );
+        long*                   data;
+        if ( !rg )
+            HR( E_UNEXPECTED );
+
+        rg[0].vt = VT_I4;
+        rg[0].lVal = 5;
+        rg[1].vt = VT_BSTR;
+        rg[1].bstrVal = ::SysAllocString( L"a" );
+        rg[2].vt = VT_BSTR;
+        rg[2].bstrVal = ::SysAllocString( L"b" );
+        rg[3].vt = VT_BSTR;
+        rg[3].bstrVal = ::SysAllocString( L"a" );
+        rg[4].vt = VT_NULL;
+        rg[5].vt = VT_I4 | VT_ARRAY;
+        rg[5].parray = SafeArrayCreateVector( VT_I4, 0, 2 );
+        if ( !rg[5].parray )
+            HR( E_OUTOFMEMORY );
+
+        data = (long*)rg[5].parray->pvData;
+        data[0] = -3;
+        data[1] = 70;
+
+        variant.vt = VT_VARIANT | VT_ARRAY;
+        variant.parray = a.Detach();
+
+        return S_OK;
+
+    } // GetMixedArray
+
+
+    //------------------------------------------------------------------------------
+    // Test keeping statistics for records and skipping those that can't
+    // match.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Test()
+    {
+        CComPtr<IStream>    pStream;
+        CComVariant         mixed;
+        CComVariant         block;
+        CComVariant         last;
+        CComVariant         text = L"no numbers";
+        CComVector<BSTR>    strings( 200 );
+        CComVariant         stringArray;
+        HRESULT             hr = S_OK;
+
+        HR( GetMixedArray( mixed ) );
+
+        {
+            CComVectorData<BSTR>    rg( strings );
+            WCHAR                   value[16];
+            if ( !rg )
+                HR( E_UNEXPECTED );
+
+            for( ULONG i = 0; i < 200; ++i )
+            {
+                ::wsprintfW( value, L"%lu", i % 100 );
+                rg[i] = ::SysAllocString( value );
+            }
+        }
+        stringArray.vt = VT_BSTR | VT_ARRAY;
+        stringArray.parray = strings.Detach();
+
+        // Twenty arrays of 1050 doubles, each record's numbers following on
+        // from the last record's, then the other records.
+        HR( CreateMemoryStream( &pStream ) );
+
+        {
+            CVariantRecordWriter    writer( pStream );
+
+            writer.EnableStatistics( 100 );
+            writer.Begin();
+
+            for( ULONG record = 0; record < 20; ++record )
+            {
+                CComVariant     numbers;
+
+                HR( GetNumbers( record * 1050.0, 1050, 1, numbers ) );
+                writer.Write( numbers );
+            }
+
+            writer.Write( mixed );
+            writer.Write( text );
+            writer.Write( stringArray );
+            writer.End();
+        }
+
+        HR( RewindStream( pStream ) );
+
+        {
+            CVariantRecordReader    reader( pStream );
+
+            reader.Open();
+            if ( !reader.HasStatistics() || reader.GetBlockElements() != 100 )
+                HR( E_UNEXPECTED );
+
+            // 10600 to 10610 is in the eleventh record, block 1; 70 is in the
+            // first record and in the nested array.
+            if ( reader.FindInRange( 0, 10600, 10610 ) != 10 || reader.FindInRange( 11, 10600, 10610 ) != reader.GetCount() )
+                hr = E_UNEXPECTED;
+            if ( reader.FindInRange( 0, 70, 70 ) != 0 || reader.FindInRange( 1, 70, 70 ) != 20 )
+                hr = E_UNEXPECTED;
+
+            if ( reader.GetBlockCount( 10 ) != 11 || reader.GetBlockCount( 20 ) != 0 )
+                hr = E_UNEXPECTED;
+
+            const CVariantZone&     zone = reader.GetBlockZone( 10, 1 );
+
+            if ( !zone.MayHold( 10600, 10610 ) || zone.minimum != 10600 || zone.maximum != 10699 || zone.numberCount != 100 )
+                hr = E_UNEXPECTED;
+
+            // Only the block is read, keeping its indexes.
+            reader.ReadBlock( 10, 1, block );
+            if ( block.vt != ( VT_R8 | VT_ARRAY ) || block.parray->rgsabound[0].lLbound != 101 ||
+                 block.parray->rgsabound[0].cElements != 100 || ( (double*)block.parray->pvData )[0] != 10600 )
+                hr = E_UNEXPECTED;
+
+            // The last block is short.
+            reader.ReadBlock( 10, 10, last );
+            if ( last.parray->rgsabound[0].cElements != 50 || ( (double*)last.parray->pvData )[49] != 11549 )
+                hr = E_UNEXPECTED;
+
+            // Numbers at any depth, strings counted apart, nulls and empties.
+            const CVariantZone&     mixedZone = reader.GetZone( 20 );
+
+            if ( mixedZone.numberCount != 3 || mixedZone.minimum != -3 || mixedZone.maximum != 70 ||
+                 mixedZone.nullCount != 2 || mixedZone.distinctStrings != 2 )
+                hr = E_UNEXPECTED;
+
+            if ( reader.GetZone( 21 ).numberCount || reader.GetZone( 21 ).distinctStrings != 1 )
+                hr = E_UNEXPECTED;
+
+            // A hundred different strings are estimated rather than counted.
+            if ( reader.GetZone( 22 ).distinctStrings < 50 || reader.GetZone( 22 ).distinctStrings > 200 )
+                hr = E_UNEXPECTED;
+        }
+
+        return hr;
+
+    } // Test
+
+
+    //------------------------------------------------------------------------------
+    // Time finding the values in a narrow range among 1000 arrays of 10000
+    // doubles, by reading every array, and by skipping with statistics.
+    //------------------------------------------------------------------------------
+
+    static HRESULT Benchmark()
+    {
+        ULONG const             records = 1000;
+        ULONG const             count = 10000;
+        double const            low = 5432100;
+        double const            high = 5432199;
+        CComPtr<IStream>        pStream;
+        CBenchmarkTimer         timer;
+        ULONG                   time;
+        ULONG                   found;
+
+        HR( CreateMemoryStream( &pStream ) );
+
+        {
+            CVariantRecordWriter    writer( pStream );
+
+            writer.EnableStatistics();
+            writer.Begin();
+
+            for( ULONG record = 0; record < records; ++record )
+            {
+                CComVariant     numbers;
+
+                HR( GetNumbers( (double)record * count, count, 0, numbers ) );
+                writer.Write( numbers );
+            }
+
+            writer.End();
+        }
+
+        HR( RewindStream( pStream ) );
+
+        {
+            CVariantRecordReader    reader( pStream );
+
+            reader.Open();
+
+            found = 0;
+            timer.Start();
+            for( ULONG record = 0; record < records; ++record )
+            {
+                CComVariant     numbers;
+
+                reader.Read( record, numbers );
+                for( ULONG i = 0; i < count; ++i )
+                {
+                    double  value = ( (double*)numbers.parray->pvData )[i];
+
+                    if ( value >= low && value <= high )
+                        found++;
+                }
+            }
+            time = timer.ElapsedMicroseconds();
+            ReportBenchmark( "scan 1000 arrays for a range", 1, time );
+
+            found = 0;
+            timer.Start();
+            for( ULONG match = reader.FindInRange( 0, low, high ); match < records; match = reader.FindInRange( match + 1, low, high ) )
+            {
+                for( ULONG block = 0; block < reader.GetBlockCount( match ); ++block )
+                {
+                    CComVariant     numbers;
+
+                    if ( !reader.GetBlockZone( match, block ).MayHold( low, high ) )
+                        continue;
+
+                    reader.ReadBlock( match, block, numbers );
+                    for( ULONG i = 0; i < numbers.parray->rgsabound[0].cElements; ++i )
+                    {
+                        double  value = ( (double*)numbers.parray->pvData )[i];
+
+                        if ( value >= low && value <= high )
+                            found++;
+                    }
+                }
+            }
+            time = timer.ElapsedMicroseconds();
+            ReportBenchmark( "scan 1000 arrays for a range with zone maps", 1, time );
+
+            if ( 100 != found )
+                HR( E_UNEXPECTED );
+        }
+
+        return S_OK;
+
+    } // Benchmark
+
+
+}; // class CZoneMapTest